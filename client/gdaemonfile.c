@@ -2257,12 +2257,12 @@ set_metadata_attribute (GFile *file,
                        _("values must be string or list of strings"));
         }
       else if (appended > 0 &&
-               !gvfs_metadata_call_set_sync (proxy,
-                                             metatreefile,
-                                             daemon_file->path,
-                                             g_variant_builder_end (builder),
-                                             cancellable,
-                                             error))
+               !_g_daemon_vfs_set_metadata (proxy,
+                                            metatreefile,
+                                            daemon_file->path,
+                                            g_variant_builder_end (builder),
+                                            cancellable,
+                                            error))
         res = FALSE;
 
       g_variant_builder_unref (builder);
@@ -2329,6 +2329,131 @@ g_daemon_file_set_attribute (GFile *file,
   return TRUE;
 }
 
+/* Like the default implementation, but all metadata keys are sent
+   to the metadata daemon in a single call */
+static gboolean
+g_daemon_file_set_attributes_from_info (GFile *file,
+					GFileInfo *info,
+					GFileQueryInfoFlags flags,
+					GCancellable *cancellable,
+					GError **error)
+{
+  GDaemonFile *daemon_file;
+  GFileAttributeType type;
+  GFileAttributeStatus status;
+  GVfsMetadata *proxy;
+  GVariantBuilder *builder;
+  MetaTree *tree;
+  char **attributes;
+  char *treename;
+  gpointer value;
+  int appended, num_set, i;
+  gboolean res;
+
+  daemon_file = G_DAEMON_FILE (file);
+  res = TRUE;
+
+  if (g_file_info_has_namespace (info, "metadata"))
+    {
+      attributes = g_file_info_list_attributes (info, "metadata");
+
+      treename = g_mount_spec_to_string (daemon_file->mount_spec);
+      tree = meta_tree_lookup_by_name (treename, FALSE);
+      g_free (treename);
+
+      proxy = _g_daemon_vfs_get_metadata_proxy (cancellable, error);
+      if (proxy == NULL)
+	{
+	  res = FALSE;
+	  error = NULL; /* Don't set further errors */
+	  for (i = 0; attributes[i] != NULL; i++)
+	    g_file_info_set_attribute_status (info, attributes[i],
+					      G_FILE_ATTRIBUTE_STATUS_ERROR_SETTING);
+	}
+      else
+	{
+	  builder = g_variant_builder_new (G_VARIANT_TYPE_VARDICT);
+	  num_set = 0;
+
+	  for (i = 0; attributes[i] != NULL; i++)
+	    {
+	      if (!g_file_info_get_attribute_data (info, attributes[i], &type, &value, &status) ||
+		  status != G_FILE_ATTRIBUTE_STATUS_UNSET)
+		continue;
+
+	      appended = _g_daemon_vfs_append_metadata_for_set (builder,
+								tree,
+								daemon_file->path,
+								attributes[i],
+								type,
+								value);
+	      if (appended != -1)
+		{
+		  num_set += appended;
+		  g_file_info_set_attribute_status (info, attributes[i],
+						    G_FILE_ATTRIBUTE_STATUS_SET);
+		}
+	      else
+		{
+		  res = FALSE;
+		  g_set_error (error, G_IO_ERROR,
+			       G_IO_ERROR_INVALID_ARGUMENT,
+			       _("Error setting file metadata: %s"),
+			       _("values must be string or list of strings"));
+		  error = NULL; /* Don't set further errors */
+		  g_file_info_set_attribute_status (info, attributes[i],
+						    G_FILE_ATTRIBUTE_STATUS_ERROR_SETTING);
+		}
+	    }
+
+	  if (num_set > 0 &&
+	      !_g_daemon_vfs_set_metadata (proxy,
+					   meta_tree_get_filename (tree),
+					   daemon_file->path,
+					   g_variant_builder_end (builder),
+					   cancellable,
+					   error))
+	    {
+	      res = FALSE;
+	      error = NULL; /* Don't set further errors */
+	      for (i = 0; attributes[i] != NULL; i++)
+		g_file_info_set_attribute_status (info, attributes[i],
+						  G_FILE_ATTRIBUTE_STATUS_ERROR_SETTING);
+	    }
+
+	  g_variant_builder_unref (builder);
+	  g_object_unref (proxy);
+	}
+
+      meta_tree_unref (tree);
+      g_strfreev (attributes);
+    }
+
+  /* The rest one by one, as the default implementation does */
+  attributes = g_file_info_list_attributes (info, NULL);
+  for (i = 0; attributes[i] != NULL; i++)
+    {
+      if (!g_file_info_get_attribute_data (info, attributes[i], &type, &value, &status) ||
+	  status != G_FILE_ATTRIBUTE_STATUS_UNSET)
+	continue;
+
+      if (g_daemon_file_set_attribute (file, attributes[i], type, value,
+				       flags, cancellable, error))
+	g_file_info_set_attribute_status (info, attributes[i],
+					  G_FILE_ATTRIBUTE_STATUS_SET);
+      else
+	{
+	  res = FALSE;
+	  error = NULL; /* Don't set further errors */
+	  g_file_info_set_attribute_status (info, attributes[i],
+					    G_FILE_ATTRIBUTE_STATUS_ERROR_SETTING);
+	}
+    }
+  g_strfreev (attributes);
+
+  return res;
+}
+
 struct ProgressCallbackData {
   GFileProgressCallback progress_callback;
   gpointer progress_callback_data;
@@ -3234,6 +3359,7 @@ g_daemon_file_file_iface_init (GFileIface *iface)
   iface->query_settable_attributes = g_daemon_file_query_settable_attributes;
   iface->query_writable_namespaces = g_daemon_file_query_writable_namespaces;
   iface->set_attribute = g_daemon_file_set_attribute;
+  iface->set_attributes_from_info = g_daemon_file_set_attributes_from_info;
   iface->make_symbolic_link = g_daemon_file_make_symbolic_link;
   iface->monitor_dir = g_daemon_file_monitor_dir;
   iface->monitor_file = g_daemon_file_monitor_file;
@@ -1110,6 +1110,19 @@ enumerate_keys_callback (const char *key,
   return TRUE;
 }
 
+/* Shared by all threads, so that mountpoints and device lookups
+   are not redone for each local file operation */
+static MetaLookupCache *
+get_metadata_lookup_cache (void)
+{
+  static gsize cache = 0;
+
+  if (g_once_init_enter (&cache))
+    g_once_init_leave (&cache, (gsize)meta_lookup_cache_new ());
+
+  return (MetaLookupCache *)cache;
+}
+
 static void
 g_daemon_vfs_local_file_add_info (GVfs       *vfs,
 				  const char *filename,
@@ -1140,12 +1153,7 @@ g_daemon_vfs_local_file_add_info (GVfs       *vfs,
 	return; /* No match */
     }
 
-  if (*extra_data == NULL)
-    {
-      *extra_data = meta_lookup_cache_new ();
-      *extra_data_free = (GDestroyNotify)meta_lookup_cache_free;
-    }
-  cache = (MetaLookupCache *)*extra_data;
+  cache = get_metadata_lookup_cache ();
 
   tree = meta_lookup_cache_lookup_path (cache,
 					filename,
@@ -1339,6 +1347,182 @@ _g_daemon_vfs_get_metadata_proxy (GCancellable *cancellable, GError **error)
   return proxy;
 }
 
+/* Metadata writes from different threads are sent to the daemon
+ * together. While a SetMulti call for a tree is in flight, further
+ * writes to that tree are collected and go out in one call when it
+ * returns. A lone writer sends its write right away and never waits
+ * for anybody else. Everyone gets the result of the call that carried
+ * their write, so errors are still reported synchronously.
+ */
+typedef struct {
+  int ref_count;
+  GVariantBuilder *data;
+  guint n_paths;
+  gsize length;
+  gboolean done;
+  gboolean res;
+  GError *error;
+} MetadataBatch;
+
+typedef struct {
+  MetadataBatch *pending;
+  gboolean sending;
+} MetadataTreeWrites;
+
+static GMutex metadata_batch_lock;
+static GCond metadata_batch_cond;
+/* tree filename -> MetadataTreeWrites */
+static GHashTable *metadata_batches = NULL;
+
+static void
+metadata_batch_unref (MetadataBatch *batch)
+{
+  if (--batch->ref_count > 0)
+    return;
+
+  g_variant_builder_unref (batch->data);
+  g_clear_error (&batch->error);
+  g_free (batch);
+}
+
+static gboolean
+send_metadata_batch (GVfsMetadata *proxy,
+                     const char *treefile,
+                     GVariant *data,
+                     GCancellable *cancellable,
+                     GError **error)
+{
+  GError *my_error;
+  GVariantIter iter;
+  const char *path;
+  GVariant *path_data;
+  gboolean res;
+
+  my_error = NULL;
+  if (gvfs_metadata_call_set_multi_sync (proxy, treefile, data,
+                                         cancellable, &my_error))
+    return TRUE;
+
+  if (!g_error_matches (my_error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      g_propagate_error (error, my_error);
+      return FALSE;
+    }
+  g_error_free (my_error);
+
+  /* Daemon from before SetMulti, send one path at a time */
+  res = TRUE;
+  g_variant_iter_init (&iter, data);
+  while (res &&
+         g_variant_iter_next (&iter, "(^&ay@a{sv})", &path, &path_data))
+    {
+      res = gvfs_metadata_call_set_sync (proxy, treefile, path, path_data,
+                                         cancellable, error);
+      g_variant_unref (path_data);
+    }
+
+  return res;
+}
+
+/* Sends the changes in data, an a{sv} as for the Set call, possibly
+   together with writes of other threads to the same tree */
+gboolean
+_g_daemon_vfs_set_metadata (GVfsMetadata *proxy,
+                            const char *treefile,
+                            const char *path,
+                            GVariant *data,
+                            GCancellable *cancellable,
+                            GError **error)
+{
+  MetadataTreeWrites *writes;
+  MetadataBatch *batch;
+  GVariant *batch_data;
+  GError *my_error;
+  gsize length;
+  guint n_paths;
+  gboolean res;
+
+  g_variant_ref_sink (data);
+
+  /* Estimate of the journal space, every key repeats the path */
+  length = g_variant_get_size (data) +
+    (strlen (path) + 32) * g_variant_n_children (data);
+
+  g_mutex_lock (&metadata_batch_lock);
+
+  if (metadata_batches == NULL)
+    metadata_batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_free);
+
+  writes = g_hash_table_lookup (metadata_batches, treefile);
+  if (writes == NULL)
+    {
+      writes = g_new0 (MetadataTreeWrites, 1);
+      g_hash_table_insert (metadata_batches, g_strdup (treefile), writes);
+    }
+
+  /* Stay within what the daemon accepts in one call, a write
+     that is too large on its own is sent alone */
+  while (writes->pending != NULL &&
+         (writes->pending->n_paths >= META_TREE_BATCH_MAX_PATHS ||
+          writes->pending->length + length > META_TREE_BATCH_MAX_LENGTH))
+    g_cond_wait (&metadata_batch_cond, &metadata_batch_lock);
+
+  if (writes->pending == NULL)
+    {
+      writes->pending = g_new0 (MetadataBatch, 1);
+      writes->pending->data = g_variant_builder_new (G_VARIANT_TYPE ("a(aya{sv})"));
+    }
+
+  batch = writes->pending;
+  batch->ref_count++;
+  g_variant_builder_add (batch->data, "(^ay@a{sv})", path, data);
+  batch->n_paths++;
+  batch->length += length;
+
+  while (!batch->done)
+    {
+      if (writes->sending)
+        {
+          g_cond_wait (&metadata_batch_cond, &metadata_batch_lock);
+          continue;
+        }
+
+      /* Nothing in flight for this tree, send what has been
+         collected so far, including our own write */
+      writes->sending = TRUE;
+      writes->pending = NULL;
+      batch_data = g_variant_ref_sink (g_variant_builder_end (batch->data));
+      n_paths = batch->n_paths;
+      g_mutex_unlock (&metadata_batch_lock);
+
+      /* Only our own write may be cancelled by our cancellable */
+      my_error = NULL;
+      res = send_metadata_batch (proxy, treefile, batch_data,
+                                 n_paths == 1 ? cancellable : NULL,
+                                 &my_error);
+      g_variant_unref (batch_data);
+
+      g_mutex_lock (&metadata_batch_lock);
+      batch->res = res;
+      batch->error = my_error;
+      batch->done = TRUE;
+      writes->sending = FALSE;
+      g_cond_broadcast (&metadata_batch_cond);
+    }
+
+  res = batch->res;
+  if (!res)
+    g_propagate_error (error, g_error_copy (batch->error));
+  metadata_batch_unref (batch);
+
+  g_mutex_unlock (&metadata_batch_lock);
+
+  g_variant_unref (data);
+
+  return res;
+}
+
 static gboolean
 g_daemon_vfs_local_file_set_attributes (GVfs       *vfs,
 					const char *filename,
@@ -1384,7 +1568,7 @@ g_daemon_vfs_local_file_set_attributes (GVfs       *vfs,
 	}
       else
 	{
-	  cache = meta_lookup_cache_new ();
+	  cache = get_metadata_lookup_cache ();
 	  tree = meta_lookup_cache_lookup_path (cache,
 						filename,
 						statbuf.st_dev,
@@ -1434,12 +1618,12 @@ g_daemon_vfs_local_file_set_attributes (GVfs       *vfs,
                 }
 	      
 	      if (num_set > 0 &&
-	          ! gvfs_metadata_call_set_sync (proxy,
-	                                         metatreefile,
-	                                         tree_path,
-	                                         g_variant_builder_end (builder),
-	                                         NULL,
-	                                         error))
+	          ! _g_daemon_vfs_set_metadata (proxy,
+	                                        metatreefile,
+	                                        tree_path,
+	                                        g_variant_builder_end (builder),
+	                                        NULL,
+	                                        error))
                 {
 	          res = FALSE;
                   error = NULL; /* Don't set further errors */
@@ -1450,7 +1634,6 @@ g_daemon_vfs_local_file_set_attributes (GVfs       *vfs,
 
 	      g_variant_builder_unref (builder);
 	      
-              meta_lookup_cache_free (cache);
               meta_tree_unref (tree);
               g_free (tree_path);
               g_object_unref (proxy);
@@ -1473,7 +1656,7 @@ g_daemon_vfs_local_file_removed (GVfs       *vfs,
   char *tree_path;
   GVfsMetadata *proxy;
 
-  cache = meta_lookup_cache_new ();
+  cache = get_metadata_lookup_cache ();
   tree = meta_lookup_cache_lookup_path (cache,
 					filename,
 					0,
@@ -1501,8 +1684,6 @@ g_daemon_vfs_local_file_removed (GVfs       *vfs,
       meta_tree_unref (tree);
       g_free (tree_path);
     }
-
-  meta_lookup_cache_free (cache);
 }
 
 static void
@@ -1516,7 +1697,7 @@ g_daemon_vfs_local_file_moved (GVfs       *vfs,
   char *tree_path1, *tree_path2;
   GVfsMetadata *proxy;
 
-  cache = meta_lookup_cache_new ();
+  cache = get_metadata_lookup_cache ();
   tree1 = meta_lookup_cache_lookup_path (cache,
 					 source,
 					 0,
@@ -1559,8 +1740,6 @@ g_daemon_vfs_local_file_moved (GVfs       *vfs,
       meta_tree_unref (tree2);
       g_free (tree_path2);
     }
-
-  meta_lookup_cache_free (cache);
 }
 
 DBusConnection *
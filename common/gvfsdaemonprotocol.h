@@ -71,6 +71,15 @@ G_BEGIN_DECLS
 #define G_VFS_DBUS_DAEMON_PATH "/org/gtk/vfs/Daemon"
 #define G_VFS_DBUS_OP_GET_CONNECTION "GetConnection"
 #define G_VFS_DBUS_OP_CANCEL "Cancel"
+/* Returns statistics for the daemon, ie: its mount:
+ *  a{st}     counters: active-jobs, active-channels, threads, ...
+ *  at        upper limits of the latency histogram buckets, in usecs
+ *  a(sttttatat) per operation: name, count, failed, total queue and
+ *            run time in usecs, queue and run time histograms
+ *  a(ust)    per open channel: id, "read" or "write", bytes transferred
+ *  a(stt)    per cache: name, hits, misses
+ */
+#define G_VFS_DBUS_OP_GET_STATS "GetStats"
 
 /* Used by the dbus-proxying implementation of GMoutOperation */
 #define G_VFS_DBUS_MOUNT_OPERATION_INTERFACE "org.gtk.vfs.MountOperation"
@@ -642,6 +642,9 @@ struct _GVfsAfpConnectionPrivate
   gboolean free_reply_buf;
 };
 
+/* Size of the FPWriteExt parameters that precede the data */
+#define AFP_WRITE_EXT_HEADER_SIZE 20
+
 typedef enum
 {
   DSI_CLOSE_SESSION = 1,
@@ -1637,6 +1640,29 @@ g_vfs_afp_connection_open (GVfsAfpConnection *afp_connection,
   return TRUE;
 }
 
+/*
+ * g_vfs_afp_connection_get_max_request_size:
+ *
+ * @afp_connection: a #GVfsAfpConnection.
+ *
+ * Returns: the largest number of bytes that should be read or written by
+ * a single FPReadExt/FPWriteExt request, derived from the request quantum
+ * the server announced when the session was opened.
+ */
+guint32
+g_vfs_afp_connection_get_max_request_size (GVfsAfpConnection *afp_connection)
+{
+  GVfsAfpConnectionPrivate *priv = afp_connection->priv;
+
+  /* Servers that don't announce a quantum get a conservative default */
+  if (priv->kRequestQuanta == (guint32)-1 ||
+      priv->kRequestQuanta <= AFP_WRITE_EXT_HEADER_SIZE)
+    return 64 * 1024;
+
+  /* FPWriteExt sends its parameters in front of the data */
+  return priv->kRequestQuanta - AFP_WRITE_EXT_HEADER_SIZE;
+}
+
 GVfsAfpConnection *
 g_vfs_afp_connection_new (GSocketConnectable *addr)
 {
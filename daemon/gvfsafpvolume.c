@@ -20,11 +20,13 @@
  * Author: Carl-Anton Ingmarsson <ca.ingmarsson@gmail.com>
  */
 
+#include <string.h>
 #include <glib/gi18n.h>
 
 #include "gvfsafpserver.h"
 
 #include "gvfsafpvolume.h"
+#include "gvfsstats.h"
 
 
 
@@ -37,8 +39,270 @@ struct _GVfsAfpVolumePrivate
 
   guint16 attributes;
   guint16 volume_id;
+
+  /* path -> DirIdCacheEntry, see resolve_path () */
+  GHashTable *dir_id_cache;
+  /* path -> ParmsCacheEntry */
+  GHashTable *parms_cache;
+  /* bumped on every invalidation */
+  guint cache_generation;
+
+  /* fork refnum -> path, for forks opened for writing */
+  GHashTable *write_forks;
 };
 
+/*
+ * Caches
+ *
+ * Every request addresses its target by a pathname relative to a directory
+ * ID. Directory IDs learned from enumerations and GetFileDirParms replies are
+ * kept in dir_id_cache, so that a request for a deep path only has to carry
+ * the components below its deepest known ancestor. The parameters in those
+ * replies are kept for a short while in parms_cache, which lets e.g. a
+ * query_info right after a listing be answered without a round trip.
+ *
+ * Both caches are cleared for any path this mount changes itself. Changes made
+ * by other clients only show up once an entry has expired.
+ */
+
+/* How long a path -> directory ID mapping is trusted, in microseconds */
+#define DIR_ID_CACHE_TTL (30 * G_USEC_PER_SEC)
+/* How long file and directory parameters are trusted, in microseconds */
+#define PARMS_CACHE_TTL  (5 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  guint32 dir_id;
+  gint64  stamp;
+} DirIdCacheEntry;
+
+typedef struct
+{
+  GFileInfo *info;
+  /* the file or dir bitmap the parameters were requested with */
+  guint16    bitmap;
+  gint64     stamp;
+} ParmsCacheEntry;
+
+/* Carried by requests whose reply may be cached */
+typedef struct
+{
+  char  *filename;
+  /* cache_generation at the time the request was sent */
+  guint  generation;
+} CacheRequest;
+
+static CacheRequest *
+cache_request_new (GVfsAfpVolume *volume, const char *filename)
+{
+  CacheRequest *req;
+
+  req = g_slice_new (CacheRequest);
+  req->filename = g_strdup (filename);
+  req->generation = volume->priv->cache_generation;
+  return req;
+}
+
+static void
+cache_request_free (CacheRequest *req)
+{
+  g_free (req->filename);
+  g_slice_free (CacheRequest, req);
+}
+
+static void
+dir_id_cache_entry_free (DirIdCacheEntry *entry)
+{
+  g_slice_free (DirIdCacheEntry, entry);
+}
+
+static void
+parms_cache_entry_free (ParmsCacheEntry *entry)
+{
+  g_object_unref (entry->info);
+  g_slice_free (ParmsCacheEntry, entry);
+}
+
+/*
+ * Returns the part of @filename below its deepest ancestor directory with a
+ * known ID and stores that ID in @dir_id. Falls back to the volume root,
+ * which always has ID 2. The object itself is never addressed by its own ID.
+ */
+static const char *
+resolve_path (GVfsAfpVolume *volume, const char *filename, guint32 *dir_id)
+{
+  GVfsAfpVolumePrivate *priv = volume->priv;
+  gint64 now;
+  char *path, *slash;
+
+  now = g_get_monotonic_time ();
+  path = g_strdup (filename);
+
+  while ((slash = strrchr (path, '/')) != NULL && slash != path)
+  {
+    DirIdCacheEntry *entry;
+
+    *slash = '\0';
+    entry = g_hash_table_lookup (priv->dir_id_cache, path);
+    if (entry && now - entry->stamp < DIR_ID_CACHE_TTL)
+    {
+      const char *rest = filename + (slash - path);
+
+      g_vfs_stats_cache_lookup ("afp-dir-id", TRUE);
+      *dir_id = entry->dir_id;
+      g_free (path);
+      return rest;
+    }
+  }
+
+  /* Only count the paths that had something to look up */
+  if (strchr (filename + 1, '/') != NULL)
+    g_vfs_stats_cache_lookup ("afp-dir-id", FALSE);
+
+  g_free (path);
+
+  *dir_id = 2;
+  return filename;
+}
+
+/* Puts the directory ID and pathname that address @filename */
+static void
+put_dir_id_and_pathname (GVfsAfpVolume *volume, GVfsAfpCommand *comm,
+                         const char *filename)
+{
+  guint32 dir_id;
+  const char *pathname;
+
+  pathname = resolve_path (volume, filename, &dir_id);
+
+  /* Directory ID */
+  g_vfs_afp_command_put_uint32 (comm, dir_id);
+  /* Pathname */
+  g_vfs_afp_command_put_pathname (comm, pathname);
+}
+
+static void
+cache_info (GVfsAfpVolume *volume, const char *filename, GFileInfo *info,
+            guint16 bitmap)
+{
+  GVfsAfpVolumePrivate *priv = volume->priv;
+  ParmsCacheEntry *parms_entry;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  parms_entry = g_slice_new (ParmsCacheEntry);
+  parms_entry->info = g_file_info_dup (info);
+  parms_entry->bitmap = bitmap;
+  parms_entry->stamp = now;
+  g_hash_table_replace (priv->parms_cache, g_strdup (filename), parms_entry);
+
+  if (!is_root (filename) &&
+      g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY &&
+      g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_AFP_NODE_ID))
+  {
+    DirIdCacheEntry *dir_id_entry;
+
+    dir_id_entry = g_slice_new (DirIdCacheEntry);
+    dir_id_entry->dir_id = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_AFP_NODE_ID);
+    dir_id_entry->stamp = now;
+    g_hash_table_replace (priv->dir_id_cache, g_strdup (filename), dir_id_entry);
+  }
+}
+
+/* Returns a copy of the cached parameters of @filename if they are recent and
+ * contain everything in @file_bitmap or @dir_bitmap */
+static GFileInfo *
+lookup_cached_info (GVfsAfpVolume *volume, const char *filename,
+                    guint16 file_bitmap, guint16 dir_bitmap)
+{
+  GVfsAfpVolumePrivate *priv = volume->priv;
+  ParmsCacheEntry *entry;
+  guint16 bitmap;
+
+  entry = g_hash_table_lookup (priv->parms_cache, filename);
+  if (!entry)
+  {
+    g_vfs_stats_cache_lookup ("afp-parms", FALSE);
+    return NULL;
+  }
+
+  if (g_get_monotonic_time () - entry->stamp >= PARMS_CACHE_TTL)
+  {
+    g_vfs_stats_cache_lookup ("afp-parms", FALSE);
+    g_hash_table_remove (priv->parms_cache, filename);
+    return NULL;
+  }
+
+  if (g_file_info_get_file_type (entry->info) == G_FILE_TYPE_DIRECTORY)
+    bitmap = dir_bitmap;
+  else
+    bitmap = file_bitmap;
+
+  if ((bitmap & ~entry->bitmap) != 0)
+  {
+    g_vfs_stats_cache_lookup ("afp-parms", FALSE);
+    return NULL;
+  }
+
+  g_vfs_stats_cache_lookup ("afp-parms", TRUE);
+  return g_file_info_dup (entry->info);
+}
+
+static gboolean
+is_path_or_child (gpointer key, gpointer value, gpointer user_data)
+{
+  const char *path = key;
+  const char *prefix = user_data;
+  gsize len = strlen (prefix);
+
+  return strncmp (path, prefix, len) == 0 &&
+    (path[len] == '\0' || path[len] == '/');
+}
+
+/*
+ * Forgets what is cached about @filename and its parent directory, whose
+ * modification time and offspring count change along with it. If @recursive
+ * is set, everything below @filename is forgotten as well, which is needed
+ * when a directory is moved or deleted.
+ */
+static void
+invalidate_path (GVfsAfpVolume *volume, const char *filename, gboolean recursive)
+{
+  GVfsAfpVolumePrivate *priv = volume->priv;
+  char *dirname;
+
+  /* Replies to requests that were sent before this point must not be cached */
+  priv->cache_generation++;
+
+  if (recursive)
+  {
+    g_hash_table_foreach_remove (priv->dir_id_cache, is_path_or_child, (gpointer)filename);
+    g_hash_table_foreach_remove (priv->parms_cache, is_path_or_child, (gpointer)filename);
+  }
+  else
+  {
+    g_hash_table_remove (priv->dir_id_cache, filename);
+    g_hash_table_remove (priv->parms_cache, filename);
+  }
+
+  dirname = g_path_get_dirname (filename);
+  g_hash_table_remove (priv->parms_cache, dirname);
+  g_free (dirname);
+}
+
+/* Invalidates the file a fork was opened for writing on */
+static void
+invalidate_fork (GVfsAfpVolume *volume, gint16 fork_refnum)
+{
+  const char *filename;
+
+  filename = g_hash_table_lookup (volume->priv->write_forks,
+                                  GINT_TO_POINTER (fork_refnum));
+  if (filename)
+    invalidate_path (volume, filename, FALSE);
+}
+
 static void
 g_vfs_afp_volume_init (GVfsAfpVolume *volume)
 {
@@ -47,12 +311,24 @@ g_vfs_afp_volume_init (GVfsAfpVolume *volume)
   volume->priv = priv = G_TYPE_INSTANCE_GET_PRIVATE (volume, G_VFS_TYPE_AFP_VOLUME,
                                                      GVfsAfpVolumePrivate);
   priv->mounted = FALSE;
+
+  priv->dir_id_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                              (GDestroyNotify)dir_id_cache_entry_free);
+  priv->parms_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify)parms_cache_entry_free);
+  priv->write_forks = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, g_free);
 }
 
 static void
 g_vfs_afp_volume_finalize (GObject *object)
 {
-  /* TODO: Add deinitalization code here */
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (object);
+  GVfsAfpVolumePrivate *priv = volume->priv;
+
+  g_hash_table_destroy (priv->dir_id_cache);
+  g_hash_table_destroy (priv->parms_cache);
+  g_hash_table_destroy (priv->write_forks);
 
   G_OBJECT_CLASS (g_vfs_afp_volume_parent_class)->finalize (object);
 }
@@ -368,6 +644,7 @@ open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 
   OpenForkData *data;
   guint16 file_bitmap;
+  const char *write_filename;
 
   volume = G_VFS_AFP_VOLUME (g_async_result_get_source_object (G_ASYNC_RESULT (simple)));
   priv = volume->priv;
@@ -418,6 +695,11 @@ open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   g_vfs_afp_server_fill_info (priv->server, data->info, reply, FALSE, file_bitmap);
   g_object_unref (reply);
 
+  write_filename = g_object_get_data (G_OBJECT (simple), "write-filename");
+  if (write_filename)
+    g_hash_table_insert (priv->write_forks, GINT_TO_POINTER (data->fork_refnum),
+                         g_strdup (write_filename));
+
   g_simple_async_result_set_op_res_gpointer (simple, data,
                                              (GDestroyNotify)open_fork_data_free);
 
@@ -452,6 +734,8 @@ g_vfs_afp_volume_open_fork (GVfsAfpVolume      *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
+  const char *pathname;
+  guint32 dir_id;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
@@ -469,10 +753,12 @@ g_vfs_afp_volume_open_fork (GVfsAfpVolume      *volume,
   /* data fork */
   g_vfs_afp_command_put_byte (comm, 0);
 
+  pathname = resolve_path (volume, filename, &dir_id);
+
   /* Volume ID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
   /* Directory ID */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  g_vfs_afp_command_put_uint32 (comm, dir_id);
 
   /* Bitmap */
   g_vfs_afp_command_put_uint16 (comm, bitmap);
@@ -481,10 +767,18 @@ g_vfs_afp_volume_open_fork (GVfsAfpVolume      *volume,
   g_vfs_afp_command_put_uint16 (comm, access_mode);
 
   /* Pathname */
-  g_vfs_afp_command_put_pathname (comm, filename);
+  g_vfs_afp_command_put_pathname (comm, pathname);
 
   simple = g_simple_async_result_new (G_OBJECT (volume), callback,
                                       user_data, g_vfs_afp_volume_open_fork);
+
+  /* Remember the file so that writes through the fork invalidate it */
+  if (access_mode & AFP_ACCESS_MODE_WRITE_BIT)
+  {
+    invalidate_path (volume, filename, FALSE);
+    g_object_set_data_full (G_OBJECT (simple), "write-filename",
+                            g_strdup (filename), g_free);
+  }
   
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      open_fork_cb, cancellable, simple);
@@ -588,6 +882,9 @@ g_vfs_afp_volume_close_fork (GVfsAfpVolume       *volume,
 
   priv = volume->priv;
   
+  invalidate_fork (volume, fork_refnum);
+  g_hash_table_remove (priv->write_forks, GINT_TO_POINTER (fork_refnum));
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_CLOSE_FORK);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
@@ -720,16 +1017,16 @@ g_vfs_afp_volume_delete (GVfsAfpVolume       *volume,
 
   priv = volume->priv;
   
+  invalidate_path (volume, filename, TRUE);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_DELETE);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
   /* Volume ID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* Directory ID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
 
-  /* Pathname */
-  g_vfs_afp_command_put_pathname (comm, filename);
+  /* Directory ID and Pathname */
+  put_dir_id_and_pathname (volume, comm, filename);
 
   simple = g_simple_async_result_new (G_OBJECT (volume), callback,
                                       user_data, g_vfs_afp_volume_delete);
@@ -875,6 +1172,8 @@ create_file_get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpo
   dir_id = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_AFP_NODE_ID);
   g_object_unref (info);
 
+  invalidate_path (volume, cfd->filename, FALSE);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_CREATE_FILE);
   /* soft/hard create */
   g_vfs_afp_command_put_byte (comm, cfd->hard_create ? 0x80 : 0x00);
@@ -1117,6 +1416,8 @@ g_vfs_afp_volume_create_directory (GVfsAfpVolume      *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
                                       g_vfs_afp_volume_create_directory);
 
+  invalidate_path (volume, directory, FALSE);
+
   cdd = g_slice_new (CreateDirData);
   cdd->basename = g_path_get_basename (directory);
   cdd->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
@@ -1256,7 +1557,7 @@ rename_get_filedir_parms_cb (GObject      *source_object,
 
   guint32 dir_id;
   GVfsAfpCommand *comm;
-  char *basename;
+  char *basename, *dirname, *new_path;
 
   info = g_vfs_afp_volume_get_filedir_parms_finish (volume, res, &err);
   if (!info)
@@ -1270,6 +1571,13 @@ rename_get_filedir_parms_cb (GObject      *source_object,
   dir_id = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_AFP_PARENT_DIR_ID);
   g_object_unref (info);
 
+  dirname = g_path_get_dirname (rd->filename);
+  new_path = g_build_filename (dirname, rd->new_name, NULL);
+  invalidate_path (volume, rd->filename, TRUE);
+  invalidate_path (volume, new_path, TRUE);
+  g_free (new_path);
+  g_free (dirname);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_RENAME);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
@@ -1451,11 +1759,20 @@ g_vfs_afp_volume_move_and_rename (GVfsAfpVolume      *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   char *dirname, *basename;
+  const char *source_pathname, *dest_pathname;
+  guint32 source_dir_id, dest_dir_id;
   GSimpleAsyncResult *simple;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
   priv = volume->priv;
+
+  invalidate_path (volume, source, TRUE);
+  invalidate_path (volume, destination, TRUE);
+
+  dirname = g_path_get_dirname (destination);
+  source_pathname = resolve_path (volume, source, &source_dir_id);
+  dest_pathname = resolve_path (volume, dirname, &dest_dir_id);
   
   comm = g_vfs_afp_command_new (AFP_COMMAND_MOVE_AND_RENAME);
   /* pad byte */
@@ -1464,17 +1781,16 @@ g_vfs_afp_volume_move_and_rename (GVfsAfpVolume      *volume,
   /* VolumeID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
 
-  /* SourceDirectoryID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
-  /* DestDirectoryID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* SourceDirectoryID */
+  g_vfs_afp_command_put_uint32 (comm, source_dir_id);
+  /* DestDirectoryID */
+  g_vfs_afp_command_put_uint32 (comm, dest_dir_id);
 
   /* SourcePathname */
-  g_vfs_afp_command_put_pathname (comm, source);
+  g_vfs_afp_command_put_pathname (comm, source_pathname);
 
   /* DestPathname */
-  dirname = g_path_get_dirname (destination);
-  g_vfs_afp_command_put_pathname (comm, dirname);
+  g_vfs_afp_command_put_pathname (comm, dest_pathname);
   g_free (dirname);
 
   /* NewName */
@@ -1609,11 +1925,19 @@ g_vfs_afp_volume_copy_file (GVfsAfpVolume      *volume,
   
   GVfsAfpCommand *comm;
   char *dirname, *basename;
+  const char *source_pathname, *dest_pathname;
+  guint32 source_dir_id, dest_dir_id;
   GSimpleAsyncResult *simple;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
   priv = volume->priv;
+
+  invalidate_path (volume, destination, FALSE);
+
+  dirname = g_path_get_dirname (destination);
+  source_pathname = resolve_path (volume, source, &source_dir_id);
+  dest_pathname = resolve_path (volume, dirname, &dest_dir_id);
   
   comm = g_vfs_afp_command_new (AFP_COMMAND_COPY_FILE);
   /* pad byte */
@@ -1621,20 +1945,19 @@ g_vfs_afp_volume_copy_file (GVfsAfpVolume      *volume,
 
   /* SourceVolumeID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* SourceDirectoryID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* SourceDirectoryID */
+  g_vfs_afp_command_put_uint32 (comm, source_dir_id);
 
   /* DestVolumeID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* DestDirectoryID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* DestDirectoryID */
+  g_vfs_afp_command_put_uint32 (comm, dest_dir_id);
 
   /* SourcePathname */
-  g_vfs_afp_command_put_pathname (comm, source);
+  g_vfs_afp_command_put_pathname (comm, source_pathname);
 
   /* DestPathname */
-  dirname = g_path_get_dirname (destination);
-  g_vfs_afp_command_put_pathname (comm, dirname);
+  g_vfs_afp_command_put_pathname (comm, dest_pathname);
   g_free (dirname);
 
   /* NewName */
@@ -1871,6 +2194,7 @@ get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpointer user_d
   guint8 FileDir;
   gboolean directory;
   GFileInfo *info;
+  CacheRequest *req;
 
   reply = g_vfs_afp_connection_send_command_finish (conn, res, &err);
   if (!reply)
@@ -1912,6 +2236,10 @@ get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpointer user_d
   
   g_object_unref (reply);
 
+  req = g_simple_async_result_get_op_res_gpointer (simple);
+  if (req->generation == volume->priv->cache_generation)
+    cache_info (volume, req->filename, info, bitmap);
+
   g_simple_async_result_set_op_res_gpointer (simple, info, g_object_unref);
 
 done:
@@ -1947,28 +2275,48 @@ g_vfs_afp_volume_get_filedir_parms (GVfsAfpVolume       *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
+  GFileInfo *info;
+  const char *pathname;
+  guint32 dir_id;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
   priv = volume->priv;
+
+  simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
+                                      g_vfs_afp_volume_get_filedir_parms);
+
+  info = lookup_cached_info (volume, filename, file_bitmap, dir_bitmap);
+  if (info)
+  {
+    g_simple_async_result_set_op_res_gpointer (simple, info, g_object_unref);
+    g_simple_async_result_complete_in_idle (simple);
+    g_object_unref (simple);
+    return;
+  }
+
+  /* Always ask for the node ID of directories so they can be cached */
+  dir_bitmap |= AFP_DIR_BITMAP_NODE_ID_BIT;
+
+  pathname = resolve_path (volume, filename, &dir_id);
   
   comm = g_vfs_afp_command_new (AFP_COMMAND_GET_FILE_DIR_PARMS);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
   /* VolumeID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* Directory ID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* Directory ID */
+  g_vfs_afp_command_put_uint32 (comm, dir_id);
   /* FileBitmap */  
   g_vfs_afp_command_put_uint16 (comm, file_bitmap);
   /* DirectoryBitmap */  
   g_vfs_afp_command_put_uint16 (comm, dir_bitmap);
   /* PathName */
-  g_vfs_afp_command_put_pathname (comm, filename);
+  g_vfs_afp_command_put_pathname (comm, pathname);
 
-  simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
-                                      g_vfs_afp_volume_get_filedir_parms);
-                                      
+  g_simple_async_result_set_op_res_gpointer (simple,
+                                             cache_request_new (volume, filename),
+                                             (GDestroyNotify)cache_request_free);
 
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      get_filedir_parms_cb, cancellable,
@@ -2209,6 +2557,8 @@ g_vfs_afp_volume_set_fork_size (GVfsAfpVolume       *volume,
 
   priv = volume->priv;
   
+  invalidate_fork (volume, fork_refnum);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_SET_FORK_PARMS);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
@@ -2337,23 +2687,28 @@ g_vfs_afp_volume_set_unix_privs (GVfsAfpVolume       *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
+  const char *pathname;
+  guint32 dir_id;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
   priv = volume->priv;
   
+  invalidate_path (volume, filename, FALSE);
+  pathname = resolve_path (volume, filename, &dir_id);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_SET_FILEDIR_PARMS);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
 
   /* VolumeID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* DirectoryID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* DirectoryID */
+  g_vfs_afp_command_put_uint32 (comm, dir_id);
   /* Bitmap */
   g_vfs_afp_command_put_uint16 (comm, AFP_FILEDIR_BITMAP_UNIX_PRIVS_BIT);
   /* Pathname */
-  g_vfs_afp_command_put_pathname (comm, filename);
+  g_vfs_afp_command_put_pathname (comm, pathname);
   /* pad to even */
   g_vfs_afp_command_pad_to_even (comm);
 
@@ -2426,6 +2781,8 @@ enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   guint16  dir_bitmap;
   gint16 count, i;
   GPtrArray *infos;
+  CacheRequest *req;
+  gboolean cache;
 
   reply = g_vfs_afp_connection_send_command_finish (conn, res, &err);
   if (!reply)
@@ -2469,6 +2826,9 @@ enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 
   g_vfs_afp_reply_read_int16 (reply, &count);
   infos = g_ptr_array_new_full (count, g_object_unref);
+
+  req = g_simple_async_result_get_op_res_gpointer (simple);
+  cache = (req->generation == priv->cache_generation);
   
   for (i = 0; i < count; i++)
   {
@@ -2494,6 +2854,15 @@ enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
     g_vfs_afp_server_fill_info (priv->server, info, reply, directory, bitmap);
     g_ptr_array_add (infos, info);
 
+    if (cache && g_file_info_get_name (info))
+    {
+      char *filename;
+
+      filename = g_build_filename (req->filename, g_file_info_get_name (info), NULL);
+      cache_info (volume, filename, info, bitmap);
+      g_free (filename);
+    }
+
     g_vfs_afp_reply_seek (reply, start_pos + struct_length, G_SEEK_SET);
   }
   g_object_unref (reply);
@@ -2529,6 +2898,8 @@ g_vfs_afp_volume_enumerate (GVfsAfpVolume       *volume,
 {
   GVfsAfpVolumePrivate *priv;
   gint32 max;
+  const char *pathname;
+  guint32 dir_id;
   
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
@@ -2557,10 +2928,15 @@ g_vfs_afp_volume_enumerate (GVfsAfpVolume       *volume,
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
 
+  /* Always ask for the node ID of directories so they can be cached */
+  dir_bitmap |= AFP_DIR_BITMAP_NODE_ID_BIT;
+
+  pathname = resolve_path (volume, directory, &dir_id);
+
   /* Volume ID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* Directory ID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* Directory ID */
+  g_vfs_afp_command_put_uint32 (comm, dir_id);
 
   /* File Bitmap */
   g_vfs_afp_command_put_uint16 (comm, file_bitmap);
@@ -2585,7 +2961,11 @@ g_vfs_afp_volume_enumerate (GVfsAfpVolume       *volume,
   }
   
   /* Pathname */
-  g_vfs_afp_command_put_pathname (comm, directory);
+  g_vfs_afp_command_put_pathname (comm, pathname);
+
+  g_simple_async_result_set_op_res_gpointer (simple,
+                                             cache_request_new (volume, directory),
+                                             (GDestroyNotify)cache_request_free);
   
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      enumerate_cb, cancellable, simple);
@@ -2703,26 +3083,34 @@ g_vfs_afp_volume_exchange_files (GVfsAfpVolume       *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
+  const char *source_pathname, *dest_pathname;
+  guint32 source_dir_id, dest_dir_id;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
   priv = volume->priv;
   
+  invalidate_path (volume, source, FALSE);
+  invalidate_path (volume, destination, FALSE);
+
+  source_pathname = resolve_path (volume, source, &source_dir_id);
+  dest_pathname = resolve_path (volume, destination, &dest_dir_id);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_EXCHANGE_FILES);
   /* pad byte */
   g_vfs_afp_command_put_byte (comm, 0);
 
   /* Volume ID */
   g_vfs_afp_command_put_uint16 (comm, g_vfs_afp_volume_get_id (volume));
-  /* SourceDirectory ID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
-  /* DestDirectory ID 2 == / */
-  g_vfs_afp_command_put_uint32 (comm, 2);
+  /* SourceDirectory ID */
+  g_vfs_afp_command_put_uint32 (comm, source_dir_id);
+  /* DestDirectory ID */
+  g_vfs_afp_command_put_uint32 (comm, dest_dir_id);
 
   /* SourcePath */
-  g_vfs_afp_command_put_pathname (comm, source);
+  g_vfs_afp_command_put_pathname (comm, source_pathname);
   /* DestPath */
-  g_vfs_afp_command_put_pathname (comm, destination);
+  g_vfs_afp_command_put_pathname (comm, dest_pathname);
 
   simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
                                       g_vfs_afp_volume_exchange_files);
@@ -2847,6 +3235,8 @@ g_vfs_afp_volume_write_to_fork (GVfsAfpVolume       *volume,
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
   
+  invalidate_fork (volume, fork_refnum);
+
   comm = g_vfs_afp_command_new (AFP_COMMAND_WRITE_EXT);
   /* StartEndFlag = 0 */
   g_vfs_afp_command_put_byte (comm, 0);
@@ -444,6 +444,140 @@ g_vfs_backend_get_mount_spec (GVfsBackend *backend)
   return backend->priv->mount_spec;
 }
 
+/*
+ * Thumbnail lookups
+ *
+ * Every file info that asks for thumbnail::path needs to know whether a
+ * thumbnail or a failure marker exists for its uri. Rather than stat'ing
+ * in ~/.thumbnails for each of them, the names in the two directories
+ * involved are read once per daemon, when first needed, and then kept
+ * current with directory monitors. Should a monitor not be available,
+ * the files are tested directly as before.
+ */
+
+typedef struct {
+  const char *subdir[2];
+  char *path;
+  /* basename -> basename, or NULL to test the files instead */
+  GHashTable *names;
+  GFileMonitor *monitor;
+} ThumbnailDir;
+
+enum {
+  THUMBNAIL_DIR_NORMAL,
+  THUMBNAIL_DIR_FAIL
+};
+
+G_LOCK_DEFINE_STATIC (thumbnail_dirs);
+static gboolean thumbnail_dirs_loaded = FALSE;
+static ThumbnailDir thumbnail_dirs[] = {
+  { { "normal", NULL } },
+  { { "fail", "gnome-thumbnail-factory" } }
+};
+
+static void
+thumbnail_dir_changed (GFileMonitor      *monitor,
+                       GFile             *file,
+                       GFile             *other_file,
+                       GFileMonitorEvent  event_type,
+                       gpointer           user_data)
+{
+  ThumbnailDir *dir = user_data;
+  char *basename;
+
+  if (event_type != G_FILE_MONITOR_EVENT_CREATED &&
+      event_type != G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  basename = g_file_get_basename (file);
+
+  G_LOCK (thumbnail_dirs);
+  if (event_type == G_FILE_MONITOR_EVENT_CREATED)
+    g_hash_table_add (dir->names, basename);
+  else
+    {
+      g_hash_table_remove (dir->names, basename);
+      g_free (basename);
+    }
+  G_UNLOCK (thumbnail_dirs);
+}
+
+/* Must be called with the lock held */
+static void
+thumbnail_dir_load (ThumbnailDir *dir)
+{
+  const char *name;
+  GFile *file;
+  GDir *gdir;
+
+  dir->path = g_build_filename (g_get_home_dir (), ".thumbnails",
+                                dir->subdir[0], dir->subdir[1], NULL);
+
+  /* Start monitoring before reading, so nothing gets lost in between.
+   * The events are delivered in the main loop. */
+  file = g_file_new_for_path (dir->path);
+  dir->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE,
+                                           NULL, NULL);
+  g_object_unref (file);
+
+  if (dir->monitor == NULL)
+    return;
+
+  dir->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_signal_connect (dir->monitor, "changed",
+                    G_CALLBACK (thumbnail_dir_changed), dir);
+
+  gdir = g_dir_open (dir->path, 0, NULL);
+  if (gdir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (gdir)) != NULL)
+    {
+      char *basename = g_strdup (name);
+      g_hash_table_add (dir->names, basename);
+    }
+
+  g_dir_close (gdir);
+}
+
+static gboolean
+thumbnail_dir_has (ThumbnailDir *dir,
+                   const char   *basename,
+                   char        **filename)
+{
+  gboolean indexed, found;
+  char *path;
+
+  G_LOCK (thumbnail_dirs);
+
+  if (!thumbnail_dirs_loaded)
+    {
+      thumbnail_dir_load (&thumbnail_dirs[THUMBNAIL_DIR_NORMAL]);
+      thumbnail_dir_load (&thumbnail_dirs[THUMBNAIL_DIR_FAIL]);
+      thumbnail_dirs_loaded = TRUE;
+    }
+
+  indexed = dir->names != NULL;
+  found = indexed && g_hash_table_lookup (dir->names, basename) != NULL;
+
+  G_UNLOCK (thumbnail_dirs);
+
+  if (indexed && !found)
+    return FALSE;
+
+  path = g_build_filename (dir->path, basename, NULL);
+
+  if (!indexed)
+    found = g_file_test (path, G_FILE_TEST_IS_REGULAR);
+
+  if (found && filename != NULL)
+    *filename = path;
+  else
+    g_free (path);
+
+  return found;
+}
+
 static void
 get_thumbnail_attributes (const char *uri,
                           GFileInfo  *info)
@@ -458,26 +592,17 @@ get_thumbnail_attributes (const char *uri,
   basename = g_strconcat (g_checksum_get_string (checksum), ".png", NULL);
   g_checksum_free (checksum);
 
-  filename = g_build_filename (g_get_home_dir (),
-                               ".thumbnails", "normal", basename,
-                               NULL);
-
-  if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
-    g_file_info_set_attribute_byte_string (info, G_FILE_ATTRIBUTE_THUMBNAIL_PATH, filename);
-  else
+  if (thumbnail_dir_has (&thumbnail_dirs[THUMBNAIL_DIR_NORMAL],
+                         basename, &filename))
     {
+      g_file_info_set_attribute_byte_string (info, G_FILE_ATTRIBUTE_THUMBNAIL_PATH, filename);
       g_free (filename);
-      filename = g_build_filename (g_get_home_dir (),
-                                   ".thumbnails", "fail",
-                                   "gnome-thumbnail-factory",
-                                   basename,
-                                   NULL);
-      
-      if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
-	g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_THUMBNAILING_FAILED, TRUE);
     }
+  else if (thumbnail_dir_has (&thumbnail_dirs[THUMBNAIL_DIR_FAIL],
+                              basename, NULL))
+    g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_THUMBNAILING_FAILED, TRUE);
+
   g_free (basename);
-  g_free (filename);
 }
 
 void
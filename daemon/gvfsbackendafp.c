@@ -23,6 +23,9 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
@@ -51,6 +54,9 @@
 #include "gvfsjobsetdisplayname.h"
 #include "gvfsjobmove.h"
 #include "gvfsjobcopy.h"
+#include "gvfsjobpull.h"
+#include "gvfsjobpush.h"
+#include "gvfsdaemonutils.h"
 
 #include "gvfsafpserver.h"
 
@@ -151,6 +157,120 @@ afp_handle_free (AfpHandle *afp_handle)
   g_slice_free (AfpHandle, afp_handle);
 }
 
+/*
+ * Reads and writes that are larger than what the server accepts in a single
+ * request are split into several FPReadExt/FPWriteExt requests which are all
+ * sent at once. GVfsAfpConnection matches the replies by request ID, so the
+ * job waits for one round trip instead of one per request quantum.
+ */
+
+/* Maximum number of requests in flight for a single read, write, pull or push */
+#define PIPELINE_DEPTH 8
+
+typedef struct _Pipeline Pipeline;
+
+typedef struct
+{
+  Pipeline *pipeline;
+
+  gint64    offset;
+  gsize     size;
+  gsize     done;
+  GError   *error;
+} PipelinePiece;
+
+struct _Pipeline
+{
+  GVfsJob       *job;
+  gint64         offset;
+
+  guint          n_pieces;
+  guint          n_pending;
+  PipelinePiece  pieces[PIPELINE_DEPTH];
+};
+
+static Pipeline *
+pipeline_new (GVfsJob *job, gint64 offset, gsize size, gsize request_size)
+{
+  Pipeline *pipeline;
+  guint i;
+
+  pipeline = g_slice_new0 (Pipeline);
+  pipeline->job = job;
+  pipeline->offset = offset;
+
+  for (i = 0; i < PIPELINE_DEPTH && size > 0; i++)
+  {
+    PipelinePiece *piece = &pipeline->pieces[i];
+
+    piece->pipeline = pipeline;
+    piece->offset = offset;
+    piece->size = MIN (size, request_size);
+
+    offset += piece->size;
+    size -= piece->size;
+  }
+
+  pipeline->n_pieces = i;
+  pipeline->n_pending = i;
+
+  return pipeline;
+}
+
+static void
+pipeline_free (Pipeline *pipeline)
+{
+  guint i;
+
+  for (i = 0; i < pipeline->n_pieces; i++)
+    g_clear_error (&pipeline->pieces[i].error);
+
+  g_slice_free (Pipeline, pipeline);
+}
+
+/* Records the outcome of a piece and returns TRUE when it was the last one */
+static gboolean
+pipeline_piece_done (PipelinePiece *piece, gsize done, GError *error)
+{
+  piece->done = done;
+  piece->error = error;
+
+  return --piece->pipeline->n_pending == 0;
+}
+
+/*
+ * Returns the number of bytes transferred without a gap from the start of the
+ * pipeline. A failure after the first piece only shortens the result, the next
+ * request will run into it again. Fails only if the first piece failed.
+ */
+static gboolean
+pipeline_get_size (Pipeline *pipeline, gsize *size, GError **error)
+{
+  guint i;
+
+  if (pipeline->pieces[0].error)
+  {
+    g_propagate_error (error, pipeline->pieces[0].error);
+    pipeline->pieces[0].error = NULL;
+    return FALSE;
+  }
+
+  *size = 0;
+  for (i = 0; i < pipeline->n_pieces; i++)
+  {
+    PipelinePiece *piece = &pipeline->pieces[i];
+
+    if (piece->error)
+      break;
+
+    *size += piece->done;
+    if (piece->done < piece->size)
+      break;
+  }
+
+  return TRUE;
+}
+
 /*
  * Backend code
  */
@@ -660,7 +780,9 @@ static void
 write_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
-  GVfsJobWrite *job = G_VFS_JOB_WRITE (user_data);
+  PipelinePiece *piece = (PipelinePiece *)user_data;
+  Pipeline *pipeline = piece->pipeline;
+  GVfsJobWrite *job = G_VFS_JOB_WRITE (pipeline->job);
   AfpHandle *afp_handle = (AfpHandle *)job->handle;
 
   GError *err = NULL;
@@ -668,20 +790,27 @@ write_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   gsize written_size;
 
   if (!g_vfs_afp_volume_write_to_fork_finish (volume, res, &last_written, &err))
+    last_written = piece->offset;
+
+  if (!pipeline_piece_done (piece, last_written - piece->offset, err))
+    return;
+
+  if (!pipeline_get_size (pipeline, &written_size, &err))
   {
     g_vfs_job_failed_from_error (G_VFS_JOB (job), err);
     g_error_free (err);
+    pipeline_free (pipeline);
     return;
   }
 
-  written_size = last_written - afp_handle->offset;
-  afp_handle->offset = last_written;
+  afp_handle->offset = pipeline->offset + written_size;
 
   if (afp_handle->type == AFP_HANDLE_TYPE_REPLACE_FILE_DIRECT)
-    afp_handle->size = MAX (last_written, afp_handle->size);
+    afp_handle->size = MAX (afp_handle->offset, afp_handle->size);
   
   g_vfs_job_write_set_written_size (job, written_size); 
   g_vfs_job_succeeded (G_VFS_JOB (job));
+  pipeline_free (pipeline);
 }
 
 static gboolean
@@ -694,9 +823,29 @@ try_write (GVfsBackend *backend,
   GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
   AfpHandle *afp_handle = (AfpHandle *)handle;
 
-  g_vfs_afp_volume_write_to_fork (afp_backend->volume, afp_handle->fork_refnum,
-                                  buffer, buffer_size, afp_handle->offset,
-                                  G_VFS_JOB (job)->cancellable, write_cb, job);
+  Pipeline *pipeline;
+  guint i;
+
+  if (buffer_size == 0)
+  {
+    g_vfs_job_write_set_written_size (job, 0);
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    return TRUE;
+  }
+
+  /* Anything beyond PIPELINE_DEPTH requests is left for a short write */
+  pipeline = pipeline_new (G_VFS_JOB (job), afp_handle->offset, buffer_size,
+                           g_vfs_afp_connection_get_max_request_size (afp_backend->server->conn));
+
+  for (i = 0; i < pipeline->n_pieces; i++)
+  {
+    PipelinePiece *piece = &pipeline->pieces[i];
+
+    g_vfs_afp_volume_write_to_fork (afp_backend->volume, afp_handle->fork_refnum,
+                                    buffer + (piece->offset - pipeline->offset),
+                                    piece->size, piece->offset,
+                                    G_VFS_JOB (job)->cancellable, write_cb, piece);
+  }
 
   return TRUE;
 }
@@ -854,16 +1003,25 @@ static void
 read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
-  GVfsJobRead *job = G_VFS_JOB_READ (user_data);
+  PipelinePiece *piece = (PipelinePiece *)user_data;
+  Pipeline *pipeline = piece->pipeline;
+  GVfsJobRead *job = G_VFS_JOB_READ (pipeline->job);
   AfpHandle *afp_handle = (AfpHandle *)job->handle;
 
   GError *err = NULL;
   gsize bytes_read;
 
   if (!g_vfs_afp_volume_read_from_fork_finish (volume, res, &bytes_read, &err))
+    bytes_read = 0;
+
+  if (!pipeline_piece_done (piece, bytes_read, err))
+    return;
+
+  if (!pipeline_get_size (pipeline, &bytes_read, &err))
   {
     g_vfs_job_failed_from_error (G_VFS_JOB (job), err);
     g_error_free (err);
+    pipeline_free (pipeline);
     return;
   }
 
@@ -871,6 +1029,7 @@ read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   g_vfs_job_read_set_size (job, bytes_read);
   
   g_vfs_job_succeeded (G_VFS_JOB (job));
+  pipeline_free (pipeline);
 }
   
 static gboolean 
@@ -883,9 +1042,781 @@ try_read (GVfsBackend *backend,
   GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
   AfpHandle *afp_handle = (AfpHandle *)handle;
 
-  g_vfs_afp_volume_read_from_fork (afp_backend->volume, afp_handle->fork_refnum,
-                                   buffer, bytes_requested, afp_handle->offset,
-                                   G_VFS_JOB (job)->cancellable, read_cb, job);
+  Pipeline *pipeline;
+  guint i;
+
+  if (bytes_requested == 0)
+  {
+    g_vfs_job_read_set_size (job, 0);
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+    return TRUE;
+  }
+
+  /* Anything beyond PIPELINE_DEPTH requests is left for a short read */
+  pipeline = pipeline_new (G_VFS_JOB (job), afp_handle->offset, bytes_requested,
+                           g_vfs_afp_connection_get_max_request_size (afp_backend->server->conn));
+
+  for (i = 0; i < pipeline->n_pieces; i++)
+  {
+    PipelinePiece *piece = &pipeline->pieces[i];
+
+    g_vfs_afp_volume_read_from_fork (afp_backend->volume, afp_handle->fork_refnum,
+                                     buffer + (piece->offset - pipeline->offset),
+                                     piece->size, piece->offset,
+                                     G_VFS_JOB (job)->cancellable, read_cb, piece);
+  }
+
+  return TRUE;
+}
+
+/*
+ * pull and push stream between a fork and a local file, keeping up to
+ * PIPELINE_DEPTH requests of the server's request size in flight. Chunks are
+ * written at their own offset, so it doesn't matter in which order the
+ * replies arrive.
+ *
+ * Both copy into a temporary file next to the destination and only move
+ * it into place once everything has been written, so a failed transfer
+ * leaves an existing destination alone.
+ */
+
+typedef struct _Transfer Transfer;
+
+typedef struct
+{
+  Transfer *transfer;
+
+  gint64    offset;
+  gsize     size;
+  char     *buffer;
+} TransferChunk;
+
+struct _Transfer
+{
+  GVfsBackendAfp *afp_backend;
+  GVfsJob   *job;
+  gboolean   is_pull;
+
+  char      *filename;
+  char      *local_path;
+  char      *tmp_path;      /* pull: the local file being written */
+  char      *tmp_filename;  /* push: the remote file being written */
+  gboolean   dest_exists;
+  gboolean   remove_source;
+  GFileProgressCallback progress_callback;
+  gpointer   progress_callback_data;
+
+  int        fd;
+  gint16     fork_refnum;
+  gboolean   fork_open;
+
+  gsize      request_size;
+  gint64     size;
+  gint64     next_offset;
+  gint64     transferred;
+  guint      n_pending;
+
+  GError    *error;
+};
+
+static void transfer_fill (Transfer *transfer);
+
+static Transfer *
+transfer_new (GVfsBackendAfp *afp_backend,
+              GVfsJob *job,
+              gboolean is_pull,
+              const char *filename,
+              const char *local_path,
+              gboolean remove_source,
+              GFileProgressCallback progress_callback,
+              gpointer progress_callback_data)
+{
+  Transfer *transfer;
+
+  transfer = g_slice_new0 (Transfer);
+  transfer->afp_backend = afp_backend;
+  transfer->job = job;
+  transfer->is_pull = is_pull;
+  transfer->filename = g_strdup (filename);
+  transfer->local_path = g_strdup (local_path);
+  transfer->remove_source = remove_source;
+  transfer->progress_callback = progress_callback;
+  transfer->progress_callback_data = progress_callback_data;
+  transfer->fd = -1;
+  transfer->request_size = g_vfs_afp_connection_get_max_request_size (afp_backend->server->conn);
+
+  return transfer;
+}
+
+static void
+transfer_free (Transfer *transfer)
+{
+  if (transfer->fd != -1)
+    close (transfer->fd);
+  g_free (transfer->filename);
+  g_free (transfer->local_path);
+  g_free (transfer->tmp_path);
+  g_free (transfer->tmp_filename);
+  g_clear_error (&transfer->error);
+
+  g_slice_free (Transfer, transfer);
+}
+
+static void
+transfer_set_error (Transfer *transfer, GError *error)
+{
+  if (transfer->error)
+    g_error_free (error);
+  else
+    transfer->error = error;
+}
+
+static void
+transfer_set_error_from_errno (Transfer *transfer, int errsv)
+{
+  transfer_set_error (transfer, g_error_new_literal (G_IO_ERROR,
+                                                     g_io_error_from_errno (errsv),
+                                                     g_strerror (errsv)));
+}
+
+static void
+transfer_succeeded (Transfer *transfer)
+{
+  g_vfs_job_succeeded (transfer->job);
+  transfer_free (transfer);
+}
+
+/* Fails the job, removing the temporary file of the transfer */
+static void
+transfer_failed (Transfer *transfer, GError *error)
+{
+  GVfsBackendAfp *afp_backend = transfer->afp_backend;
+
+  if (transfer->fd != -1)
+    close (transfer->fd);
+  transfer->fd = -1;
+
+  if (transfer->tmp_path)
+    gvfs_pull_finish_temp (transfer->local_path, G_VFS_JOB_PULL (transfer->job)->flags,
+                           transfer->tmp_path, FALSE, NULL);
+  else if (transfer->tmp_filename)
+    g_vfs_afp_volume_delete (afp_backend->volume, transfer->tmp_filename,
+                             NULL, NULL, NULL);
+
+  g_vfs_job_failed_from_error (transfer->job, error);
+  transfer_free (transfer);
+}
+
+static void
+transfer_remove_source_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_delete_finish (volume, res, &err))
+  {
+    g_vfs_job_failed_from_error (transfer->job, err);
+    g_error_free (err);
+    transfer_free (transfer);
+    return;
+  }
+
+  transfer_succeeded (transfer);
+}
+
+/* Called once the copy is in place */
+static void
+transfer_done (Transfer *transfer)
+{
+  GVfsBackendAfp *afp_backend = transfer->afp_backend;
+
+  if (!transfer->remove_source)
+    transfer_succeeded (transfer);
+
+  else if (transfer->is_pull)
+    g_vfs_afp_volume_delete (afp_backend->volume, transfer->filename,
+                             transfer->job->cancellable,
+                             transfer_remove_source_cb, transfer);
+
+  else if (g_unlink (transfer->local_path) == -1)
+  {
+    int errsv = errno;
+
+    g_vfs_job_failed_literal (transfer->job, G_IO_ERROR,
+                              g_io_error_from_errno (errsv),
+                              g_strerror (errsv));
+    transfer_free (transfer);
+  }
+
+  else
+    transfer_succeeded (transfer);
+}
+
+static void
+push_move_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_move_and_rename_finish (volume, res, &err))
+  {
+    transfer_failed (transfer, err);
+    g_error_free (err);
+    return;
+  }
+
+  transfer_done (transfer);
+}
+
+static void
+push_delete_target_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_delete_finish (volume, res, &err))
+  {
+    transfer_failed (transfer, err);
+    g_error_free (err);
+    return;
+  }
+
+  g_vfs_afp_volume_move_and_rename (volume, transfer->tmp_filename, transfer->filename,
+                                    transfer->job->cancellable,
+                                    push_move_cb, transfer);
+}
+
+static void
+push_exchange_files_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_exchange_files_finish (volume, res, &err))
+  {
+    transfer_failed (transfer, err);
+    g_error_free (err);
+    return;
+  }
+
+  /* The temporary file has the old contents now */
+  g_vfs_afp_volume_delete (volume, transfer->tmp_filename, NULL, NULL, NULL);
+  transfer_done (transfer);
+}
+
+/* Puts the uploaded temporary file in place of the destination */
+static void
+push_commit (Transfer *transfer)
+{
+  GVfsAfpVolume *volume = transfer->afp_backend->volume;
+
+  if (!transfer->dest_exists)
+    g_vfs_afp_volume_move_and_rename (volume, transfer->tmp_filename, transfer->filename,
+                                      transfer->job->cancellable,
+                                      push_move_cb, transfer);
+
+  else if (!(g_vfs_afp_volume_get_attributes (volume) &
+             AFP_VOLUME_ATTRIBUTES_BITMAP_NO_EXCHANGE_FILES))
+    g_vfs_afp_volume_exchange_files (volume, transfer->filename, transfer->tmp_filename,
+                                     transfer->job->cancellable,
+                                     push_exchange_files_cb, transfer);
+
+  /* Without FPExchangeFiles the target has to go before the rename */
+  else
+    g_vfs_afp_volume_delete (volume, transfer->filename,
+                             transfer->job->cancellable,
+                             push_delete_target_cb, transfer);
+}
+
+static void
+transfer_close_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_close_fork_finish (volume, res, &err))
+  {
+    transfer_failed (transfer, err);
+    g_error_free (err);
+    return;
+  }
+
+  if (!transfer->is_pull)
+  {
+    push_commit (transfer);
+    return;
+  }
+
+  if (!gvfs_pull_finish_temp (transfer->local_path, G_VFS_JOB_PULL (transfer->job)->flags,
+                              transfer->tmp_path, TRUE, &err))
+  {
+    /* the temporary file is gone already */
+    g_free (transfer->tmp_path);
+    transfer->tmp_path = NULL;
+
+    transfer_failed (transfer, err);
+    g_error_free (err);
+    return;
+  }
+
+  transfer_done (transfer);
+}
+
+/* Called once all requests have completed */
+static void
+transfer_finish (Transfer *transfer)
+{
+  GVfsBackendAfp *afp_backend = transfer->afp_backend;
+
+  if (transfer->fd != -1 && close (transfer->fd) == -1)
+    transfer_set_error_from_errno (transfer, errno);
+  transfer->fd = -1;
+
+  if (transfer->error)
+  {
+    /* Don't leave a partial copy behind */
+    if (transfer->fork_open)
+      g_vfs_afp_volume_close_fork (afp_backend->volume, transfer->fork_refnum,
+                                   NULL, NULL, NULL);
+    transfer_failed (transfer, transfer->error);
+    return;
+  }
+
+  g_vfs_afp_volume_close_fork (afp_backend->volume, transfer->fork_refnum,
+                               transfer->job->cancellable,
+                               transfer_close_fork_cb, transfer);
+}
+
+static void
+transfer_chunk_done (TransferChunk *chunk, gsize done)
+{
+  Transfer *transfer = chunk->transfer;
+
+  transfer->transferred += done;
+  transfer->n_pending--;
+
+  /* The file got shorter while we were reading it */
+  if (transfer->is_pull && done < chunk->size)
+    transfer->size = MIN (transfer->size, chunk->offset + (gint64)done);
+
+  g_free (chunk->buffer);
+  g_slice_free (TransferChunk, chunk);
+
+  if (!transfer->error && transfer->progress_callback)
+    transfer->progress_callback (transfer->transferred, transfer->size,
+                                 transfer->progress_callback_data);
+
+  transfer_fill (transfer);
+}
+
+static void
+pull_read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  TransferChunk *chunk = (TransferChunk *)user_data;
+  Transfer *transfer = chunk->transfer;
+
+  GError *err = NULL;
+  gsize bytes_read;
+  gsize written;
+
+  if (!g_vfs_afp_volume_read_from_fork_finish (volume, res, &bytes_read, &err))
+  {
+    transfer_set_error (transfer, err);
+    transfer_chunk_done (chunk, 0);
+    return;
+  }
+
+  for (written = 0; written < bytes_read; )
+  {
+    ssize_t res;
+
+    res = pwrite (transfer->fd, chunk->buffer + written, bytes_read - written,
+                  chunk->offset + written);
+    if (res == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      transfer_set_error_from_errno (transfer, errno);
+      break;
+    }
+
+    written += res;
+  }
+
+  transfer_chunk_done (chunk, written);
+}
+
+static void
+push_write_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  TransferChunk *chunk = (TransferChunk *)user_data;
+  Transfer *transfer = chunk->transfer;
+
+  GError *err = NULL;
+  gint64 last_written;
+
+  if (!g_vfs_afp_volume_write_to_fork_finish (volume, res, &last_written, &err))
+  {
+    transfer_set_error (transfer, err);
+    transfer_chunk_done (chunk, 0);
+    return;
+  }
+
+  if (last_written != chunk->offset + (gint64)chunk->size)
+    transfer_set_error (transfer, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                                       _("Error writing file")));
+
+  transfer_chunk_done (chunk, last_written - chunk->offset);
+}
+
+/* Sends requests until PIPELINE_DEPTH are in flight or everything is sent */
+static void
+transfer_fill (Transfer *transfer)
+{
+  GVfsBackendAfp *afp_backend = transfer->afp_backend;
+
+  if (!transfer->error && g_vfs_job_is_cancelled (transfer->job))
+    transfer_set_error (transfer, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                       _("Operation was cancelled")));
+
+  while (!transfer->error &&
+         transfer->n_pending < PIPELINE_DEPTH &&
+         transfer->next_offset < transfer->size)
+  {
+    TransferChunk *chunk;
+
+    chunk = g_slice_new (TransferChunk);
+    chunk->transfer = transfer;
+    chunk->offset = transfer->next_offset;
+    chunk->size = MIN (transfer->request_size, transfer->size - transfer->next_offset);
+    chunk->buffer = g_malloc (chunk->size);
+
+    if (transfer->is_pull)
+    {
+      g_vfs_afp_volume_read_from_fork (afp_backend->volume, transfer->fork_refnum,
+                                       chunk->buffer, chunk->size, chunk->offset,
+                                       transfer->job->cancellable,
+                                       pull_read_cb, chunk);
+    }
+    else
+    {
+      gsize n_read = 0;
+
+      while (n_read < chunk->size)
+      {
+        ssize_t res;
+
+        res = pread (transfer->fd, chunk->buffer + n_read, chunk->size - n_read,
+                     chunk->offset + n_read);
+        if (res == -1 && errno == EINTR)
+          continue;
+        if (res <= 0)
+        {
+          if (res == -1)
+            transfer_set_error_from_errno (transfer, errno);
+          break;
+        }
+
+        n_read += res;
+      }
+
+      /* The local file got shorter, send what we have and stop there */
+      if (!transfer->error && n_read < chunk->size)
+      {
+        chunk->size = n_read;
+        transfer->size = chunk->offset + n_read;
+      }
+
+      if (transfer->error || chunk->size == 0)
+      {
+        g_free (chunk->buffer);
+        g_slice_free (TransferChunk, chunk);
+        break;
+      }
+
+      g_vfs_afp_volume_write_to_fork (afp_backend->volume, transfer->fork_refnum,
+                                      chunk->buffer, chunk->size, chunk->offset,
+                                      transfer->job->cancellable,
+                                      push_write_cb, chunk);
+    }
+
+    transfer->next_offset += chunk->size;
+    transfer->n_pending++;
+  }
+
+  if (transfer->n_pending == 0)
+    transfer_finish (transfer);
+}
+
+static void
+pull_open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+  GVfsJobPull *job = G_VFS_JOB_PULL (transfer->job);
+
+  GError *err = NULL;
+  GFileInfo *info;
+  struct stat st;
+
+  if (!g_vfs_afp_volume_open_fork_finish (volume, res, &transfer->fork_refnum, &info, &err))
+  {
+    if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY))
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+    else
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), err);
+    g_error_free (err);
+    transfer_free (transfer);
+    return;
+  }
+
+  transfer->fork_open = TRUE;
+  transfer->size = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  if (g_lstat (transfer->local_path, &st) == 0)
+  {
+    if (!(job->flags & G_FILE_COPY_OVERWRITE))
+      transfer_set_error (transfer, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_EXISTS,
+                                                         _("Target file already exists")));
+    else if (S_ISDIR (st.st_mode))
+      transfer_set_error (transfer, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                                                         _("File is directory")));
+  }
+
+  if (!transfer->error)
+    transfer->fd = gvfs_pull_open_temp (transfer->local_path, job->flags,
+                                        &transfer->tmp_path, &transfer->error);
+
+  if (transfer->error)
+  {
+    /* Nothing has been written yet, so keep whatever is at local_path */
+    g_vfs_afp_volume_close_fork (volume, transfer->fork_refnum, NULL, NULL, NULL);
+    g_vfs_job_failed_from_error (G_VFS_JOB (job), transfer->error);
+    transfer_free (transfer);
+    return;
+  }
+
+  transfer_fill (transfer);
+}
+
+static gboolean
+try_pull (GVfsBackend *backend,
+          GVfsJobPull *job,
+          const char *source,
+          const char *local_path,
+          GFileCopyFlags flags,
+          gboolean remove_source,
+          GFileProgressCallback progress_callback,
+          gpointer progress_callback_data)
+{
+  GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
+  Transfer *transfer;
+
+  if (flags & G_FILE_COPY_BACKUP)
+  {
+    g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                      _("backups not supported"));
+    return TRUE;
+  }
+
+  transfer = transfer_new (afp_backend, G_VFS_JOB (job), TRUE, source, local_path, remove_source,
+                           progress_callback, progress_callback_data);
+
+  g_vfs_afp_volume_open_fork (afp_backend->volume, source, AFP_ACCESS_MODE_READ_BIT,
+                              AFP_FILE_BITMAP_EXT_DATA_FORK_LEN_BIT,
+                              G_VFS_JOB (job)->cancellable, pull_open_fork_cb, transfer);
+  return TRUE;
+}
+
+static void
+push_open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_open_fork_finish (volume, res, &transfer->fork_refnum, NULL, &err))
+  {
+    transfer_failed (transfer, err);
+    g_error_free (err);
+    return;
+  }
+
+  transfer->fork_open = TRUE;
+  transfer_fill (transfer);
+}
+
+static void random_chars (char *str, int len);
+static void push_create_tmp_file (Transfer *transfer);
+
+static void
+push_create_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+
+  GError *err = NULL;
+
+  if (!g_vfs_afp_volume_create_file_finish (volume, res, &err))
+  {
+    if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_EXISTS))
+      push_create_tmp_file (transfer);
+    else
+    {
+      /* Nothing was created, so there is nothing to clean up */
+      g_free (transfer->tmp_filename);
+      transfer->tmp_filename = NULL;
+
+      g_vfs_job_failed (transfer->job, err->domain, err->code,
+                        _("Unable to create temporary file (%s)"), err->message);
+      transfer_free (transfer);
+    }
+    g_error_free (err);
+    return;
+  }
+
+  g_vfs_afp_volume_open_fork (volume, transfer->tmp_filename, AFP_ACCESS_MODE_WRITE_BIT, 0,
+                              transfer->job->cancellable, push_open_fork_cb, transfer);
+}
+
+static void
+push_create_tmp_file (Transfer *transfer)
+{
+  char basename[] = "~gvfXXXX.tmp";
+  char *dir;
+
+  random_chars (basename + 4, 4);
+  dir = g_path_get_dirname (transfer->filename);
+
+  g_free (transfer->tmp_filename);
+  transfer->tmp_filename = g_build_filename (dir, basename, NULL);
+  g_free (dir);
+
+  g_vfs_afp_volume_create_file (transfer->afp_backend->volume, transfer->tmp_filename, FALSE,
+                                transfer->job->cancellable, push_create_cb, transfer);
+}
+
+static void
+push_get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  Transfer *transfer = (Transfer *)user_data;
+  GVfsJobPush *job = G_VFS_JOB_PUSH (transfer->job);
+
+  GError *err = NULL;
+  GFileInfo *info;
+  gboolean dest_exists;
+
+  info = g_vfs_afp_volume_get_filedir_parms_finish (volume, res, &err);
+  if (!info)
+  {
+    if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), err);
+      g_error_free (err);
+      transfer_free (transfer);
+      return;
+    }
+
+    g_clear_error (&err);
+    dest_exists = FALSE;
+  }
+  else
+  {
+    gboolean dest_is_dir;
+
+    dest_exists = TRUE;
+    dest_is_dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
+    g_object_unref (info);
+
+    if (!(job->flags & G_FILE_COPY_OVERWRITE))
+    {
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_EXISTS,
+                        _("Target file already exists"));
+      transfer_free (transfer);
+      return;
+    }
+
+    if (dest_is_dir)
+    {
+      g_vfs_job_failed_literal (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                                _("File is directory"));
+      transfer_free (transfer);
+      return;
+    }
+  }
+
+  transfer->dest_exists = dest_exists;
+  push_create_tmp_file (transfer);
+}
+
+static gboolean
+try_push (GVfsBackend *backend,
+          GVfsJobPush *job,
+          const char *destination,
+          const char *local_path,
+          GFileCopyFlags flags,
+          gboolean remove_source,
+          GFileProgressCallback progress_callback,
+          gpointer progress_callback_data)
+{
+  GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
+  Transfer *transfer;
+  struct stat st;
+
+  if (flags & G_FILE_COPY_BACKUP)
+  {
+    g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                      _("backups not supported"));
+    return TRUE;
+  }
+
+  transfer = transfer_new (afp_backend, G_VFS_JOB (job), FALSE, destination, local_path, remove_source,
+                           progress_callback, progress_callback_data);
+
+  transfer->fd = g_open (local_path, O_RDONLY, 0);
+  if (transfer->fd == -1 || fstat (transfer->fd, &st) == -1)
+  {
+    int errsv = errno;
+
+    g_vfs_job_failed_literal (G_VFS_JOB (job), G_IO_ERROR,
+                              g_io_error_from_errno (errsv),
+                              g_strerror (errsv));
+    transfer_free (transfer);
+    return TRUE;
+  }
+
+  if (S_ISDIR (st.st_mode))
+  {
+    g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                      _("Can't recursively copy directory"));
+    transfer_free (transfer);
+    return TRUE;
+  }
+
+  transfer->size = st.st_size;
+
+  g_vfs_afp_volume_get_filedir_parms (afp_backend->volume, destination,
+                                      AFP_FILEDIR_BITMAP_ATTRIBUTE_BIT,
+                                      AFP_FILEDIR_BITMAP_ATTRIBUTE_BIT,
+                                      G_VFS_JOB (job)->cancellable,
+                                      push_get_filedir_parms_cb, transfer);
   return TRUE;
 }
 
@@ -2165,6 +3096,8 @@ g_vfs_backend_afp_class_init (GVfsBackendAfpClass *klass)
   backend_class->try_set_display_name = try_set_display_name;
   backend_class->try_move = try_move;
   backend_class->try_copy = try_copy;
+  backend_class->try_pull = try_pull;
+  backend_class->try_push = try_push;
 }
 
 void
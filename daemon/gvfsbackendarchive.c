@@ -61,32 +61,59 @@ struct _ArchiveFile {
   char *	name;			/* name of the file inside the archive */
   GFileInfo *	info;			/* file info created from archive_entry */
   GSList *	children;		/* (unordered) list of child files */
+  GHashTable *	child_table;		/* name => child, NULL without children */
+  guint		n_children;		/* length of children */
+  gint64	entry_index;		/* position in the archive, -1 if none */
+  gint64	header_offset;		/* offset of the entry's header */
 };
 
+typedef struct _GVfsArchive GVfsArchive;
+
 struct _GVfsBackendArchive
 {
   GVfsBackend		backend;
 
   GFile *		file;
   ArchiveFile *		files;		/* the tree of files */
+  gboolean		indexed;	/* entries can be opened at header_offset */
+  GVfsArchive *		parked;		/* last closed sequential reader */
+
+  /* The tree is filled by a thread after the mount succeeded. Jobs that
+   * need a file that wasn't read yet are parked until the scan finds it,
+   * enumerations are answered by the scan thread as the directory fills
+   * up. */
+  GMutex		lock;		/* protects files and everything below */
+  gboolean		scan_done;
+  GError *		scan_error;	/* why the scan stopped early */
+  GList *		enumerates;	/* ArchiveEnumerate, unfinished */
+  GList *		lookups;	/* ArchiveLookup, parked jobs */
+  GThread *		scan_thread;
+  GCancellable *	scan_cancellable;
 };
 
+/* wake up waiting jobs after this many new entries */
+#define SCAN_BATCH_SIZE 256
+
 G_DEFINE_TYPE (GVfsBackendArchive, g_vfs_backend_archive, G_VFS_TYPE_BACKEND)
 
 static void backend_unmount (GVfsBackendArchive *ba);
 
 /*** AN ARCHIVE WE CAN OPERATE ON ***/
 
-typedef struct {
+struct _GVfsArchive {
   struct archive *  archive;
   GFile *	    file;
   GFileInputStream *stream;
   GVfsJob *	    job;
+  GCancellable *    cancellable;	/* used when there is no job */
   GError *	    error;
-  guchar	    data[4096];
-} GVfsArchive;
+  goffset	    start_offset;	/* where in the file reading starts */
+  gint64	    entry_index;	/* index of the last header read */
+  guchar	    data[64 * 1024];
+};
 
 #define gvfs_archive_return(d) ((d)->error ? ARCHIVE_FATAL : ARCHIVE_OK)
+#define gvfs_archive_cancellable(d) ((d)->job ? (d)->job->cancellable : (d)->cancellable)
 
 static int
 gvfs_archive_open (struct archive *archive, 
@@ -97,8 +124,23 @@ gvfs_archive_open (struct archive *archive,
   DEBUG ("OPEN\n");
   g_assert (d->stream == NULL);
   d->stream = g_file_read (d->file,
-			   d->job->cancellable,
+			   gvfs_archive_cancellable (d),
 			   &d->error);
+
+  if (d->stream && d->start_offset > 0)
+    {
+      if (g_seekable_can_seek (G_SEEKABLE (d->stream)))
+        g_seekable_seek (G_SEEKABLE (d->stream),
+                         d->start_offset,
+                         G_SEEK_SET,
+                         gvfs_archive_cancellable (d),
+                         &d->error);
+      else
+        g_set_error_literal (&d->error,
+                             G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             _("Operation unsupported"));
+    }
+
   return gvfs_archive_return (d);
 }
 
@@ -114,7 +156,7 @@ gvfs_archive_read (struct archive *archive,
   read_bytes = g_input_stream_read (G_INPUT_STREAM (d->stream),
 				    d->data,
 				    sizeof (d->data),
-				    d->job->cancellable,
+				    gvfs_archive_cancellable (d),
 				    &d->error);
 
   DEBUG ("READ %d\n", (int) read_bytes);
@@ -132,7 +174,7 @@ gvfs_archive_skip (struct archive *archive,
     g_seekable_seek (G_SEEKABLE (d->stream),
 		     request,
 		     G_SEEK_CUR,
-		     d->job->cancellable,
+		     gvfs_archive_cancellable (d),
 		     &d->error);
   else
     return 0;
@@ -208,15 +250,30 @@ gvfs_archive_finish (GVfsArchive *archive)
   g_slice_free (GVfsArchive, archive);
 }
 
-/* NB: assumes an GVfsArchive initialized with ARCHIVE_DATA_INIT */
+/* Drops the archive without touching its job, e.g. after a failed
+ * attempt that is retried another way.
+ */
+static void
+gvfs_archive_abandon (GVfsArchive *archive)
+{
+  g_clear_error (&archive->error);
+  archive->job = NULL;
+  gvfs_archive_finish (archive);
+}
+
+/* Starts reading the archive at start_offset, which must be 0 or the
+ * header_offset of an entry in an indexed archive.
+ */
 static GVfsArchive *
-gvfs_archive_new (GVfsBackendArchive *ba, GVfsJob *job)
+gvfs_archive_new_at (GVfsBackendArchive *ba, GVfsJob *job, goffset start_offset)
 {
   GVfsArchive *d;
   
   d = g_slice_new0 (GVfsArchive);
 
   d->file = ba->file;
+  d->start_offset = start_offset;
+  d->entry_index = -1;
   gvfs_archive_push_job (d, job);
 
   d->archive = archive_read_new ();
@@ -232,6 +289,44 @@ gvfs_archive_new (GVfsBackendArchive *ba, GVfsJob *job)
   return d;
 }
 
+#define gvfs_archive_new(ba, job) gvfs_archive_new_at ((ba), (job), 0)
+
+/* Reads the next header, ignoring warnings. Returns FALSE at the end of
+ * the archive or on errors.
+ */
+static gboolean
+gvfs_archive_next_header (GVfsArchive *archive, struct archive_entry **entry)
+{
+  int result;
+
+  result = archive_read_next_header (archive->archive, entry);
+  if (result < ARCHIVE_WARN || result > ARCHIVE_OK)
+    return FALSE;
+
+  if (result < ARCHIVE_OK)
+    {
+      DEBUG ("archive_read_next_header: result = %d, error = '%s'\n", result, archive_error_string (archive->archive));
+      archive_set_error (archive->archive, ARCHIVE_OK, "No error");
+      archive_clear_error (archive->archive);
+    }
+
+  archive->entry_index++;
+  return TRUE;
+}
+
+static gboolean
+entry_has_path (struct archive_entry *entry, const char *path)
+{
+  const char *entry_pathname;
+
+  entry_pathname = archive_entry_pathname (entry);
+  /* skip leading garbage if present */
+  if (g_str_has_prefix (entry_pathname, "./"))
+    entry_pathname += 2;
+
+  return g_str_equal (entry_pathname, path);
+}
+
 /*** BACKEND ***/
 
 static void
@@ -241,6 +336,8 @@ g_vfs_backend_archive_finalize (GObject *object)
 
   backend_unmount (archive);
 
+  g_mutex_clear (&archive->lock);
+
   if (G_OBJECT_CLASS (g_vfs_backend_archive_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_archive_parent_class)->finalize) (object);
 }
@@ -248,6 +345,7 @@ g_vfs_backend_archive_finalize (GObject *object)
 static void
 g_vfs_backend_archive_init (GVfsBackendArchive *archive)
 {
+  g_mutex_init (&archive->lock);
 }
 
 /*** FILE TREE HANDLING ***/
@@ -258,7 +356,6 @@ archive_file_get_from_path (ArchiveFile *file, const char *filename, gboolean ad
 {
   char **names;
   ArchiveFile *cur;
-  GSList *walk;
   guint i;
 
   /* libarchive reports paths starting with ./ for some archive types */
@@ -270,13 +367,8 @@ archive_file_get_from_path (ArchiveFile *file, const char *filename, gboolean ad
   for (i = 0; file && names[i] != NULL; i++)
     {
       cur = NULL;
-      for (walk = file->children; walk; walk = walk->next)
-	{
-	  cur = walk->data;
-	  if (g_str_equal (cur->name, names[i]))
-	    break;
-	  cur = NULL;
-	}
+      if (file->child_table)
+        cur = g_hash_table_lookup (file->child_table, names[i]);
       if (cur == NULL && add != FALSE)
 	{
 	  DEBUG ("adding node %s to %s\n", names[i], file->name);
@@ -286,8 +378,20 @@ archive_file_get_from_path (ArchiveFile *file, const char *filename, gboolean ad
 	    {
 	      cur = g_slice_new0 (ArchiveFile);
 	      cur->name = names[i];
+	      cur->entry_index = -1;
+	      cur->header_offset = -1;
 	      names[i] = NULL;
+	      /* until we see its own entry, if any */
+	      cur->info = g_file_info_new ();
+	      g_file_info_set_name (cur->info, cur->name);
+	      gvfs_file_info_populate_default (cur->info,
+	                                       cur->name,
+	                                       G_FILE_TYPE_DIRECTORY);
 	      file->children = g_slist_prepend (file->children, cur);
+	      file->n_children++;
+	      if (file->child_table == NULL)
+	        file->child_table = g_hash_table_new (g_str_hash, g_str_equal);
+	      g_hash_table_insert (file->child_table, cur->name, cur);
 	    }
 	  else
 	    {
@@ -306,6 +410,202 @@ archive_file_get_from_path (ArchiveFile *file, const char *filename, gboolean ad
 }
 #define archive_file_find(ba, filename) archive_file_get_from_path((ba)->files, (filename) + 1, FALSE)
 
+/* Fails job for a file that isn't in the finished tree.
+ * Must be called with ba->lock held. */
+static void
+archive_fail_not_found (GVfsBackendArchive *ba, GVfsJob *job)
+{
+  if (ba->scan_error)
+    g_vfs_job_failed_from_error (job, ba->scan_error);
+  else
+    g_vfs_job_failed (job,
+                      G_IO_ERROR,
+                      G_IO_ERROR_NOT_FOUND,
+                      _("File doesn't exist"));
+}
+
+/* A query_info or open_for_read job for a file the scan didn't get to
+ * yet. It is run in a job thread once the file is found or the scan is
+ * done, so that it doesn't block the thread while it waits. */
+typedef struct {
+  GVfsJob *		job;
+  char *		filename;
+} ArchiveLookup;
+
+static void
+archive_lookup_free (ArchiveLookup *lookup)
+{
+  g_object_unref (lookup->job);
+  g_free (lookup->filename);
+  g_slice_free (ArchiveLookup, lookup);
+}
+
+static void
+archive_lookup_cancelled (GVfsJob *job, gpointer user_data)
+{
+  GVfsBackendArchive *ba = user_data;
+  ArchiveLookup *lookup;
+  GList *l;
+
+  lookup = NULL;
+  g_mutex_lock (&ba->lock);
+  for (l = ba->lookups; l != NULL; l = l->next)
+    if (((ArchiveLookup *) l->data)->job == job)
+      {
+        lookup = l->data;
+        ba->lookups = g_list_delete_link (ba->lookups, l);
+        break;
+      }
+  g_mutex_unlock (&ba->lock);
+
+  /* else it is running already */
+  if (lookup == NULL)
+    return;
+
+  g_vfs_job_failed (job,
+                    G_IO_ERROR,
+                    G_IO_ERROR_CANCELLED,
+                    _("Operation was cancelled"));
+  archive_lookup_free (lookup);
+}
+
+/* Parks job if filename isn't in the tree yet. Returns FALSE if the job
+ * can run right away. */
+static gboolean
+archive_park_lookup (GVfsBackendArchive *ba, GVfsJob *job, const char *filename)
+{
+  ArchiveLookup *lookup;
+  gboolean parked;
+
+  g_mutex_lock (&ba->lock);
+  parked = !ba->scan_done && archive_file_find (ba, filename) == NULL;
+  if (parked)
+    {
+      lookup = g_slice_new (ArchiveLookup);
+      lookup->job = g_object_ref (job);
+      lookup->filename = g_strdup (filename);
+      ba->lookups = g_list_prepend (ba->lookups, lookup);
+
+      /* emitted in the main thread, like this is called */
+      g_signal_connect (job, "cancelled",
+                        G_CALLBACK (archive_lookup_cancelled), ba);
+    }
+  g_mutex_unlock (&ba->lock);
+
+  return parked;
+}
+
+/* Must be called with ba->lock held */
+static void
+archive_update_lookups (GVfsBackendArchive *ba)
+{
+  ArchiveLookup *lookup;
+  GList *l, *next;
+
+  for (l = ba->lookups; l != NULL; l = next)
+    {
+      next = l->next;
+      lookup = l->data;
+      if (ba->scan_done || archive_file_find (ba, lookup->filename) != NULL)
+        {
+          g_vfs_daemon_run_job_in_thread (g_vfs_backend_get_daemon (G_VFS_BACKEND (ba)),
+                                          lookup->job);
+          archive_lookup_free (lookup);
+          ba->lookups = g_list_delete_link (ba->lookups, l);
+        }
+    }
+}
+
+/* An enumeration waiting for the scan to finish its directory */
+typedef struct {
+  GVfsJobEnumerate *	job;
+  char *		filename;
+  ArchiveFile *		file;		/* NULL until the scan found it */
+  guint			n_sent;		/* children sent so far */
+} ArchiveEnumerate;
+
+static void
+archive_enumerate_free (ArchiveEnumerate *enumerate)
+{
+  g_object_unref (enumerate->job);
+  g_free (enumerate->filename);
+  g_slice_free (ArchiveEnumerate, enumerate);
+}
+
+/* Sends the children that were added to the directory since the last
+ * call and finishes the job once the scan is done. Returns TRUE when
+ * the job is finished.
+ * Must be called with ba->lock held. */
+static gboolean
+archive_enumerate_update (GVfsBackendArchive *ba, ArchiveEnumerate *enumerate)
+{
+  ArchiveFile *file;
+  GSList *walk;
+  GList *infos;
+  guint i;
+
+  if (enumerate->file == NULL)
+    {
+      file = archive_file_find (ba, enumerate->filename);
+      if (file == NULL)
+        {
+          if (!ba->scan_done)
+            return FALSE;
+
+          archive_fail_not_found (ba, G_VFS_JOB (enumerate->job));
+          return TRUE;
+        }
+
+      if (g_file_info_get_file_type (file->info) != G_FILE_TYPE_DIRECTORY)
+        {
+          g_vfs_job_failed (G_VFS_JOB (enumerate->job),
+                            G_IO_ERROR,
+                            G_IO_ERROR_NOT_DIRECTORY,
+                            _("The file is not a directory"));
+          return TRUE;
+        }
+
+      enumerate->file = file;
+      g_vfs_job_succeeded (G_VFS_JOB (enumerate->job));
+    }
+
+  /* New children are prepended, so they are always at the head */
+  file = enumerate->file;
+  infos = NULL;
+  for (walk = file->children, i = file->n_children; i > enumerate->n_sent; walk = walk->next, i--)
+    infos = g_list_prepend (infos, g_file_info_dup (((ArchiveFile *) walk->data)->info));
+  enumerate->n_sent = file->n_children;
+
+  if (infos)
+    {
+      g_vfs_job_enumerate_add_infos (enumerate->job, infos);
+      g_list_free_full (infos, g_object_unref);
+    }
+
+  if (!ba->scan_done)
+    return FALSE;
+
+  g_vfs_job_enumerate_done (enumerate->job);
+  return TRUE;
+}
+
+/* Must be called with ba->lock held */
+static void
+archive_update_enumerates (GVfsBackendArchive *ba)
+{
+  GList *l, *next;
+
+  for (l = ba->enumerates; l != NULL; l = next)
+    {
+      next = l->next;
+      if (archive_enumerate_update (ba, l->data))
+        {
+          archive_enumerate_free (l->data);
+          ba->enumerates = g_list_delete_link (ba->enumerates, l);
+        }
+    }
+}
+
 static void
 create_root_file (GVfsBackendArchive *ba)
 {
@@ -316,6 +616,8 @@ create_root_file (GVfsBackendArchive *ba)
 
   root = g_slice_new0 (ArchiveFile);
   root->name = g_strdup ("/");
+  root->entry_index = -1;
+  root->header_offset = -1;
   ba->files = root;
 
   info = g_file_info_new ();
@@ -444,66 +746,153 @@ const char		*archive_entry_uname(struct archive_entry *);
   /* FIXME: do ACLs */
 }
 
+/* Uncompressed archives of these formats are a sequence of self-contained
+ * entries, so reading can start right at an entry's header.
+ *
+ * Not ar: the format is only recognized by the "!<arch>" magic at the
+ * start of the file, and long member names refer to the "//" table
+ * member, so its entries can't be read on their own.
+ */
+static gboolean
+archive_can_be_indexed (struct archive *archive)
+{
+  if (archive_compression (archive) != ARCHIVE_COMPRESSION_NONE)
+    return FALSE;
+
+  switch (archive_format (archive) & ARCHIVE_FORMAT_BASE_MASK)
+    {
+      case ARCHIVE_FORMAT_TAR:
+      case ARCHIVE_FORMAT_ZIP:
+      case ARCHIVE_FORMAT_CPIO:
+        return TRUE;
+      default:
+        return FALSE;
+    }
+}
+
+/* Adds the entry the archive is positioned at to the tree.
+ * Must be called with ba->lock held. */
 static void
-fixup_dirs (ArchiveFile *file)
+archive_file_add_entry (GVfsBackendArchive *ba,
+                        GVfsArchive *archive,
+                        struct archive_entry *entry)
 {
-  GSList *l;
+  ArchiveFile *file;
 
-  if (file->info == NULL)
+  file = archive_file_get_from_path (ba->files, 
+                                     archive_entry_pathname (entry), 
+                                     TRUE);
+  /* Don't set info for root */
+  if (file != ba->files)
     {
-      GFileInfo *info = g_file_info_new ();
-      
-      file->info = info;
-      g_file_info_set_name (info, file->name);
-      gvfs_file_info_populate_default (info,
-                                       file->name,
-                                       G_FILE_TYPE_DIRECTORY);
+      if (file->info)
+        g_object_unref (file->info);
+      archive_file_set_info_from_entry (file, entry, archive->entry_index);
+      file->entry_index = archive->entry_index;
+      file->header_offset = archive_read_header_position (archive->archive);
     }
-  
-  for (l = file->children; l != NULL; l = l->next)
-    fixup_dirs (l->data);
 }
 
+typedef struct {
+  GVfsBackendArchive *ba;
+  GVfsArchive *archive;
+} ScanData;
+
+static gpointer
+scan_thread (gpointer data)
+{
+  ScanData *scan = data;
+  GVfsBackendArchive *ba = scan->ba;
+  GVfsArchive *archive = scan->archive;
+  struct archive_entry *entry;
+  guint n_added;
+
+  g_slice_free (ScanData, scan);
+
+  n_added = 0;
+  while (gvfs_archive_next_header (archive, &entry))
+    {
+      g_mutex_lock (&ba->lock);
+      archive_file_add_entry (ba, archive, entry);
+      if (++n_added % SCAN_BATCH_SIZE == 0)
+        {
+          archive_update_lookups (ba);
+          archive_update_enumerates (ba);
+        }
+      g_mutex_unlock (&ba->lock);
+
+      archive_read_data_skip (archive->archive);
+    }
+
+  DEBUG ("scan done after %" G_GINT64_FORMAT " entries\n", archive->entry_index + 1);
+
+  g_mutex_lock (&ba->lock);
+  /* Files after the error are missing, so lookups that fail get this */
+  if (archive->error)
+    ba->scan_error = g_error_copy (archive->error);
+  else if (archive_error_string (archive->archive) != NULL)
+    ba->scan_error = g_error_new_literal (G_IO_ERROR,
+                                          g_io_error_from_errno (archive_errno (archive->archive)),
+                                          archive_error_string (archive->archive));
+  if (ba->scan_error)
+    g_debug ("archive scan stopped: %s\n", ba->scan_error->message);
+
+  ba->scan_done = TRUE;
+  archive_update_lookups (ba);
+  archive_update_enumerates (ba);
+  g_mutex_unlock (&ba->lock);
+
+  gvfs_archive_abandon (archive);
+
+  return NULL;
+}
+
+/* Reads the first header to make sure this is an archive we can handle,
+ * finishing the mount job, and leaves the rest of the tree to a thread so
+ * that huge archives can be browsed right away.
+ */
 static void
 create_file_tree (GVfsBackendArchive *ba, GVfsJob *job)
 {
   GVfsArchive *archive;
   struct archive_entry *entry;
-  int result;
-  guint64 entry_index = 0;
+  ScanData *scan;
 
   archive = gvfs_archive_new (ba, job);
 
   g_assert (ba->files != NULL);
 
-  do
+  if (!gvfs_archive_next_header (archive, &entry))
     {
-      result = archive_read_next_header (archive->archive, &entry);
-      if (result >= ARCHIVE_WARN && result <= ARCHIVE_OK)
-	{
-  	  if (result < ARCHIVE_OK) {
-  	    DEBUG ("archive_read_next_header: result = %d, error = '%s'\n", result, archive_error_string (archive->archive));
-  	    archive_set_error (archive->archive, ARCHIVE_OK, "No error");
-  	    archive_clear_error (archive->archive);
-	  }
-  
-	  ArchiveFile *file = archive_file_get_from_path (ba->files, 
-	                                                  archive_entry_pathname (entry), 
-							  TRUE);
-          /* Don't set info for root */
-          if (file != ba->files)
-            archive_file_set_info_from_entry (file, entry, entry_index);
-	  archive_read_data_skip (archive->archive);
-	  entry_index++;
-	}
+      ba->scan_done = TRUE;
+      if (archive_error_string (archive->archive) != NULL &&
+          !gvfs_archive_in_error (archive))
+        {
+          /* this fails the job */
+          gvfs_archive_set_error_from_errno (archive);
+          gvfs_archive_abandon (archive);
+        }
+      else
+        gvfs_archive_finish (archive);
+      return;
     }
-  while (result != ARCHIVE_FATAL && result != ARCHIVE_EOF);
 
-  if (result == ARCHIVE_FATAL)
-    gvfs_archive_set_error_from_errno (archive);
-  fixup_dirs (ba->files);
-  
-  gvfs_archive_finish (archive);
+  archive_file_add_entry (ba, archive, entry);
+  archive_read_data_skip (archive->archive);
+
+  /* the compression and format are known after the first header */
+  ba->indexed = archive_can_be_indexed (archive->archive);
+  DEBUG ("archive %s indexed\n", ba->indexed ? "is" : "is not");
+
+  gvfs_archive_pop_job (archive);
+
+  ba->scan_cancellable = g_cancellable_new ();
+  archive->cancellable = ba->scan_cancellable;
+
+  scan = g_slice_new (ScanData);
+  scan->ba = ba;
+  scan->archive = archive;
+  ba->scan_thread = g_thread_new ("archive scan", scan_thread, scan);
 }
 
 static void
@@ -511,6 +900,8 @@ archive_file_free (ArchiveFile *file)
 {
   g_slist_foreach (file->children, (GFunc) archive_file_free, NULL);
   g_slist_free (file->children);
+  if (file->child_table)
+    g_hash_table_destroy (file->child_table);
   if (file->info)
     g_object_unref (file->info);
   g_free (file->name);
@@ -603,6 +994,15 @@ do_mount (GVfsBackend *backend,
 static void
 backend_unmount (GVfsBackendArchive *ba)
 {
+  if (ba->scan_thread)
+    {
+      g_cancellable_cancel (ba->scan_cancellable);
+      g_thread_join (ba->scan_thread);
+      ba->scan_thread = NULL;
+      g_object_unref (ba->scan_cancellable);
+      ba->scan_cancellable = NULL;
+    }
+  g_clear_error (&ba->scan_error);
   if (ba->file)
     {
       g_object_unref (ba->file);
@@ -613,6 +1013,11 @@ backend_unmount (GVfsBackendArchive *ba)
       archive_file_free (ba->files);
       ba->files = NULL;
     }
+  if (ba->parked)
+    {
+      gvfs_archive_finish (ba->parked);
+      ba->parked = NULL;
+    }
 }
 
 static void
@@ -626,6 +1031,23 @@ do_unmount (GVfsBackend *backend,
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
+/* Scans forward from the current position for the entry at path */
+static gboolean
+gvfs_archive_seek_entry (GVfsArchive *archive, const char *path)
+{
+  struct archive_entry *entry;
+
+  while (gvfs_archive_next_header (archive, &entry))
+    {
+      if (entry_has_path (entry, path))
+        return TRUE;
+
+      archive_read_data_skip (archive->archive);
+    }
+
+  return FALSE;
+}
+
 static void
 do_open_for_read (GVfsBackend *       backend,
 		  GVfsJobOpenForRead *job,
@@ -634,67 +1056,106 @@ do_open_for_read (GVfsBackend *       backend,
   GVfsBackendArchive *ba = G_VFS_BACKEND_ARCHIVE (backend);
   GVfsArchive *archive;
   struct archive_entry *entry;
-  int result;
   ArchiveFile *file;
-  const char *entry_pathname;
+  GFileType type;
+  gint64 entry_index, header_offset;
 
+  type = G_FILE_TYPE_UNKNOWN;
+  entry_index = header_offset = -1;
+
+  g_mutex_lock (&ba->lock);
   file = archive_file_find (ba, filename);
   if (file == NULL)
     {
-      g_vfs_job_failed (G_VFS_JOB (job),
-		        G_IO_ERROR,
-			G_IO_ERROR_NOT_FOUND,
-			_("File doesn't exist"));
+      archive_fail_not_found (ba, G_VFS_JOB (job));
+      g_mutex_unlock (&ba->lock);
       return;
     }
+  type = g_file_info_get_file_type (file->info);
+  entry_index = file->entry_index;
+  header_offset = file->header_offset;
+  g_mutex_unlock (&ba->lock);
 
-  if (g_file_info_get_file_type (file->info) == G_FILE_TYPE_DIRECTORY)
+  if (type == G_FILE_TYPE_DIRECTORY)
     {
       g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
 			G_IO_ERROR_IS_DIRECTORY,
 			_("Can't open directory"));
       return;
     }
-  
-  archive = gvfs_archive_new (ba, G_VFS_JOB (job));
 
-  do
+  /* Jump straight to the entry if we can */
+  if (ba->indexed && header_offset >= 0)
     {
-      result = archive_read_next_header (archive->archive, &entry);
-      if (result >= ARCHIVE_WARN && result <= ARCHIVE_OK)
+      archive = gvfs_archive_new_at (ba, G_VFS_JOB (job), header_offset);
+
+      if (gvfs_archive_next_header (archive, &entry) &&
+          entry_has_path (entry, filename + 1))
         {
-	  if (result < ARCHIVE_OK) {
-	    DEBUG ("do_open_for_read: result = %d, error = '%s'\n", result, archive_error_string (archive->archive));
-	    archive_set_error (archive->archive, ARCHIVE_OK, "No error");
-	    archive_clear_error (archive->archive);
-	  }
-
-          entry_pathname = archive_entry_pathname (entry);
-          /* skip leading garbage if present */
-          if (g_str_has_prefix (entry_pathname, "./"))
-            entry_pathname += 2;
-          if (g_str_equal (entry_pathname, filename + 1))
-            {
-              /* SUCCESS */
-              g_vfs_job_open_for_read_set_handle (job, archive);
-              g_vfs_job_open_for_read_set_can_seek (job, FALSE);
-              gvfs_archive_pop_job (archive);
-              return;
-            }
-          else
-            archive_read_data_skip (archive->archive);
+          archive->entry_index = entry_index;
+          g_vfs_job_open_for_read_set_handle (job, archive);
+          g_vfs_job_open_for_read_set_can_seek (job, FALSE);
+          gvfs_archive_pop_job (archive);
+          return;
         }
+
+      DEBUG ("index lookup for %s failed, scanning\n", filename);
+      gvfs_archive_abandon (archive);
     }
-  while (result != ARCHIVE_FATAL && result != ARCHIVE_EOF);
 
-  if (!gvfs_archive_in_error (archive))
+  /* For compressed and solid archives, continue from where the last
+   * sequential reader stopped instead of decompressing everything
+   * before this entry again. */
+  archive = NULL;
+  if (ba->parked && ba->parked->entry_index < entry_index)
     {
-      g_set_error_literal (&archive->error,
-			   G_IO_ERROR,
-			   G_IO_ERROR_NOT_FOUND,
-			   _("File doesn't exist"));
+      archive = ba->parked;
+      ba->parked = NULL;
+      gvfs_archive_push_job (archive, G_VFS_JOB (job));
+
+      if (!gvfs_archive_seek_entry (archive, filename + 1))
+        {
+          gvfs_archive_abandon (archive);
+          archive = NULL;
+        }
     }
-  gvfs_archive_finish (archive);
+  else if (ba->parked)
+    {
+      gvfs_archive_finish (ba->parked);
+      ba->parked = NULL;
+    }
+
+  if (archive == NULL)
+    {
+      archive = gvfs_archive_new (ba, G_VFS_JOB (job));
+
+      if (!gvfs_archive_seek_entry (archive, filename + 1))
+        {
+          if (!gvfs_archive_in_error (archive))
+            {
+              g_set_error_literal (&archive->error,
+                                   G_IO_ERROR,
+                                   G_IO_ERROR_NOT_FOUND,
+                                   _("File doesn't exist"));
+            }
+          gvfs_archive_finish (archive);
+          return;
+        }
+    }
+
+  /* SUCCESS */
+  g_vfs_job_open_for_read_set_handle (job, archive);
+  g_vfs_job_open_for_read_set_can_seek (job, FALSE);
+  gvfs_archive_pop_job (archive);
+}
+
+static gboolean
+try_open_for_read (GVfsBackend *backend,
+                   GVfsJobOpenForRead *job,
+                   const char *filename)
+{
+  return archive_park_lookup (G_VFS_BACKEND_ARCHIVE (backend),
+                              G_VFS_JOB (job), filename);
 }
 
 static void
@@ -702,9 +1163,23 @@ do_close_read (GVfsBackend *backend,
 	       GVfsJobCloseRead *job,
 	       GVfsBackendHandle handle)
 {
+  GVfsBackendArchive *ba = G_VFS_BACKEND_ARCHIVE (backend);
   GVfsArchive *archive = handle;
 
   gvfs_archive_push_job (archive, G_VFS_JOB (job));
+
+  /* Keep a sequential reader around, the next open is likely to be for
+   * a later entry (e.g. when copying the whole archive) */
+  if (!ba->indexed && !gvfs_archive_in_error (archive) &&
+      archive_error_string (archive->archive) == NULL)
+    {
+      if (ba->parked)
+        gvfs_archive_finish (ba->parked);
+      ba->parked = archive;
+      gvfs_archive_pop_job (archive);
+      return;
+    }
+
   gvfs_archive_finish (archive);
 }
 
@@ -738,13 +1213,12 @@ do_query_info (GVfsBackend *backend,
   GVfsBackendArchive *ba = G_VFS_BACKEND_ARCHIVE (backend);
   ArchiveFile *file;
 
+  g_mutex_lock (&ba->lock);
   file = archive_file_find (ba, filename);
   if (file == NULL)
     {
-      g_vfs_job_failed (G_VFS_JOB (job),
-		        G_IO_ERROR,
-			G_IO_ERROR_NOT_FOUND,
-			_("File doesn't exist"));
+      archive_fail_not_found (ba, G_VFS_JOB (job));
+      g_mutex_unlock (&ba->lock);
       return;
     }
 
@@ -752,10 +1226,23 @@ do_query_info (GVfsBackend *backend,
     g_warning ("FIXME: follow symlinks");
 
   g_file_info_copy_into (file->info, info);
+  g_mutex_unlock (&ba->lock);
 
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
+static gboolean
+try_query_info (GVfsBackend *backend,
+                GVfsJobQueryInfo *job,
+                const char *filename,
+                GFileQueryInfoFlags flags,
+                GFileInfo *info,
+                GFileAttributeMatcher *attribute_matcher)
+{
+  return archive_park_lookup (G_VFS_BACKEND_ARCHIVE (backend),
+                              G_VFS_JOB (job), filename);
+}
+
 static void
 do_enumerate (GVfsBackend *backend,
 	      GVfsJobEnumerate *job,
@@ -764,40 +1251,23 @@ do_enumerate (GVfsBackend *backend,
 	      GFileQueryInfoFlags flags)
 {
   GVfsBackendArchive *ba = G_VFS_BACKEND_ARCHIVE (backend);
-  ArchiveFile *file;
-  GSList *walk;
-
-  file = archive_file_find (ba, filename);
-  if (file == NULL)
-    {
-      g_vfs_job_failed (G_VFS_JOB (job),
-		        G_IO_ERROR,
-			G_IO_ERROR_NOT_FOUND,
-			_("File doesn't exist"));
-      return;
-    }
-
-  if (g_file_info_get_file_type (file->info) != G_FILE_TYPE_DIRECTORY)
-    {
-      g_vfs_job_failed (G_VFS_JOB (job),
-		        G_IO_ERROR,
-			G_IO_ERROR_NOT_DIRECTORY,
-			_("The file is not a directory"));
-      return;
-    }
+  ArchiveEnumerate *enumerate;
 
   if (!(flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS))
     g_warning ("FIXME: follow symlinks");
 
-  for (walk = file->children; walk; walk = walk->next)
-    {
-      GFileInfo *info = g_file_info_dup (((ArchiveFile *) walk->data)->info);
-      g_vfs_job_enumerate_add_info (job, info);
-      g_object_unref (info);
-    }
-  g_vfs_job_enumerate_done (job);
+  enumerate = g_slice_new0 (ArchiveEnumerate);
+  enumerate->job = g_object_ref (job);
+  enumerate->filename = g_strdup (filename);
 
-  g_vfs_job_succeeded (G_VFS_JOB (job));
+  /* Send what we have; while the scan is running, it sends the rest
+   * and finishes the job, so that other jobs can run meanwhile. */
+  g_mutex_lock (&ba->lock);
+  if (archive_enumerate_update (ba, enumerate))
+    archive_enumerate_free (enumerate);
+  else
+    ba->enumerates = g_list_prepend (ba->enumerates, enumerate);
+  g_mutex_unlock (&ba->lock);
 }
 
 static gboolean
@@ -823,10 +1293,12 @@ g_vfs_backend_archive_class_init (GVfsBackendArchiveClass *klass)
 
   backend_class->mount = do_mount;
   backend_class->unmount = do_unmount;
+  backend_class->try_open_for_read = try_open_for_read;
   backend_class->open_for_read = do_open_for_read;
   backend_class->close_read = do_close_read;
   backend_class->read = do_read;
   backend_class->enumerate = do_enumerate;
+  backend_class->try_query_info = try_query_info;
   backend_class->query_info = do_query_info;
   backend_class->try_query_fs_info = try_query_fs_info;
 }
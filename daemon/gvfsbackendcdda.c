@@ -82,8 +82,8 @@
  *   - Need to handle this better... ideally caller passes a flag when opening the file to
  *     specify whether he wants us to try hard to get the hard result (ripping) or whether 
  *     he's fine with some noise (playback)
- *
- * - Sector cache? Might be useful to maintain a cache of previously read sectors
+ *   - For now, GVFS_CDDA_PARANOIA=full in the environment turns on full paranoia; the
+ *     read-ahead thread absorbs its retries so they don't stall the channel
  */
 
 /*--------------------------------------------------------------------------------------------------------------*/
@@ -110,6 +110,7 @@ struct _GVfsBackendCdda
 
   char *device_path;
   cdrom_drive_t *drive;
+  GMutex drive_lock; /* serializes paranoia access from the read-ahead threads */
   int num_open_files;
 
   /* Metadata from CD-Text */
@@ -281,6 +282,8 @@ g_vfs_backend_cdda_finalize (GObject *object)
   release_device (cdda_backend);
   release_metadata (cdda_backend);
 
+  g_mutex_clear (&cdda_backend->drive_lock);
+
   if (G_OBJECT_CLASS (g_vfs_backend_cdda_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_cdda_parent_class)->finalize) (object);
 }
@@ -294,6 +297,8 @@ g_vfs_backend_cdda_init (GVfsBackendCdda *cdda_backend)
 
   //g_warning ("initing %p", cdda_backend);
 
+  g_mutex_init (&cdda_backend->drive_lock);
+
   g_vfs_backend_set_display_name (backend, "cdda");
   g_vfs_backend_set_x_content_types (backend, x_content_types);
   // TODO: HMM: g_vfs_backend_set_user_visible (backend, FALSE);  
@@ -535,7 +540,13 @@ get_track_num_from_name (GVfsBackendCdda *cdda_backend, const char *filename)
   return -1;
 }
 
+/* How much audio the read-ahead thread keeps buffered: 75 sectors are one
+ * second, so this lets the drive stream continuously for a few seconds
+ * while the client is busy. */
+#define READ_AHEAD_SECTORS (75 * 4)
+
 typedef struct {
+  GVfsBackendCdda *cdda_backend;
   cdrom_paranoia_t *paranoia;
 
   long size;           /* size of file being read */
@@ -546,23 +557,41 @@ typedef struct {
 
   long first_sector;   /* first sector of raw PCM audio data */
   long last_sector;    /* last sector of raw PCM audio data */
-  long sector_cursor;  /* sector we're currently at */
 
   char *header;        /* header payload */
 
-  /* These following two fields are used for caching the last read sector. This
-   * is to avoid seeking back if fewer bytes than whole sector is requested.
-   */
-  long buf_at_sector_num;                     /* the sector that is cached */
-  char buf_at_sector[CDIO_CD_FRAMESIZE_RAW];  /* the data of the sector */
+  /* The read-ahead ring. It holds ring_count sectors starting at
+   * ring_start; the thread always reads sector ring_start + ring_count
+   * next. Sectors before the one the client reads are dropped, so a
+   * partially read sector stays around. Protected by lock. */
+  GThread *reader;
+  GMutex lock;
+  GCond cond;
+  char *ring;
+  long ring_start;
+  int ring_count;
+  guint generation;    /* bumped when the client seeks away */
+  int error;           /* errno of a failed read, 0 if none */
+  gboolean stop;
 
 } ReadHandle;
 
 static void
 free_read_handle (ReadHandle *read_handle)
 {
+  if (read_handle->reader != NULL)
+    {
+      g_mutex_lock (&read_handle->lock);
+      read_handle->stop = TRUE;
+      g_cond_broadcast (&read_handle->cond);
+      g_mutex_unlock (&read_handle->lock);
+      g_thread_join (read_handle->reader);
+    }
+  g_mutex_clear (&read_handle->lock);
+  g_cond_clear (&read_handle->cond);
   if (read_handle->paranoia != NULL)
     cdio_paranoia_free (read_handle->paranoia);
+  g_free (read_handle->ring);
   g_free (read_handle->header);
   g_free (read_handle);
 }
@@ -688,6 +717,9 @@ do_open_for_read (GVfsBackend *backend,
   //g_warning ("open_for_read (%s)", filename);
 
   read_handle = g_new0 (ReadHandle, 1);
+  read_handle->cdda_backend = cdda_backend;
+  g_mutex_init (&read_handle->lock);
+  g_cond_init (&read_handle->cond);
 
   track_num = get_track_num_from_name (cdda_backend, job->filename);
   if (track_num == -1)
@@ -702,17 +734,20 @@ do_open_for_read (GVfsBackend *backend,
 
   read_handle->first_sector = cdio_cddap_track_firstsector (cdda_backend->drive, track_num);
   read_handle->last_sector = cdio_cddap_track_lastsector (cdda_backend->drive, track_num);
-  read_handle->sector_cursor = -1;
+  read_handle->ring_start = read_handle->first_sector;
 
   read_handle->cursor = 0;
-  read_handle->buf_at_sector_num = -1;
   read_handle->content_size  = ((read_handle->last_sector - read_handle->first_sector) + 1) * CDIO_CD_FRAMESIZE_RAW;
 
   read_handle->header = create_header (cdda_backend, &(read_handle->header_size), read_handle->content_size);
   read_handle->size = read_handle->header_size + read_handle->content_size;
 
   read_handle->paranoia = cdio_paranoia_init (cdda_backend->drive);
-  cdio_paranoia_modeset (read_handle->paranoia, PARANOIA_MODE_DISABLE);
+  if (g_strcmp0 (g_getenv ("GVFS_CDDA_PARANOIA"), "full") == 0)
+    /* verify, but give up on a sector rather than retrying forever */
+    cdio_paranoia_modeset (read_handle->paranoia, PARANOIA_MODE_FULL ^ PARANOIA_MODE_NEVERSKIP);
+  else
+    cdio_paranoia_modeset (read_handle->paranoia, PARANOIA_MODE_DISABLE);
 
   cdda_backend->num_open_files++;
 
@@ -728,6 +763,93 @@ paranoia_callback (long int inpos, paranoia_cb_mode_t function)
 }
 
 
+static gpointer
+read_ahead_thread (gpointer data)
+{
+  ReadHandle *read_handle = data;
+  GMutex *drive_lock = &read_handle->cdda_backend->drive_lock;
+  char sector[CDIO_CD_FRAMESIZE_RAW];
+  long paranoia_pos, wanted;
+  guint generation;
+  char *readbuf;
+  int errsv;
+
+  paranoia_pos = -1;
+
+  g_mutex_lock (&read_handle->lock);
+  while (!read_handle->stop)
+    {
+      wanted = read_handle->ring_start + read_handle->ring_count;
+
+      if (read_handle->ring_count == READ_AHEAD_SECTORS ||
+          wanted > read_handle->last_sector ||
+          read_handle->error != 0)
+        {
+          g_cond_wait (&read_handle->cond, &read_handle->lock);
+          continue;
+        }
+
+      generation = read_handle->generation;
+      g_mutex_unlock (&read_handle->lock);
+
+      g_mutex_lock (drive_lock);
+      if (wanted != paranoia_pos)
+        cdio_paranoia_seek (read_handle->paranoia, wanted, SEEK_SET);
+      readbuf = (char *) cdio_paranoia_read (read_handle->paranoia, paranoia_callback);
+      errsv = errno;
+      if (readbuf != NULL)
+        memcpy (sector, readbuf, CDIO_CD_FRAMESIZE_RAW);
+      g_mutex_unlock (drive_lock);
+
+      paranoia_pos = readbuf != NULL ? wanted + 1 : -1;
+
+      g_mutex_lock (&read_handle->lock);
+
+      /* the client went elsewhere while we were reading */
+      if (generation != read_handle->generation)
+        continue;
+
+      if (readbuf == NULL)
+        read_handle->error = errsv ? errsv : EIO;
+      else
+        {
+          memcpy (read_handle->ring +
+                  (wanted % READ_AHEAD_SECTORS) * CDIO_CD_FRAMESIZE_RAW,
+                  sector, CDIO_CD_FRAMESIZE_RAW);
+          read_handle->ring_count++;
+        }
+
+      g_cond_broadcast (&read_handle->cond);
+    }
+  g_mutex_unlock (&read_handle->lock);
+
+  return NULL;
+}
+
+/* Makes sure the ring will contain sector, dropping the sectors before it
+ * or restarting the read-ahead there. Must be called with the lock held.
+ */
+static void
+read_handle_move_to (ReadHandle *read_handle, long sector)
+{
+  long end = read_handle->ring_start + read_handle->ring_count;
+
+  if (sector >= read_handle->ring_start && sector <= end)
+    {
+      read_handle->ring_count -= sector - read_handle->ring_start;
+      read_handle->ring_start = sector;
+    }
+  else
+    {
+      read_handle->ring_start = sector;
+      read_handle->ring_count = 0;
+      read_handle->error = 0;
+      read_handle->generation++;
+    }
+
+  g_cond_broadcast (&read_handle->cond);
+}
+
 static void
 do_read (GVfsBackend *backend,
          GVfsJobRead *job,
@@ -737,100 +859,84 @@ do_read (GVfsBackend *backend,
 {
   GVfsBackendCdda *cdda_backend = G_VFS_BACKEND_CDDA (backend);
   ReadHandle *read_handle = (ReadHandle *) handle;
-  int bytes_read;
+  gsize bytes_read;
   long skip_bytes;
-  char *readbuf;
   long desired_sector;
-  int bytes_to_copy;
+  long bytes_to_copy;
   long cursor_in_stream;
+  char *readbuf;
 
   //g_warning ("read (%"G_GSSIZE_FORMAT") (@ %ld)", bytes_requested, read_handle->cursor);
 
+  bytes_read = 0;
+
   /* header */
   if (read_handle->cursor < read_handle->header_size)
     {
       skip_bytes = read_handle->cursor;
-      bytes_read = read_handle->header_size - read_handle->cursor;
-      readbuf = read_handle->header + skip_bytes;
-      goto read_data_done;
+      bytes_to_copy = MIN ((long) bytes_requested, read_handle->header_size - skip_bytes);
+      memcpy (buffer, read_handle->header + skip_bytes, bytes_to_copy);
+      read_handle->cursor += bytes_to_copy;
+      bytes_read += bytes_to_copy;
     }
 
-  /* EOF */
-  if (read_handle->cursor >= read_handle->size)
+  if (bytes_read == bytes_requested || read_handle->cursor >= read_handle->size)
+    goto read_data_done;
+
+  if (read_handle->reader == NULL)
     {
-      skip_bytes = 0;
-      bytes_read = 0;
-      readbuf = NULL;
-      goto read_data_done;
+      read_handle->ring = g_malloc (READ_AHEAD_SECTORS * CDIO_CD_FRAMESIZE_RAW);
+      read_handle->reader = g_thread_new ("cdda read-ahead", read_ahead_thread, read_handle);
     }
 
-  cursor_in_stream = read_handle->cursor - read_handle->header_size;
-
-  desired_sector = cursor_in_stream / CDIO_CD_FRAMESIZE_RAW + read_handle->first_sector;
-
-  if (desired_sector == read_handle->buf_at_sector_num)
+  /* Copy as many consecutive sectors as the request wants; only wait
+   * for the first one, the rest is whatever the read-ahead already has */
+  g_mutex_lock (&read_handle->lock);
+  while (bytes_read < bytes_requested && read_handle->cursor < read_handle->size)
     {
-      /* got it cached */
+      cursor_in_stream = read_handle->cursor - read_handle->header_size;
+      desired_sector = cursor_in_stream / CDIO_CD_FRAMESIZE_RAW + read_handle->first_sector;
 
-      /* skip some bytes */
-      skip_bytes = cursor_in_stream - (desired_sector - read_handle->first_sector) * CDIO_CD_FRAMESIZE_RAW;
-      readbuf = read_handle->buf_at_sector + skip_bytes;
-      bytes_read = CDIO_CD_FRAMESIZE_RAW - skip_bytes;
+      read_handle_move_to (read_handle, desired_sector);
 
-      //g_warning ("read from cache for cursor @ %ld", read_handle->buf_at_sector_num);
-    }
-  else
-    {
-      /* first check that we're at the right sector */
-      if (desired_sector != read_handle->sector_cursor)
+      if (read_handle->ring_count == 0)
         {
-          cdio_paranoia_seek (read_handle->paranoia, desired_sector, SEEK_SET);
-          read_handle->sector_cursor = desired_sector;
-          //g_warning ("seeking cursor to %ld", read_handle->sector_cursor);
-        }
-      
-      /* skip some bytes */
-      skip_bytes = cursor_in_stream - (read_handle->sector_cursor - read_handle->first_sector) * CDIO_CD_FRAMESIZE_RAW;
-      //g_warning ("advanced cursor to %ld", read_handle->sector_cursor);
-      
-      readbuf = (char *) cdio_paranoia_read (read_handle->paranoia, paranoia_callback);
+          if (bytes_read > 0)
+            break;
 
-      if (readbuf == NULL)
-        {
-          int errsv = errno;
+          while (read_handle->ring_count == 0 && read_handle->error == 0)
+            g_cond_wait (&read_handle->cond, &read_handle->lock);
 
-          g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
-                            g_io_error_from_errno (errsv),
-                            /* Translators: paranoia is the name of the cd audio reading library */
-                            _("Error from 'paranoia' on drive %s"), cdda_backend->device_path);
-          return;
+          if (read_handle->ring_count == 0)
+            {
+              int errsv = read_handle->error;
+
+              /* let the next read try again */
+              read_handle->error = 0;
+              g_cond_broadcast (&read_handle->cond);
+              g_mutex_unlock (&read_handle->lock);
+              g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                                g_io_error_from_errno (errsv),
+                                /* Translators: paranoia is the name of the cd audio reading library */
+                                _("Error from 'paranoia' on drive %s"), cdda_backend->device_path);
+              return;
+            }
         }
 
-      read_handle->buf_at_sector_num = read_handle->sector_cursor;
-      memcpy (read_handle->buf_at_sector, readbuf, CDIO_CD_FRAMESIZE_RAW);
-
-      read_handle->sector_cursor++;
-
-      readbuf += skip_bytes;
-      bytes_read = CDIO_CD_FRAMESIZE_RAW - skip_bytes;
+      skip_bytes = cursor_in_stream - (desired_sector - read_handle->first_sector) * CDIO_CD_FRAMESIZE_RAW;
+      readbuf = read_handle->ring + (desired_sector % READ_AHEAD_SECTORS) * CDIO_CD_FRAMESIZE_RAW;
 
+      bytes_to_copy = MIN ((long) (bytes_requested - bytes_read), CDIO_CD_FRAMESIZE_RAW - skip_bytes);
+      memcpy (buffer + bytes_read, readbuf + skip_bytes, bytes_to_copy);
 
+      read_handle->cursor += bytes_to_copy;
+      bytes_read += bytes_to_copy;
     }
-  
- read_data_done:
+  g_mutex_unlock (&read_handle->lock);
 
-  bytes_to_copy = bytes_read;
-  if (bytes_requested < bytes_read)
-    bytes_to_copy = bytes_requested;
-
-  read_handle->cursor += bytes_to_copy;
-  cursor_in_stream = read_handle->cursor - read_handle->header_size;
-
-
-  if (bytes_to_copy > 0 && readbuf != NULL)
-    memcpy (buffer, readbuf, bytes_to_copy);
+ read_data_done:
 
-  g_vfs_job_read_set_size (job, bytes_to_copy);
+  g_vfs_job_read_set_size (job, bytes_read);
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
@@ -56,7 +56,10 @@
 #include "gvfsjobqueryfsinfo.h"
 #include "gvfsjobqueryattributes.h"
 #include "gvfsjobenumerate.h"
+#include "gvfsjobpull.h"
+#include "gvfsjobpush.h"
 #include "gvfsdaemonprotocol.h"
+#include "gvfsstats.h"
 
 #include "soup-input-stream.h"
 #include "soup-output-stream.h"
@@ -69,6 +72,7 @@
 typedef struct _MountAuthData MountAuthData;
 
 static void mount_auth_info_free (MountAuthData *info);
+static void info_cache_entry_free (gpointer data);
 
 
 #ifdef HAVE_AVAHI
@@ -102,6 +106,11 @@ struct _GVfsBackendDav
 
   MountAuthData auth_info;
 
+  /* infos of recently enumerated files, filename -> InfoCacheEntry */
+  GMutex      info_cache_lock;
+  GHashTable *info_cache;
+  guint       info_cache_generation; /* bumped on every invalidation */
+
 #ifdef HAVE_AVAHI
   /* only set if we're handling a [dav|davs]+sd:// mounts */
   GVfsDnsSdResolver *resolver;
@@ -126,6 +135,9 @@ g_vfs_backend_dav_finalize (GObject *object)
 #endif
 
   mount_auth_info_free (&(dav_backend->auth_info));
+
+  g_hash_table_destroy (dav_backend->info_cache);
+  g_mutex_clear (&dav_backend->info_cache_lock);
   
   if (G_OBJECT_CLASS (g_vfs_backend_dav_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_dav_parent_class)->finalize) (object);
@@ -135,6 +147,10 @@ static void
 g_vfs_backend_dav_init (GVfsBackendDav *backend)
 {
   g_vfs_backend_set_user_visible (G_VFS_BACKEND (backend), TRUE);
+
+  g_mutex_init (&backend->info_cache_lock);
+  backend->info_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, info_cache_entry_free);
 }
 
 /* ************************************************************************* */
@@ -508,7 +524,8 @@ g_vfs_backend_dav_send_message (GVfsBackend *backend, SoupMessage *message)
   session = http_backend->session;
 
   /* We have our own custom redirect handler */
-  soup_message_set_flags (message, SOUP_MESSAGE_NO_REDIRECT);
+  soup_message_set_flags (message,
+                          soup_message_get_flags (message) | SOUP_MESSAGE_NO_REDIRECT);
 
   soup_message_add_header_handler (message, "got_body", "Location",
                                    G_CALLBACK (redirect_handler), session);
@@ -1179,6 +1196,214 @@ ms_response_to_file_type (MsResponse *response)
   return file_type;
 }
 
+/* ************************************************************************* */
+/* Streaming multistatus parsing
+ *
+ * Large collections produce multistatus bodies of many megabytes; instead
+ * of accumulating the whole body and building the complete DOM we feed the
+ * chunks into a libxml2 push parser as they arrive and hand every finished
+ * <response> element to a callback, unlinking it from the tree afterwards.
+ * So at any time only the response currently being received is in memory.
+ */
+
+typedef void (*MsStreamFunc) (MsResponse *response, gpointer user_data);
+
+typedef struct _MsStream {
+
+  Multistatus       multistatus;
+  xmlParserCtxtPtr  ctxt;
+  gboolean          invalid;
+
+  MsStreamFunc      func;
+  gpointer          user_data;
+
+} MsStream;
+
+static gboolean
+ms_stream_node_is_open (MsStream *stream, xmlNodePtr node)
+{
+  xmlNodePtr iter;
+
+  for (iter = stream->ctxt->node; iter; iter = iter->parent)
+    if (iter == node)
+      return TRUE;
+
+  return FALSE;
+}
+
+static void
+ms_stream_process (MsStream *stream)
+{
+  Multistatus *multistatus;
+  xmlNodeIter  iter;
+  xmlNodePtr   node;
+  xmlNodePtr   next;
+
+  multistatus = &stream->multistatus;
+
+  if (stream->invalid || stream->ctxt->myDoc == NULL)
+    return;
+
+  if (multistatus->root == NULL)
+    {
+      multistatus->root = xmlDocGetRootElement (stream->ctxt->myDoc);
+
+      if (multistatus->root == NULL)
+        return;
+
+      if (! node_has_name (multistatus->root, "multistatus"))
+        {
+          stream->invalid = TRUE;
+          return;
+        }
+    }
+
+  for (node = multistatus->root->children; node; node = next)
+    {
+      next = node->next;
+
+      if (ms_stream_node_is_open (stream, node))
+        break;
+
+      if (node_is_element (node) && node_has_name_ns (node, "response", "DAV:"))
+        {
+          MsResponse response;
+
+          iter.cur_node = node;
+          iter.next_node = next;
+          iter.name = "response";
+          iter.ns_href = "DAV:";
+          iter.user_data = multistatus;
+
+          if (multistatus_get_response (&iter, &response))
+            {
+              stream->func (&response, stream->user_data);
+              ms_response_clear (&response);
+            }
+        }
+
+      xmlUnlinkNode (node);
+      xmlFreeNode (node);
+    }
+}
+
+static void
+ms_stream_clear (MsStream *stream)
+{
+  if (stream->ctxt)
+    {
+      if (stream->ctxt->myDoc)
+        xmlFreeDoc (stream->ctxt->myDoc);
+
+      xmlFreeParserCtxt (stream->ctxt);
+      stream->ctxt = NULL;
+    }
+
+  g_free (stream->multistatus.path);
+  memset (&stream->multistatus, 0, sizeof (Multistatus));
+  stream->invalid = FALSE;
+}
+
+static void
+ms_stream_got_chunk (SoupMessage *msg, SoupBuffer *chunk, gpointer user_data)
+{
+  MsStream *stream = user_data;
+
+  /* bodies of 401s, redirects etc. are not ours to parse */
+  if (msg->status_code != SOUP_STATUS_MULTI_STATUS || stream->invalid)
+    return;
+
+  if (stream->ctxt == NULL)
+    {
+      SoupURI *uri;
+
+      stream->ctxt = xmlCreatePushParserCtxt (NULL, NULL, NULL, 0,
+                                              "response.xml");
+      xmlCtxtUseOptions (stream->ctxt,
+                         XML_PARSE_NONET |
+                         XML_PARSE_NOWARNING |
+                         XML_PARSE_NOBLANKS |
+                         XML_PARSE_NSCLEAN |
+                         XML_PARSE_NOCDATA |
+                         XML_PARSE_COMPACT);
+
+      uri = soup_message_get_uri (msg);
+      stream->multistatus.target = uri;
+      stream->multistatus.path = g_uri_unescape_string (uri->path, "/");
+    }
+
+  if (xmlParseChunk (stream->ctxt, chunk->data, chunk->length, 0) != 0)
+    stream->invalid = TRUE;
+  else
+    ms_stream_process (stream);
+}
+
+static void
+ms_stream_restarted (SoupMessage *msg, gpointer user_data)
+{
+  ms_stream_clear (user_data);
+}
+
+static void
+ms_stream_init (MsStream     *stream,
+                SoupMessage  *msg,
+                MsStreamFunc  func,
+                gpointer      user_data)
+{
+  memset (stream, 0, sizeof (MsStream));
+  stream->func = func;
+  stream->user_data = user_data;
+
+  soup_message_body_set_accumulate (msg->response_body, FALSE);
+
+  g_signal_connect (msg, "got-chunk",
+                    G_CALLBACK (ms_stream_got_chunk), stream);
+  g_signal_connect (msg, "restarted",
+                    G_CALLBACK (ms_stream_restarted), stream);
+}
+
+/* Must be called once the message has been sent; delivers the responses
+ * still held back and tells whether the whole body was a valid multistatus.
+ */
+static gboolean
+ms_stream_finish (MsStream *stream, SoupMessage *msg, GError **error)
+{
+  g_signal_handlers_disconnect_by_func (msg, ms_stream_got_chunk, stream);
+  g_signal_handlers_disconnect_by_func (msg, ms_stream_restarted, stream);
+
+  if (! SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    {
+      g_set_error (error, G_IO_ERROR, http_to_gio_error (msg->status_code),
+                   _("HTTP Error: %s"), msg->reason_phrase);
+      return FALSE;
+    }
+
+  if (stream->ctxt == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           msg->status_code == SOUP_STATUS_MULTI_STATUS ?
+                           _("Empty response") :
+                           _("Unexpected reply from server"));
+      return FALSE;
+    }
+
+  if (! stream->invalid &&
+      (xmlParseChunk (stream->ctxt, NULL, 0, 1) != 0 ||
+       ! stream->ctxt->wellFormed))
+    stream->invalid = TRUE;
+
+  ms_stream_process (stream);
+
+  if (stream->invalid || stream->multistatus.root == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Could not parse response"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 #define PROPSTAT_XML_BEGIN                        \
   "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n" \
   " <D:propfind xmlns:D=\"DAV:\">\n"
@@ -1344,6 +1569,28 @@ stat_location_finish (SoupMessage *msg,
   return res;
 }
 
+typedef struct _StatLocationData {
+
+  gboolean  found;
+  GFileType file_type;
+  guint     child_count;
+
+} StatLocationData;
+
+static void
+stat_location_got_response (MsResponse *response, gpointer user_data)
+{
+  StatLocationData *data = user_data;
+
+  if (response->is_target)
+    {
+      data->file_type = ms_response_to_file_type (response);
+      data->found = TRUE;
+    }
+  else
+    data->child_count++;
+}
+
 static gboolean
 stat_location (GVfsBackend  *backend,
                SoupURI      *uri,
@@ -1351,10 +1598,12 @@ stat_location (GVfsBackend  *backend,
                guint        *num_children,
                GError      **error)
 {
-  SoupMessage *msg;
-  guint        status;
-  gboolean     count_children;
-  gboolean     res;
+  SoupMessage      *msg;
+  MsStream          stream;
+  StatLocationData  data;
+  guint             status;
+  gboolean          count_children;
+  gboolean          res;
 
   count_children = num_children != NULL;
   msg = stat_location_begin (uri, count_children);
@@ -1362,6 +1611,9 @@ stat_location (GVfsBackend  *backend,
   if (msg == NULL)
     return FALSE;
 
+  memset (&data, 0, sizeof (data));
+  ms_stream_init (&stream, msg, stat_location_got_response, &data);
+
   status = g_vfs_backend_dav_send_message (backend, msg);
 
   if (status != 207)
@@ -1371,19 +1623,171 @@ stat_location (GVfsBackend  *backend,
         	           http_error_code_from_status (status),
                 	   msg->reason_phrase);
 
+      ms_stream_finish (&stream, msg, NULL);
+      ms_stream_clear (&stream);
+      g_object_unref (msg);
       return FALSE;
     }
 
-  res = stat_location_finish (msg, target_type, num_children);
+  res = ms_stream_finish (&stream, msg, NULL) && data.found;
+  ms_stream_clear (&stream);
+  g_object_unref (msg);
 
   if (res == FALSE)
-    g_set_error_literal (error, 
-	                 G_IO_ERROR, G_IO_ERROR_FAILED,
-        	         _("Response invalid"));
+    {
+      g_set_error_literal (error, 
+	                   G_IO_ERROR, G_IO_ERROR_FAILED,
+        	           _("Response invalid"));
+      return FALSE;
+    }
+
+  if (target_type)
+    *target_type = data.file_type;
+
+  if (num_children)
+    *num_children = data.child_count;
+
+  return TRUE;
+}
+
+
+/* ************************************************************************* */
+/* Info cache
+ *
+ * A depth-1 PROPFIND returns the very same properties for every child as a
+ * depth-0 PROPFIND on the child would, and file managers stat each file
+ * right after listing its directory. So we remember the infos of the last
+ * enumerations for a few seconds and answer query_info from there. Any
+ * modification done through this mount drops the whole cache once it is
+ * done. Enumerations that were running meanwhile may carry the old state,
+ * so their results are only cached if no modification finished since they
+ * started.
+ */
+
+#define INFO_CACHE_TTL (5 * G_USEC_PER_SEC)
+
+typedef struct _InfoCacheEntry {
+
+  GFileInfo           *info;
+  GFileQueryInfoFlags  flags;
+  gint64               stamp;
+
+} InfoCacheEntry;
+
+static void
+info_cache_entry_free (gpointer data)
+{
+  InfoCacheEntry *entry = data;
+
+  g_object_unref (entry->info);
+  g_slice_free (InfoCacheEntry, entry);
+}
+
+static gboolean
+info_cache_entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+  InfoCacheEntry *entry = value;
+  gint64          now = *(gint64 *) user_data;
+
+  return now - entry->stamp > INFO_CACHE_TTL;
+}
+
+static void
+info_cache_expire (GVfsBackendDav *dav_backend)
+{
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+  g_hash_table_foreach_remove (dav_backend->info_cache,
+                               info_cache_entry_expired, &now);
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+}
+
+static guint
+info_cache_get_generation (GVfsBackendDav *dav_backend)
+{
+  guint generation;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+  generation = dav_backend->info_cache_generation;
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+
+  return generation;
+}
+
+/* generation is the one from when the request was sent */
+static void
+info_cache_insert (GVfsBackendDav      *dav_backend,
+                   const char          *filename,
+                   GFileInfo           *info,
+                   GFileQueryInfoFlags  flags,
+                   guint                generation)
+{
+  InfoCacheEntry *entry;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+
+  if (generation == dav_backend->info_cache_generation)
+    {
+      entry = g_slice_new (InfoCacheEntry);
+      entry->info = g_file_info_dup (info);
+      entry->flags = flags;
+      entry->stamp = g_get_monotonic_time ();
+
+      g_hash_table_replace (dav_backend->info_cache, g_strdup (filename), entry);
+    }
+
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+}
+
+static gboolean
+info_cache_lookup (GVfsBackendDav      *dav_backend,
+                   const char          *filename,
+                   GFileQueryInfoFlags  flags,
+                   GFileInfo           *info)
+{
+  InfoCacheEntry *entry;
+  gboolean        res;
+
+  res = FALSE;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+
+  entry = g_hash_table_lookup (dav_backend->info_cache, filename);
+
+  if (entry != NULL &&
+      g_get_monotonic_time () - entry->stamp > INFO_CACHE_TTL)
+    {
+      g_hash_table_remove (dav_backend->info_cache, filename);
+      entry = NULL;
+    }
+
+  if (entry != NULL && entry->flags == flags)
+    {
+      g_file_info_copy_into (entry->info, info);
+      res = TRUE;
+    }
+
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+
+  g_vfs_stats_cache_lookup ("dav-info", res);
 
   return res;
 }
 
+/* Call after a modification is done, whether it succeeded or not */
+static void
+info_cache_invalidate (GVfsBackend *backend)
+{
+  GVfsBackendDav *dav_backend = G_VFS_BACKEND_DAV (backend);
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+  g_hash_table_remove_all (dav_backend->info_cache);
+  dav_backend->info_cache_generation++;
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+}
 
 /* ************************************************************************* */
 /* Authentication */
@@ -1953,6 +2357,13 @@ do_query_info (GVfsBackend           *backend,
 
   g_debug ("Query info %s\n", filename);
 
+  if (info_cache_lookup (G_VFS_BACKEND_DAV (backend), filename, flags,
+                         job->file_info))
+    {
+      g_vfs_job_succeeded (G_VFS_JOB (job));
+      return;
+    }
+
   msg = propfind_request_new (backend, filename, 0, ls_propnames);
 
   if (msg == NULL)
@@ -2097,6 +2508,46 @@ do_query_fs_info (GVfsBackend           *backend,
 }
 
 /* *** enumerate *** */
+typedef struct _EnumerateData {
+
+  GVfsBackend         *backend;
+  GVfsJobEnumerate    *job;
+  const char          *filename;
+  GFileQueryInfoFlags  flags;
+  guint                cache_generation;
+
+} EnumerateData;
+
+static void
+enumerate_got_response (MsResponse *response, gpointer user_data)
+{
+  EnumerateData *data = user_data;
+  GFileInfo     *info;
+  char          *basename;
+  char          *path;
+
+  info = g_file_info_new ();
+  ms_response_to_file_info (response, info);
+
+  if (response->is_target)
+    path = g_strdup (data->filename);
+  else
+    {
+      basename = ms_response_get_basename (response);
+      path = g_build_filename (data->filename, basename, NULL);
+      g_free (basename);
+    }
+
+  info_cache_insert (G_VFS_BACKEND_DAV (data->backend),
+                     path, info, data->flags, data->cache_generation);
+  g_free (path);
+
+  if (response->is_target == FALSE)
+    g_vfs_job_enumerate_add_info (data->job, info);
+
+  g_object_unref (info);
+}
+
 static void
 do_enumerate (GVfsBackend           *backend,
               GVfsJobEnumerate      *job,
@@ -2104,11 +2555,11 @@ do_enumerate (GVfsBackend           *backend,
               GFileAttributeMatcher *matcher,
               GFileQueryInfoFlags    flags)
 {
-  SoupMessage *msg;
-  Multistatus  ms;
-  xmlNodeIter  iter;
-  gboolean     res;
-  GError      *error;
+  SoupMessage   *msg;
+  MsStream       stream;
+  EnumerateData  data;
+  gboolean       res;
+  GError        *error;
  
   error = NULL;
 
@@ -2127,41 +2578,30 @@ do_enumerate (GVfsBackend           *backend,
 
   message_add_redirect_header (msg, flags);
 
+  info_cache_expire (G_VFS_BACKEND_DAV (backend));
+
+  data.backend = backend;
+  data.job = job;
+  data.filename = filename;
+  data.flags = flags;
+  data.cache_generation = info_cache_get_generation (G_VFS_BACKEND_DAV (backend));
+
+  /* infos are sent to the client while the response is still coming in */
+  ms_stream_init (&stream, msg, enumerate_got_response, &data);
+
   g_vfs_backend_dav_send_message (backend, msg);
 
-  res = multistatus_parse (msg, &ms, &error);
+  res = ms_stream_finish (&stream, msg, &error);
+  ms_stream_clear (&stream);
+  g_object_unref (msg);
 
   if (res == FALSE)
     {
       g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
       g_error_free (error);
-      g_object_unref (msg);
       return;
     }
 
-  multistatus_get_response_iter (&ms, &iter);
-
-  while (xml_node_iter_next (&iter))
-    {
-      MsResponse  response;
-      GFileInfo  *info;
-
-      if (! multistatus_get_response (&iter, &response))
-        continue;
-
-      if (response.is_target == FALSE)
-	{
-	  info = g_file_info_new ();
-	  ms_response_to_file_info (&response, info);
-	  g_vfs_job_enumerate_add_info (job, info);
-	}
-
-      ms_response_clear (&response);
-    }
-
-  multistatus_free (&ms);
-  g_object_unref (msg);
-
   g_vfs_job_succeeded (G_VFS_JOB (job)); /* should that be called earlier? */
   g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
 }
@@ -2275,7 +2715,7 @@ try_create_tested_existence (SoupSession *session, SoupMessage *msg,
    * Doesn't work with apache > 2.2.9
    * soup_message_headers_append (put_msg->request_headers, "If-None-Match", "*");
    */
-  stream = soup_output_stream_new (op_backend->session, put_msg, -1);
+  stream = soup_output_stream_new (op_backend->session_async, put_msg, -1);
   g_object_unref (put_msg);
 
   g_vfs_job_open_for_write_set_handle (G_VFS_JOB_OPEN_FOR_WRITE (job), stream);
@@ -2291,8 +2731,9 @@ try_create (GVfsBackend *backend,
   SoupMessage *msg;
   SoupURI     *uri;
 
-  /* TODO: if SoupOutputStream supported chunked requests, we could
-   * use a PUT with "If-None-Match: *" and "Expect: 100-continue"
+  /* TODO: now that SoupOutputStream sends chunked requests with
+   * "Expect: 100-continue" we could drop the HEAD and use a PUT with
+   * "If-None-Match: *"
    */
   uri = g_vfs_backend_dav_uri_for_path (backend, filename, FALSE);
   msg = soup_message_new_from_uri (SOUP_METHOD_HEAD, uri);
@@ -2317,7 +2758,7 @@ open_for_replace_succeeded (GVfsBackendHttp *op_backend, GVfsJob *job,
   if (etag)
     soup_message_headers_append (put_msg->request_headers, "If-Match", etag);
 
-  stream = soup_output_stream_new (op_backend->session, put_msg, -1);
+  stream = soup_output_stream_new (op_backend->session_async, put_msg, -1);
   g_object_unref (put_msg);
 
   g_vfs_job_open_for_write_set_handle (G_VFS_JOB_OPEN_FOR_WRITE (job), stream);
@@ -2356,8 +2797,9 @@ try_replace (GVfsBackend *backend,
   GVfsBackendHttp *op_backend;
   SoupURI         *uri;
 
-  /* TODO: if SoupOutputStream supported chunked requests, we could
-   * use a PUT with "If-Match: ..." and "Expect: 100-continue"
+  /* TODO: now that SoupOutputStream sends chunked requests with
+   * "Expect: 100-continue" we could drop the HEAD and put the
+   * "If-Match: ..." on the PUT itself
    */
 
   op_backend = G_VFS_BACKEND_HTTP (backend);
@@ -2464,6 +2906,9 @@ close_write_ready (GObject      *source_object,
   res = g_output_stream_close_finish (stream,
                                       result,
                                       &error);
+
+  /* The upload is complete (or failed) only now */
+  info_cache_invalidate (G_VFS_JOB_CLOSE_WRITE (job)->backend);
   if (res == FALSE)
     {
       g_vfs_job_failed_literal (G_VFS_JOB (job),
@@ -2511,6 +2956,7 @@ do_make_directory (GVfsBackend          *backend,
   soup_uri_free (uri);
 
   status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_invalidate (backend);
 
   if (! SOUP_STATUS_IS_SUCCESSFUL (status))
     if (status == SOUP_STATUS_METHOD_NOT_ALLOWED)
@@ -2563,6 +3009,7 @@ do_delete (GVfsBackend   *backend,
   msg = soup_message_new_from_uri (SOUP_METHOD_DELETE, uri);
 
   status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_invalidate (backend);
 
   if (!SOUP_STATUS_IS_SUCCESSFUL (status))
     g_vfs_job_failed_literal (G_VFS_JOB (job),
@@ -2600,6 +3047,7 @@ do_set_display_name (GVfsBackend           *backend,
   message_add_overwrite_header (msg, FALSE);
 
   status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_invalidate (backend);
 
   /*
    * The precondition of SOUP_STATUS_PRECONDITION_FAILED (412) in
@@ -2640,6 +3088,314 @@ do_set_display_name (GVfsBackend           *backend,
   soup_uri_free (source);
 }
 
+/* *** pull () *** */
+static void
+do_pull (GVfsBackend           *backend,
+         GVfsJobPull           *job,
+         const char            *source,
+         const char            *local_path,
+         GFileCopyFlags         flags,
+         gboolean               remove_source,
+         GFileProgressCallback  progress_callback,
+         gpointer               progress_callback_data)
+{
+  SoupMessage *msg;
+  SoupURI     *uri;
+  GFileType    file_type;
+  gboolean     res;
+  guint        status;
+  GError      *error;
+
+  error = NULL;
+
+  uri = g_vfs_backend_dav_uri_for_path (backend, source, FALSE);
+  res = stat_location (backend, uri, &file_type, NULL, &error);
+
+  if (res && file_type == G_FILE_TYPE_DIRECTORY)
+    {
+      g_vfs_job_failed (G_VFS_JOB (job),
+                        G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+      soup_uri_free (uri);
+      return;
+    }
+
+  if (res)
+    res = http_backend_pull (backend, uri, local_path, flags,
+                             G_VFS_JOB (job)->cancellable,
+                             progress_callback, progress_callback_data,
+                             &error);
+
+  if (res && remove_source)
+    {
+      msg = soup_message_new_from_uri (SOUP_METHOD_DELETE, uri);
+      status = g_vfs_backend_dav_send_message (backend, msg);
+      info_cache_invalidate (backend);
+
+      if (! SOUP_STATUS_IS_SUCCESSFUL (status))
+        {
+          error = g_error_new_literal (G_IO_ERROR,
+                                       http_error_code_from_status (status),
+                                       msg->reason_phrase);
+          res = FALSE;
+        }
+
+      g_object_unref (msg);
+    }
+
+  if (res)
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+  else
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+    }
+
+  soup_uri_free (uri);
+}
+
+/* *** push () *** */
+
+/* The body is read from the file in chunks of this size while it is
+ * being sent, rather than mapped, so a file that shrinks meanwhile
+ * fails the upload instead of crashing us.
+ */
+#define PUSH_CHUNK_SIZE (64 * 1024)
+
+typedef struct _PushData {
+
+  SoupSession           *session;
+  int                    fd;
+  goffset                size;
+  goffset                read;     /* handed to the message body */
+  goffset                written;  /* sent to the server */
+  GError                *error;
+
+  GFileProgressCallback  callback;
+  gpointer               callback_data;
+
+} PushData;
+
+static void
+push_write_next_chunk (SoupMessage *msg, gpointer user_data)
+{
+  PushData *push = user_data;
+  char     *buffer;
+  ssize_t   res;
+
+  if (push->read == push->size)
+    {
+      soup_message_body_complete (msg->request_body);
+      return;
+    }
+
+  buffer = g_malloc (PUSH_CHUNK_SIZE);
+
+  do
+    res = read (push->fd, buffer, MIN (PUSH_CHUNK_SIZE, push->size - push->read));
+  while (res == -1 && errno == EINTR);
+
+  if (res <= 0)
+    {
+      int errsv = errno;
+
+      g_free (buffer);
+
+      if (res == 0)
+        push->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                           _("File was truncated while it was being uploaded"));
+      else
+        push->error = g_error_new_literal (G_IO_ERROR,
+                                           g_io_error_from_errno (errsv),
+                                           g_strerror (errsv));
+
+      soup_session_cancel_message (push->session, msg, SOUP_STATUS_IO_ERROR);
+      return;
+    }
+
+  push->read += res;
+  soup_message_body_append (msg->request_body, SOUP_MEMORY_TAKE, buffer, res);
+}
+
+static void
+push_wrote_body_data (SoupMessage *msg, SoupBuffer *chunk, gpointer user_data)
+{
+  PushData *push = user_data;
+
+  push->written += chunk->length;
+
+  if (push->callback)
+    push->callback (push->written, push->size, push->callback_data);
+}
+
+static void
+push_restarted (SoupMessage *msg, gpointer user_data)
+{
+  PushData *push = user_data;
+
+  /* e.g. authentication, the body is sent again from the start */
+  soup_message_body_truncate (msg->request_body);
+  push->read = 0;
+  push->written = 0;
+
+  if (lseek (push->fd, 0, SEEK_SET) == -1)
+    {
+      int errsv = errno;
+
+      push->error = g_error_new_literal (G_IO_ERROR,
+                                         g_io_error_from_errno (errsv),
+                                         g_strerror (errsv));
+      soup_session_cancel_message (push->session, msg, SOUP_STATUS_IO_ERROR);
+    }
+}
+
+static void
+do_push (GVfsBackend           *backend,
+         GVfsJobPush           *job,
+         const char            *destination,
+         const char            *local_path,
+         GFileCopyFlags         flags,
+         gboolean               remove_source,
+         GFileProgressCallback  progress_callback,
+         gpointer               progress_callback_data)
+{
+  SoupMessage  *msg;
+  SoupURI      *uri;
+  PushData      push;
+  GFileType     file_type;
+  struct stat   st;
+  guint         status;
+  GError       *error;
+  int           fd;
+
+  error = NULL;
+
+  if (flags & G_FILE_COPY_BACKUP)
+    {
+      g_vfs_job_failed (G_VFS_JOB (job),
+                        G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        _("backups not supported"));
+      return;
+    }
+
+  fd = g_open (local_path, O_RDONLY, 0);
+
+  if (fd == -1 || fstat (fd, &st) == -1)
+    {
+      int errsv = errno;
+
+      g_vfs_job_failed_literal (G_VFS_JOB (job), G_IO_ERROR,
+                                g_io_error_from_errno (errsv),
+                                g_strerror (errsv));
+      if (fd != -1)
+        close (fd);
+      return;
+    }
+
+  if (S_ISDIR (st.st_mode))
+    {
+      g_vfs_job_failed (G_VFS_JOB (job),
+                        G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+      close (fd);
+      return;
+    }
+
+  uri = g_vfs_backend_dav_uri_for_path (backend, destination, FALSE);
+
+  if (stat_location (backend, uri, &file_type, NULL, &error))
+    {
+      if (! (flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_vfs_job_failed (G_VFS_JOB (job),
+                            G_IO_ERROR, G_IO_ERROR_EXISTS,
+                            _("Target file already exists"));
+          soup_uri_free (uri);
+          close (fd);
+          return;
+        }
+
+      if (file_type == G_FILE_TYPE_DIRECTORY)
+        {
+          g_vfs_job_failed (G_VFS_JOB (job),
+                            G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                            _("Can't copy file over directory"));
+          soup_uri_free (uri);
+          close (fd);
+          return;
+        }
+    }
+  else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    g_clear_error (&error);
+  else
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+      soup_uri_free (uri);
+      close (fd);
+      return;
+    }
+
+  memset (&push, 0, sizeof (push));
+  push.session = G_VFS_BACKEND_HTTP (backend)->session;
+  push.fd = fd;
+  push.size = st.st_size;
+  push.callback = progress_callback;
+  push.callback_data = progress_callback_data;
+
+  msg = soup_message_new_from_uri (SOUP_METHOD_PUT, uri);
+  soup_message_headers_set_expectations (msg->request_headers,
+                                         SOUP_EXPECTATION_CONTINUE);
+  soup_message_headers_set_content_length (msg->request_headers, push.size);
+
+  /* Each chunk is dropped once written and read again from the file
+   * if the message is restarted.
+   */
+  soup_message_body_set_accumulate (msg->request_body, FALSE);
+  soup_message_set_flags (msg, soup_message_get_flags (msg) | SOUP_MESSAGE_CAN_REBUILD);
+
+  g_signal_connect (msg, "wrote-headers",
+                    G_CALLBACK (push_write_next_chunk), &push);
+  g_signal_connect (msg, "wrote-chunk",
+                    G_CALLBACK (push_write_next_chunk), &push);
+  g_signal_connect (msg, "wrote-body-data",
+                    G_CALLBACK (push_wrote_body_data), &push);
+  g_signal_connect (msg, "restarted",
+                    G_CALLBACK (push_restarted), &push);
+
+  status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_invalidate (backend);
+
+  g_signal_handlers_disconnect_by_func (msg, push_write_next_chunk, &push);
+  g_signal_handlers_disconnect_by_func (msg, push_wrote_body_data, &push);
+  g_signal_handlers_disconnect_by_func (msg, push_restarted, &push);
+
+  close (fd);
+
+  if (push.error)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), push.error);
+      g_error_free (push.error);
+    }
+  else if (! SOUP_STATUS_IS_SUCCESSFUL (status))
+    g_vfs_job_failed_literal (G_VFS_JOB (job), G_IO_ERROR,
+                              http_error_code_from_status (status),
+                              msg->reason_phrase);
+  else if (remove_source && g_unlink (local_path) == -1)
+    {
+      int errsv = errno;
+
+      g_vfs_job_failed_literal (G_VFS_JOB (job), G_IO_ERROR,
+                                g_io_error_from_errno (errsv),
+                                g_strerror (errsv));
+    }
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+
+  g_object_unref (msg);
+  soup_uri_free (uri);
+}
+
 /* ************************************************************************* */
 /*  */
 static void
@@ -2667,4 +3423,6 @@ g_vfs_backend_dav_class_init (GVfsBackendDavClass *klass)
   backend_class->make_directory    = do_make_directory;
   backend_class->delete            = do_delete;
   backend_class->set_display_name  = do_set_display_name;
+  backend_class->pull              = do_pull;
+  backend_class->push              = do_push;
 }
@@ -60,7 +60,9 @@
 #include "gvfsjobunmount.h"
 #include "gvfsmonitor.h"
 #include "gvfsjobseekwrite.h"
+#include "gvfsjobpull.h"
 #include "gvfsicon.h"
+#include "gvfsdaemonutils.h"
 
 /* showing debug traces */
 #if 1
@@ -280,15 +282,33 @@ typedef struct {
   gboolean is_dirty;
 } WriteHandle;
 
-/* how much more memory to ask for when using g_realloc() when writing a file */
+/* how much memory to start out with when writing a file; the buffer
+ * is doubled whenever it runs out so large files don't cause a
+ * g_realloc() (and a copy of everything written so far) every 4k
+ */
 #define WRITE_INCREMENT 4096
 
+/* how much to fetch from the camera at a time when streaming a file */
+#define READ_CHUNK_SIZE (1024 * 1024)
+
 typedef struct {
   CameraFile *file;
 
   const char *data;
   unsigned long int size;
   unsigned long int cursor;
+
+  /* If streaming is TRUE the file is read from the camera in pieces of
+   * READ_CHUNK_SIZE with gp_camera_file_read() instead of being loaded
+   * into file/data when opened. chunk holds the bytes starting at
+   * chunk_offset; dir and name include the ignore prefix.
+   */
+  gboolean streaming;
+  char *dir;
+  char *name;
+  char *chunk;
+  unsigned long int chunk_offset;
+  unsigned long int chunk_size;
 } ReadHandle;
 
 /* ------------------------------------------------------------------------------------------------- */
@@ -1781,9 +1801,112 @@ free_read_handle (ReadHandle *read_handle)
     {
       gp_file_unref (read_handle->file);
     }
+  g_free (read_handle->dir);
+  g_free (read_handle->name);
+  g_free (read_handle->chunk);
   g_free (read_handle);
 }
 
+#ifdef HAVE_GPHOTO2_FILE_READ
+/* Returns the size of a file as reported by the camera, or -1 if it
+ * doesn't tell us.
+ */
+static gint64
+get_file_size (GVfsBackendGphoto2 *gphoto2_backend, const char *dir, const char *name)
+{
+  CameraFileInfo gp_info;
+
+  if (gp_camera_file_get_info (gphoto2_backend->camera,
+                               dir,
+                               name,
+                               &gp_info,
+                               gphoto2_backend->context) != 0)
+    return -1;
+
+  if (!(gp_info.file.fields & GP_FILE_INFO_SIZE))
+    return -1;
+
+  return gp_info.file.size;
+}
+
+/* Reads the chunk starting at offset into the handle; returns a gphoto2
+ * error code, e.g. GP_ERROR_NOT_SUPPORTED if the camera driver can't do
+ * partial reads.
+ */
+static int
+read_handle_fetch_chunk (GVfsBackendGphoto2 *gphoto2_backend,
+                         ReadHandle *read_handle,
+                         unsigned long int offset)
+{
+  uint64_t size;
+  int rc;
+
+  size = MIN (READ_CHUNK_SIZE, read_handle->size - offset);
+
+  if (read_handle->chunk == NULL)
+    read_handle->chunk = g_malloc (READ_CHUNK_SIZE);
+
+  rc = gp_camera_file_read (gphoto2_backend->camera,
+                            read_handle->dir,
+                            read_handle->name,
+                            GP_FILE_TYPE_NORMAL,
+                            offset,
+                            read_handle->chunk,
+                            &size,
+                            gphoto2_backend->context);
+  if (rc != 0)
+    {
+      read_handle->chunk_size = 0;
+      return rc;
+    }
+
+  DEBUG ("  fetched chunk of %ld bytes @ %ld for handle=%p", (long) size, offset, read_handle);
+
+  read_handle->chunk_offset = offset;
+  read_handle->chunk_size = size;
+  return 0;
+}
+
+/* Sets up read_handle for streaming; returns FALSE (with the handle
+ * untouched) if the file has to be loaded in one go instead.
+ */
+static gboolean
+read_handle_start_streaming (GVfsBackendGphoto2 *gphoto2_backend,
+                             ReadHandle *read_handle,
+                             const char *dir,
+                             const char *name)
+{
+  gint64 size;
+
+  size = get_file_size (gphoto2_backend, dir, name);
+  if (size < 0)
+    return FALSE;
+
+  read_handle->streaming = TRUE;
+  read_handle->size = size;
+  read_handle->dir = g_strdup (dir);
+  read_handle->name = g_strdup (name);
+
+  /* fetching the first chunk right away tells us whether the camera
+   * driver supports partial reads at all
+   */
+  if (size > 0 && read_handle_fetch_chunk (gphoto2_backend, read_handle, 0) != 0)
+    {
+      read_handle->streaming = FALSE;
+      read_handle->size = 0;
+      g_free (read_handle->dir);
+      g_free (read_handle->name);
+      g_free (read_handle->chunk);
+      read_handle->dir = NULL;
+      read_handle->name = NULL;
+      read_handle->chunk = NULL;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+#endif
+
 static void
 do_open_for_read_real (GVfsBackend *backend,
                        GVfsJobOpenForRead *job,
@@ -1818,6 +1941,16 @@ do_open_for_read_real (GVfsBackend *backend,
     }
 
   read_handle = g_new0 (ReadHandle, 1);
+
+#ifdef HAVE_GPHOTO2_FILE_READ
+  if (!get_preview &&
+      read_handle_start_streaming (gphoto2_backend, read_handle, dir, name))
+    {
+      DEBUG ("  streaming size=%ld handle=%p", read_handle->size, read_handle);
+      goto opened;
+    }
+#endif
+
   rc = gp_file_new (&read_handle->file);
   if (rc != 0)
     {
@@ -1856,6 +1989,9 @@ do_open_for_read_real (GVfsBackend *backend,
   DEBUG ("  data=%p size=%ld handle=%p get_preview=%d",
          read_handle->data, read_handle->size, read_handle, get_preview);
 
+#ifdef HAVE_GPHOTO2_FILE_READ
+ opened:
+#endif
   g_mutex_lock (&gphoto2_backend->lock);
   gphoto2_backend->open_read_handles = g_list_prepend (gphoto2_backend->open_read_handles, read_handle);
   g_mutex_unlock (&gphoto2_backend->lock);
@@ -1911,6 +2047,49 @@ do_open_icon_for_read (GVfsBackend *backend,
 
 /* ------------------------------------------------------------------------------------------------- */
 
+/* Copies whatever is in memory at the cursor to buffer. Returns FALSE if
+ * the handle is streaming and the chunk at the cursor has to be fetched
+ * from the camera first.
+ */
+static gboolean
+read_handle_copy (ReadHandle *read_handle,
+                  char *buffer,
+                  gsize bytes_requested,
+                  gsize *bytes_copied)
+{
+  const char *data;
+  unsigned long int start;
+  unsigned long int end;
+
+  if (read_handle->cursor >= read_handle->size)
+    {
+      *bytes_copied = 0;
+      return TRUE;
+    }
+
+  if (read_handle->streaming)
+    {
+      if (read_handle->cursor < read_handle->chunk_offset ||
+          read_handle->cursor >= read_handle->chunk_offset + read_handle->chunk_size)
+        return FALSE;
+
+      data = read_handle->chunk;
+      start = read_handle->cursor - read_handle->chunk_offset;
+      end = read_handle->chunk_size;
+    }
+  else
+    {
+      data = read_handle->data;
+      start = read_handle->cursor;
+      end = read_handle->size;
+    }
+
+  *bytes_copied = MIN (bytes_requested, end - start);
+  memcpy (buffer, data + start, *bytes_copied);
+  read_handle->cursor += *bytes_copied;
+  return TRUE;
+}
+
 static gboolean
 try_read (GVfsBackend *backend,
           GVfsJobRead *job,
@@ -1918,34 +2097,56 @@ try_read (GVfsBackend *backend,
           char *buffer,
           gsize bytes_requested)
 {
-  //GVfsBackendGphoto2 *gphoto2_backend = G_VFS_BACKEND_GPHOTO2 (backend);
   ReadHandle *read_handle = (ReadHandle *) handle;
-  gsize bytes_left;
-  gsize bytes_to_copy;
+  gsize bytes_copied;
+
+  DEBUG ("try_read() %d @ %ld of %ld, handle=%p", bytes_requested, read_handle->cursor, read_handle->size, handle);
+
+  /* fall back to do_read() if we need to talk to the camera */
+  if (!read_handle_copy (read_handle, buffer, bytes_requested, &bytes_copied))
+    return FALSE;
+
+  g_vfs_job_read_set_size (job, bytes_copied);
+  g_vfs_job_succeeded (G_VFS_JOB (job));
+  return TRUE;
+}
+
+#ifdef HAVE_GPHOTO2_FILE_READ
+static void
+do_read (GVfsBackend *backend,
+         GVfsJobRead *job,
+         GVfsBackendHandle handle,
+         char *buffer,
+         gsize bytes_requested)
+{
+  GVfsBackendGphoto2 *gphoto2_backend = G_VFS_BACKEND_GPHOTO2 (backend);
+  ReadHandle *read_handle = (ReadHandle *) handle;
+  GError *error;
+  gsize bytes_copied;
+  int rc;
 
   DEBUG ("do_read() %d @ %ld of %ld, handle=%p", bytes_requested, read_handle->cursor, read_handle->size, handle);
 
-  if (read_handle->cursor >= read_handle->size)
+  if (!read_handle_copy (read_handle, buffer, bytes_requested, &bytes_copied))
     {
-      bytes_to_copy = 0;
-      goto out;
-    }
-  
-  bytes_left = read_handle->size - read_handle->cursor;
-  if (bytes_requested > bytes_left)
-    bytes_to_copy = bytes_left;
-  else
-    bytes_to_copy = bytes_requested;
+      rc = read_handle_fetch_chunk (gphoto2_backend, read_handle, read_handle->cursor);
+      if (rc != 0)
+        {
+          error = get_error_from_gphoto2 (_("Error getting file"), rc);
+          g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+          g_error_free (error);
+          return;
+        }
 
-  memcpy (buffer, read_handle->data + read_handle->cursor, bytes_to_copy);
-  read_handle->cursor += bytes_to_copy;
+      /* a camera returning nothing before the end of the file is treated as EOF */
+      if (!read_handle_copy (read_handle, buffer, bytes_requested, &bytes_copied))
+        bytes_copied = 0;
+    }
 
- out:
-  
-  g_vfs_job_read_set_size (job, bytes_to_copy);
+  g_vfs_job_read_set_size (job, bytes_copied);
   g_vfs_job_succeeded (G_VFS_JOB (job));
-  return TRUE;
 }
+#endif
 
 /* ------------------------------------------------------------------------------------------------- */
 
@@ -1985,7 +2186,7 @@ try_seek_on_read (GVfsBackend *backend,
   else
     {
       read_handle->cursor = new_offset;
-      g_vfs_job_seek_read_set_offset (job, offset);
+      g_vfs_job_seek_read_set_offset (job, new_offset);
       g_vfs_job_succeeded (G_VFS_JOB (job));
     }
   return TRUE;
@@ -2015,6 +2216,265 @@ do_close_read (GVfsBackend *backend,
 
 /* ------------------------------------------------------------------------------------------------- */
 
+#ifdef HAVE_GPHOTO2_FILE_READ
+/* Copies the file to fd in chunks of READ_CHUNK_SIZE, reporting progress
+ * as it goes. Returns a gphoto2 error code; GP_ERROR_NOT_SUPPORTED is
+ * only returned before anything has been written.
+ */
+static int
+pull_streaming (GVfsBackendGphoto2 *gphoto2_backend,
+                GVfsJob *job,
+                const char *dir,
+                const char *name,
+                int fd,
+                GFileProgressCallback progress_callback,
+                gpointer progress_callback_data)
+{
+  char *buffer;
+  gint64 total;
+  gint64 offset;
+  int rc;
+
+  total = get_file_size (gphoto2_backend, dir, name);
+  if (total < 0)
+    return GP_ERROR_NOT_SUPPORTED;
+
+  buffer = g_malloc (READ_CHUNK_SIZE);
+  rc = 0;
+
+  for (offset = 0; offset < total; )
+    {
+      uint64_t size;
+      char *p;
+
+      if (g_vfs_job_is_cancelled (job))
+        {
+          rc = GP_ERROR_CANCEL;
+          break;
+        }
+
+      size = MIN (READ_CHUNK_SIZE, total - offset);
+      rc = gp_camera_file_read (gphoto2_backend->camera,
+                                dir,
+                                name,
+                                GP_FILE_TYPE_NORMAL,
+                                offset,
+                                buffer,
+                                &size,
+                                gphoto2_backend->context);
+      if (rc != 0)
+        {
+          /* too late to fall back to loading the file in one go */
+          if (rc == GP_ERROR_NOT_SUPPORTED && offset > 0)
+            rc = GP_ERROR;
+          break;
+        }
+
+      if (size == 0)
+        {
+          rc = GP_ERROR_CORRUPTED_DATA;
+          break;
+        }
+
+      for (p = buffer; size > 0; )
+        {
+          ssize_t written = write (fd, p, size);
+
+          if (written == -1)
+            {
+              if (errno == EINTR)
+                continue;
+              rc = GP_ERROR_IO_WRITE;
+              break;
+            }
+
+          p += written;
+          size -= written;
+          offset += written;
+        }
+
+      if (rc != 0)
+        break;
+
+      if (progress_callback)
+        progress_callback (offset, total, progress_callback_data);
+    }
+
+  g_free (buffer);
+  return rc;
+}
+#endif
+
+static void
+do_pull (GVfsBackend *backend,
+         GVfsJobPull *job,
+         const char *source,
+         const char *local_path,
+         GFileCopyFlags flags,
+         gboolean remove_source,
+         GFileProgressCallback progress_callback,
+         gpointer progress_callback_data)
+{
+  GVfsBackendGphoto2 *gphoto2_backend = G_VFS_BACKEND_GPHOTO2 (backend);
+  CameraFile *file;
+  struct stat st;
+  GError *error;
+  char *dir;
+  char *name;
+  char *tmp_path;
+  int fd;
+  int rc;
+
+  ensure_not_dirty (gphoto2_backend);
+
+  DEBUG ("pull() '%s' -> '%s'", source, local_path);
+
+  tmp_path = NULL;
+
+  split_filename_with_ignore_prefix (gphoto2_backend, source, &dir, &name);
+
+  if (flags & G_FILE_COPY_BACKUP)
+    {
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                        G_IO_ERROR_NOT_SUPPORTED,
+                        _("backups not supported"));
+      goto out;
+    }
+
+  if (remove_source && !gphoto2_backend->can_delete)
+    {
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                        G_IO_ERROR_NOT_SUPPORTED,
+                        _("Not supported"));
+      goto out;
+    }
+
+  if (is_directory (gphoto2_backend, dir, name))
+    {
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                        G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+      goto out;
+    }
+
+  if (!is_regular (gphoto2_backend, dir, name))
+    {
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                        G_IO_ERROR_NOT_FOUND,
+                        _("No such file"));
+      goto out;
+    }
+
+  if (g_lstat (local_path, &st) == 0)
+    {
+      if (!(flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                            G_IO_ERROR_EXISTS,
+                            _("Target file already exists"));
+          goto out;
+        }
+
+      if (S_ISDIR (st.st_mode))
+        {
+          g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                            G_IO_ERROR_IS_DIRECTORY,
+                            _("Can't copy file over directory"));
+          goto out;
+        }
+    }
+
+  /* Download next to local_path, so a failure leaves it alone */
+  error = NULL;
+  fd = gvfs_pull_open_temp (local_path, flags, &tmp_path, &error);
+  if (fd == -1)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+      goto out;
+    }
+
+  rc = GP_ERROR_NOT_SUPPORTED;
+
+#ifdef HAVE_GPHOTO2_FILE_READ
+  rc = pull_streaming (gphoto2_backend, G_VFS_JOB (job), dir, name, fd,
+                       progress_callback, progress_callback_data);
+#endif
+
+  if (rc == GP_ERROR_NOT_SUPPORTED)
+    {
+      /* Let gphoto2 write the whole file straight to fd; the CameraFile
+       * owns fd from here on and closes it when freed.
+       */
+      rc = gp_file_new_from_fd (&file, fd);
+      if (rc == 0)
+        {
+          rc = gp_camera_file_get (gphoto2_backend->camera,
+                                   dir,
+                                   name,
+                                   GP_FILE_TYPE_NORMAL,
+                                   file,
+                                   gphoto2_backend->context);
+          gp_file_unref (file);
+        }
+      else
+        close (fd);
+    }
+  else
+    close (fd);
+
+  if (!gvfs_pull_finish_temp (local_path, flags, tmp_path, rc == 0, &error) &&
+      rc == 0)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+      goto out;
+    }
+
+  if (rc != 0)
+    {
+      if (rc == GP_ERROR_CANCEL)
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                          G_IO_ERROR_CANCELLED,
+                          _("Operation was cancelled"));
+      else
+        {
+          error = get_error_from_gphoto2 (_("Error getting file"), rc);
+          g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+          g_error_free (error);
+        }
+      goto out;
+    }
+
+  if (remove_source)
+    {
+      rc = gp_camera_file_delete (gphoto2_backend->camera,
+                                  dir,
+                                  name,
+                                  gphoto2_backend->context);
+      if (rc != 0)
+        {
+          error = get_error_from_gphoto2 (_("Error deleting file"), rc);
+          g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+          g_error_free (error);
+          goto out;
+        }
+
+      caches_invalidate_file (gphoto2_backend, dir, name);
+      caches_invalidate_free_space (gphoto2_backend);
+      monitors_emit_deleted (gphoto2_backend, dir, name);
+    }
+
+  g_vfs_job_succeeded (G_VFS_JOB (job));
+
+ out:
+  g_free (tmp_path);
+  g_free (dir);
+  g_free (name);
+}
+
+/* ------------------------------------------------------------------------------------------------- */
+
 static void
 do_query_info (GVfsBackend *backend,
 	       GVfsJobQueryInfo *job,
@@ -3116,7 +3576,7 @@ do_write (GVfsBackend *backend,
   if (handle->cursor + buffer_size > handle->allocated_size)
     {
       unsigned long int new_allocated_size;
-      new_allocated_size = ((handle->cursor + buffer_size) / WRITE_INCREMENT + 1) * WRITE_INCREMENT;
+      new_allocated_size = MAX (handle->allocated_size * 2, handle->cursor + buffer_size);
       handle->data = g_realloc (handle->data, new_allocated_size);
       handle->allocated_size = new_allocated_size;
       DEBUG ("    allocated_size is now %ld bytes)", handle->allocated_size);
@@ -3521,6 +3981,9 @@ g_vfs_backend_gphoto2_class_init (GVfsBackendGphoto2Class *klass)
    backend_class->open_icon_for_read = do_open_icon_for_read;
   backend_class->open_for_read = do_open_for_read;
   backend_class->try_read = try_read;
+#ifdef HAVE_GPHOTO2_FILE_READ
+  backend_class->read = do_read;
+#endif
   backend_class->try_seek_on_read = try_seek_on_read;
   backend_class->close_read = do_close_read;
   backend_class->query_info = do_query_info;
@@ -3536,6 +3999,7 @@ g_vfs_backend_gphoto2_class_init (GVfsBackendGphoto2Class *klass)
   backend_class->close_write = do_close_write;
   backend_class->seek_on_write = do_seek_on_write;
   backend_class->move = do_move;
+  backend_class->pull = do_pull;
   backend_class->create_dir_monitor = do_create_dir_monitor;
   backend_class->create_file_monitor = do_create_file_monitor;
 
@@ -46,8 +46,10 @@
 #include "gvfsjobqueryfsinfo.h"
 #include "gvfsjobqueryattributes.h"
 #include "gvfsjobenumerate.h"
+#include "gvfsjobpull.h"
 #include "gvfsdaemonprotocol.h"
 #include "gvfsdaemonutils.h"
+#include "gvfsstats.h"
 
 #include "soup-input-stream.h"
 
@@ -70,6 +72,8 @@ g_vfs_backend_http_finalize (GObject *object)
   soup_session_abort (backend->session_async);
   g_object_unref (backend->session_async);
 
+  if (backend->cache)
+    g_vfs_http_cache_free (backend->cache);
 
   if (G_OBJECT_CLASS (g_vfs_backend_http_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_http_parent_class)->finalize) (object);
@@ -324,19 +328,64 @@ try_mount (GVfsBackend  *backend,
   g_vfs_backend_set_mount_spec (backend, real_mount_spec);
   
   op_backend->mount_base = uri;
+  op_backend->cache = g_vfs_http_cache_new ();
 
   g_vfs_job_succeeded (G_VFS_JOB (job));
   return TRUE;
 }
 
+static SoupMessageHeaders *
+headers_copy (SoupMessageHeaders *headers)
+{
+  SoupMessageHeaders *copy;
+  SoupMessageHeadersIter iter;
+  const char *name, *value;
+
+  copy = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+
+  soup_message_headers_iter_init (&iter, headers);
+  while (soup_message_headers_iter_next (&iter, &name, &value))
+    soup_message_headers_append (copy, name, value);
+
+  return copy;
+}
+
 /* *** open_read () *** */
+
+/* Used instead of the http stream when the server told us our cached
+ * copy is still valid. The headers are kept around for query_info_on_read.
+ */
+static GInputStream *
+open_cached (GVfsBackendHttp *op_backend,
+             SoupURI         *uri)
+{
+  SoupMessageHeaders *headers;
+  GInputStream       *stream;
+
+  headers = g_vfs_http_cache_revalidated (op_backend->cache, uri);
+  if (headers == NULL)
+    return NULL;
+
+  stream = g_vfs_http_cache_open (op_backend->cache, uri);
+  if (stream == NULL)
+    return NULL;
+
+  g_object_set_data_full (G_OBJECT (stream), "gvfs-http-headers",
+                          headers_copy (headers),
+                          (GDestroyNotify) soup_message_headers_free);
+  return stream;
+}
+
 static void
 open_for_read_ready (GObject      *source_object,
                      GAsyncResult *result,
                      gpointer      user_data)
 {
+  GVfsBackendHttp *op_backend;
   GInputStream *stream;
   GVfsJob      *job;
+  SoupMessage  *msg;
+  SoupURI      *uri;
   gboolean      res;
   gboolean      can_seek;
   GError       *error;
@@ -344,10 +393,41 @@ open_for_read_ready (GObject      *source_object,
   stream = G_INPUT_STREAM (source_object); 
   error  = NULL;
   job    = G_VFS_JOB (user_data);
+  op_backend = G_VFS_BACKEND_HTTP (G_VFS_JOB_OPEN_FOR_READ (job)->backend);
 
   res = soup_input_stream_send_finish (stream,
                                        result,
                                        &error);
+
+  if (res == FALSE && op_backend->cache &&
+      g_error_matches (error, SOUP_HTTP_ERROR, SOUP_STATUS_NOT_MODIFIED))
+    {
+      GInputStream *cached;
+
+      msg = soup_input_stream_get_message (stream);
+      uri = soup_message_get_uri (msg);
+      cached = open_cached (op_backend, uri);
+
+      if (cached == NULL)
+        {
+          /* the copy went away under us, fetch the whole thing again */
+          g_vfs_http_cache_remove (op_backend->cache, uri);
+          http_backend_open_for_read (G_VFS_BACKEND (op_backend), job, uri);
+        }
+      else
+        {
+          g_vfs_stats_cache_lookup ("http-content", TRUE);
+          g_vfs_job_open_for_read_set_can_seek (G_VFS_JOB_OPEN_FOR_READ (job), TRUE);
+          g_vfs_job_open_for_read_set_handle (G_VFS_JOB_OPEN_FOR_READ (job), cached);
+          g_vfs_job_succeeded (job);
+        }
+
+      g_object_unref (msg);
+      g_error_free (error);
+      g_object_unref (stream);
+      return;
+    }
+
   if (res == FALSE)
     {
       g_vfs_job_failed_literal (G_VFS_JOB (job),
@@ -360,6 +440,23 @@ open_for_read_ready (GObject      *source_object,
       return;
     }
 
+  if (op_backend->cache)
+    {
+      GVfsHttpCacheWriter *writer;
+
+      g_vfs_stats_cache_lookup ("http-content", FALSE);
+
+      msg = soup_input_stream_get_message (stream);
+      writer = g_vfs_http_cache_writer_new (op_backend->cache,
+                                            soup_message_get_uri (msg),
+                                            msg);
+      if (writer)
+        g_object_set_data_full (G_OBJECT (stream), "gvfs-http-cache-writer",
+                                writer,
+                                (GDestroyNotify) g_vfs_http_cache_writer_free);
+      g_object_unref (msg);
+    }
+
   can_seek = G_IS_SEEKABLE (stream) && g_seekable_can_seek (G_SEEKABLE (stream));
 
   g_vfs_job_open_for_read_set_can_seek (G_VFS_JOB_OPEN_FOR_READ (job), can_seek);
@@ -395,6 +492,9 @@ http_backend_open_for_read (GVfsBackend *backend,
 
   soup_message_body_set_accumulate (msg->response_body, FALSE);
 
+  if (op_backend->cache)
+    g_vfs_http_cache_add_conditions (op_backend->cache, uri, TRUE, msg);
+
   stream = soup_input_stream_new (op_backend->session_async, msg);
   g_object_unref (msg);
 
@@ -415,6 +515,7 @@ read_ready (GObject      *source_object,
   GVfsJob      *job;
   GError       *error;
   gssize        nread;
+  GVfsHttpCacheWriter *writer;
 
   stream = G_INPUT_STREAM (source_object); 
   error  = NULL;
@@ -433,6 +534,16 @@ read_ready (GObject      *source_object,
      return;
    }
 
+  /* tee the body into the cache, it becomes valid once we hit the end */
+  writer = g_object_get_data (G_OBJECT (stream), "gvfs-http-cache-writer");
+  if (writer && nread > 0)
+    g_vfs_http_cache_writer_write (writer, G_VFS_JOB_READ (job)->buffer, nread);
+  else if (writer)
+    {
+      g_vfs_http_cache_writer_commit (writer);
+      g_object_set_data (G_OBJECT (stream), "gvfs-http-cache-writer", NULL);
+    }
+
   g_vfs_job_read_set_size (G_VFS_JOB_READ (job), nread);
   g_vfs_job_succeeded (job);
 
@@ -471,6 +582,19 @@ try_seek_on_read (GVfsBackend *backend,
 
   stream = G_INPUT_STREAM (handle);
 
+  /* a ranged request can't fill the cache, and must not be conditional */
+  if (SOUP_IS_INPUT_STREAM (stream))
+    {
+      SoupMessage *msg;
+
+      g_object_set_data (G_OBJECT (stream), "gvfs-http-cache-writer", NULL);
+
+      msg = soup_input_stream_get_message (stream);
+      soup_message_headers_remove (msg->request_headers, "If-None-Match");
+      soup_message_headers_remove (msg->request_headers, "If-Modified-Since");
+      g_object_unref (msg);
+    }
+
   if (!g_seekable_seek (G_SEEKABLE (stream), offset, type,
                         G_VFS_JOB (job)->cancellable, &error))
     {
@@ -539,10 +663,515 @@ try_close_read (GVfsBackend       *backend,
 }
 
 
+/* *** pull () *** */
+
+/* An interrupted download is resumed with a Range request; we only give
+ * up after this many attempts in a row that made no progress.
+ */
+#define PULL_MAX_RETRIES 3
+
+/* Files at least this big are fetched as several ranges in parallel,
+ * using as many connections as the session allows per host.
+ */
+#define PULL_PARALLEL_MIN_SIZE (32 * 1024 * 1024)
+#define PULL_MAX_PARALLEL      4
+
+typedef struct _HttpPull      HttpPull;
+typedef struct _HttpPullRange HttpPullRange;
+
+struct _HttpPull {
+
+  SoupSession           *session;
+  SoupURI               *uri;
+  int                    fd;
+
+  GMutex                 lock;
+  GList                 *ranges;
+  goffset                size;       /* -1 if not known */
+  char                  *validator;  /* ETag or Last-Modified, for If-Range */
+  goffset                received;
+  gboolean               probed;
+  gboolean               encoded;    /* Content-Encoding, no byte ranges */
+  GError                *error;
+
+  GCancellable          *cancellable;
+  GFileProgressCallback  progress_callback;
+  gpointer               progress_callback_data;
+
+};
+
+struct _HttpPullRange {
+
+  HttpPull    *pull;
+  SoupMessage *msg;
+  GThread     *thread;
+
+  goffset      start;
+  goffset      offset;  /* next byte to write */
+  goffset      end;     /* one past the last byte, or -1 for all of it */
+
+};
+
+/* call with pull->lock held */
+static void
+http_pull_cancel_messages (HttpPull *pull)
+{
+  GList *l;
+
+  for (l = pull->ranges; l; l = l->next)
+    {
+      HttpPullRange *range = l->data;
+
+      if (range->msg)
+        soup_session_cancel_message (pull->session, range->msg,
+                                     SOUP_STATUS_CANCELLED);
+    }
+}
+
+/* takes ownership of error */
+static void
+http_pull_set_error (HttpPull *pull, GError *error)
+{
+  g_mutex_lock (&pull->lock);
+
+  if (pull->error == NULL)
+    {
+      pull->error = error;
+      http_pull_cancel_messages (pull);
+    }
+  else
+    g_error_free (error);
+
+  g_mutex_unlock (&pull->lock);
+}
+
+static gboolean
+http_pull_is_done (HttpPull *pull)
+{
+  gboolean done;
+
+  g_mutex_lock (&pull->lock);
+  done = pull->error != NULL || g_cancellable_is_cancelled (pull->cancellable);
+  g_mutex_unlock (&pull->lock);
+
+  return done;
+}
+
+static void
+http_pull_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+  HttpPull *pull = user_data;
+
+  g_mutex_lock (&pull->lock);
+  http_pull_cancel_messages (pull);
+  g_mutex_unlock (&pull->lock);
+}
+
+static void http_pull_range_run (HttpPullRange *range);
+
+static gpointer
+http_pull_range_thread (gpointer data)
+{
+  http_pull_range_run (data);
+  return NULL;
+}
+
+/* The first response told us the size; let the first range stop at its
+ * share of the file and start threads for the remaining ones.
+ */
+static void
+http_pull_split (HttpPullRange *first)
+{
+  HttpPull *pull = first->pull;
+  goffset   share;
+  int       max_conns;
+  int       n, i;
+
+  g_object_get (pull->session, SOUP_SESSION_MAX_CONNS_PER_HOST, &max_conns, NULL);
+  n = MIN (max_conns, PULL_MAX_PARALLEL);
+
+  if (n < 2)
+    return;
+
+  share = pull->size / n;
+  first->end = share;
+
+  g_mutex_lock (&pull->lock);
+
+  for (i = 1; i < n; i++)
+    {
+      HttpPullRange *range;
+
+      range = g_slice_new0 (HttpPullRange);
+      range->pull = pull;
+      range->start = range->offset = share * i;
+      range->end = i == n - 1 ? pull->size : share * (i + 1);
+      range->thread = g_thread_new ("http-pull", http_pull_range_thread, range);
+
+      pull->ranges = g_list_append (pull->ranges, range);
+    }
+
+  g_mutex_unlock (&pull->lock);
+}
+
+static void
+http_pull_got_headers (SoupMessage *msg, gpointer user_data)
+{
+  HttpPullRange *range = user_data;
+  HttpPull      *pull = range->pull;
+  SoupMessageHeaders *headers = msg->response_headers;
+  const char    *text;
+  goffset        start, end, total;
+
+  if (msg->status_code == SOUP_STATUS_PARTIAL_CONTENT)
+    {
+      if (! soup_message_headers_get_content_range (headers, &start, &end, &total) ||
+          start != range->offset)
+        http_pull_set_error (pull, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                                        _("Unexpected reply from server")));
+      return;
+    }
+
+  /* errors are handled once the message is done */
+  if (! SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    return;
+
+  /* A plain 200 always carries the whole file */
+  if (range->start == 0 && range->offset > 0)
+    {
+      if (range->end != -1)
+        {
+          http_pull_set_error (pull, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_WRONG_ETAG,
+                                                          _("The file was externally modified")));
+          return;
+        }
+
+      /* Server can't resume or the file changed, start over */
+      g_mutex_lock (&pull->lock);
+      pull->received -= range->offset;
+      range->offset = 0;
+      g_mutex_unlock (&pull->lock);
+    }
+  else if (range->start > 0)
+    {
+      http_pull_set_error (pull, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_WRONG_ETAG,
+                                                      _("The file was externally modified")));
+      return;
+    }
+
+  if (pull->probed)
+    return;
+
+  pull->probed = TRUE;
+
+  text = soup_message_headers_get_one (headers, "ETag");
+  if (text == NULL)
+    text = soup_message_headers_get_one (headers, "Last-Modified");
+  pull->validator = g_strdup (text);
+
+  /* The content decoder hands us the decoded file, but lengths and
+   * ranges are about the encoded one, so we can neither split nor
+   * resume such a download.
+   */
+  text = soup_message_headers_get_one (headers, "Content-Encoding");
+  pull->encoded = text != NULL && g_ascii_strcasecmp (text, "identity") != 0;
+
+  if (! pull->encoded &&
+      soup_message_headers_get_encoding (headers) == SOUP_ENCODING_CONTENT_LENGTH)
+    pull->size = soup_message_headers_get_content_length (headers);
+
+  text = soup_message_headers_get_list (headers, "Accept-Ranges");
+
+  if (! pull->encoded &&
+      pull->size >= PULL_PARALLEL_MIN_SIZE &&
+      pull->validator != NULL &&
+      text != NULL && soup_header_contains (text, "bytes"))
+    http_pull_split (range);
+}
+
+static void
+http_pull_got_chunk (SoupMessage *msg, SoupBuffer *chunk, gpointer user_data)
+{
+  HttpPullRange *range = user_data;
+  HttpPull      *pull = range->pull;
+  const char    *data;
+  gsize          len;
+  goffset        received, size;
+
+  if (! SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    return;
+
+  data = chunk->data;
+  len = chunk->length;
+
+  if (range->end != -1 && range->offset + (goffset) len > range->end)
+    len = range->end - range->offset;
+
+  while (len > 0)
+    {
+      ssize_t res;
+
+      res = pwrite (pull->fd, data, len, range->offset);
+
+      if (res == -1)
+        {
+          int errsv = errno;
+
+          if (errsv == EINTR)
+            continue;
+
+          http_pull_set_error (pull, g_error_new_literal (G_IO_ERROR,
+                                                          g_io_error_from_errno (errsv),
+                                                          g_strerror (errsv)));
+          return;
+        }
+
+      data += res;
+      len -= res;
+
+      g_mutex_lock (&pull->lock);
+      range->offset += res;
+      pull->received += res;
+      received = pull->received;
+      size = pull->size;
+      g_mutex_unlock (&pull->lock);
+
+      if (pull->progress_callback)
+        pull->progress_callback (received, MAX (size, 0),
+                                 pull->progress_callback_data);
+    }
+
+  /* The first range got the whole file but only wants its share */
+  if (range->end != -1 && range->offset == range->end)
+    soup_session_cancel_message (pull->session, msg, SOUP_STATUS_CANCELLED);
+}
+
+static void
+http_pull_range_run (HttpPullRange *range)
+{
+  HttpPull    *pull = range->pull;
+  SoupMessage *msg;
+  goffset      offset;
+  guint        status;
+  guint        retries;
+  gboolean     done;
+
+  retries = 0;
+
+  while (! http_pull_is_done (pull))
+    {
+      /* an encoded download can't be resumed, start it over */
+      if (pull->encoded && range->offset > 0)
+        {
+          g_mutex_lock (&pull->lock);
+          pull->received -= range->offset;
+          range->offset = 0;
+          g_mutex_unlock (&pull->lock);
+
+          if (ftruncate (pull->fd, 0) == -1)
+            {
+              int errsv = errno;
+
+              http_pull_set_error (pull, g_error_new_literal (G_IO_ERROR,
+                                                              g_io_error_from_errno (errsv),
+                                                              g_strerror (errsv)));
+              break;
+            }
+        }
+
+      offset = range->offset;
+
+      msg = soup_message_new_from_uri (SOUP_METHOD_GET, pull->uri);
+      soup_message_body_set_accumulate (msg->response_body, FALSE);
+
+      if (range->offset > 0 || range->end != -1)
+        {
+          soup_message_headers_set_range (msg->request_headers, range->offset,
+                                          range->end != -1 ? range->end - 1 : -1);
+          if (pull->validator)
+            soup_message_headers_append (msg->request_headers, "If-Range",
+                                         pull->validator);
+        }
+
+      g_signal_connect (msg, "got-headers",
+                        G_CALLBACK (http_pull_got_headers), range);
+      g_signal_connect (msg, "got-chunk",
+                        G_CALLBACK (http_pull_got_chunk), range);
+
+      g_mutex_lock (&pull->lock);
+      range->msg = msg;
+      g_mutex_unlock (&pull->lock);
+
+      status = soup_session_send_message (pull->session, msg);
+
+      g_mutex_lock (&pull->lock);
+      range->msg = NULL;
+      g_mutex_unlock (&pull->lock);
+
+      if (range->end != -1)
+        done = range->offset == range->end;
+      else
+        done = SOUP_STATUS_IS_SUCCESSFUL (status) &&
+               (pull->size < 0 || range->offset == pull->size);
+
+      if (! done && ! http_pull_is_done (pull))
+        {
+          if (range->offset == offset)
+            retries++;
+          else
+            retries = 0;
+
+          if ((! SOUP_STATUS_IS_TRANSPORT_ERROR (status) &&
+               ! SOUP_STATUS_IS_SUCCESSFUL (status)) ||
+              retries > PULL_MAX_RETRIES)
+            http_pull_set_error (pull, g_error_new (G_IO_ERROR,
+                                                    http_error_code_from_status (status),
+                                                    _("HTTP Error: %s"),
+                                                    msg->reason_phrase));
+        }
+
+      g_object_unref (msg);
+
+      if (done)
+        break;
+    }
+}
+
+/* Downloads uri into a temporary file next to local_path and moves it
+ * into place once complete, resuming interrupted transfers and
+ * splitting big files into parallel ranges if the server supports
+ * that. Blocks, so call it from a job thread.
+ */
+gboolean
+http_backend_pull (GVfsBackend           *backend,
+                   SoupURI               *uri,
+                   const char            *local_path,
+                   GFileCopyFlags         flags,
+                   GCancellable          *cancellable,
+                   GFileProgressCallback  progress_callback,
+                   gpointer               progress_callback_data,
+                   GError               **error)
+{
+  HttpPull  pull;
+  GList    *l;
+  gulong    handler;
+  gboolean  res;
+  char     *tmp_path;
+  int       fd;
+
+  if (flags & G_FILE_COPY_BACKUP)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           _("backups not supported"));
+      return FALSE;
+    }
+
+  fd = gvfs_pull_open_temp (local_path, flags, &tmp_path, error);
+
+  if (fd == -1)
+    return FALSE;
+
+  memset (&pull, 0, sizeof (pull));
+  g_mutex_init (&pull.lock);
+  pull.session = G_VFS_BACKEND_HTTP (backend)->session;
+  pull.uri = uri;
+  pull.fd = fd;
+  pull.size = -1;
+  pull.cancellable = cancellable;
+  pull.progress_callback = progress_callback;
+  pull.progress_callback_data = progress_callback_data;
+  pull.ranges = g_list_append (NULL, g_slice_new0 (HttpPullRange));
+  ((HttpPullRange *) pull.ranges->data)->pull = &pull;
+  ((HttpPullRange *) pull.ranges->data)->end = -1;
+
+  handler = g_cancellable_connect (cancellable,
+                                   G_CALLBACK (http_pull_cancelled),
+                                   &pull, NULL);
+
+  http_pull_range_run (pull.ranges->data);
+
+  /* only the first range adds others, so the list is final by now */
+  for (l = pull.ranges; l; l = l->next)
+    {
+      HttpPullRange *range = l->data;
+
+      if (range->thread)
+        g_thread_join (range->thread);
+
+      g_slice_free (HttpPullRange, range);
+    }
+
+  g_list_free (pull.ranges);
+  pull.ranges = NULL;
+
+  g_cancellable_disconnect (cancellable, handler);
+
+  if (pull.error == NULL)
+    g_cancellable_set_error_if_cancelled (cancellable, &pull.error);
+
+  if (close (fd) == -1 && pull.error == NULL)
+    {
+      int errsv = errno;
+
+      pull.error = g_error_new_literal (G_IO_ERROR, g_io_error_from_errno (errsv),
+                                        g_strerror (errsv));
+    }
+
+  res = gvfs_pull_finish_temp (local_path, flags, tmp_path,
+                               pull.error == NULL, &pull.error);
+  g_free (tmp_path);
+
+  if (! res)
+    g_propagate_error (error, pull.error);
+
+  g_free (pull.validator);
+  g_mutex_clear (&pull.lock);
+
+  return res;
+}
+
+static void
+do_pull (GVfsBackend           *backend,
+         GVfsJobPull           *job,
+         const char            *source,
+         const char            *local_path,
+         GFileCopyFlags         flags,
+         gboolean               remove_source,
+         GFileProgressCallback  progress_callback,
+         gpointer               progress_callback_data)
+{
+  GError *error = NULL;
+
+  if (remove_source)
+    {
+      g_vfs_job_failed (G_VFS_JOB (job),
+                        G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        _("Operation unsupported"));
+      return;
+    }
+
+  if (http_backend_pull (backend,
+                         http_backend_get_mount_base (backend),
+                         local_path,
+                         flags,
+                         G_VFS_JOB (job)->cancellable,
+                         progress_callback,
+                         progress_callback_data,
+                         &error))
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+  else
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+    }
+}
+
+
 /* *** query_info () *** */
 
 static void
-file_info_from_message (SoupMessage *msg,
+file_info_from_headers (SoupURI *uri,
+                        SoupMessageHeaders *headers,
                         GFileInfo *info,
                         GFileAttributeMatcher *matcher)
 {
@@ -555,7 +1184,7 @@ file_info_from_message (SoupMessage *msg,
 
   /* prefer the filename from the Content-Disposition (rfc2183) header
      if one if present. See bug 551298. */
-  if (soup_message_headers_get_content_disposition (msg->response_headers,
+  if (soup_message_headers_get_content_disposition (headers,
                                                     NULL, &params))
     {
       const char *name = g_hash_table_lookup (params, "filename");
@@ -567,12 +1196,7 @@ file_info_from_message (SoupMessage *msg,
     }
 
   if (basename == NULL)
-    {
-      const SoupURI *uri;
-
-      uri = soup_message_get_uri (msg);
-      basename = http_uri_get_basename (uri->path);
-    }
+    basename = http_uri_get_basename (uri->path);
 
   g_debug ("basename:%s\n", basename);
 
@@ -591,10 +1215,10 @@ file_info_from_message (SoupMessage *msg,
   g_free (basename);
   g_free (ed_name);
 
-  if (soup_message_headers_get_encoding(msg->response_headers) == SOUP_ENCODING_CONTENT_LENGTH)
-    g_file_info_set_size (info, soup_message_headers_get_content_length (msg->response_headers));
+  if (soup_message_headers_get_encoding(headers) == SOUP_ENCODING_CONTENT_LENGTH)
+    g_file_info_set_size (info, soup_message_headers_get_content_length (headers));
 
-  text = soup_message_headers_get_content_type (msg->response_headers, NULL);
+  text = soup_message_headers_get_content_type (headers, NULL);
   if (text)
     {
       GIcon *icon;
@@ -609,7 +1233,7 @@ file_info_from_message (SoupMessage *msg,
     }
 
 
-  text = soup_message_headers_get (msg->response_headers,
+  text = soup_message_headers_get (headers,
                                    "Last-Modified");
   if (text)
     {
@@ -626,7 +1250,7 @@ file_info_from_message (SoupMessage *msg,
     }
 
 
-  text = soup_message_headers_get (msg->response_headers,
+  text = soup_message_headers_get (headers,
                                    "ETag");
   if (text)
     {
@@ -636,6 +1260,15 @@ file_info_from_message (SoupMessage *msg,
     }
 }
 
+static void
+file_info_from_message (SoupMessage *msg,
+                        GFileInfo *info,
+                        GFileAttributeMatcher *matcher)
+{
+  file_info_from_headers (soup_message_get_uri (msg), msg->response_headers,
+                          info, matcher);
+}
+
 static void
 query_info_ready (SoupSession *session,
                   SoupMessage *msg,
@@ -645,9 +1278,26 @@ query_info_ready (SoupSession *session,
   GVfsJobQueryInfo      *job;
   GFileInfo             *info;
 
+  GVfsBackendHttp       *op_backend;
+  SoupMessageHeaders    *headers;
+
   job     = G_VFS_JOB_QUERY_INFO (user_data);
   info    = job->file_info;
   matcher = job->attribute_matcher;
+  op_backend = G_VFS_BACKEND_HTTP (job->backend);
+
+  if (op_backend->cache && msg->status_code == SOUP_STATUS_NOT_MODIFIED)
+    {
+      headers = g_vfs_http_cache_revalidated (op_backend->cache,
+                                              soup_message_get_uri (msg));
+      if (headers)
+        {
+          file_info_from_headers (soup_message_get_uri (msg), headers,
+                                  info, matcher);
+          g_vfs_job_succeeded (G_VFS_JOB (job));
+          return;
+        }
+    }
 
   if (! SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
     {
@@ -656,6 +1306,10 @@ query_info_ready (SoupSession *session,
       return;
     }
 
+  if (op_backend->cache)
+    g_vfs_http_cache_store (op_backend->cache, soup_message_get_uri (msg),
+                            msg->response_headers);
+
   file_info_from_message (msg, info, matcher);
 
   g_vfs_job_succeeded (G_VFS_JOB (job));
@@ -670,12 +1324,32 @@ try_query_info (GVfsBackend           *backend,
                 GFileInfo             *info,
                 GFileAttributeMatcher *attribute_matcher)
 {
+  GVfsBackendHttp    *op_backend;
+  SoupMessageHeaders *headers;
   SoupMessage *msg;
   SoupURI     *uri;
+  gboolean     fresh;
 
+  op_backend = G_VFS_BACKEND_HTTP (backend);
   uri = http_backend_get_mount_base (backend);
+
+  if (op_backend->cache)
+    {
+      headers = g_vfs_http_cache_lookup (op_backend->cache, uri, FALSE, &fresh);
+      g_vfs_stats_cache_lookup ("http-headers", headers && fresh);
+      if (headers && fresh)
+        {
+          file_info_from_headers (uri, headers, info, attribute_matcher);
+          g_vfs_job_succeeded (G_VFS_JOB (job));
+          return TRUE;
+        }
+    }
+
   msg = soup_message_new_from_uri (SOUP_METHOD_HEAD, uri);
 
+  if (op_backend->cache)
+    g_vfs_http_cache_add_conditions (op_backend->cache, uri, FALSE, msg);
+
   http_backend_queue_message (backend, msg, query_info_ready, job);
 
   return TRUE;
@@ -689,7 +1363,20 @@ try_query_info_on_read (GVfsBackend           *backend,
                         GFileInfo             *info,
                         GFileAttributeMatcher *attribute_matcher)
 {
-    SoupMessage *msg = soup_input_stream_get_message (G_INPUT_STREAM (handle));
+    SoupMessageHeaders *headers;
+    SoupMessage *msg;
+
+    if (!SOUP_IS_INPUT_STREAM (handle))
+      {
+        /* served from the cache */
+        headers = g_object_get_data (G_OBJECT (handle), "gvfs-http-headers");
+        file_info_from_headers (http_backend_get_mount_base (backend),
+                                headers, info, attribute_matcher);
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+        return TRUE;
+      }
+
+    msg = soup_input_stream_get_message (G_INPUT_STREAM (handle));
 
     file_info_from_message (msg, info, attribute_matcher);
     g_object_unref (msg);
@@ -717,4 +1404,5 @@ g_vfs_backend_http_class_init (GVfsBackendHttpClass *klass)
   backend_class->try_close_read         = try_close_read;
   backend_class->try_query_info         = try_query_info;
   backend_class->try_query_info_on_read = try_query_info_on_read;
+  backend_class->pull                   = do_pull;
 }
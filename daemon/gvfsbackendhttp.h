@@ -26,6 +26,7 @@
 #include <gvfsbackend.h>
 #include <gmountspec.h>
 #include <libsoup/soup.h>
+#include "gvfshttpcache.h"
 
 G_BEGIN_DECLS
 
@@ -53,6 +54,8 @@ struct _GVfsBackendHttp
   SoupSession *session;
 
   SoupSession *session_async;
+
+  GVfsHttpCache *cache;
 };
 
 GType         g_vfs_backend_http_get_type    (void) G_GNUC_CONST;
@@ -77,6 +80,15 @@ void          http_backend_open_for_read     (GVfsBackend         *backend,
 					      GVfsJob             *job,
 					      SoupURI             *uri);
 
+gboolean      http_backend_pull              (GVfsBackend           *backend,
+                                              SoupURI               *uri,
+                                              const char            *local_path,
+                                              GFileCopyFlags         flags,
+                                              GCancellable          *cancellable,
+                                              GFileProgressCallback  progress_callback,
+                                              gpointer               progress_callback_data,
+                                              GError               **error);
+
 G_END_DECLS
 
 #endif /* __G_VFS_BACKEND_HTTP_H__ */
@@ -28,6 +28,13 @@
  *    GVFS_ERRORNEOUS: number, how often operation should fail (a random() is used, this number is not a sequence) 
  *    GVFS_ERRORNEOUS_OPS: bitmask of operations to fail - see GVfsJobType enum
  * 
+ *  - the backend can also pretend to be a remote server, for benchmarking:
+ *    GVFS_LOCALTEST_LATENCY: number, milliseconds each operation takes
+ *    GVFS_LOCALTEST_JITTER: number, up to this many milliseconds are randomly added to the latency
+ *    GVFS_LOCALTEST_LATENCY_OPS: bitmask of operations to delay - see GVfsJobType enum
+ *    GVFS_LOCALTEST_BANDWIDTH: number, bytes per second read and written, shared by all operations
+ *    GVFS_LOCALTEST_MAX_OPS: number, how many operations the "server" handles at the same time
+ * 
  ***/
 
 
@@ -87,13 +94,89 @@
  */
 
 
+/*  sleeps until the monotonic time 'until', FALSE if the job got cancelled meanwhile  */
+static gboolean
+sleep_until (GVfsJob *job, gint64 until)
+{
+  gint64 now;
+
+  while ((now = g_get_monotonic_time ()) < until)
+  {
+      if (g_vfs_job_is_cancelled (job))
+        return FALSE;
+      g_usleep (MIN (until - now, 10000));
+  }
+  return TRUE;
+}
+
+/*  waits for the latency of the operation and for 'bytes' to go through the link  */
+static gboolean
+simulate_remote (GVfsBackendLocalTest *op_backend,
+				 GVfsJob *job,
+				 GVfsJobType job_type,
+				 gsize bytes)
+{
+  gint64 until;
+  gboolean res;
+
+  if (op_backend->max_ops > 0)
+  {
+      g_mutex_lock (&op_backend->shape_lock);
+      while (op_backend->running_ops >= op_backend->max_ops)
+        g_cond_wait (&op_backend->shape_cond, &op_backend->shape_lock);
+      op_backend->running_ops++;
+      g_mutex_unlock (&op_backend->shape_lock);
+  }
+
+  until = g_get_monotonic_time ();
+  if ((op_backend->latency > 0) &&
+	  ((op_backend->latency_op_types < 1) || ((op_backend->latency_op_types & job_type) == job_type)))
+  {
+      until += (gint64) op_backend->latency * 1000;
+      if (op_backend->jitter > 0)
+        until += (gint64) g_random_int_range (0, op_backend->jitter + 1) * 1000;
+  }
+  res = sleep_until (job, until);
+
+  /*  the link is shared, a transfer starts when the previous ones went through  */
+  if (res && (bytes > 0) && (op_backend->bandwidth > 0))
+  {
+      g_mutex_lock (&op_backend->shape_lock);
+      until = MAX (op_backend->link_free_time, g_get_monotonic_time ());
+      until += bytes * G_USEC_PER_SEC / op_backend->bandwidth;
+      op_backend->link_free_time = until;
+      g_mutex_unlock (&op_backend->shape_lock);
+
+      res = sleep_until (job, until);
+  }
+
+  if (op_backend->max_ops > 0)
+  {
+      g_mutex_lock (&op_backend->shape_lock);
+      op_backend->running_ops--;
+      g_cond_signal (&op_backend->shape_cond);
+      g_mutex_unlock (&op_backend->shape_lock);
+  }
+
+  return res;
+}
+
 static gboolean     
-inject_error (GVfsBackend *backend,
-			  GVfsJob *job,
-			  GVfsJobType job_type)
+inject_error_transfer (GVfsBackend *backend,
+					   GVfsJob *job,
+					   GVfsJobType job_type,
+					   gsize bytes)
 {
   GVfsBackendLocalTest *op_backend = G_VFS_BACKEND_LOCALTEST (backend);
 
+  if (! simulate_remote (op_backend, job, job_type, bytes))
+  {
+      g_vfs_job_failed (G_VFS_JOB (job),
+			G_IO_ERROR, G_IO_ERROR_CANCELLED,
+			_("Operation was cancelled"));
+      return FALSE;
+  }
+
   if ((op_backend->errorneous > 0) && ((random() % op_backend->errorneous) == 0) && 
 	  ((op_backend->inject_op_types < 1) || ((op_backend->inject_op_types & job_type) == job_type)))
   {
@@ -106,6 +189,14 @@ inject_error (GVfsBackend *backend,
   return TRUE;
 }
 
+static gboolean     
+inject_error (GVfsBackend *backend,
+			  GVfsJob *job,
+			  GVfsJobType job_type)
+{
+  return inject_error_transfer (backend, job, job_type, 0);
+}
+
 
 
 
@@ -199,6 +290,44 @@ g_vfs_backend_localtest_init (GVfsBackendLocalTest *backend)
 		backend->inject_op_types = g_ascii_strtoll(c, NULL, 0);
 		g_print ("(II) g_vfs_backend_localtest_init: setting 'inject_op_types' to '%lu' \n", (unsigned long)backend->inject_op_types);
 	}
+
+	backend->latency = 0;
+	backend->jitter = 0;
+	backend->latency_op_types = -1;
+	backend->bandwidth = 0;
+	backend->max_ops = 0;
+	g_mutex_init (&backend->shape_lock);
+	g_cond_init (&backend->shape_cond);
+
+	c = g_getenv("GVFS_LOCALTEST_LATENCY");
+	if (c) {
+		backend->latency = g_ascii_strtoll(c, NULL, 0);
+		g_print ("(II) g_vfs_backend_localtest_init: setting 'latency' to '%d' ms \n", backend->latency);
+	}
+
+	c = g_getenv("GVFS_LOCALTEST_JITTER");
+	if (c) {
+		backend->jitter = g_ascii_strtoll(c, NULL, 0);
+		g_print ("(II) g_vfs_backend_localtest_init: setting 'jitter' to '%d' ms \n", backend->jitter);
+	}
+
+	c = g_getenv("GVFS_LOCALTEST_LATENCY_OPS");
+	if (c) {
+		backend->latency_op_types = g_ascii_strtoll(c, NULL, 0);
+		g_print ("(II) g_vfs_backend_localtest_init: setting 'latency_op_types' to '%lu' \n", (unsigned long)backend->latency_op_types);
+	}
+
+	c = g_getenv("GVFS_LOCALTEST_BANDWIDTH");
+	if (c) {
+		backend->bandwidth = g_ascii_strtoull(c, NULL, 0);
+		g_print ("(II) g_vfs_backend_localtest_init: setting 'bandwidth' to '%" G_GUINT64_FORMAT "' B/s \n", backend->bandwidth);
+	}
+
+	c = g_getenv("GVFS_LOCALTEST_MAX_OPS");
+	if (c) {
+		backend->max_ops = g_ascii_strtoll(c, NULL, 0);
+		g_print ("(II) g_vfs_backend_localtest_init: setting 'max_ops' to '%d' \n", backend->max_ops);
+	}
 	
 	g_print ("(II) g_vfs_backend_localtest_init done.\n");
 }
@@ -214,6 +343,9 @@ g_vfs_backend_localtest_finalize (GObject *object)
 
     if (backend->test)
     	g_free ((gpointer)backend->test);  
+
+	g_mutex_clear (&backend->shape_lock);
+	g_cond_clear (&backend->shape_cond);
   
 	if (G_OBJECT_CLASS (g_vfs_backend_localtest_parent_class)->finalize)
       (*G_OBJECT_CLASS (g_vfs_backend_localtest_parent_class)->finalize) (object);
@@ -944,7 +1076,7 @@ do_read (GVfsBackend *backend,
 		  				   G_VFS_JOB (job)->cancellable, &error); 
   if (s >= 0) {
       g_vfs_job_read_set_size (job, s);
-	  inject_error (backend, G_VFS_JOB (job), GVFS_JOB_READ);
+	  inject_error_transfer (backend, G_VFS_JOB (job), GVFS_JOB_READ, s);
 	  g_print ("(II) try_read success. \n");
   } else  {
 	  g_vfs_job_failed_from_error (G_VFS_JOB (job), error); 
@@ -1141,7 +1273,7 @@ do_write (GVfsBackend *backend,
   s = g_output_stream_write (G_OUTPUT_STREAM (stream), buffer, buffer_size, G_VFS_JOB (job)->cancellable, &error); 
   if (s >= 0) {
 	  g_vfs_job_write_set_written_size (job, s);
-	  inject_error (backend, G_VFS_JOB (job), GVFS_JOB_WRITE);
+	  inject_error_transfer (backend, G_VFS_JOB (job), GVFS_JOB_WRITE, s);
 	  g_print ("(II) try_write success. \n");
   } else  {
 	  g_vfs_job_failed_from_error (G_VFS_JOB (job), error); 
@@ -80,6 +80,18 @@ struct _GVfsBackendLocalTest
 	  GMountSpec *mount_spec;
 	  int errorneous;
 	  GVfsJobType inject_op_types;
+
+	  /* simulated remote end, see the usage in gvfsbackendlocaltest.c */
+	  int latency;
+	  int jitter;
+	  GVfsJobType latency_op_types;
+	  guint64 bandwidth;
+	  int max_ops;
+
+	  GMutex shape_lock;
+	  GCond shape_cond;
+	  int running_ops;
+	  gint64 link_free_time;
 };
 
 struct _GVfsBackendLocalTestClass
@@ -61,6 +61,7 @@
 #include "gvfsjobqueryattributes.h"
 #include "gvfsjobenumerate.h"
 #include "gvfsdaemonprotocol.h"
+#include "gvfsstats.h"
 
 #define BDADDR_LEN 17
 
@@ -71,6 +72,23 @@
 
 #define CACHE_LIFESPAN 3
 
+typedef struct {
+    GVfsBackendObexftp *backend;
+    char *source;
+    goffset size;
+    int fd;
+
+    /* ASYNC_PENDING until the transfer into fd has started, ASYNC_RUNNING
+     * while it is in progress, then ASYNC_SUCCESS or ASYNC_ERROR */
+    int transfer_status;
+    GError *transfer_error;
+} ObexFTPOpenHandle;
+
+typedef struct {
+    char *files;
+    time_t time_captured;
+} ObexFTPListing;
+
 struct _GVfsBackendObexftp
 {
   GVfsBackend parent_instance;
@@ -91,17 +109,12 @@ struct _GVfsBackendObexftp
   gboolean doing_io;
   GError *error;
 
-  /* Folders listing cache */
-  char *files_listing;
-  char *directory;
-  time_t time_captured;
-};
+  /* The file being copied by CopyRemoteFile, if any */
+  ObexFTPOpenHandle *read_handle;
 
-typedef struct {
-    char *source;
-    goffset size;
-    int fd;
-} ObexFTPOpenHandle;
+  /* Folders listing cache, path -> ObexFTPListing */
+  GHashTable *listings;
+};
 
 G_DEFINE_TYPE (GVfsBackendObexftp, g_vfs_backend_obexftp, G_VFS_TYPE_BACKEND);
 
@@ -479,6 +492,13 @@ end:
   return ods_intf_num;
 }
 
+static void
+listing_free (ObexFTPListing *listing)
+{
+  g_free (listing->files);
+  g_slice_free (ObexFTPListing, listing);
+}
+
 static void
 g_vfs_backend_obexftp_finalize (GObject *object)
 {
@@ -489,8 +509,7 @@ g_vfs_backend_obexftp_finalize (GObject *object)
   g_free (backend->display_name);
   g_free (backend->bdaddr);
   g_free (backend->icon_name);
-  g_free (backend->files_listing);
-  g_free (backend->directory);
+  g_hash_table_destroy (backend->listings);
 
   if (backend->session_proxy != NULL)
         g_object_unref (backend->session_proxy);
@@ -508,6 +527,9 @@ g_vfs_backend_obexftp_init (GVfsBackendObexftp *backend)
   DBusGConnection *connection;
   DBusError error;
 
+  backend->listings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) listing_free);
+
   /* Otherwise dbus-glib doesn't setup it value types */
   connection = dbus_g_bus_get (DBUS_BUS_SESSION, NULL);
 
@@ -616,25 +638,25 @@ _retrieve_folder_listing (GVfsBackend *backend,
                           GError **error)
 {
   GVfsBackendObexftp *op_backend = G_VFS_BACKEND_OBEXFTP (backend);
+  ObexFTPListing *listing;
   time_t current;
 
   current = time (NULL);
 
-  if (op_backend->directory != NULL &&
-      strcmp (op_backend->directory, filename) == 0 &&
-      op_backend->time_captured > current - CACHE_LIFESPAN)
-    {
-      *files = g_strdup (op_backend->files_listing);
-      return TRUE;
-    }
-  else
+  listing = g_hash_table_lookup (op_backend->listings, filename);
+  if (listing != NULL)
     {
-      g_free (op_backend->directory);
-      op_backend->directory = NULL;
-      g_free (op_backend->files_listing);
-      op_backend->files_listing = NULL;
+      if (listing->time_captured > current - CACHE_LIFESPAN)
+        {
+          g_vfs_stats_cache_lookup ("obexftp-listing", TRUE);
+          *files = g_strdup (listing->files);
+          return TRUE;
+        }
+      g_hash_table_remove (op_backend->listings, filename);
     }
 
+  g_vfs_stats_cache_lookup ("obexftp-listing", FALSE);
+
   if (dbus_g_proxy_call (op_backend->session_proxy, "RetrieveFolderListing", error,
                          G_TYPE_INVALID,
                          G_TYPE_STRING, files, G_TYPE_INVALID) == FALSE)
@@ -642,9 +664,10 @@ _retrieve_folder_listing (GVfsBackend *backend,
       return FALSE;
     }
 
-  op_backend->directory = g_strdup (filename);
-  op_backend->files_listing = g_strdup (*files);
-  op_backend->time_captured = time (NULL);
+  listing = g_slice_new (ObexFTPListing);
+  listing->files = g_strdup (*files);
+  listing->time_captured = time (NULL);
+  g_hash_table_replace (op_backend->listings, g_strdup (filename), listing);
 
   return TRUE;
 }
@@ -737,11 +760,31 @@ _query_file_info_helper (GVfsBackend *backend,
   return found;
 }
 
+static gboolean
+_is_path_or_child (gpointer key, gpointer value, gpointer user_data)
+{
+  const char *path = key;
+  const char *prefix = user_data;
+  gsize len = strlen (prefix);
+
+  return strncmp (path, prefix, len) == 0 &&
+    (path[len] == '\0' || path[len] == '/');
+}
+
+/* Drops the cached listings that a change to filename makes stale: its
+ * parent's, and its own and its children's in case it is a directory. */
 static void
-_invalidate_cache_helper (GVfsBackendObexftp *op_backend)
+_invalidate_cache_helper (GVfsBackendObexftp *op_backend,
+                          const char *filename)
 {
-  g_free (op_backend->directory);
-  op_backend->directory = NULL;
+  char *parent;
+
+  parent = g_path_get_dirname (filename);
+  g_hash_table_remove (op_backend->listings, parent);
+  g_free (parent);
+
+  g_hash_table_foreach_remove (op_backend->listings, _is_path_or_child,
+                               (gpointer) filename);
 }
 
 static void
@@ -759,15 +802,29 @@ error_occurred_cb (DBusGProxy *proxy, const gchar *error_name, const gchar *erro
       _exit (1);
     }
 
-  /* Something is waiting on us */
   g_mutex_lock (&op_backend->mutex);
+
+  /* A file being read failed to download */
+  if (op_backend->read_handle != NULL &&
+      op_backend->read_handle->transfer_status == ASYNC_RUNNING)
+    {
+      op_backend->read_handle->transfer_status = ASYNC_ERROR;
+      op_backend->read_handle->transfer_error = g_error_new_literal (DBUS_GERROR,
+                                                                     DBUS_GERROR_REMOTE_EXCEPTION,
+                                                                     error_message);
+      g_cond_broadcast (&op_backend->cond);
+      g_mutex_unlock (&op_backend->mutex);
+      return;
+    }
+
+  /* Something is waiting on us */
   if (op_backend->doing_io)
     {
       op_backend->status = ASYNC_ERROR;
       op_backend->error = g_error_new_literal (DBUS_GERROR,
                                                DBUS_GERROR_REMOTE_EXCEPTION,
                                                error_message);
-      g_cond_signal (&op_backend->cond);
+      g_cond_broadcast (&op_backend->cond);
       g_mutex_unlock (&op_backend->mutex);
       return;
     }
@@ -791,7 +848,7 @@ session_connect_error_cb (DBusGProxy *proxy,
   op_backend->error = g_error_new_literal (DBUS_GERROR,
                                            DBUS_GERROR_REMOTE_EXCEPTION,
                                            error_message);
-  g_cond_signal (&op_backend->cond);
+  g_cond_broadcast (&op_backend->cond);
   g_mutex_unlock (&op_backend->mutex);
 }
 
@@ -804,7 +861,7 @@ session_connected_cb (DBusGProxy *proxy,
 
   g_mutex_lock (&op_backend->mutex);
   op_backend->status = ASYNC_SUCCESS;
-  g_cond_signal (&op_backend->cond);
+  g_cond_broadcast (&op_backend->cond);
   g_mutex_unlock (&op_backend->mutex);
 }
 
@@ -817,7 +874,10 @@ cancelled_cb (DBusGProxy *proxy, gpointer user_data)
 
   g_mutex_lock (&op_backend->mutex);
   op_backend->status = ASYNC_ERROR;
-  g_cond_signal (&op_backend->cond);
+  if (op_backend->read_handle != NULL &&
+      op_backend->read_handle->transfer_status == ASYNC_RUNNING)
+    op_backend->read_handle->transfer_status = ASYNC_ERROR;
+  g_cond_broadcast (&op_backend->cond);
   g_mutex_unlock (&op_backend->mutex);
 }
 
@@ -1028,10 +1088,65 @@ transfer_started_cb (DBusGProxy *proxy, const gchar *filename,
 
   g_mutex_lock (&op_backend->mutex);
   op_backend->status = ASYNC_SUCCESS;
-  g_cond_signal (&op_backend->cond);
+  g_cond_broadcast (&op_backend->cond);
+  g_mutex_unlock (&op_backend->mutex);
+}
+
+/* The transfer signals are connected for each open handle, but they are
+ * about whichever transfer is running: only the handle that started it,
+ * op_backend->read_handle, takes them into account. */
+
+/* More data got written to the file being read, wake up do_read () */
+static void
+read_transfer_progress_cb (DBusGProxy *proxy,
+                           guint64 bytes_transferred,
+                           gpointer user_data)
+{
+  ObexFTPOpenHandle *handle = user_data;
+  GVfsBackendObexftp *op_backend = handle->backend;
+
+  g_mutex_lock (&op_backend->mutex);
+  g_cond_broadcast (&op_backend->cond);
   g_mutex_unlock (&op_backend->mutex);
 }
 
+static void
+read_transfer_completed_cb (DBusGProxy *proxy,
+                            gpointer user_data)
+{
+  ObexFTPOpenHandle *handle = user_data;
+  GVfsBackendObexftp *op_backend = handle->backend;
+
+  g_message ("transfer completed");
+
+  g_mutex_lock (&op_backend->mutex);
+  if (op_backend->read_handle == handle)
+    handle->transfer_status = ASYNC_SUCCESS;
+  g_cond_broadcast (&op_backend->cond);
+  g_mutex_unlock (&op_backend->mutex);
+}
+
+static void
+read_transfer_disconnect_signals (ObexFTPOpenHandle *handle)
+{
+  GVfsBackendObexftp *op_backend = handle->backend;
+
+  dbus_g_proxy_disconnect_signal (op_backend->session_proxy, "TransferProgress",
+                                  G_CALLBACK (read_transfer_progress_cb), handle);
+  dbus_g_proxy_disconnect_signal (op_backend->session_proxy, "TransferCompleted",
+                                  G_CALLBACK (read_transfer_completed_cb), handle);
+}
+
+static void
+open_handle_free (ObexFTPOpenHandle *handle)
+{
+  close (handle->fd);
+  if (handle->transfer_error != NULL)
+    g_error_free (handle->transfer_error);
+  g_free (handle->source);
+  g_free (handle);
+}
+
 static void
 do_open_for_read (GVfsBackend *backend,
                   GVfsJobOpenForRead *job,
@@ -1039,7 +1154,7 @@ do_open_for_read (GVfsBackend *backend,
 {
   GVfsBackendObexftp *op_backend = G_VFS_BACKEND_OBEXFTP (backend);
   GError *error = NULL;
-  ObexFTPOpenHandle *handle;
+  ObexFTPOpenHandle *handle, *previous;
   char *target, *basename;
   GFileInfo *info;
   goffset size;
@@ -1107,10 +1222,26 @@ do_open_for_read (GVfsBackend *backend,
       return;
     }
 
+  handle = g_new0 (ObexFTPOpenHandle, 1);
+  handle->backend = op_backend;
+  handle->source = g_strdup (filename);
+  handle->fd = fd;
+  handle->size = size;
+  handle->transfer_status = ASYNC_PENDING;
+
+  /* Given back if our transfer doesn't start */
+  previous = op_backend->read_handle;
+
   op_backend->status = ASYNC_PENDING;
+  op_backend->read_handle = handle;
 
+  /* The transfer may complete before we get to wait for it */
   dbus_g_proxy_connect_signal(op_backend->session_proxy, "TransferStarted",
                               G_CALLBACK(transfer_started_cb), op_backend, NULL);
+  dbus_g_proxy_connect_signal(op_backend->session_proxy, "TransferProgress",
+                              G_CALLBACK(read_transfer_progress_cb), handle, NULL);
+  dbus_g_proxy_connect_signal(op_backend->session_proxy, "TransferCompleted",
+                              G_CALLBACK(read_transfer_completed_cb), handle, NULL);
 
   basename = g_path_get_basename (filename);
   if (dbus_g_proxy_call (op_backend->session_proxy, "CopyRemoteFile", &error,
@@ -1127,11 +1258,14 @@ do_open_for_read (GVfsBackend *backend,
 
       dbus_g_proxy_disconnect_signal(op_backend->session_proxy, "TransferStarted",
                                      G_CALLBACK(transfer_started_cb), op_backend);
+      read_transfer_disconnect_signals (handle);
+      if (op_backend->read_handle == handle)
+        op_backend->read_handle = previous;
 
       /* Close the target */
       g_unlink (target);
       g_free (target);
-      close (fd);
+      open_handle_free (handle);
 
       op_backend->doing_io = FALSE;
       g_mutex_unlock (&op_backend->mutex);
@@ -1157,9 +1291,13 @@ do_open_for_read (GVfsBackend *backend,
 
   if (success == ASYNC_ERROR)
     {
+      read_transfer_disconnect_signals (handle);
+      if (op_backend->read_handle == handle)
+        op_backend->read_handle = previous;
+      open_handle_free (handle);
+
       op_backend->doing_io = FALSE;
       g_mutex_unlock (&op_backend->mutex);
-      close (fd);
       g_vfs_job_failed_from_error (G_VFS_JOB (job),
                                    op_backend->error);
       g_error_free (op_backend->error);
@@ -1167,10 +1305,10 @@ do_open_for_read (GVfsBackend *backend,
       return;
     }
 
-  handle = g_new0 (ObexFTPOpenHandle, 1);
-  handle->source = g_strdup (filename);
-  handle->fd = fd;
-  handle->size = size;
+  /* Unless it already completed */
+  if (handle->transfer_status == ASYNC_PENDING)
+    handle->transfer_status = ASYNC_RUNNING;
+
   g_vfs_job_open_for_read_set_handle (job, handle);
 
   g_debug ("- do_open_for_read, filename: %s\n", filename);
@@ -1182,22 +1320,14 @@ do_open_for_read (GVfsBackend *backend,
   g_mutex_unlock (&op_backend->mutex);
 }
 
-static int
-is_busy (DBusGProxy *session_proxy, GVfsJob *job)
+static void
+read_cancelled_cb (GVfsJob *job, gpointer user_data)
 {
-  GError *error = NULL;
-  gboolean busy;
-
-  if (dbus_g_proxy_call (session_proxy, "IsBusy", &error,
-                         G_TYPE_INVALID,
-                         G_TYPE_BOOLEAN, &busy, G_TYPE_INVALID) == FALSE)
-    {
-      g_vfs_job_failed_from_error (job, error);
-      g_error_free (error);
-      return -1;
-    }
+  GVfsBackendObexftp *op_backend = G_VFS_BACKEND_OBEXFTP (user_data);
 
-  return busy;
+  g_mutex_lock (&op_backend->mutex);
+  g_cond_broadcast (&op_backend->cond);
+  g_mutex_unlock (&op_backend->mutex);
 }
 
 static void
@@ -1209,42 +1339,67 @@ do_read (GVfsBackend *backend,
 {
   GVfsBackendObexftp *op_backend = G_VFS_BACKEND_OBEXFTP (backend);
   ObexFTPOpenHandle *backend_handle = (ObexFTPOpenHandle *) handle;
-  ssize_t bytes_read = 0;
-  gboolean busy = TRUE;
+  ssize_t bytes_read;
+  gulong cancelled_tag;
+  int status, errsv;
 
-  while (bytes_read == 0 && busy != FALSE)
+  cancelled_tag = g_signal_connect (job, "cancelled",
+                                    G_CALLBACK (read_cancelled_cb), op_backend);
+
+  /* obex-data-server is still writing the file while we read it. When we
+   * catch up with it, sleep until it signals progress, completion or an
+   * error, or until the job gets cancelled. */
+  g_mutex_lock (&op_backend->mutex);
+  while (TRUE)
     {
+      /* Look at the status before reading, so that data written just
+       * before completion isn't mistaken for the end of the file */
+      status = backend_handle->transfer_status;
+
       bytes_read = read (backend_handle->fd, buffer, bytes_requested);
-      if (bytes_read != 0)
-            break;
+      errsv = errno;
+      if (bytes_read == -1 && errsv == EINTR)
+        continue;
+      if (bytes_read != 0 || status != ASYNC_RUNNING)
+        break;
 
       if (g_vfs_job_is_cancelled (G_VFS_JOB (job)))
-        {
-          g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
-                            G_IO_ERROR_CANCELLED,
-                            _("Operation was cancelled"));
-          return;
-        }
+        break;
 
-      busy = is_busy (op_backend->session_proxy, G_VFS_JOB (job));
-      if (busy < 0)
-            return;
-
-      g_usleep (G_USEC_PER_SEC / 100);
+      g_cond_wait (&op_backend->cond, &op_backend->mutex);
     }
+  g_mutex_unlock (&op_backend->mutex);
+
+  g_signal_handler_disconnect (job, cancelled_tag);
 
   if (bytes_read < 0)
     {
-      g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
+      g_vfs_job_failed_from_errno (G_VFS_JOB (job), errsv);
     }
-  else if (bytes_read == 0)
+  else if (bytes_read > 0)
     {
-      g_vfs_job_read_set_size (job, 0);
+      g_vfs_job_read_set_size (job, bytes_read);
       g_vfs_job_succeeded (G_VFS_JOB (job));
     }
+  else if (status == ASYNC_RUNNING)
+    {
+      g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                        G_IO_ERROR_CANCELLED,
+                        _("Operation was cancelled"));
+    }
+  else if (status == ASYNC_ERROR)
+    {
+      if (backend_handle->transfer_error != NULL)
+        g_vfs_job_failed_from_error (G_VFS_JOB (job),
+                                     backend_handle->transfer_error);
+      else
+        g_vfs_job_failed (G_VFS_JOB (job), G_IO_ERROR,
+                          G_IO_ERROR_CANCELLED,
+                          _("Operation was cancelled"));
+    }
   else
     {
-      g_vfs_job_read_set_size (job, bytes_read);
+      g_vfs_job_read_set_size (job, 0);
       g_vfs_job_succeeded (G_VFS_JOB (job));
     }
 }
@@ -1256,35 +1411,33 @@ do_close_read (GVfsBackend *backend,
 {
   GVfsBackendObexftp *op_backend = G_VFS_BACKEND_OBEXFTP (backend);
   ObexFTPOpenHandle *backend_handle = (ObexFTPOpenHandle *) handle;
-  int busy;
 
   g_debug ("+ do_close_read\n");
 
-  busy = is_busy (op_backend->session_proxy, G_VFS_JOB (job));
-  if (busy < 0) {
-      g_message ("busy error");
-        return;
-  }
-
   g_mutex_lock (&op_backend->mutex);
 
-  if (busy > 0)
+  /* Stop the download if it didn't finish yet */
+  if (backend_handle->transfer_status == ASYNC_RUNNING)
     {
       op_backend->status = ASYNC_PENDING;
 
       if (dbus_g_proxy_call (op_backend->session_proxy, "Cancel", NULL,
                          G_TYPE_INVALID, G_TYPE_INVALID) != FALSE)
         {
-          while (op_backend->status == ASYNC_PENDING)
+          /* Wait for Cancelled, or TransferCompleted if we were too late */
+          while (op_backend->status == ASYNC_PENDING &&
+                 backend_handle->transfer_status == ASYNC_RUNNING)
                 g_cond_wait (&op_backend->cond, &op_backend->mutex);
         }
     }
 
+  read_transfer_disconnect_signals (backend_handle);
+  if (op_backend->read_handle == backend_handle)
+    op_backend->read_handle = NULL;
+
   g_mutex_unlock (&op_backend->mutex);
 
-  close (backend_handle->fd);
-  g_free (backend_handle->source);
-  g_free (backend_handle);
+  open_handle_free (backend_handle);
 
   g_vfs_job_succeeded (G_VFS_JOB (job));
 
@@ -1557,7 +1710,7 @@ push_transfer_started_cb (DBusGProxy *proxy,
     job_data->progress_callback (0, job_data->total_bytes,
                                  job_data->progress_callback_data);
 
-  g_cond_signal (&op_backend->cond);
+  g_cond_broadcast (&op_backend->cond);
   g_mutex_unlock (&op_backend->mutex);
 }
 
@@ -1574,7 +1727,7 @@ push_transfer_completed_cb (DBusGProxy *proxy,
 
   op_backend->status = ASYNC_SUCCESS;
 
-  g_cond_signal (&op_backend->cond);
+  g_cond_broadcast (&op_backend->cond);
   g_mutex_unlock (&op_backend->mutex);
 }
 
@@ -1843,7 +1996,7 @@ do_push (GVfsBackend *backend,
   /* we called _query_file_info_helper (), so we need to invalidate the
    * cache, as a query_info () will be called on us after we return.
    */
-  _invalidate_cache_helper (op_backend);
+  _invalidate_cache_helper (op_backend, destination);
 
   if (remove_source && g_unlink (local_path) == -1)
     {
@@ -2018,6 +2171,8 @@ do_delete (GVfsBackend *backend,
     }
   g_free (basename);
 
+  _invalidate_cache_helper (op_backend, filename);
+
   g_vfs_job_succeeded (G_VFS_JOB (job));
 
   g_mutex_unlock (&op_backend->mutex);
@@ -2101,10 +2256,10 @@ do_make_directory (GVfsBackend *backend,
     }
   g_free (basename);
 
-  /* reset the current directory so that we won't cache when querying
+  /* drop the parent's listing so that we won't use it when querying
    * info after this has succeeded.
    */
-  _invalidate_cache_helper (op_backend);
+  _invalidate_cache_helper (op_backend, filename);
 
   g_vfs_job_succeeded (G_VFS_JOB (job));
 
@@ -47,7 +47,10 @@
 #include "gvfsjobqueryfsinfo.h"
 #include "gvfsjobqueryattributes.h"
 #include "gvfsjobenumerate.h"
+#include "gvfsjobpull.h"
+#include "gvfsjobpush.h"
 #include "gvfsdaemonprotocol.h"
+#include "gvfsdaemonutils.h"
 #include "gvfskeyring.h"
 
 #include <libsmbclient.h>
@@ -676,6 +679,11 @@ try_mount (GVfsBackend *backend,
   return FALSE;
 }
 
+/* Largest single read or write we hand to libsmbclient. It pipelines the
+ * request as max-read/max-write sized SMB2 (or 64k SMB1) operations.
+ */
+#define SMB_IO_BLOCK_SIZE (4 * 1024 * 1024)
+
 static int
 fixup_open_errno (int err)
 {
@@ -739,13 +747,12 @@ do_read (GVfsBackend *backend,
   ssize_t res;
   smbc_read_fn smbc_read;
 
-  /* libsmbclient limits blocksize to (64*1024)-2 for Windows servers,
-   * let's do the same here to achieve reasonable performance. (#588391)
-   *
-   * TODO: port to pull mechanism (#592468)
+  /* libsmbclient splits larger reads into pieces of the size negotiated
+   * with the server and keeps several of them in flight, so don't cut
+   * requests down to a single 64k SMB1 read. (#588391)
    */
-  if (bytes_requested > 65534)
-    bytes_requested = 65534;
+  if (bytes_requested > SMB_IO_BLOCK_SIZE)
+    bytes_requested = SMB_IO_BLOCK_SIZE;
 
   smbc_read = smbc_getFunctionRead (op_backend->smb_context);
   res = smbc_read (op_backend->smb_context, (SMBCFILE *)handle, buffer, bytes_requested);
@@ -1760,50 +1767,93 @@ do_set_attribute (GVfsBackend *backend,
     g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
+/* Files the server gives attributes for in each FIND_FIRST2/FIND_NEXT2
+ * reply; we hand them to the client in batches of about that size.
+ */
+#define ENUMERATE_BATCH_SIZE 100
+
+static gboolean
+enumerate_skip_entry (const char *name)
+{
+  return strcmp (name, ".") == 0 || strcmp (name, "..") == 0;
+}
+
 static void
-do_enumerate (GVfsBackend *backend,
-	      GVfsJobEnumerate *job,
-	      const char *filename,
-	      GFileAttributeMatcher *matcher,
-	      GFileQueryInfoFlags flags)
+enumerate_flush (GVfsJobEnumerate *job,
+		 GList **files)
+{
+  if (*files == NULL)
+    return;
+
+  *files = g_list_reverse (*files);
+  g_vfs_job_enumerate_add_infos (job, *files);
+  g_list_foreach (*files, (GFunc)g_object_unref, NULL);
+  g_list_free (*files);
+  *files = NULL;
+}
+
+#ifdef HAVE_SAMBA_READDIRPLUS2
+/* The directory listing reply already carries size, times and attributes
+ * of every entry, so we don't need a stat round trip per file.
+ */
+static void
+enumerate_plus (GVfsBackendSmb *op_backend,
+		GVfsJobEnumerate *job,
+		SMBCFILE *dir,
+		GFileAttributeMatcher *matcher)
+{
+  smbc_readdirplus2_fn smbc_readdirplus2;
+  const struct libsmb_file_info *file_info;
+  struct stat st;
+  GList *files;
+  GFileInfo *info;
+  int n_files;
+
+  smbc_readdirplus2 = smbc_getFunctionReaddirPlus2 (op_backend->smb_context);
+
+  files = NULL;
+  n_files = 0;
+
+  while ((file_info = smbc_readdirplus2 (op_backend->smb_context, dir, &st)) != NULL)
+    {
+      if (file_info->name == NULL || enumerate_skip_entry (file_info->name))
+	continue;
+
+      info = g_file_info_new ();
+      set_info_from_stat (op_backend, info, &st, file_info->name, matcher);
+      files = g_list_prepend (files, info);
+
+      if (++n_files == ENUMERATE_BATCH_SIZE)
+	{
+	  enumerate_flush (job, &files);
+	  n_files = 0;
+	}
+    }
+
+  enumerate_flush (job, &files);
+}
+#endif
+
+/* For libsmbclient without readdirplus2 we have to stat each entry */
+static void
+enumerate_stat (GVfsBackendSmb *op_backend,
+		GVfsJobEnumerate *job,
+		SMBCFILE *dir,
+		GString *uri,
+		GFileAttributeMatcher *matcher)
 {
-  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
   struct stat st;
   int res;
-  GError *error;
-  SMBCFILE *dir;
   char dirents[1024*4];
   struct smbc_dirent *dirp;
   GList *files;
   GFileInfo *info;
-  GString *uri;
   int uri_start_len;
-  smbc_opendir_fn smbc_opendir;
   smbc_getdents_fn smbc_getdents;
   smbc_stat_fn smbc_stat;
-  smbc_closedir_fn smbc_closedir;
 
-  uri = create_smb_uri_string (op_backend->server, op_backend->share, filename);
-  
-  smbc_opendir = smbc_getFunctionOpendir (op_backend->smb_context);
   smbc_getdents = smbc_getFunctionGetdents (op_backend->smb_context);
   smbc_stat = smbc_getFunctionStat (op_backend->smb_context);
-  smbc_closedir = smbc_getFunctionClosedir (op_backend->smb_context);
-  
-  dir = smbc_opendir (op_backend->smb_context, uri->str);
-
-  if (dir == NULL)
-    {
-      int errsv = errno;
-
-      error = NULL;
-      g_set_error_literal (&error, G_IO_ERROR,
-			   g_io_error_from_errno (errsv),
-			   g_strerror (errsv));
-      goto error;
-    }
-
-  g_vfs_job_succeeded (G_VFS_JOB (job));
 
   if (uri->str[uri->len - 1] != '/')
     g_string_append_c (uri, '/');
@@ -1822,13 +1872,10 @@ do_enumerate (GVfsBackend *backend,
 	{
 	  unsigned int dirlen;
 
-	  /* TODO: Only do stat if required for flags */
-	  
 	  if ((dirp->smbc_type == SMBC_DIR ||
 	       dirp->smbc_type == SMBC_FILE ||
 	       dirp->smbc_type == SMBC_LINK) &&
-	      strcmp (dirp->name, ".") != 0 &&
-	      strcmp (dirp->name, "..") != 0)
+	      !enumerate_skip_entry (dirp->name))
 	    {
 	      int stat_res;
 	      g_string_truncate (uri, uri_start_len);
@@ -1861,16 +1908,55 @@ do_enumerate (GVfsBackend *backend,
 	  res -= dirlen;
 	}
       
-      if (files)
-	{
-	  files = g_list_reverse (files);
-	  g_vfs_job_enumerate_add_infos (job, files);
-	  g_list_foreach (files, (GFunc)g_object_unref, NULL);
-	  g_list_free (files);
-	}
+      enumerate_flush (job, &files);
     }
-      
-  res = smbc_closedir (op_backend->smb_context, dir);
+}
+
+static void
+do_enumerate (GVfsBackend *backend,
+	      GVfsJobEnumerate *job,
+	      const char *filename,
+	      GFileAttributeMatcher *matcher,
+	      GFileQueryInfoFlags flags)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  GError *error;
+  SMBCFILE *dir;
+  GString *uri;
+  smbc_opendir_fn smbc_opendir;
+  smbc_closedir_fn smbc_closedir;
+
+  uri = create_smb_uri_string (op_backend->server, op_backend->share, filename);
+  
+  smbc_opendir = smbc_getFunctionOpendir (op_backend->smb_context);
+  smbc_closedir = smbc_getFunctionClosedir (op_backend->smb_context);
+  
+  dir = smbc_opendir (op_backend->smb_context, uri->str);
+
+  if (dir == NULL)
+    {
+      int errsv = errno;
+
+      error = NULL;
+      g_set_error_literal (&error, G_IO_ERROR,
+			   g_io_error_from_errno (errsv),
+			   g_strerror (errsv));
+      goto error;
+    }
+
+  g_vfs_job_succeeded (G_VFS_JOB (job));
+
+#ifdef HAVE_SAMBA_READDIRPLUS2
+  if (matcher == NULL ||
+      g_file_attribute_matcher_matches_only (matcher, G_FILE_ATTRIBUTE_STANDARD_NAME))
+    enumerate_stat (op_backend, job, dir, uri, matcher);
+  else
+    enumerate_plus (op_backend, job, dir, matcher);
+#else
+  enumerate_stat (op_backend, job, dir, uri, matcher);
+#endif
+
+  smbc_closedir (op_backend->smb_context, dir);
 
   g_vfs_job_enumerate_done (job);
 
@@ -2148,6 +2234,349 @@ do_move (GVfsBackend *backend,
     g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
+/* Checks done by both pull () and push () before copying: the source must
+ * be a regular file and the destination must not be a directory, or exist
+ * at all without G_FILE_COPY_OVERWRITE. Backups are left to the generic
+ * copy fallback.
+ */
+static gboolean
+check_copy_target (GVfsJob *job,
+		   gboolean source_is_dir,
+		   gboolean target_exists,
+		   gboolean target_is_dir,
+		   GFileCopyFlags flags)
+{
+  if (flags & G_FILE_COPY_BACKUP)
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			_("backups not supported"));
+      return FALSE;
+    }
+
+  if (source_is_dir)
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+			_("Can't recursively copy directory"));
+      return FALSE;
+    }
+
+  if (target_exists && !(flags & G_FILE_COPY_OVERWRITE))
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_EXISTS,
+			_("Target file already exists"));
+      return FALSE;
+    }
+
+  if (target_is_dir)
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+			_("Can't copy file over directory"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+fail_copy (GVfsJob *job, int errsv)
+{
+  if (errsv == ECANCELED)
+    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+		      _("Operation was cancelled"));
+  else
+    g_vfs_job_failed_literal (job, G_IO_ERROR,
+			      g_io_error_from_errno (errsv),
+			      g_strerror (errsv));
+}
+
+static void
+do_pull (GVfsBackend *backend,
+	 GVfsJobPull *job,
+	 const char *source,
+	 const char *local_path,
+	 GFileCopyFlags flags,
+	 gboolean remove_source,
+	 GFileProgressCallback progress_callback,
+	 gpointer progress_callback_data)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  char *uri;
+  char *buffer;
+  char *tmp_path;
+  SMBCFILE *file;
+  struct stat st, local_st;
+  gboolean local_exists;
+  goffset copied;
+  ssize_t res;
+  int fd, errsv;
+  GError *error;
+  smbc_stat_fn smbc_stat;
+  smbc_open_fn smbc_open;
+  smbc_read_fn smbc_read;
+  smbc_close_fn smbc_close;
+  smbc_unlink_fn smbc_unlink;
+
+  smbc_stat = smbc_getFunctionStat (op_backend->smb_context);
+  smbc_open = smbc_getFunctionOpen (op_backend->smb_context);
+  smbc_read = smbc_getFunctionRead (op_backend->smb_context);
+  smbc_close = smbc_getFunctionClose (op_backend->smb_context);
+  smbc_unlink = smbc_getFunctionUnlink (op_backend->smb_context);
+
+  uri = create_smb_uri (op_backend->server, op_backend->share, source);
+
+  if (smbc_stat (op_backend->smb_context, uri, &st) == -1)
+    {
+      g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
+      g_free (uri);
+      return;
+    }
+
+  local_exists = g_lstat (local_path, &local_st) == 0;
+
+  if (!check_copy_target (G_VFS_JOB (job), S_ISDIR (st.st_mode),
+			  local_exists,
+			  local_exists && S_ISDIR (local_st.st_mode),
+			  flags))
+    {
+      g_free (uri);
+      return;
+    }
+
+  errno = 0;
+  file = smbc_open (op_backend->smb_context, uri, O_RDONLY, 0);
+  if (file == NULL)
+    {
+      g_vfs_job_failed_from_errno (G_VFS_JOB (job), fixup_open_errno (errno));
+      g_free (uri);
+      return;
+    }
+
+  /* Download next to local_path, so a failure leaves it alone */
+  error = NULL;
+  fd = gvfs_pull_open_temp (local_path, flags, &tmp_path, &error);
+  if (fd == -1)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+      smbc_close (op_backend->smb_context, file);
+      g_free (uri);
+      return;
+    }
+
+  buffer = g_malloc (SMB_IO_BLOCK_SIZE);
+  copied = 0;
+  errsv = 0;
+
+  while (errsv == 0)
+    {
+      char *p;
+
+      if (g_vfs_job_is_cancelled (G_VFS_JOB (job)))
+	{
+	  errsv = ECANCELED;
+	  break;
+	}
+
+      res = smbc_read (op_backend->smb_context, file, buffer, SMB_IO_BLOCK_SIZE);
+      if (res <= 0)
+	{
+	  if (res < 0)
+	    errsv = errno;
+	  break;
+	}
+
+      for (p = buffer; res > 0 && errsv == 0; )
+	{
+	  ssize_t written = write (fd, p, res);
+
+	  if (written == -1)
+	    {
+	      if (errno != EINTR)
+		errsv = errno;
+	      continue;
+	    }
+
+	  p += written;
+	  res -= written;
+	  copied += written;
+	}
+
+      if (errsv == 0 && progress_callback)
+	progress_callback (copied, st.st_size, progress_callback_data);
+    }
+
+  g_free (buffer);
+  smbc_close (op_backend->smb_context, file);
+
+  if (close (fd) == -1 && errsv == 0)
+    errsv = errno;
+
+  if (!gvfs_pull_finish_temp (local_path, flags, tmp_path, errsv == 0, &error))
+    {
+      if (error)
+	{
+	  g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+	  g_error_free (error);
+	}
+      else
+	fail_copy (G_VFS_JOB (job), errsv);
+    }
+  else if (remove_source &&
+	   smbc_unlink (op_backend->smb_context, uri) == -1)
+    g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+
+  g_free (tmp_path);
+  g_free (uri);
+}
+
+static void
+do_push (GVfsBackend *backend,
+	 GVfsJobPush *job,
+	 const char *destination,
+	 const char *local_path,
+	 GFileCopyFlags flags,
+	 gboolean remove_source,
+	 GFileProgressCallback progress_callback,
+	 gpointer progress_callback_data)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  char *uri, *tmp_uri;
+  char *buffer;
+  SMBCFILE *file;
+  struct stat st, local_st;
+  gboolean target_exists;
+  goffset copied;
+  ssize_t res;
+  int fd, errsv;
+  smbc_stat_fn smbc_stat;
+  smbc_write_fn smbc_write;
+  smbc_close_fn smbc_close;
+  smbc_unlink_fn smbc_unlink;
+  smbc_rename_fn smbc_rename;
+
+  smbc_stat = smbc_getFunctionStat (op_backend->smb_context);
+  smbc_write = smbc_getFunctionWrite (op_backend->smb_context);
+  smbc_close = smbc_getFunctionClose (op_backend->smb_context);
+  smbc_unlink = smbc_getFunctionUnlink (op_backend->smb_context);
+  smbc_rename = smbc_getFunctionRename (op_backend->smb_context);
+
+  fd = g_open (local_path, O_RDONLY, 0);
+  if (fd == -1 || fstat (fd, &local_st) == -1)
+    {
+      fail_copy (G_VFS_JOB (job), errno);
+      if (fd != -1)
+	close (fd);
+      return;
+    }
+
+  uri = create_smb_uri (op_backend->server, op_backend->share, destination);
+
+  target_exists = smbc_stat (op_backend->smb_context, uri, &st) == 0;
+
+  if (!check_copy_target (G_VFS_JOB (job), S_ISDIR (local_st.st_mode),
+			  target_exists,
+			  target_exists && S_ISDIR (st.st_mode),
+			  flags))
+    {
+      close (fd);
+      g_free (uri);
+      return;
+    }
+
+  /* Upload to a temporary file and only replace the target with it
+     once complete, so a failure leaves the target alone */
+  file = open_tmpfile (op_backend, uri, &tmp_uri);
+  if (file == NULL)
+    {
+      g_vfs_job_failed_from_errno (G_VFS_JOB (job), fixup_open_errno (errno));
+      close (fd);
+      g_free (uri);
+      return;
+    }
+
+  buffer = g_malloc (SMB_IO_BLOCK_SIZE);
+  copied = 0;
+  errsv = 0;
+
+  while (errsv == 0)
+    {
+      char *p;
+
+      if (g_vfs_job_is_cancelled (G_VFS_JOB (job)))
+	{
+	  errsv = ECANCELED;
+	  break;
+	}
+
+      res = read (fd, buffer, SMB_IO_BLOCK_SIZE);
+      if (res == -1 && errno == EINTR)
+	continue;
+      if (res <= 0)
+	{
+	  if (res < 0)
+	    errsv = errno;
+	  break;
+	}
+
+      for (p = buffer; res > 0 && errsv == 0; )
+	{
+	  ssize_t written;
+
+	  written = smbc_write (op_backend->smb_context, file, p, res);
+	  if (written < 0)
+	    {
+	      errsv = errno;
+	      continue;
+	    }
+
+	  p += written;
+	  res -= written;
+	  copied += written;
+	}
+
+      if (errsv == 0 && progress_callback)
+	progress_callback (copied, local_st.st_size, progress_callback_data);
+    }
+
+  g_free (buffer);
+  close (fd);
+
+  if (smbc_close (op_backend->smb_context, file) == -1 && errsv == 0)
+    errsv = errno;
+
+  if (errsv == 0 &&
+      smbc_rename (op_backend->smb_context, tmp_uri,
+		   op_backend->smb_context, uri) == -1)
+    {
+      errsv = errno;
+
+      /* SMB doesn't rename over existing files */
+      if (errsv == EEXIST && (flags & G_FILE_COPY_OVERWRITE))
+	{
+	  errsv = 0;
+	  if (smbc_unlink (op_backend->smb_context, uri) == -1 ||
+	      smbc_rename (op_backend->smb_context, tmp_uri,
+			   op_backend->smb_context, uri) == -1)
+	    errsv = errno;
+	}
+    }
+
+  if (errsv != 0)
+    {
+      smbc_unlink (op_backend->smb_context, tmp_uri);
+      fail_copy (G_VFS_JOB (job), errsv);
+    }
+  else if (remove_source && g_unlink (local_path) == -1)
+    fail_copy (G_VFS_JOB (job), errno);
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+
+  g_free (tmp_uri);
+  g_free (uri);
+}
+
 static void
 g_vfs_backend_smb_class_init (GVfsBackendSmbClass *klass)
 {
@@ -2177,6 +2606,8 @@ g_vfs_backend_smb_class_init (GVfsBackendSmbClass *klass)
   backend_class->delete = do_delete;
   backend_class->make_directory = do_make_directory;
   backend_class->move = do_move;
+  backend_class->pull = do_pull;
+  backend_class->push = do_push;
   backend_class->try_query_settable_attributes = try_query_settable_attributes;
   backend_class->set_attribute = do_set_attribute;
 }
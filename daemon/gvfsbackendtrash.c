@@ -16,6 +16,7 @@
 
 #include "trashlib/trashwatcher.h"
 #include "trashlib/trashitem.h"
+#include "trashlib/trashexpunge.h"
 
 #include "gvfsjobcreatemonitor.h"
 #include "gvfsjobopenforread.h"
@@ -486,6 +487,7 @@ trash_backend_add_info (TrashItem *item,
     {
       const gchar *delete_date;
       GFile *original;
+      goffset size;
 
       g_assert (item != NULL);
 
@@ -512,6 +514,9 @@ trash_backend_add_info (TrashItem *item,
         g_file_info_set_attribute_string (info,
                                           "trash::deletion-date",
                                           delete_date);
+
+      if (trash_item_get_size (item, &size))
+        g_file_info_set_attribute_uint64 (info, "trash::size", size);
     }
 
   g_file_info_set_attribute_boolean (info,
@@ -532,57 +537,55 @@ trash_backend_add_info (TrashItem *item,
 }
 
 static void
-trash_backend_enumerate_root (GVfsBackendTrash      *backend,
-                              GVfsJobEnumerate      *job,
-                              GFileAttributeMatcher *attribute_matcher,
-                              GFileQueryInfoFlags    flags)
+trash_backend_enumerate_item (TrashItem *item,
+                              GFileInfo *info,
+                              gpointer   user_data)
 {
-  GList *items, *node;
+  GVfsJobEnumerate *job = user_data;
+  GFile *original;
 
-  g_vfs_job_succeeded (G_VFS_JOB (job));
+  /* the standard attributes are always queried */
+  g_file_info_set_attribute_mask (info, job->attribute_matcher);
 
-  items = trash_root_get_items (backend->root);
+  g_file_info_set_name (info, trash_item_get_escaped_name (item));
+  trash_backend_add_info (item, info, TRUE);
 
-  for (node = items; node; node = node->next)
-    {
-      TrashItem *item = node->data;
-      GFileInfo *info;
+  original = trash_item_get_original (item);
 
-      info = g_file_query_info (trash_item_get_file (item),
-                                job->attributes, flags,
-                                G_VFS_JOB (job)->cancellable, NULL);
-
-      if (info)
-        {
-          GFile *original;
-
-          g_file_info_set_attribute_mask (info, attribute_matcher);
+  if (original)
+    {
+      char *basename;
 
-          g_file_info_set_name (info, trash_item_get_escaped_name (item));
-          trash_backend_add_info (item, info, TRUE);
+      basename = g_file_get_basename (original);
 
-          original = trash_item_get_original (item);
+      /* XXX utf8 */
+      g_file_info_set_display_name (info, basename);
+      g_free (basename);
+    }
 
-          if (original)
-            {
-              char *basename;
+  g_vfs_job_enumerate_add_info (job, info);
+}
 
-              basename = g_file_get_basename (original);
+static void
+trash_backend_enumerate_root (GVfsBackendTrash      *backend,
+                              GVfsJobEnumerate      *job,
+                              GFileAttributeMatcher *attribute_matcher,
+                              GFileQueryInfoFlags    flags)
+{
+  GList *items;
 
-              /* XXX utf8 */
-              g_file_info_set_display_name (info, basename);
-              g_free (basename);
-            }
+  g_vfs_job_succeeded (G_VFS_JOB (job));
 
-          g_vfs_job_enumerate_add_info (job, info);
-          g_object_unref (info);
-        }
+  items = trash_root_get_items (backend->root);
 
-      trash_item_unref (item);
-    }
+  /* cached infos are sent right away, the others as soon as they
+   * have been queried */
+  trash_root_query_infos (backend->root, items, job->attributes, flags,
+                          G_VFS_JOB (job)->cancellable,
+                          trash_backend_enumerate_item, job);
 
   g_vfs_job_enumerate_done (job);
-  g_list_free (items);
+  trash_item_list_free (items);
 }
 
 static void
@@ -679,6 +682,25 @@ trash_backend_mount (GVfsBackend  *vfs_backend,
   return TRUE;
 }
 
+/* sizes are measured in the background, trash::size-pending tells how
+ * many items trash::size does not account for yet */
+static void
+trash_backend_add_size_info (GVfsBackendTrash *backend,
+                             GFileInfo        *info)
+{
+  goffset size;
+  char **dir_sizes;
+  int n_pending;
+
+  size = trash_root_get_size (backend->root, &n_pending);
+  g_file_info_set_attribute_uint64 (info, "trash::size", size);
+  g_file_info_set_attribute_uint32 (info, "trash::size-pending", n_pending);
+
+  dir_sizes = trash_root_get_dir_sizes (backend->root);
+  g_file_info_set_attribute_stringv (info, "trash::size-per-root", dir_sizes);
+  g_strfreev (dir_sizes);
+}
+
 static gboolean
 trash_backend_query_info (GVfsBackend           *vfs_backend,
                           GVfsJobQueryInfo      *job,
@@ -705,16 +727,24 @@ trash_backend_query_info (GVfsBackend           *vfs_backend,
         {
           GFileInfo *real_info;
 
-          real_info = g_file_query_info (real, 
-                                         job->attributes,
-                                         flags,
-                                         G_VFS_JOB (job)->cancellable,
-                                         &error);
+          if (is_toplevel)
+            real_info = trash_item_get_info (item, job->attributes, flags,
+                                             G_VFS_JOB (job)->cancellable,
+                                             &error);
+          else
+            real_info = g_file_query_info (real, 
+                                           job->attributes,
+                                           flags,
+                                           G_VFS_JOB (job)->cancellable,
+                                           &error);
           g_object_unref (real);
 
           if (real_info)
             {
               g_file_info_copy_into (real_info, info);
+              /* the cached info has the standard attributes too, and
+               * copy_into () dropped the mask */
+              g_file_info_set_attribute_mask (info, matcher);
               trash_backend_add_info (item, info, is_toplevel);
               g_vfs_job_succeeded (G_VFS_JOB (job));
               trash_item_unref (item);
@@ -733,6 +763,7 @@ trash_backend_query_info (GVfsBackend           *vfs_backend,
     {
       GIcon *icon;
       int n_items;
+      guint n_deleted, n_pending;
 
       n_items = trash_root_get_n_items (backend->root);
 
@@ -748,6 +779,12 @@ trash_backend_query_info (GVfsBackend           *vfs_backend,
 
       g_file_info_set_attribute_uint32 (info, "trash::item-count", n_items);
 
+      trash_backend_add_size_info (backend, info);
+
+      trash_expunge_get_progress (&n_deleted, &n_pending);
+      g_file_info_set_attribute_uint32 (info, "trash::expunge-pending", n_pending);
+      g_file_info_set_attribute_uint32 (info, "trash::expunged-count", n_deleted);
+
       g_vfs_job_succeeded (G_VFS_JOB (job));
     }
 
@@ -761,10 +798,14 @@ trash_backend_query_fs_info (GVfsBackend           *vfs_backend,
                              GFileInfo             *info,
                              GFileAttributeMatcher *matcher)
 {
+  GVfsBackendTrash *backend = G_VFS_BACKEND_TRASH (vfs_backend);
+
   g_file_info_set_attribute_string (info,
                                     G_FILE_ATTRIBUTE_FILESYSTEM_TYPE,
                                     "trash");
 
+  trash_backend_add_size_info (backend, info);
+
   g_file_info_set_attribute_boolean (info,
                                      G_FILE_ATTRIBUTE_FILESYSTEM_READONLY,
                                      FALSE);
@@ -41,6 +41,7 @@
 #include <gvfsjobcloseread.h>
 #include <gvfsjobclosewrite.h>
 #include <gvfsfileinfo.h>
+#include <gvfsstats.h>
 
 static void g_vfs_channel_job_source_iface_init (GVfsJobSourceIface *iface);
 
@@ -122,6 +123,8 @@ g_vfs_channel_finalize (GObject *object)
 
   channel = G_VFS_CHANNEL (object);
 
+  g_vfs_stats_channel_closed (channel);
+
   if (channel->priv->current_job)
     g_object_unref (channel->priv->current_job);
   channel->priv->current_job = NULL;
@@ -43,6 +43,7 @@
 #include <gvfsjobopenforread.h>
 #include <gvfsjobopenforwrite.h>
 #include <gvfsdbusutils.h>
+#include <gvfsstats.h>
 
 enum {
   PROP_0
@@ -885,6 +886,52 @@ daemon_start_mount (GVfsDaemon *daemon,
     }
 }
 
+static void
+daemon_handle_get_stats (DBusConnection *conn,
+			 DBusMessage *message,
+			 GVfsDaemon *daemon)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter, dict_iter;
+  guint n_jobs;
+
+  reply = dbus_message_new_method_return (message);
+  if (reply == NULL)
+    _g_dbus_oom ();
+
+  dbus_message_iter_init_append (reply, &iter);
+
+  if (!dbus_message_iter_open_container (&iter,
+					 DBUS_TYPE_ARRAY,
+					 DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					   DBUS_TYPE_STRING_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					 DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					 &dict_iter))
+    _g_dbus_oom ();
+
+  g_mutex_lock (&daemon->lock);
+  n_jobs = g_list_length (daemon->jobs);
+  g_mutex_unlock (&daemon->lock);
+
+  g_vfs_stats_append_counter (&dict_iter, "active-jobs", n_jobs);
+  g_vfs_stats_append_counter (&dict_iter, "threads",
+			      g_thread_pool_get_num_threads (daemon->thread_pool));
+  g_vfs_stats_append_counter (&dict_iter, "max-threads",
+			      MAX (g_thread_pool_get_max_threads (daemon->thread_pool), 0));
+  g_vfs_stats_append_counter (&dict_iter, "queued-jobs",
+			      g_thread_pool_unprocessed (daemon->thread_pool));
+  g_vfs_stats_append_counters (&dict_iter);
+
+  if (!dbus_message_iter_close_container (&iter, &dict_iter))
+    _g_dbus_oom ();
+
+  g_vfs_stats_append_details (&iter);
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+}
+
 static DBusHandlerResult
 daemon_message_func (DBusConnection *conn,
 		     DBusMessage    *message,
@@ -938,6 +985,14 @@ daemon_message_func (DBusConnection *conn,
       return DBUS_HANDLER_RESULT_HANDLED;
     }
 
+  if (dbus_message_is_method_call (message,
+				   G_VFS_DBUS_DAEMON_INTERFACE,
+				   G_VFS_DBUS_OP_GET_STATS))
+    {
+      daemon_handle_get_stats (conn, message, daemon);
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
   if (dbus_message_is_method_call (message,
 				   G_VFS_DBUS_DAEMON_INTERFACE,
 				   G_VFS_DBUS_OP_CANCEL))
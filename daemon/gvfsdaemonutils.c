@@ -30,9 +30,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <fcntl.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include <gio/gio.h>
 #include "gvfsdbusutils.h"
@@ -284,3 +286,112 @@ gvfs_file_info_populate_content_types (GFileInfo  *info,
   g_free (free_mimetype);
 }
 
+
+static void
+set_error_from_errno (GError **error, int errsv)
+{
+  g_set_error_literal (error, G_IO_ERROR,
+		       g_io_error_from_errno (errsv),
+		       g_strerror (errsv));
+}
+
+/**
+ * gvfs_pull_open_temp:
+ * @local_path: the file a pull job downloads to
+ * @flags: the #GFileCopyFlags of the job
+ * @tmp_path: return location for the name of the temporary file
+ * @error: a #GError, or %NULL
+ *
+ * Creates a temporary file next to @local_path for a pull job to write
+ * to, so that an existing @local_path is left alone until the download
+ * is complete. Unless @flags contains %G_FILE_COPY_OVERWRITE,
+ * @local_path is also created (empty) right away, which fails if it
+ * already exists.
+ *
+ * Finish the download with gvfs_pull_finish_temp().
+ *
+ * Returns: a file descriptor open for writing, or -1 on error.
+ **/
+int
+gvfs_pull_open_temp (const char      *local_path,
+		     GFileCopyFlags   flags,
+		     char           **tmp_path,
+		     GError         **error)
+{
+  char *dirname, *basename, *template;
+  int fd;
+
+  g_return_val_if_fail (local_path != NULL, -1);
+  g_return_val_if_fail (tmp_path != NULL, -1);
+
+  if (!(flags & G_FILE_COPY_OVERWRITE))
+    {
+      fd = g_open (local_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+      if (fd == -1)
+	{
+	  set_error_from_errno (error, errno);
+	  return -1;
+	}
+      close (fd);
+    }
+
+  dirname = g_path_get_dirname (local_path);
+  basename = g_path_get_basename (local_path);
+  template = g_strdup_printf ("%s/.%s.XXXXXX", dirname, basename);
+  g_free (dirname);
+  g_free (basename);
+
+  fd = g_mkstemp_full (template, O_WRONLY, 0666);
+  if (fd == -1)
+    {
+      set_error_from_errno (error, errno);
+      g_free (template);
+      if (!(flags & G_FILE_COPY_OVERWRITE))
+	g_unlink (local_path);
+      return -1;
+    }
+
+  *tmp_path = template;
+  return fd;
+}
+
+/**
+ * gvfs_pull_finish_temp:
+ * @local_path: the file a pull job downloads to
+ * @flags: the #GFileCopyFlags of the job
+ * @tmp_path: the temporary file from gvfs_pull_open_temp()
+ * @success: whether the download succeeded
+ * @error: a #GError, or %NULL
+ *
+ * If @success is %TRUE, moves @tmp_path over @local_path. Otherwise
+ * removes @tmp_path and, if gvfs_pull_open_temp() created it,
+ * @local_path. The file descriptor must be closed already.
+ *
+ * Returns: %TRUE if the file is in place, %FALSE if @success was
+ * %FALSE or renaming failed.
+ **/
+gboolean
+gvfs_pull_finish_temp (const char      *local_path,
+		       GFileCopyFlags   flags,
+		       const char      *tmp_path,
+		       gboolean         success,
+		       GError         **error)
+{
+  g_return_val_if_fail (local_path != NULL, FALSE);
+  g_return_val_if_fail (tmp_path != NULL, FALSE);
+
+  if (success && g_rename (tmp_path, local_path) == -1)
+    {
+      set_error_from_errno (error, errno);
+      success = FALSE;
+    }
+
+  if (!success)
+    {
+      g_unlink (tmp_path);
+      if (!(flags & G_FILE_COPY_OVERWRITE))
+	g_unlink (local_path);
+    }
+
+  return success;
+}
@@ -24,6 +24,7 @@
 #define __G_VFS_DAEMON_UTILS_H__
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <dbus/dbus.h>
 
 G_BEGIN_DECLS
@@ -47,6 +48,16 @@ void	     gvfs_file_info_populate_content_types  (GFileInfo        *info,
 						     const char       *basename,
 						     GFileType         type);
 
+int          gvfs_pull_open_temp                  (const char       *local_path,
+						   GFileCopyFlags    flags,
+						   char            **tmp_path,
+						   GError          **error);
+gboolean     gvfs_pull_finish_temp                (const char       *local_path,
+						   GFileCopyFlags    flags,
+						   const char       *tmp_path,
+						   gboolean          success,
+						   GError          **error);
+
 G_END_DECLS
 
 #endif /* __G_VFS_DAEMON_UTILS_H__ */
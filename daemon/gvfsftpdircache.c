@@ -28,6 +28,7 @@
 #include <glib/gi18n.h>
 
 #include "gvfsftpdircache.h"
+#include "gvfsstats.h"
 
 /*** CACHE ENTRY ***/
 
@@ -146,7 +147,12 @@ g_vfs_ftp_dir_cache_lookup_entry (GVfsFtpDirCache *  cache,
   if (entry && entry->stamp < stamp)
     g_vfs_ftp_dir_cache_entry_unref (entry);
   else if (entry)
-    return entry;
+    {
+      g_vfs_stats_cache_lookup ("ftp-dir", TRUE);
+      return entry;
+    }
+
+  g_vfs_stats_cache_lookup ("ftp-dir", FALSE);
 
   if (g_vfs_ftp_task_send (task,
         	           G_VFS_FTP_PASS_550,
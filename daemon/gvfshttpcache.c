@@ -0,0 +1,713 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <utime.h>
+
+#include <glib/gstdio.h>
+
+#include "gvfshttpcache.h"
+
+/* Cache of http responses, keyed by URI.
+ *
+ * The headers of every response we saw are kept in memory, so a HEAD can
+ * be answered locally while the entry is fresh and is revalidated with
+ * If-None-Match / If-Modified-Since afterwards. Bodies of cacheable GETs
+ * (the ones carrying an ETag or Last-Modified) are also written to
+ * $XDG_CACHE_HOME/gvfs/http, one file per URI named after its SHA-1 plus
+ * a key file with the headers, and served from there after a 304.
+ *
+ * The cache is only used from the main thread.
+ */
+
+/* how long a response is fresh without any Cache-Control: max-age */
+#define DEFAULT_MAX_AGE        (10 * G_USEC_PER_SEC)
+
+/* size bound of the content on disk, least recently used goes first */
+#define MAX_CACHE_SIZE         (256 * 1024 * 1024)
+#define MAX_ENTRY_SIZE         (MAX_CACHE_SIZE / 8)
+
+#define INFO_SUFFIX            ".info"
+
+typedef struct {
+  SoupMessageHeaders *  headers;
+  gint64                checked;        /* real time of the last validation */
+  gboolean              has_content;
+} CacheEntry;
+
+struct _GVfsHttpCache
+{
+  GHashTable *          entries;        /* uri string => CacheEntry */
+  char *                dir;
+};
+
+struct _GVfsHttpCacheWriter
+{
+  char *                dir;
+  char *                name;
+  char *                uri;
+  char *                tmp_path;
+  int                   fd;
+  goffset               size;
+  SoupMessageHeaders *  headers;
+};
+
+/* hop-by-hop headers and those that don't describe the stored body */
+static const char *const skip_headers[] = {
+  "Connection",
+  "Keep-Alive",
+  "Transfer-Encoding",
+  "Content-Encoding",
+  "Content-Length",
+  "Set-Cookie",
+  NULL
+};
+
+static void
+cache_entry_free (gpointer data)
+{
+  CacheEntry *entry = data;
+
+  soup_message_headers_free (entry->headers);
+  g_slice_free (CacheEntry, entry);
+}
+
+static char *
+uri_to_key (SoupURI *uri)
+{
+  return soup_uri_to_string (uri, FALSE);
+}
+
+static char *
+key_to_name (const char *key)
+{
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+}
+
+static char *
+content_path (const char *dir, const char *name)
+{
+  return g_build_filename (dir, name, NULL);
+}
+
+static char *
+info_path (const char *dir, const char *name)
+{
+  char *info_name, *path;
+
+  info_name = g_strconcat (name, INFO_SUFFIX, NULL);
+  path = g_build_filename (dir, info_name, NULL);
+  g_free (info_name);
+
+  return path;
+}
+
+static gboolean
+skip_header (const char *name)
+{
+  guint i;
+
+  for (i = 0; skip_headers[i]; i++)
+    if (g_ascii_strcasecmp (name, skip_headers[i]) == 0)
+      return TRUE;
+
+  return FALSE;
+}
+
+static void
+copy_header (const char *name, const char *value, gpointer headers)
+{
+  if (!skip_header (name))
+    soup_message_headers_append (headers, name, value);
+}
+
+static SoupMessageHeaders *
+copy_headers (SoupMessageHeaders *headers)
+{
+  SoupMessageHeaders *copy;
+
+  copy = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  soup_message_headers_foreach (headers, copy_header, copy);
+
+  return copy;
+}
+
+static gboolean
+same_validators (SoupMessageHeaders *a, SoupMessageHeaders *b)
+{
+  return g_strcmp0 (soup_message_headers_get_one (a, "ETag"),
+                    soup_message_headers_get_one (b, "ETag")) == 0 &&
+         g_strcmp0 (soup_message_headers_get_one (a, "Last-Modified"),
+                    soup_message_headers_get_one (b, "Last-Modified")) == 0;
+}
+
+static gint64
+headers_get_max_age (SoupMessageHeaders *headers)
+{
+  GHashTable *params;
+  const char *cache_control;
+  const char *value;
+  gint64      max_age;
+
+  cache_control = soup_message_headers_get_list (headers, "Cache-Control");
+  if (cache_control == NULL)
+    return DEFAULT_MAX_AGE;
+
+  max_age = DEFAULT_MAX_AGE;
+  params = soup_header_parse_param_list (cache_control);
+
+  if (g_hash_table_lookup_extended (params, "no-cache", NULL, NULL) ||
+      g_hash_table_lookup_extended (params, "must-revalidate", NULL, NULL))
+    max_age = 0;
+  else if ((value = g_hash_table_lookup (params, "max-age")) != NULL)
+    max_age = g_ascii_strtoll (value, NULL, 10) * G_USEC_PER_SEC;
+
+  soup_header_free_param_list (params);
+
+  return MAX (max_age, 0);
+}
+
+static void
+remove_content (const char *dir, const char *name)
+{
+  char *path;
+
+  path = content_path (dir, name);
+  g_unlink (path);
+  g_free (path);
+
+  path = info_path (dir, name);
+  g_unlink (path);
+  g_free (path);
+}
+
+static CacheEntry *
+load_entry (GVfsHttpCache *cache, const char *key)
+{
+  CacheEntry *entry;
+  GKeyFile   *key_file;
+  struct stat st;
+  char       *name, *path, *uri;
+  char      **keys;
+  goffset     size;
+  guint       i;
+
+  name = key_to_name (key);
+  entry = NULL;
+
+  key_file = g_key_file_new ();
+  path = info_path (cache->dir, name);
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL))
+    goto out;
+
+  g_free (path);
+  path = content_path (cache->dir, name);
+
+  uri = g_key_file_get_string (key_file, "entry", "uri", NULL);
+  size = g_key_file_get_int64 (key_file, "entry", "size", NULL);
+
+  if (g_strcmp0 (uri, key) != 0 ||
+      g_stat (path, &st) != 0 || st.st_size != size)
+    {
+      g_free (uri);
+      goto out;
+    }
+  g_free (uri);
+
+  entry = g_slice_new (CacheEntry);
+  entry->headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  entry->checked = g_key_file_get_int64 (key_file, "entry", "checked", NULL);
+  entry->has_content = TRUE;
+
+  keys = g_key_file_get_keys (key_file, "headers", NULL, NULL);
+  for (i = 0; keys && keys[i]; i++)
+    {
+      char *value = g_key_file_get_string (key_file, "headers", keys[i], NULL);
+
+      if (value)
+        soup_message_headers_append (entry->headers, keys[i], value);
+      g_free (value);
+    }
+  g_strfreev (keys);
+
+  soup_message_headers_set_content_length (entry->headers, size);
+
+  g_hash_table_replace (cache->entries, g_strdup (key), entry);
+
+ out:
+  g_key_file_free (key_file);
+  g_free (path);
+  g_free (name);
+
+  return entry;
+}
+
+static CacheEntry *
+lookup_entry (GVfsHttpCache *cache, SoupURI *uri, gboolean need_content)
+{
+  CacheEntry *entry;
+  char       *key;
+
+  key = uri_to_key (uri);
+  entry = g_hash_table_lookup (cache->entries, key);
+
+  if (entry == NULL || (need_content && !entry->has_content))
+    entry = load_entry (cache, key);
+
+  g_free (key);
+
+  if (entry && need_content && !entry->has_content)
+    return NULL;
+
+  return entry;
+}
+
+GVfsHttpCache *
+g_vfs_http_cache_new (void)
+{
+  GVfsHttpCache *cache;
+
+  cache = g_slice_new0 (GVfsHttpCache);
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, cache_entry_free);
+  cache->dir = g_build_filename (g_get_user_cache_dir (), "gvfs", "http", NULL);
+
+  return cache;
+}
+
+void
+g_vfs_http_cache_free (GVfsHttpCache *cache)
+{
+  g_hash_table_destroy (cache->entries);
+  g_free (cache->dir);
+  g_slice_free (GVfsHttpCache, cache);
+}
+
+/* Returns the headers of the cached response for uri, owned by the cache,
+ * or NULL. fresh tells whether they may be used without asking the server.
+ */
+SoupMessageHeaders *
+g_vfs_http_cache_lookup (GVfsHttpCache *cache,
+                         SoupURI       *uri,
+                         gboolean       need_content,
+                         gboolean      *fresh)
+{
+  CacheEntry *entry;
+
+  entry = lookup_entry (cache, uri, need_content);
+
+  if (entry == NULL)
+    return NULL;
+
+  if (fresh)
+    *fresh = g_get_real_time () - entry->checked < headers_get_max_age (entry->headers);
+
+  return entry->headers;
+}
+
+void
+g_vfs_http_cache_add_conditions (GVfsHttpCache *cache,
+                                 SoupURI       *uri,
+                                 gboolean       need_content,
+                                 SoupMessage   *msg)
+{
+  SoupMessageHeaders *headers;
+  const char         *value;
+
+  headers = g_vfs_http_cache_lookup (cache, uri, need_content, NULL);
+
+  if (headers == NULL)
+    return;
+
+  value = soup_message_headers_get_one (headers, "ETag");
+  if (value)
+    soup_message_headers_replace (msg->request_headers, "If-None-Match", value);
+
+  value = soup_message_headers_get_one (headers, "Last-Modified");
+  if (value)
+    soup_message_headers_replace (msg->request_headers, "If-Modified-Since", value);
+}
+
+/* The server answered 304 to a request made with the conditions above */
+SoupMessageHeaders *
+g_vfs_http_cache_revalidated (GVfsHttpCache *cache,
+                              SoupURI       *uri)
+{
+  CacheEntry *entry;
+
+  entry = lookup_entry (cache, uri, FALSE);
+
+  if (entry == NULL)
+    return NULL;
+
+  entry->checked = g_get_real_time ();
+
+  return entry->headers;
+}
+
+/* Remembers the headers of a response without a body, dropping any cached
+ * body that doesn't match them anymore.
+ */
+void
+g_vfs_http_cache_store (GVfsHttpCache      *cache,
+                        SoupURI            *uri,
+                        SoupMessageHeaders *headers)
+{
+  CacheEntry *entry, *old;
+  char       *key;
+
+  key = uri_to_key (uri);
+
+  entry = g_slice_new (CacheEntry);
+  entry->headers = copy_headers (headers);
+  entry->checked = g_get_real_time ();
+  entry->has_content = FALSE;
+
+  old = lookup_entry (cache, uri, TRUE);
+  if (old == NULL)
+    old = g_hash_table_lookup (cache->entries, key);
+
+  if (old && old->has_content)
+    {
+      if (same_validators (old->headers, entry->headers))
+        {
+          entry->has_content = TRUE;
+          soup_message_headers_set_content_length (entry->headers,
+                                                   soup_message_headers_get_content_length (old->headers));
+        }
+      else
+        {
+          char *name = key_to_name (key);
+          remove_content (cache->dir, name);
+          g_free (name);
+        }
+    }
+
+  g_hash_table_replace (cache->entries, key, entry);
+}
+
+void
+g_vfs_http_cache_remove (GVfsHttpCache *cache,
+                         SoupURI       *uri)
+{
+  char *key, *name;
+
+  key = uri_to_key (uri);
+  name = key_to_name (key);
+
+  g_hash_table_remove (cache->entries, key);
+  remove_content (cache->dir, name);
+
+  g_free (name);
+  g_free (key);
+}
+
+GInputStream *
+g_vfs_http_cache_open (GVfsHttpCache *cache,
+                       SoupURI       *uri)
+{
+  GFileInputStream *stream;
+  GFile            *file;
+  char             *key, *name, *path;
+
+  if (lookup_entry (cache, uri, TRUE) == NULL)
+    return NULL;
+
+  key = uri_to_key (uri);
+  name = key_to_name (key);
+  path = content_path (cache->dir, name);
+
+  file = g_file_new_for_path (path);
+  stream = g_file_read (file, NULL, NULL);
+  g_object_unref (file);
+
+  /* the mtime is what trim_cache () uses to find the least recently used */
+  if (stream)
+    utime (path, NULL);
+
+  g_free (path);
+  g_free (name);
+  g_free (key);
+
+  return G_INPUT_STREAM (stream);
+}
+
+typedef struct {
+  char   *name;
+  goffset size;
+  time_t  mtime;
+} TrimItem;
+
+static int
+trim_item_compare (gconstpointer a, gconstpointer b)
+{
+  const TrimItem *item_a = a, *item_b = b;
+
+  if (item_a->mtime != item_b->mtime)
+    return item_a->mtime < item_b->mtime ? -1 : 1;
+
+  return 0;
+}
+
+static void
+trim_cache (const char *dir)
+{
+  GArray     *items;
+  GDir       *gdir;
+  const char *name;
+  goffset     total;
+  guint       i;
+
+  gdir = g_dir_open (dir, 0, NULL);
+  if (gdir == NULL)
+    return;
+
+  items = g_array_new (FALSE, FALSE, sizeof (TrimItem));
+  total = 0;
+
+  while ((name = g_dir_read_name (gdir)) != NULL)
+    {
+      struct stat st;
+      TrimItem    item;
+      char       *path;
+
+      /* skip key files and files still being written */
+      if (strchr (name, '.') != NULL)
+        continue;
+
+      path = g_build_filename (dir, name, NULL);
+
+      if (g_stat (path, &st) == 0)
+        {
+          item.name = g_strdup (name);
+          item.size = st.st_size;
+          item.mtime = st.st_mtime;
+          g_array_append_val (items, item);
+          total += st.st_size;
+        }
+
+      g_free (path);
+    }
+
+  g_dir_close (gdir);
+
+  if (total > MAX_CACHE_SIZE)
+    {
+      g_array_sort (items, trim_item_compare);
+
+      for (i = 0; i < items->len && total > MAX_CACHE_SIZE; i++)
+        {
+          TrimItem *item = &g_array_index (items, TrimItem, i);
+
+          remove_content (dir, item->name);
+          total -= item->size;
+        }
+    }
+
+  for (i = 0; i < items->len; i++)
+    g_free (g_array_index (items, TrimItem, i).name);
+
+  g_array_free (items, TRUE);
+}
+
+static gboolean
+response_is_cacheable (SoupMessage *msg)
+{
+  SoupMessageHeaders *headers = msg->response_headers;
+  const char         *cache_control;
+
+  if (msg->status_code != SOUP_STATUS_OK)
+    return FALSE;
+
+  if (soup_message_headers_get_one (headers, "ETag") == NULL &&
+      soup_message_headers_get_one (headers, "Last-Modified") == NULL)
+    return FALSE;
+
+  cache_control = soup_message_headers_get_list (headers, "Cache-Control");
+  if (cache_control && soup_header_contains (cache_control, "no-store"))
+    return FALSE;
+
+  if (soup_message_headers_get_encoding (headers) == SOUP_ENCODING_CONTENT_LENGTH &&
+      soup_message_headers_get_content_length (headers) > MAX_ENTRY_SIZE)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Starts writing the body of msg, the GET response for uri, to the cache.
+ * Returns NULL if the response can't be cached.
+ */
+GVfsHttpCacheWriter *
+g_vfs_http_cache_writer_new (GVfsHttpCache *cache,
+                             SoupURI       *uri,
+                             SoupMessage   *msg)
+{
+  GVfsHttpCacheWriter *writer;
+  char                *key;
+
+  if (!response_is_cacheable (msg))
+    return NULL;
+
+  if (g_mkdir_with_parents (cache->dir, 0700) != 0)
+    return NULL;
+
+  key = uri_to_key (uri);
+
+  writer = g_slice_new0 (GVfsHttpCacheWriter);
+  writer->dir = g_strdup (cache->dir);
+  writer->name = key_to_name (key);
+  writer->uri = key;
+  writer->tmp_path = g_strdup_printf ("%s/%s.XXXXXX", writer->dir, writer->name);
+  writer->fd = g_mkstemp (writer->tmp_path);
+  writer->headers = copy_headers (msg->response_headers);
+
+  if (writer->fd == -1)
+    {
+      g_vfs_http_cache_writer_free (writer);
+      return NULL;
+    }
+
+  /* whatever we had is outdated now */
+  g_hash_table_remove (cache->entries, key);
+  remove_content (cache->dir, writer->name);
+
+  return writer;
+}
+
+static void
+writer_abort (GVfsHttpCacheWriter *writer)
+{
+  if (writer->fd != -1)
+    {
+      close (writer->fd);
+      writer->fd = -1;
+      g_unlink (writer->tmp_path);
+    }
+}
+
+void
+g_vfs_http_cache_writer_write (GVfsHttpCacheWriter *writer,
+                               const char          *data,
+                               gsize                len)
+{
+  if (writer->fd == -1)
+    return;
+
+  if (writer->size + len > MAX_ENTRY_SIZE)
+    {
+      writer_abort (writer);
+      return;
+    }
+
+  while (len > 0)
+    {
+      ssize_t res;
+
+      res = write (writer->fd, data, len);
+
+      if (res == -1)
+        {
+          if (errno == EINTR)
+            continue;
+
+          writer_abort (writer);
+          return;
+        }
+
+      data += res;
+      len -= res;
+      writer->size += res;
+    }
+}
+
+static void
+write_key_header (const char *name, const char *value, gpointer user_data)
+{
+  GKeyFile *key_file = user_data;
+
+  g_key_file_set_string (key_file, "headers", name, value);
+}
+
+/* The whole body was received, make the entry visible */
+void
+g_vfs_http_cache_writer_commit (GVfsHttpCacheWriter *writer)
+{
+  GKeyFile *key_file;
+  char     *path, *data;
+  gsize     len;
+
+  if (writer->fd == -1)
+    return;
+
+  if (close (writer->fd) != 0)
+    {
+      writer->fd = -1;
+      g_unlink (writer->tmp_path);
+      return;
+    }
+  writer->fd = -1;
+
+  path = content_path (writer->dir, writer->name);
+  if (g_rename (writer->tmp_path, path) != 0)
+    {
+      g_unlink (writer->tmp_path);
+      g_free (path);
+      return;
+    }
+  g_free (path);
+
+  key_file = g_key_file_new ();
+  g_key_file_set_string (key_file, "entry", "uri", writer->uri);
+  g_key_file_set_int64 (key_file, "entry", "size", writer->size);
+  g_key_file_set_int64 (key_file, "entry", "checked", g_get_real_time ());
+  soup_message_headers_foreach (writer->headers, write_key_header, key_file);
+
+  data = g_key_file_to_data (key_file, &len, NULL);
+  path = info_path (writer->dir, writer->name);
+
+  if (!g_file_set_contents (path, data, len, NULL))
+    remove_content (writer->dir, writer->name);
+
+  g_free (path);
+  g_free (data);
+  g_key_file_free (key_file);
+
+  trim_cache (writer->dir);
+}
+
+/* Frees the writer, dropping the partial body unless it was committed */
+void
+g_vfs_http_cache_writer_free (GVfsHttpCacheWriter *writer)
+{
+  writer_abort (writer);
+
+  soup_message_headers_free (writer->headers);
+  g_free (writer->tmp_path);
+  g_free (writer->uri);
+  g_free (writer->name);
+  g_free (writer->dir);
+  g_slice_free (GVfsHttpCacheWriter, writer);
+}
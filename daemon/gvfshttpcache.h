@@ -0,0 +1,63 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_VFS_HTTP_CACHE_H__
+#define __G_VFS_HTTP_CACHE_H__
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GVfsHttpCache       GVfsHttpCache;
+typedef struct _GVfsHttpCacheWriter GVfsHttpCacheWriter;
+
+GVfsHttpCache *         g_vfs_http_cache_new            (void);
+void                    g_vfs_http_cache_free           (GVfsHttpCache *        cache);
+
+SoupMessageHeaders *    g_vfs_http_cache_lookup         (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri,
+                                                         gboolean               need_content,
+                                                         gboolean *             fresh);
+void                    g_vfs_http_cache_add_conditions (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri,
+                                                         gboolean               need_content,
+                                                         SoupMessage *          msg);
+SoupMessageHeaders *    g_vfs_http_cache_revalidated    (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri);
+void                    g_vfs_http_cache_store          (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri,
+                                                         SoupMessageHeaders *   headers);
+void                    g_vfs_http_cache_remove         (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri);
+
+GInputStream *          g_vfs_http_cache_open           (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri);
+
+GVfsHttpCacheWriter *   g_vfs_http_cache_writer_new     (GVfsHttpCache *        cache,
+                                                         SoupURI *              uri,
+                                                         SoupMessage *          msg);
+void                    g_vfs_http_cache_writer_write   (GVfsHttpCacheWriter *  writer,
+                                                         const char *           data,
+                                                         gsize                  len);
+void                    g_vfs_http_cache_writer_commit  (GVfsHttpCacheWriter *  writer);
+void                    g_vfs_http_cache_writer_free    (GVfsHttpCacheWriter *  writer);
+
+G_END_DECLS
+
+#endif /* __G_VFS_HTTP_CACHE_H__ */
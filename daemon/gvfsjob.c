@@ -33,6 +33,7 @@
 #include <gio/gio.h>
 #include "gvfsjob.h"
 #include "gvfsjobsource.h"
+#include "gvfsstats.h"
 
 G_DEFINE_TYPE (GVfsJob, g_vfs_job, G_TYPE_OBJECT)
 
@@ -53,7 +54,10 @@ enum {
 
 struct _GVfsJobPrivate
 {
-  int dummy;
+  /* monotonic times, for the stats */
+  gint64 queued_time;
+  gint64 start_time;
+  gint64 reply_time;
 };
 
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -137,7 +141,9 @@ g_vfs_job_init (GVfsJob *job)
   job->priv = G_TYPE_INSTANCE_GET_PRIVATE (job, G_VFS_TYPE_JOB, GVfsJobPrivate);
 
   job->cancellable = g_cancellable_new ();
-  
+
+  /* Jobs are queued as soon as they are created */
+  job->priv->queued_time = g_get_monotonic_time ();
 }
 
 void
@@ -194,7 +200,9 @@ g_vfs_job_run (GVfsJob *job)
    * we call g_vfs_job_succeed/fail()
    */
   g_object_ref (job);
-  
+
+  /* Time waiting for a thread counts as queued */
+  job->priv->start_time = g_get_monotonic_time ();
   class->run (job);
   
   g_object_unref (job);
@@ -213,6 +221,7 @@ g_vfs_job_try (GVfsJob *job)
    * we call g_vfs_job_succeed/fail()
    */
   g_object_ref (job);
+  job->priv->start_time = g_get_monotonic_time ();
   res = class->try (job);
   g_object_unref (job);
 
@@ -234,6 +243,7 @@ static void
 g_vfs_job_send_reply (GVfsJob *job)
 {
   job->sent_reply = TRUE;
+  job->priv->reply_time = g_get_monotonic_time ();
   g_signal_emit (job, signals[SEND_REPLY], 0);
 }
 
@@ -320,8 +330,17 @@ g_vfs_job_is_cancelled (GVfsJob *job)
 void
 g_vfs_job_emit_finished (GVfsJob *job)
 {
+  gint64 start, end;
+
   g_assert (!job->finished);
-  
+
+  start = job->priv->start_time ? job->priv->start_time : job->priv->queued_time;
+  end = job->priv->reply_time ? job->priv->reply_time : g_get_monotonic_time ();
+  g_vfs_stats_job_finished (g_type_name_from_instance ((gpointer)job),
+			    start - job->priv->queued_time,
+			    end - start,
+			    job->failed);
+
   job->finished = TRUE;
   g_signal_emit (job, signals[FINISHED], 0);
 }
@@ -40,6 +40,7 @@
 #include <gvfsjobqueryinforead.h>
 #include <gvfsjobcloseread.h>
 #include <gvfsfileinfo.h>
+#include <gvfsstats.h>
 
 struct _GVfsReadChannel
 {
@@ -277,6 +278,7 @@ g_vfs_read_channel_send_data (GVfsReadChannel  *read_channel,
   reply.arg1 = g_htonl (count);
   reply.arg2 = g_htonl (read_channel->seek_generation);
 
+  g_vfs_stats_channel_transferred (channel, count);
   g_vfs_channel_send_reply (channel, &reply, buffer, count);
 }
 
@@ -285,8 +287,13 @@ GVfsReadChannel *
 g_vfs_read_channel_new (GVfsBackend *backend,
                         GPid         actual_consumer)
 {
-  return g_object_new (G_VFS_TYPE_READ_CHANNEL,
-		       "backend", backend,
-                       "actual-consumer", actual_consumer,
-		       NULL);
+  GVfsReadChannel *channel;
+
+  channel = g_object_new (G_VFS_TYPE_READ_CHANNEL,
+			  "backend", backend,
+			  "actual-consumer", actual_consumer,
+			  NULL);
+  g_vfs_stats_channel_opened (channel, "read");
+
+  return channel;
 }
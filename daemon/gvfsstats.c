@@ -0,0 +1,430 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+#include <gvfsstats.h>
+#include <gvfsdbusutils.h>
+
+/* Latency histograms have one bucket per decade, from below 100 usecs
+ * to 10 seconds and above.  The upper limits are sent along with the
+ * histograms, so clients don't need to know them.
+ */
+#define N_BUCKETS 7
+
+static const dbus_uint64_t bucket_limits[N_BUCKETS - 1] = {
+  100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+typedef struct {
+  char *name;
+  dbus_uint64_t count;
+  dbus_uint64_t failed;
+  dbus_uint64_t queue_usecs;
+  dbus_uint64_t run_usecs;
+  dbus_uint64_t queue_hist[N_BUCKETS];
+  dbus_uint64_t run_hist[N_BUCKETS];
+} OpStats;
+
+typedef struct {
+  guint32 id;
+  const char *kind;
+  dbus_uint64_t bytes;
+} ChannelStats;
+
+typedef struct {
+  char *name;
+  dbus_uint64_t hits;
+  dbus_uint64_t misses;
+} CacheStats;
+
+G_LOCK_DEFINE_STATIC (stats);
+/* job type -> OpStats */
+static GHashTable *op_stats = NULL;
+/* channel -> ChannelStats, for the open channels */
+static GHashTable *channel_stats = NULL;
+/* cache name -> CacheStats */
+static GHashTable *cache_stats = NULL;
+static guint32 next_channel_id = 1;
+static dbus_uint64_t bytes_read = 0;
+static dbus_uint64_t bytes_written = 0;
+static gint64 start_time = 0;
+
+static void
+op_stats_free (OpStats *op)
+{
+  g_free (op->name);
+  g_free (op);
+}
+
+static void
+cache_stats_free (CacheStats *cache)
+{
+  g_free (cache->name);
+  g_free (cache);
+}
+
+/* Called with the lock held */
+static void
+ensure_tables (void)
+{
+  if (op_stats != NULL)
+    return;
+
+  op_stats = g_hash_table_new_full (g_str_hash, g_str_equal,
+				    NULL, (GDestroyNotify)op_stats_free);
+  channel_stats = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					 NULL, g_free);
+  cache_stats = g_hash_table_new_full (g_str_hash, g_str_equal,
+				       NULL, (GDestroyNotify)cache_stats_free);
+  start_time = g_get_monotonic_time ();
+}
+
+static int
+bucket_for (gint64 usecs)
+{
+  int i;
+
+  for (i = 0; i < N_BUCKETS - 1; i++)
+    {
+      if (usecs < (gint64)bucket_limits[i])
+	break;
+    }
+
+  return i;
+}
+
+void
+g_vfs_stats_job_finished (const char *job_type,
+			  gint64      queue_usecs,
+			  gint64      run_usecs,
+			  gboolean    failed)
+{
+  OpStats *op;
+  const char *name;
+
+  /* GVfsJobQueryInfo -> QueryInfo, same as the dbus method */
+  name = job_type;
+  if (g_str_has_prefix (name, "GVfsJob"))
+    name += strlen ("GVfsJob");
+
+  queue_usecs = MAX (queue_usecs, 0);
+  run_usecs = MAX (run_usecs, 0);
+
+  G_LOCK (stats);
+  ensure_tables ();
+
+  op = g_hash_table_lookup (op_stats, name);
+  if (op == NULL)
+    {
+      op = g_new0 (OpStats, 1);
+      op->name = g_strdup (name);
+      g_hash_table_insert (op_stats, op->name, op);
+    }
+
+  op->count++;
+  if (failed)
+    op->failed++;
+  op->queue_usecs += queue_usecs;
+  op->run_usecs += run_usecs;
+  op->queue_hist[bucket_for (queue_usecs)]++;
+  op->run_hist[bucket_for (run_usecs)]++;
+
+  G_UNLOCK (stats);
+}
+
+void
+g_vfs_stats_channel_opened (gpointer    channel,
+			    const char *kind)
+{
+  ChannelStats *chan;
+
+  chan = g_new0 (ChannelStats, 1);
+  chan->kind = kind;
+
+  G_LOCK (stats);
+  ensure_tables ();
+  chan->id = next_channel_id++;
+  g_hash_table_insert (channel_stats, channel, chan);
+  G_UNLOCK (stats);
+}
+
+void
+g_vfs_stats_channel_transferred (gpointer channel,
+				 gsize    bytes)
+{
+  ChannelStats *chan;
+
+  G_LOCK (stats);
+  ensure_tables ();
+
+  chan = g_hash_table_lookup (channel_stats, channel);
+  if (chan != NULL)
+    {
+      chan->bytes += bytes;
+      if (strcmp (chan->kind, "read") == 0)
+	bytes_read += bytes;
+      else
+	bytes_written += bytes;
+    }
+
+  G_UNLOCK (stats);
+}
+
+/* The totals keep what was transferred on closed channels */
+void
+g_vfs_stats_channel_closed (gpointer channel)
+{
+  G_LOCK (stats);
+  ensure_tables ();
+  g_hash_table_remove (channel_stats, channel);
+  G_UNLOCK (stats);
+}
+
+void
+g_vfs_stats_cache_lookup (const char *cache,
+			  gboolean    hit)
+{
+  CacheStats *entry;
+
+  G_LOCK (stats);
+  ensure_tables ();
+
+  entry = g_hash_table_lookup (cache_stats, cache);
+  if (entry == NULL)
+    {
+      entry = g_new0 (CacheStats, 1);
+      entry->name = g_strdup (cache);
+      g_hash_table_insert (cache_stats, entry->name, entry);
+    }
+
+  if (hit)
+    entry->hits++;
+  else
+    entry->misses++;
+
+  G_UNLOCK (stats);
+}
+
+void
+g_vfs_stats_append_counter (DBusMessageIter *dict_iter,
+			    const char      *name,
+			    guint64          value)
+{
+  DBusMessageIter entry_iter;
+  dbus_uint64_t v;
+
+  v = value;
+
+  if (!dbus_message_iter_open_container (dict_iter,
+					 DBUS_TYPE_DICT_ENTRY,
+					 NULL,
+					 &entry_iter))
+    _g_dbus_oom ();
+
+  if (!dbus_message_iter_append_basic (&entry_iter, DBUS_TYPE_STRING, &name) ||
+      !dbus_message_iter_append_basic (&entry_iter, DBUS_TYPE_UINT64, &v))
+    _g_dbus_oom ();
+
+  if (!dbus_message_iter_close_container (dict_iter, &entry_iter))
+    _g_dbus_oom ();
+}
+
+void
+g_vfs_stats_append_counters (DBusMessageIter *dict_iter)
+{
+  guint n_channels;
+  dbus_uint64_t n_read, n_written;
+  gint64 uptime;
+
+  G_LOCK (stats);
+  ensure_tables ();
+  n_channels = g_hash_table_size (channel_stats);
+  n_read = bytes_read;
+  n_written = bytes_written;
+  uptime = g_get_monotonic_time () - start_time;
+  G_UNLOCK (stats);
+
+  g_vfs_stats_append_counter (dict_iter, "active-channels", n_channels);
+  g_vfs_stats_append_counter (dict_iter, "bytes-read", n_read);
+  g_vfs_stats_append_counter (dict_iter, "bytes-written", n_written);
+  g_vfs_stats_append_counter (dict_iter, "uptime-usecs", uptime);
+}
+
+static void
+append_uint64_array (DBusMessageIter     *iter,
+		     const dbus_uint64_t *values,
+		     int                  n_values)
+{
+  DBusMessageIter array_iter;
+
+  if (!dbus_message_iter_open_container (iter,
+					 DBUS_TYPE_ARRAY,
+					 DBUS_TYPE_UINT64_AS_STRING,
+					 &array_iter))
+    _g_dbus_oom ();
+
+  if (!dbus_message_iter_append_fixed_array (&array_iter,
+					     DBUS_TYPE_UINT64,
+					     &values, n_values))
+    _g_dbus_oom ();
+
+  if (!dbus_message_iter_close_container (iter, &array_iter))
+    _g_dbus_oom ();
+}
+
+static void
+append_op (OpStats         *op,
+	   DBusMessageIter *array_iter)
+{
+  DBusMessageIter struct_iter;
+
+  if (!dbus_message_iter_open_container (array_iter,
+					 DBUS_TYPE_STRUCT,
+					 NULL,
+					 &struct_iter))
+    _g_dbus_oom ();
+
+  _g_dbus_message_iter_append_args (&struct_iter,
+				    DBUS_TYPE_STRING, &op->name,
+				    DBUS_TYPE_UINT64, &op->count,
+				    DBUS_TYPE_UINT64, &op->failed,
+				    DBUS_TYPE_UINT64, &op->queue_usecs,
+				    DBUS_TYPE_UINT64, &op->run_usecs,
+				    0);
+  append_uint64_array (&struct_iter, op->queue_hist, N_BUCKETS);
+  append_uint64_array (&struct_iter, op->run_hist, N_BUCKETS);
+
+  if (!dbus_message_iter_close_container (array_iter, &struct_iter))
+    _g_dbus_oom ();
+}
+
+static void
+append_channel (ChannelStats    *chan,
+		DBusMessageIter *array_iter)
+{
+  DBusMessageIter struct_iter;
+
+  if (!dbus_message_iter_open_container (array_iter,
+					 DBUS_TYPE_STRUCT,
+					 NULL,
+					 &struct_iter))
+    _g_dbus_oom ();
+
+  _g_dbus_message_iter_append_args (&struct_iter,
+				    DBUS_TYPE_UINT32, &chan->id,
+				    DBUS_TYPE_STRING, &chan->kind,
+				    DBUS_TYPE_UINT64, &chan->bytes,
+				    0);
+
+  if (!dbus_message_iter_close_container (array_iter, &struct_iter))
+    _g_dbus_oom ();
+}
+
+static void
+append_cache (CacheStats      *cache,
+	      DBusMessageIter *array_iter)
+{
+  DBusMessageIter struct_iter;
+
+  if (!dbus_message_iter_open_container (array_iter,
+					 DBUS_TYPE_STRUCT,
+					 NULL,
+					 &struct_iter))
+    _g_dbus_oom ();
+
+  _g_dbus_message_iter_append_args (&struct_iter,
+				    DBUS_TYPE_STRING, &cache->name,
+				    DBUS_TYPE_UINT64, &cache->hits,
+				    DBUS_TYPE_UINT64, &cache->misses,
+				    0);
+
+  if (!dbus_message_iter_close_container (array_iter, &struct_iter))
+    _g_dbus_oom ();
+}
+
+/* Appends the histogram limits, the per operation, per channel and
+ * per cache statistics, see G_VFS_DBUS_OP_GET_STATS.
+ */
+void
+g_vfs_stats_append_details (DBusMessageIter *iter)
+{
+  DBusMessageIter array_iter;
+  GHashTableIter hash_iter;
+  gpointer value;
+
+  append_uint64_array (iter, bucket_limits, N_BUCKETS - 1);
+
+  G_LOCK (stats);
+  ensure_tables ();
+
+  if (!dbus_message_iter_open_container (iter,
+					 DBUS_TYPE_ARRAY,
+					 DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+					   DBUS_TYPE_STRING_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					   DBUS_TYPE_ARRAY_AS_STRING DBUS_TYPE_UINT64_AS_STRING
+					   DBUS_TYPE_ARRAY_AS_STRING DBUS_TYPE_UINT64_AS_STRING
+					 DBUS_STRUCT_END_CHAR_AS_STRING,
+					 &array_iter))
+    _g_dbus_oom ();
+  g_hash_table_iter_init (&hash_iter, op_stats);
+  while (g_hash_table_iter_next (&hash_iter, NULL, &value))
+    append_op (value, &array_iter);
+  if (!dbus_message_iter_close_container (iter, &array_iter))
+    _g_dbus_oom ();
+
+  if (!dbus_message_iter_open_container (iter,
+					 DBUS_TYPE_ARRAY,
+					 DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+					   DBUS_TYPE_UINT32_AS_STRING
+					   DBUS_TYPE_STRING_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					 DBUS_STRUCT_END_CHAR_AS_STRING,
+					 &array_iter))
+    _g_dbus_oom ();
+  g_hash_table_iter_init (&hash_iter, channel_stats);
+  while (g_hash_table_iter_next (&hash_iter, NULL, &value))
+    append_channel (value, &array_iter);
+  if (!dbus_message_iter_close_container (iter, &array_iter))
+    _g_dbus_oom ();
+
+  if (!dbus_message_iter_open_container (iter,
+					 DBUS_TYPE_ARRAY,
+					 DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+					   DBUS_TYPE_STRING_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					   DBUS_TYPE_UINT64_AS_STRING
+					 DBUS_STRUCT_END_CHAR_AS_STRING,
+					 &array_iter))
+    _g_dbus_oom ();
+  g_hash_table_iter_init (&hash_iter, cache_stats);
+  while (g_hash_table_iter_next (&hash_iter, NULL, &value))
+    append_cache (value, &array_iter);
+  if (!dbus_message_iter_close_container (iter, &array_iter))
+    _g_dbus_oom ();
+
+  G_UNLOCK (stats);
+}
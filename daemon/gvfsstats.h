@@ -0,0 +1,53 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_VFS_STATS_H__
+#define __G_VFS_STATS_H__
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+G_BEGIN_DECLS
+
+/* Statistics for the daemon process, ie: for the mount it serves.
+ * All of these may be called from any thread.
+ */
+
+void g_vfs_stats_job_finished        (const char      *job_type,
+				      gint64           queue_usecs,
+				      gint64           run_usecs,
+				      gboolean         failed);
+
+void g_vfs_stats_channel_opened      (gpointer         channel,
+				      const char      *kind);
+void g_vfs_stats_channel_transferred (gpointer         channel,
+				      gsize            bytes);
+void g_vfs_stats_channel_closed      (gpointer         channel);
+
+void g_vfs_stats_cache_lookup        (const char      *cache,
+				      gboolean         hit);
+
+void g_vfs_stats_append_counter      (DBusMessageIter *dict_iter,
+				      const char      *name,
+				      guint64          value);
+void g_vfs_stats_append_counters     (DBusMessageIter *dict_iter);
+void g_vfs_stats_append_details      (DBusMessageIter *iter);
+
+G_END_DECLS
+
+#endif /* __G_VFS_STATS_H__ */
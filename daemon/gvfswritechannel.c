@@ -40,6 +40,7 @@
 #include <gvfsjobseekwrite.h>
 #include <gvfsjobclosewrite.h>
 #include <gvfsjobqueryinfowrite.h>
+#include <gvfsstats.h>
 
 struct _GVfsWriteChannel
 {
@@ -213,6 +214,7 @@ g_vfs_write_channel_send_written (GVfsWriteChannel  *write_channel,
   reply.arg1 = g_htonl (bytes_written);
   reply.arg2 = 0;
 
+  g_vfs_stats_channel_transferred (channel, bytes_written);
   g_vfs_channel_send_reply (channel, &reply, NULL, 0);
 }
 
@@ -221,8 +223,13 @@ GVfsWriteChannel *
 g_vfs_write_channel_new (GVfsBackend *backend,
                          GPid         actual_consumer)
 {
-  return g_object_new (G_VFS_TYPE_WRITE_CHANNEL,
-		       "backend", backend,
-                       "actual-consumer", actual_consumer,
-		       NULL);
+  GVfsWriteChannel *channel;
+
+  channel = g_object_new (G_VFS_TYPE_WRITE_CHANNEL,
+			  "backend", backend,
+			  "actual-consumer", actual_consumer,
+			  NULL);
+  g_vfs_stats_channel_opened (channel, "write");
+
+  return channel;
 }
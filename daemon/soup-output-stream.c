@@ -32,6 +32,11 @@
 
 G_DEFINE_TYPE (SoupOutputStream, soup_output_stream, G_TYPE_OUTPUT_STREAM)
 
+/* When streaming, a write does not return before the amount of data
+ * queued on the message but not yet sent drops below this.
+ */
+#define MAX_PENDING_BYTES (256 * 1024)
+
 typedef void (*SoupOutputStreamCallback) (GOutputStream *);
 
 typedef struct {
@@ -43,12 +48,18 @@ typedef struct {
   goffset size, offset;
   GByteArray *ba;
 
+  gboolean streaming, started;
+  gsize pending;
+  goffset written;
+
   GCancellable *cancellable;
   GSource *cancel_watch;
   SoupOutputStreamCallback finished_cb;
   SoupOutputStreamCallback cancelled_cb;
 
   GSimpleAsyncResult *result;
+  GSimpleAsyncResult *write_result;
+  gssize write_count;
 } SoupOutputStreamPrivate;
 #define SOUP_OUTPUT_STREAM_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), SOUP_TYPE_OUTPUT_STREAM, SoupOutputStreamPrivate))
 
@@ -80,6 +91,10 @@ static gboolean soup_output_stream_close_finish (GOutputStream        *stream,
 						 GError              **error);
 
 static void soup_output_stream_finished (SoupMessage *msg, gpointer stream);
+static void soup_output_stream_wrote_body_data (SoupMessage *msg,
+						SoupBuffer  *chunk,
+						gpointer     stream);
+static void soup_output_stream_restarted (SoupMessage *msg, gpointer stream);
 
 static void
 soup_output_stream_finalize (GObject *object)
@@ -89,6 +104,8 @@ soup_output_stream_finalize (GObject *object)
   g_object_unref (priv->session);
 
   g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_finished), object);
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_wrote_body_data), object);
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_restarted), object);
   g_object_unref (priv->msg);
 
   if (priv->ba)
@@ -143,9 +160,19 @@ soup_output_stream_init (SoupOutputStream *stream)
  * that, or closing the stream without having written enough, will
  * result in an error.
  *
- * In some situations, the request will not actually be sent until you
- * call g_output_stream_close(). (In fact, currently this is *always*
- * true.)
+ * If @session is a #SoupSessionAsync, the request is sent while it
+ * is being written: with a Content-Length header if @size is known,
+ * chunked otherwise, and with "Expect: 100-continue" so that the
+ * server can refuse it before any data went out. Writes only complete
+ * once most of the data has been sent, so the amount of memory used
+ * is bounded. If the server refuses the request because of its
+ * encoding (411, 417 or 501) the stream falls back to buffering the
+ * whole body and sends it on close, in a new message with the same
+ * method, URI and headers. The response is then in that message, not
+ * in @msg.
+ *
+ * With any other session the request is buffered and not sent until
+ * you call g_output_stream_close().
  *
  * Internally, #SoupOutputStream is implemented using asynchronous
  * I/O, so if you are using the synchronous API (eg,
@@ -173,6 +200,9 @@ soup_output_stream_new (SoupSession *session, SoupMessage *msg, goffset size)
   priv->msg = g_object_ref (msg);
   priv->size = size;
 
+  /* Pausing a message while we wait for more data only works there */
+  priv->streaming = SOUP_IS_SESSION_ASYNC (session);
+
   return G_OUTPUT_STREAM (stream);
 }
 
@@ -184,6 +214,14 @@ soup_output_stream_cancelled (GIOChannel *chan, GIOCondition condition,
 
   priv->cancel_watch = NULL;
 
+  if (priv->streaming)
+    {
+      /* The pending operation is completed from the "finished" handler */
+      soup_session_cancel_message (priv->session, priv->msg,
+				   SOUP_STATUS_CANCELLED);
+      return FALSE;
+    }
+
   soup_session_pause_message (priv->session, priv->msg);
   if (priv->cancelled_cb)
     priv->cancelled_cb (stream);
@@ -192,18 +230,11 @@ soup_output_stream_cancelled (GIOChannel *chan, GIOCondition condition,
 }  
 
 static void
-soup_output_stream_prepare_for_io (GOutputStream *stream, GCancellable *cancellable)
+soup_output_stream_watch_cancellable (GOutputStream *stream, GCancellable *cancellable)
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
   int cancel_fd;
 
-  /* Move the buffer to the SoupMessage */
-  soup_message_body_append (priv->msg->request_body, SOUP_MEMORY_TAKE,
-			    priv->ba->data, priv->ba->len);
-  g_byte_array_free (priv->ba, FALSE);
-  priv->ba = NULL;
-
-  /* Set up cancellation */
   priv->cancellable = cancellable;
   cancel_fd = g_cancellable_get_fd (cancellable);
   if (cancel_fd != -1)
@@ -215,6 +246,21 @@ soup_output_stream_prepare_for_io (GOutputStream *stream, GCancellable *cancella
 					      stream);
       g_io_channel_unref (chan);
     }
+}
+
+static void
+soup_output_stream_prepare_for_io (GOutputStream *stream, GCancellable *cancellable)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  /* Move the buffer to the SoupMessage */
+  soup_message_body_append (priv->msg->request_body, SOUP_MEMORY_TAKE,
+			    priv->ba->data, priv->ba->len);
+  g_byte_array_free (priv->ba, FALSE);
+  priv->ba = NULL;
+
+  /* Set up cancellation */
+  soup_output_stream_watch_cancellable (stream, cancellable);
 
   /* Add an extra ref since soup_session_queue_message steals one */
   g_object_ref (priv->msg);
@@ -235,6 +281,108 @@ soup_output_stream_done_io (GOutputStream *stream)
   priv->cancellable = NULL;
 }
 
+/* Streaming mode: queue the message as soon as there is something to
+ * send. The message pauses itself whenever it runs out of body data and
+ * is unpaused again by soup_output_stream_append().
+ */
+static void
+soup_output_stream_start (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+  SoupMessageHeaders *headers = priv->msg->request_headers;
+
+  priv->started = TRUE;
+
+  if (priv->size > 0)
+    soup_message_headers_set_content_length (headers, priv->size);
+  else
+    soup_message_headers_set_encoding (headers, SOUP_ENCODING_CHUNKED);
+
+  soup_message_headers_set_expectations (headers, SOUP_EXPECTATION_CONTINUE);
+
+  /* Drop every chunk once it has been written; since the message can't
+   * be resent after that, soup_output_stream_restarted() cancels it.
+   */
+  soup_message_body_set_accumulate (priv->msg->request_body, FALSE);
+  soup_message_set_flags (priv->msg,
+			  soup_message_get_flags (priv->msg) | SOUP_MESSAGE_CAN_REBUILD);
+
+  g_signal_connect (priv->msg, "wrote-body-data",
+		    G_CALLBACK (soup_output_stream_wrote_body_data), stream);
+  g_signal_connect (priv->msg, "restarted",
+		    G_CALLBACK (soup_output_stream_restarted), stream);
+  g_signal_connect (priv->msg, "finished",
+		    G_CALLBACK (soup_output_stream_finished), stream);
+
+  /* Add an extra ref since soup_session_queue_message steals one */
+  g_object_ref (priv->msg);
+  soup_session_queue_message (priv->session, priv->msg, NULL, NULL);
+}
+
+static void
+copy_request_header (const char *name,
+		     const char *value,
+		     gpointer    headers)
+{
+  /* These were set up for streaming */
+  if (g_ascii_strcasecmp (name, "Expect") == 0 ||
+      g_ascii_strcasecmp (name, "Content-Length") == 0 ||
+      g_ascii_strcasecmp (name, "Transfer-Encoding") == 0)
+    return;
+
+  soup_message_headers_append (headers, name, value);
+}
+
+/* If the server refused the streamed request before we sent any of the
+ * body, we still have all of it: switch to buffering and send it again
+ * with a Content-Length on close.
+ *
+ * The refused message has finished and can't be queued again, so the
+ * request is sent with a copy of it.
+ */
+static gboolean
+soup_output_stream_fall_back (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+  SoupMessage *msg;
+  SoupBuffer *body;
+  guint status;
+
+  status = priv->msg->status_code;
+
+  if (priv->written > 0 ||
+      (status != SOUP_STATUS_LENGTH_REQUIRED &&
+       status != SOUP_STATUS_EXPECTATION_FAILED &&
+       status != SOUP_STATUS_NOT_IMPLEMENTED))
+    return FALSE;
+
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_wrote_body_data), stream);
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_restarted), stream);
+
+  soup_message_body_set_accumulate (priv->msg->request_body, TRUE);
+  body = soup_message_body_flatten (priv->msg->request_body);
+  g_byte_array_append (priv->ba, (const guint8 *) body->data, body->length);
+  soup_buffer_free (body);
+
+  msg = soup_message_new_from_uri (priv->msg->method,
+				   soup_message_get_uri (priv->msg));
+  soup_message_headers_foreach (priv->msg->request_headers,
+				copy_request_header, msg->request_headers);
+  soup_message_set_flags (msg, soup_message_get_flags (priv->msg) &
+			  ~SOUP_MESSAGE_CAN_REBUILD);
+
+  /* The session's queue item still holds the old message */
+  g_object_unref (priv->msg);
+  priv->msg = msg;
+
+  priv->streaming = FALSE;
+  priv->started = FALSE;
+  priv->finished = FALSE;
+  priv->pending = 0;
+
+  return TRUE;
+}
+
 static gboolean
 set_error_if_http_failed (SoupMessage *msg, GError **error)
 {
@@ -247,6 +395,59 @@ set_error_if_http_failed (SoupMessage *msg, GError **error)
   return FALSE;
 }
 
+/* Whether a streamed request was answered before we were done writing */
+static gboolean
+set_error_if_finished_early (SoupOutputStreamPrivate *priv, GError **error)
+{
+  if (!priv->streaming || !priv->finished)
+    return FALSE;
+
+  if (!set_error_if_http_failed (priv->msg, error))
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			 "Server closed the request before it was complete");
+  return TRUE;
+}
+
+static gboolean
+soup_output_stream_check_write (GOutputStream  *stream,
+				gsize           count,
+				GError        **error)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  if (priv->size > 0 && priv->offset + count > priv->size) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+			   "Write would exceed caller-defined file size");
+      return FALSE;
+  }
+
+  return !set_error_if_finished_early (priv, error);
+}
+
+static void
+soup_output_stream_append (GOutputStream  *stream,
+			   const void     *buffer,
+			   gsize           count)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  priv->offset += count;
+
+  if (!priv->streaming)
+    {
+      g_byte_array_append (priv->ba, buffer, count);
+      return;
+    }
+
+  if (!priv->started)
+    soup_output_stream_start (stream);
+
+  soup_message_body_append (priv->msg->request_body, SOUP_MEMORY_COPY,
+			    buffer, count);
+  priv->pending += count;
+  soup_session_unpause_message (priv->session, priv->msg);
+}
+
 static gssize
 soup_output_stream_write (GOutputStream  *stream,
 			  const void     *buffer,
@@ -256,14 +457,28 @@ soup_output_stream_write (GOutputStream  *stream,
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
 
-  if (priv->size > 0 && priv->offset + count > priv->size) {
-      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
-			   "Write would exceed caller-defined file size");
+  if (!soup_output_stream_check_write (stream, count, error))
+    return -1;
+
+  soup_output_stream_append (stream, buffer, count);
+
+  if (!priv->streaming)
+    return count;
+
+  while (priv->pending >= MAX_PENDING_BYTES && !priv->finished &&
+	 !g_cancellable_is_cancelled (cancellable))
+    g_main_context_iteration (priv->async_context, TRUE);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    {
+      soup_session_cancel_message (priv->session, priv->msg,
+				   SOUP_STATUS_CANCELLED);
       return -1;
-  }
+    }
+
+  if (set_error_if_finished_early (priv, error))
+    return -1;
 
-  g_byte_array_append (priv->ba, buffer, count);
-  priv->offset += count;
   return count;
 }
 
@@ -275,19 +490,99 @@ soup_output_stream_close (GOutputStream  *stream,
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
 
   if (priv->size > 0 && priv->offset != priv->size) {
+      if (priv->started && !priv->finished)
+	soup_session_cancel_message (priv->session, priv->msg,
+				     SOUP_STATUS_CANCELLED);
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
 			   "File is incomplete");
       return -1;
   }
 
-  soup_output_stream_prepare_for_io (stream, cancellable);
-  while (!priv->finished && !g_cancellable_is_cancelled (cancellable))
-    g_main_context_iteration (priv->async_context, TRUE);
-  soup_output_stream_done_io (stream);
+  if (priv->streaming)
+    {
+      if (!priv->started)
+	soup_output_stream_start (stream);
+
+      soup_message_body_complete (priv->msg->request_body);
+      soup_session_unpause_message (priv->session, priv->msg);
+
+      /* A fall back resets priv->finished for the new message */
+      while (priv->streaming && !priv->finished &&
+	     !g_cancellable_is_cancelled (cancellable))
+	g_main_context_iteration (priv->async_context, TRUE);
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+	{
+	  soup_session_cancel_message (priv->session, priv->msg,
+				       SOUP_STATUS_CANCELLED);
+	  return FALSE;
+	}
+    }
+
+  /* Not streaming, or the server made us fall back to buffering */
+  if (!priv->streaming)
+    {
+      g_signal_connect (priv->msg, "finished",
+			G_CALLBACK (soup_output_stream_finished), stream);
+      soup_output_stream_prepare_for_io (stream, cancellable);
+      while (!priv->finished && !g_cancellable_is_cancelled (cancellable))
+	g_main_context_iteration (priv->async_context, TRUE);
+      soup_output_stream_done_io (stream);
+    }
 
   return !set_error_if_http_failed (priv->msg, error);
 }
 
+static void
+write_async_done (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+  GSimpleAsyncResult *result;
+  GError *error = NULL;
+
+  result = priv->write_result;
+  priv->write_result = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (priv->cancellable, &error) ||
+      set_error_if_finished_early (priv, &error))
+    {
+      g_simple_async_result_set_from_error (result, error);
+      g_error_free (error);
+    }
+  else
+    g_simple_async_result_set_op_res_gssize (result, priv->write_count);
+
+  soup_output_stream_done_io (stream);
+
+  g_simple_async_result_complete (result);
+  g_object_unref (result);
+}
+
+static void
+soup_output_stream_wrote_body_data (SoupMessage *msg, SoupBuffer *chunk,
+				    gpointer stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  priv->pending -= MIN (priv->pending, chunk->length);
+  priv->written += chunk->length;
+
+  if (priv->write_result && priv->pending < MAX_PENDING_BYTES / 2)
+    write_async_done (stream);
+}
+
+static void
+soup_output_stream_restarted (SoupMessage *msg, gpointer stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  /* e.g. authentication after we started sending the body; the data
+   * sent so far is gone and can't be sent again.
+   */
+  if (priv->written > 0)
+    soup_session_cancel_message (priv->session, msg, SOUP_STATUS_IO_ERROR);
+}
+
 static void
 soup_output_stream_write_async (GOutputStream       *stream,
 				const void          *buffer,
@@ -299,24 +594,30 @@ soup_output_stream_write_async (GOutputStream       *stream,
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
   GSimpleAsyncResult *result;
+  GError *error = NULL;
 
   result = g_simple_async_result_new (G_OBJECT (stream),
 				      callback, user_data,
 				      soup_output_stream_write_async);
 
-  if (priv->size > 0 && priv->offset + count > priv->size)
+  if (!soup_output_stream_check_write (stream, count, &error))
     {
-      GError *error;
-
-      error = g_error_new (G_IO_ERROR, G_IO_ERROR_NO_SPACE,
-			   "Write would exceed caller-defined file size");
       g_simple_async_result_set_from_error (result, error);
       g_error_free (error);
     }
   else
     {
-      g_byte_array_append (priv->ba, buffer, count);
-      priv->offset += count;
+      soup_output_stream_append (stream, buffer, count);
+
+      if (priv->streaming && priv->pending >= MAX_PENDING_BYTES)
+	{
+	  /* Completed by wrote_body_data or finished */
+	  priv->write_result = result;
+	  priv->write_count = count;
+	  soup_output_stream_watch_cancellable (stream, cancellable);
+	  return;
+	}
+
       g_simple_async_result_set_op_res_gssize (result, count);
     }
 
@@ -340,15 +641,11 @@ soup_output_stream_write_finish (GOutputStream  *stream,
 }
 
 static void
-close_async_done (GOutputStream *stream)
+close_async_set_result (GOutputStream *stream, GSimpleAsyncResult *result)
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
-  GSimpleAsyncResult *result;
   GError *error = NULL;
 
-  result = priv->result;
-  priv->result = NULL;
-
   if (g_cancellable_set_error_if_cancelled (priv->cancellable, &error) ||
       set_error_if_http_failed (priv->msg, &error))
     {
@@ -357,6 +654,18 @@ close_async_done (GOutputStream *stream)
     }
   else
     g_simple_async_result_set_op_res_gboolean (result, TRUE);
+}
+
+static void
+close_async_done (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+  GSimpleAsyncResult *result;
+
+  result = priv->result;
+  priv->result = NULL;
+
+  close_async_set_result (stream, result);
 
   priv->finished_cb = NULL;
   priv->cancelled_cb = NULL;
@@ -374,7 +683,34 @@ soup_output_stream_finished (SoupMessage *msg, gpointer stream)
   priv->finished = TRUE;
 
   g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_finished), stream);
-  close_async_done (stream);
+
+  if (priv->streaming && soup_output_stream_fall_back (stream))
+    {
+      /* A waiting write is fine, its data is in the buffer now, and a
+       * waiting close sends the buffered request.
+       */
+      if (priv->write_result)
+	write_async_done (stream);
+
+      if (priv->result)
+	{
+	  GCancellable *cancellable = priv->cancellable;
+
+	  /* priv->msg is the fresh copy, not the one finishing now */
+	  soup_output_stream_done_io (stream);
+	  priv->cancelled_cb = close_async_done;
+	  g_signal_connect (priv->msg, "finished",
+			    G_CALLBACK (soup_output_stream_finished), stream);
+	  soup_output_stream_prepare_for_io (stream, cancellable);
+	}
+      return;
+    }
+
+  if (priv->write_result)
+    write_async_done (stream);
+
+  if (priv->result)
+    close_async_done (stream);
 }
 
 static void
@@ -395,6 +731,10 @@ soup_output_stream_close_async (GOutputStream        *stream,
     {
       GError *error;
 
+      if (priv->started && !priv->finished)
+	soup_session_cancel_message (priv->session, priv->msg,
+				     SOUP_STATUS_CANCELLED);
+
       error = g_error_new (G_IO_ERROR, G_IO_ERROR_NO_SPACE,
 			   "File is incomplete");
       g_simple_async_result_set_from_error (result, error);
@@ -404,6 +744,26 @@ soup_output_stream_close_async (GOutputStream        *stream,
       return;
     }
 
+  if (priv->streaming)
+    {
+      if (!priv->started)
+	soup_output_stream_start (stream);
+
+      if (priv->finished)
+	{
+	  close_async_set_result (stream, result);
+	  g_simple_async_result_complete_in_idle (result);
+	  g_object_unref (result);
+	  return;
+	}
+
+      priv->result = result;
+      soup_message_body_complete (priv->msg->request_body);
+      soup_session_unpause_message (priv->session, priv->msg);
+      soup_output_stream_watch_cancellable (stream, cancellable);
+      return;
+    }
+
   priv->result = result;
   priv->cancelled_cb = close_async_done;
   g_signal_connect (priv->msg, "finished",
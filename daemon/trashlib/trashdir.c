@@ -13,10 +13,18 @@
 
 #include "dirwatch.h"
 
+/* minimum time between two full rescans of a monitored directory, in
+ * microseconds.  events are applied as they come in, so rescanning is
+ * only a consistency check for the changes that a monitor may miss.
+ */
+#define RESCAN_INTERVAL (10 * G_USEC_PER_SEC)
+
 struct OPAQUE_TYPE__TrashDir
 {
   TrashRoot *root;
-  GSList *items;
+  /* basename -> GFile */
+  GHashTable *items;
+  gint64 last_scan;
 
   GFile *directory;
   GFile *topdir;
@@ -26,71 +34,63 @@ struct OPAQUE_TYPE__TrashDir
   GFileMonitor *monitor;
 };
 
-static gint
-compare_basename (gconstpointer a,
-                  gconstpointer b)
+static void
+trash_dir_add_file (TrashDir *dir,
+                    GFile    *file)
 {
-  GFile *file_a, *file_b;
-  char *name_a, *name_b;
-  gint result;
+  char *basename;
+
+  basename = g_file_get_basename (file);
 
-  file_a = (GFile *) a;
-  file_b = (GFile *) b;
+  if (g_hash_table_lookup (dir->items, basename) == NULL)
+    {
+      g_hash_table_insert (dir->items, basename, g_object_ref (file));
+      trash_root_add_item (dir->root, file, dir->is_homedir);
+    }
+  else
+    g_free (basename);
+}
 
-  name_a = g_file_get_basename (file_a);
-  name_b = g_file_get_basename (file_b);
+static void
+trash_dir_remove_file (TrashDir *dir,
+                       GFile    *file)
+{
+  char *basename;
 
-  result = strcmp (name_a, name_b);
+  basename = g_file_get_basename (file);
 
-  g_free (name_a);
-  g_free (name_b);
+  if (g_hash_table_remove (dir->items, basename))
+    trash_root_remove_item (dir->root, file, dir->is_homedir);
 
-  return result;
+  g_free (basename);
 }
 
 static void
-trash_dir_set_files (TrashDir *dir,
-                     GSList   *items)
+trash_dir_set_files (TrashDir   *dir,
+                     GHashTable *items)
 {
-  GSList **old, *new;
-
-  items = g_slist_sort (items, (GCompareFunc) compare_basename);
-  old = &dir->items;
-  new = items;
-
-  while (new || *old)
+  GHashTableIter iter;
+  gpointer key, value;
+
+  /* remove the old entries that are gone */
+  g_hash_table_iter_init (&iter, dir->items);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    if (items == NULL || g_hash_table_lookup (items, key) == NULL)
+      {
+        trash_root_remove_item (dir->root, value, dir->is_homedir);
+        g_hash_table_iter_remove (&iter);
+      }
+
+  /* and add the new ones */
+  if (items != NULL)
     {
-      int result;
+      g_hash_table_iter_init (&iter, items);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        trash_dir_add_file (dir, value);
 
-      if ((result = (new == NULL) - (*old == NULL)) == 0)
-        result = compare_basename (new->data, (*old)->data);
-
-      if (result < 0)
-        {
-          /* new entry.  add it. */
-          *old = g_slist_prepend (*old, new->data); /* take reference */
-          old = &(*old)->next;
-          trash_root_add_item (dir->root, new->data, dir->is_homedir);
-          new = new->next;
-        }
-      else if (result > 0)
-        {
-          /* old entry.  remove it. */
-          trash_root_remove_item (dir->root, (*old)->data, dir->is_homedir);
-          g_object_unref ((*old)->data);
-          *old = g_slist_delete_link (*old, *old);
-        }
-      else
-        {
-          /* match.  no change. */
-          old = &(*old)->next;
-          g_object_unref (new->data);
-          new = new->next;
-        }
+      g_hash_table_unref (items);
     }
 
-  g_slist_free (items);
-
   trash_root_thaw (dir->root);
 }
 
@@ -104,7 +104,11 @@ static void
 trash_dir_enumerate (TrashDir *dir)
 {
   GFileEnumerator *enumerator;
-  GSList *files = NULL;
+  GHashTable *files;
+
+  files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                 g_free, g_object_unref);
+  dir->last_scan = g_get_monotonic_time ();
 
   enumerator = g_file_enumerate_children (dir->directory,
                                           G_FILE_ATTRIBUTE_STANDARD_NAME,
@@ -121,7 +125,8 @@ trash_dir_enumerate (TrashDir *dir)
 
           file = g_file_get_child (dir->directory,
                                    g_file_info_get_name (info));
-          files = g_slist_prepend (files, file);
+          g_hash_table_replace (files, g_strdup (g_file_info_get_name (info)),
+                                file);
 
           g_object_unref (info);
         }
@@ -142,12 +147,19 @@ trash_dir_changed (GFileMonitor      *monitor,
   TrashDir *dir = user_data;
 
   if (event_type == G_FILE_MONITOR_EVENT_CREATED)
-    trash_root_add_item (dir->root, file, dir->is_homedir);
+    trash_dir_add_file (dir, file);
 
   else if (event_type == G_FILE_MONITOR_EVENT_DELETED)
-    trash_root_remove_item (dir->root, file, dir->is_homedir);
+    trash_dir_remove_file (dir, file);
 
-  else if (event_type == G_FILE_MONITOR_EVENT_PRE_UNMOUNT ||
+  else if (event_type == G_FILE_MONITOR_EVENT_CHANGED ||
+           event_type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+    /* not expected in a files/ directory, but the cached info of the
+     * item is outdated now */
+    trash_root_item_changed (dir->root, file, dir->is_homedir);
+
+  else if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+           event_type == G_FILE_MONITOR_EVENT_PRE_UNMOUNT ||
            event_type == G_FILE_MONITOR_EVENT_UNMOUNTED)
     ;
 
@@ -300,6 +312,14 @@ dir_exists (GFile *directory,
 void
 trash_dir_rescan (TrashDir *dir)
 {
+  /* while the monitor is running, the items are kept up to date from
+   * its events and a rescan only catches what it missed.  don't do
+   * that more often than necessary, since it reads the whole directory.
+   */
+  if (dir->monitor &&
+      g_get_monotonic_time () - dir->last_scan < RESCAN_INTERVAL)
+    return;
+
   if (dir->watch)
     dir_watch_check (dir->watch);
 
@@ -331,7 +351,9 @@ trash_dir_new (TrashRoot  *root,
   dir = g_slice_new (TrashDir);
 
   dir->root = root;
-  dir->items = NULL;
+  dir->items = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, g_object_unref);
+  dir->last_scan = 0;
   dir->topdir = g_file_new_for_path (mount_point);
   dir->directory = g_file_get_child (dir->topdir, rel);
   dir->monitor = NULL;
@@ -371,6 +393,7 @@ trash_dir_free (TrashDir *dir)
     g_object_unref (dir->monitor);
 
   trash_dir_set_files (dir, NULL);
+  g_hash_table_unref (dir->items);
 
   g_object_unref (dir->directory);
   g_object_unref (dir->topdir);
@@ -8,125 +8,308 @@
 
 #include "trashexpunge.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* number of directories that are deleted at the same time.  each
+ * directory queued with trash_expunge() is one of them, and so is each
+ * of its subdirectories, ie: each expunged trash item.  this lets trash
+ * directories on different devices, as well as big items on the same
+ * one, be deleted in parallel.
+ */
+#define EXPUNGE_THREADS 4
+
+typedef enum
+{
+  EXPUNGE_PENDING,
+  EXPUNGE_RUNNING,
+  /* running, and queued again since it started */
+  EXPUNGE_RERUN
+} ExpungeState;
+
+typedef struct
+{
+  char *path;
+  /* the directories passed to trash_expunge() are kept, their
+   * subdirectories are removed once they are empty */
+  gboolean toplevel;
+  ExpungeState state;
+} ExpungeJob;
+
 static gsize trash_expunge_initialised;
+/* path -> ExpungeJob, for all jobs that are pending or running */
 static GHashTable *trash_expunge_queue;
-static gboolean trash_expunge_alive;
+static GThreadPool *trash_expunge_pool;
 static GMutex trash_expunge_lock;
-static GCond trash_expunge_wait;
 
+/* progress, see trash_expunge_get_progress() */
+static volatile gint trash_expunge_deleted;
+
+/* throttling, see trash_expunge_throttle() */
+static guint trash_expunge_max_rate;
+static GMutex trash_expunge_rate_lock;
+static gint64 trash_expunge_rate_start;
+static guint trash_expunge_rate_count;
+
+/* called after each file deleted.  if GVFS_TRASH_EXPUNGE_RATE is set,
+ * no more than that many files are deleted per second, so that emptying
+ * a big trash does not starve other users of the disk.
+ */
 static void
-trash_expunge_delete_everything_under (GFile *directory)
+trash_expunge_throttle (void)
 {
-  GFileEnumerator *enumerator;
+  g_atomic_int_inc (&trash_expunge_deleted);
 
-  g_file_set_attribute_uint32 (directory,
-                               G_FILE_ATTRIBUTE_UNIX_MODE, 0700,
-                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                               NULL, NULL);
+  if (trash_expunge_max_rate == 0)
+    return;
 
-  enumerator = g_file_enumerate_children (directory,
-                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                          G_FILE_ATTRIBUTE_STANDARD_TYPE,
-                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                          NULL, NULL);
+  g_mutex_lock (&trash_expunge_rate_lock);
 
-  if (enumerator)
+  if (++trash_expunge_rate_count >= trash_expunge_max_rate)
     {
-      GFileInfo *info;
+      gint64 elapsed;
+
+      elapsed = g_get_monotonic_time () - trash_expunge_rate_start;
+      if (elapsed < G_USEC_PER_SEC)
+        g_usleep (G_USEC_PER_SEC - elapsed);
+
+      trash_expunge_rate_start = g_get_monotonic_time ();
+      trash_expunge_rate_count = 0;
+    }
+
+  g_mutex_unlock (&trash_expunge_rate_lock);
+}
+
+static gboolean
+trash_expunge_is_dir (int            fd,
+                      struct dirent *entry)
+{
+  struct stat buf;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+  if (entry->d_type != DT_UNKNOWN)
+    return entry->d_type == DT_DIR;
+#endif
+
+  if (fstatat (fd, entry->d_name, &buf, AT_SYMLINK_NOFOLLOW) != 0)
+    return FALSE;
+
+  return S_ISDIR (buf.st_mode);
+}
 
-      while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL)))
+/* opens the directory name in the one at fd, making sure that we are
+ * allowed to read it and to delete its contents */
+static int
+trash_expunge_open_dir (int         fd,
+                        const char *name)
+{
+  struct stat buf;
+  int subfd;
+
+  subfd = openat (fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+  if (subfd != -1)
+    {
+      fchmod (subfd, 0700);
+      return subfd;
+    }
+
+  if (errno != EACCES)
+    return -1;
+
+  /* can't open it without changing its mode first.  fchmodat() follows
+   * symlinks, so check that it isn't one */
+  if (fstatat (fd, name, &buf, AT_SYMLINK_NOFOLLOW) != 0 ||
+      !S_ISDIR (buf.st_mode))
+    return -1;
+
+  fchmodat (fd, name, 0700, 0);
+
+  return openat (fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+}
+
+static void trash_expunge_queue_dir (const char *path,
+                                     gboolean    toplevel);
+
+/* deletes everything in the directory at fd, and closes fd.  if path is
+ * given, subdirectories are queued as separate jobs instead.
+ */
+static void
+trash_expunge_delete_everything_under (int         fd,
+                                       const char *path)
+{
+  struct dirent *entry;
+  DIR *dir;
+
+  dir = fdopendir (fd);
+
+  if (dir == NULL)
+    {
+      close (fd);
+      return;
+    }
+
+  while ((entry = readdir (dir)))
+    {
+      if (strcmp (entry->d_name, ".") == 0 ||
+          strcmp (entry->d_name, "..") == 0)
+        continue;
+
+      if (trash_expunge_is_dir (fd, entry))
         {
-          const gchar *basename;
-          GFile *sub;
-          
-          basename = g_file_info_get_name (info);
-          sub = g_file_get_child (directory, basename);
+          if (path != NULL)
+            {
+              char *sub;
 
-          if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
-            trash_expunge_delete_everything_under (sub);
+              sub = g_build_filename (path, entry->d_name, NULL);
+              trash_expunge_queue_dir (sub, FALSE);
+              g_free (sub);
+              continue;
+            }
+          else
+            {
+              int subfd;
 
-          /* do the delete here */
-          g_file_delete (sub, NULL, NULL);
+              subfd = trash_expunge_open_dir (fd, entry->d_name);
+              if (subfd != -1)
+                trash_expunge_delete_everything_under (subfd, NULL);
 
-          g_object_unref (info);
-          g_object_unref (sub);
+              unlinkat (fd, entry->d_name, AT_REMOVEDIR);
+            }
         }
-      g_object_unref (enumerator);
+      else
+        unlinkat (fd, entry->d_name, 0);
+
+      trash_expunge_throttle ();
     }
+
+  closedir (dir);
 }
 
-static gboolean
-just_return_true (gpointer a,
-                  gpointer b,
-                  gpointer c)
+static void
+trash_expunge_job_free (ExpungeJob *job)
 {
-  return TRUE;
+  g_free (job->path);
+  g_slice_free (ExpungeJob, job);
 }
 
-static gpointer
-trash_expunge_thread (gpointer data)
+static void
+trash_expunge_run (gpointer data,
+                   gpointer user_data)
 {
-  gint64 end_time;
+  ExpungeJob *job = data;
 
   g_mutex_lock (&trash_expunge_lock);
 
   do
     {
-      while (g_hash_table_size (trash_expunge_queue))
-        {
-          GFile *directory;
-         
-          directory = g_hash_table_find (trash_expunge_queue,
-                                         just_return_true, NULL);
-          g_hash_table_remove (trash_expunge_queue, directory);
+      int fd;
+
+      job->state = EXPUNGE_RUNNING;
+      g_mutex_unlock (&trash_expunge_lock);
 
-          g_mutex_unlock (&trash_expunge_lock);
-          trash_expunge_delete_everything_under (directory);
-          g_mutex_lock (&trash_expunge_lock);
+      fd = trash_expunge_open_dir (AT_FDCWD, job->path);
 
-          g_object_unref (directory);
+      if (fd != -1)
+        {
+          /* split the toplevel directories up by item */
+          trash_expunge_delete_everything_under (fd, job->toplevel ?
+                                                     job->path : NULL);
+
+          if (!job->toplevel && rmdir (job->path) == 0)
+            trash_expunge_throttle ();
         }
 
-      end_time = g_get_monotonic_time () + 1 * G_TIME_SPAN_MINUTE;
+      g_mutex_lock (&trash_expunge_lock);
     }
-  while (g_cond_wait_until (&trash_expunge_wait,
-                            &trash_expunge_lock,
-                            end_time));
+  while (job->state == EXPUNGE_RERUN);
 
-  trash_expunge_alive = FALSE;
+  g_hash_table_remove (trash_expunge_queue, job->path);
 
   g_mutex_unlock (&trash_expunge_lock);
+}
+
+static void
+trash_expunge_queue_dir (const char *path,
+                         gboolean    toplevel)
+{
+  ExpungeJob *job;
+
+  g_mutex_lock (&trash_expunge_lock);
+
+  job = g_hash_table_lookup (trash_expunge_queue, path);
+
+  if (job == NULL)
+    {
+      job = g_slice_new (ExpungeJob);
+      job->path = g_strdup (path);
+      job->toplevel = toplevel;
+      job->state = EXPUNGE_PENDING;
+      g_hash_table_insert (trash_expunge_queue, job->path, job);
+
+      g_thread_pool_push (trash_expunge_pool, job, NULL);
+    }
+  else if (job->state == EXPUNGE_RUNNING)
+    /* it may have missed what was just added, so go again */
+    job->state = EXPUNGE_RERUN;
 
-  return NULL;
+  g_mutex_unlock (&trash_expunge_lock);
 }
 
-void
-trash_expunge (GFile *directory)
+static void
+trash_expunge_init (void)
 {
   if G_UNLIKELY (g_once_init_enter (&trash_expunge_initialised))
     {
-      trash_expunge_queue = g_hash_table_new (g_file_hash,
-                                              (GEqualFunc) g_file_equal);
+      const char *rate;
+
+      trash_expunge_queue = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   NULL,
+                                                   (GDestroyNotify) trash_expunge_job_free);
+      trash_expunge_pool = g_thread_pool_new (trash_expunge_run, NULL,
+                                              EXPUNGE_THREADS, FALSE, NULL);
+
+      rate = g_getenv ("GVFS_TRASH_EXPUNGE_RATE");
+      if (rate)
+        trash_expunge_max_rate = strtoul (rate, NULL, 10);
+      trash_expunge_rate_start = g_get_monotonic_time ();
+
       g_once_init_leave (&trash_expunge_initialised, 1);
     }
+}
 
-  g_mutex_lock (&trash_expunge_lock);
+void
+trash_expunge (GFile *directory)
+{
+  char *path;
 
-  if (!g_hash_table_lookup (trash_expunge_queue, directory))
-    g_hash_table_insert (trash_expunge_queue,
-                         g_object_ref (directory),
-                         directory);
+  trash_expunge_init ();
 
-  if (trash_expunge_alive == FALSE)
-    {
-      GThread *thread;
+  path = g_file_get_path (directory);
+  if (path)
+    trash_expunge_queue_dir (path, TRUE);
+  g_free (path);
+}
 
-      thread = g_thread_new ("trash-expunge", trash_expunge_thread, NULL);
-      g_assert (thread != NULL);
-      trash_expunge_alive = TRUE;
-    }
-  else
-    g_cond_signal (&trash_expunge_wait);
+void
+trash_expunge_get_progress (guint *deleted,
+                            guint *pending)
+{
+  trash_expunge_init ();
 
-  g_mutex_unlock (&trash_expunge_lock);
+  if (deleted)
+    *deleted = g_atomic_int_get (&trash_expunge_deleted);
+
+  if (pending)
+    {
+      g_mutex_lock (&trash_expunge_lock);
+      *pending = g_hash_table_size (trash_expunge_queue);
+      g_mutex_unlock (&trash_expunge_lock);
+    }
 }
@@ -14,4 +14,8 @@
 typedef struct OPAQUE_TYPE__TrashExpunger TrashExpunger;
 void trash_expunge (GFile *expunge_directory);
 
+/* files deleted so far, and directories still being deleted */
+void trash_expunge_get_progress (guint *deleted,
+                                 guint *pending);
+
 #endif /* _trashexpunger_h_ */
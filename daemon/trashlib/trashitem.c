@@ -10,6 +10,15 @@
 #include "trashitem.h"
 
 #include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/* threads used to query the file infos of trash items */
+#define INFO_THREADS 8
 
 typedef struct
 {
@@ -31,6 +40,18 @@ struct OPAQUE_TYPE__TrashRoot
   GHashTable *item_table;
   gboolean is_homedir;
   int old_size;
+
+  /* protects the lazily filled in fields of all items, and the sizes */
+  GMutex info_lock;
+  GThreadPool *info_pool;
+
+  /* sizes of the items, measured one at a time in the background */
+  GThreadPool *size_pool;
+  gint freeing;
+  goffset total_size;
+  int n_unsized;
+  /* trash directory -> goffset*, the total size of its items */
+  GHashTable *dir_sizes;
 };
 
 struct OPAQUE_TYPE__TrashItem
@@ -41,10 +62,51 @@ struct OPAQUE_TYPE__TrashItem
   char *escaped_name;
   GFile *file;
 
+  /* read from the .trashinfo file on first use */
+  gboolean trashinfo_loaded;
   GFile *original;
   char *delete_date;
+
+  /* the info of file, queried with and without
+   * G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, and the attributes it was
+   * queried for, or NULL until needed
+   */
+  GFileInfo *info[2];
+  char *info_attributes[2];
+  /* bumped when the infos go stale, so that a query that was already
+   * running doesn't cache its outdated result */
+  guint info_generation;
+
+  /* the trash directory holding the item (interned) */
+  const char *trash_dir;
+  /* total size of the file or directory tree, once known */
+  goffset size;
+  gboolean size_known;
+  /* no longer counted in the root */
+  gboolean removed;
 };
 
+/* a set of items whose infos are being queried by the thread pool */
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  int pending;
+  /* finished tasks, not passed to the caller yet */
+  GQueue done;
+
+  const char *attributes;
+  GFileQueryInfoFlags flags;
+  GCancellable *cancellable;
+} InfoBatch;
+
+typedef struct
+{
+  TrashItem *item;
+  GFileInfo *info;
+  InfoBatch *batch;
+} InfoTask;
+
 static char *
 trash_item_escape_name (GFile    *file,
                         gboolean  in_homedir)
@@ -212,11 +274,68 @@ trash_item_new (TrashRoot *root,
   item->ref_count = 1;
   item->file = g_object_ref (file);
   item->escaped_name = trash_item_escape_name (file, in_homedir);
-  trash_item_get_trashinfo (item->file, &item->original, &item->delete_date);
+  item->trashinfo_loaded = FALSE;
+  item->original = NULL;
+  item->delete_date = NULL;
+  item->info[0] = NULL;
+  item->info[1] = NULL;
+  item->info_attributes[0] = NULL;
+  item->info_attributes[1] = NULL;
+  item->info_generation = 0;
+  item->size = 0;
+  item->size_known = FALSE;
+  item->removed = FALSE;
+
+  {
+    GFile *files, *trashdir;
+    char *path;
+
+    /* .../Trash/files/item -> .../Trash */
+    files = g_file_get_parent (file);
+    trashdir = g_file_get_parent (files);
+    path = g_file_get_path (trashdir);
+    item->trash_dir = g_intern_string (path);
+    g_free (path);
+    g_object_unref (trashdir);
+    g_object_unref (files);
+  }
 
   return item;
 }
 
+static void
+trash_item_load_trashinfo (TrashItem *item)
+{
+  GFile *original;
+  gboolean loaded;
+  char *date;
+
+  g_mutex_lock (&item->root->info_lock);
+  loaded = item->trashinfo_loaded;
+  g_mutex_unlock (&item->root->info_lock);
+
+  if (loaded)
+    return;
+
+  /* don't hold the lock while reading the file */
+  trash_item_get_trashinfo (item->file, &original, &date);
+
+  g_mutex_lock (&item->root->info_lock);
+  if (!item->trashinfo_loaded)
+    {
+      item->original = original;
+      item->delete_date = date;
+      item->trashinfo_loaded = TRUE;
+      original = NULL;
+      date = NULL;
+    }
+  g_mutex_unlock (&item->root->info_lock);
+
+  if (original)
+    g_object_unref (original);
+  g_free (date);
+}
+
 static TrashItem *
 trash_item_ref (TrashItem *item)
 {
@@ -234,6 +353,14 @@ trash_item_unref (TrashItem *item)
       if (item->original)
         g_object_unref (item->original);
 
+      if (item->info[0])
+        g_object_unref (item->info[0]);
+
+      if (item->info[1])
+        g_object_unref (item->info[1]);
+
+      g_free (item->info_attributes[0]);
+      g_free (item->info_attributes[1]);
       g_free (item->delete_date);
       g_free (item->escaped_name);
 
@@ -250,15 +377,467 @@ trash_item_get_escaped_name (TrashItem *item)
 const char *
 trash_item_get_delete_date (TrashItem *item)
 {
+  trash_item_load_trashinfo (item);
+
   return item->delete_date;
 }
 
 GFile *
 trash_item_get_original (TrashItem *item)
 {
+  trash_item_load_trashinfo (item);
+
   return item->original;
 }
 
+static int
+trash_item_info_slot (GFileQueryInfoFlags flags)
+{
+  return (flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS) != 0;
+}
+
+/* must hold info_lock */
+static void
+trash_item_drop_infos (TrashItem *item)
+{
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (item->info[i])
+        g_object_unref (item->info[i]);
+      g_free (item->info_attributes[i]);
+      item->info[i] = NULL;
+      item->info_attributes[i] = NULL;
+    }
+
+  item->info_generation++;
+}
+
+static GFileInfo *
+trash_item_lookup_info (TrashItem           *item,
+                        const char          *attributes,
+                        GFileQueryInfoFlags  flags)
+{
+  GFileInfo *info;
+  int slot;
+
+  slot = trash_item_info_slot (flags);
+  info = NULL;
+
+  g_mutex_lock (&item->root->info_lock);
+  if (item->info[slot] &&
+      strcmp (item->info_attributes[slot], attributes) == 0)
+    info = g_file_info_dup (item->info[slot]);
+  g_mutex_unlock (&item->root->info_lock);
+
+  return info;
+}
+
+/* queries and caches the info, also loading the .trashinfo file while
+ * we are at it, so that both are in place when the item is listed.
+ * The standard attributes are always needed to list the item.
+ */
+static GFileInfo *
+trash_item_query_info (TrashItem            *item,
+                       const char           *attributes,
+                       GFileQueryInfoFlags   flags,
+                       GCancellable         *cancellable,
+                       GError              **error)
+{
+  GFileInfo *info;
+  guint generation;
+  char *query;
+  int slot;
+
+  trash_item_load_trashinfo (item);
+
+  g_mutex_lock (&item->root->info_lock);
+  generation = item->info_generation;
+  g_mutex_unlock (&item->root->info_lock);
+
+  query = g_strconcat ("standard::*,", attributes, NULL);
+  info = g_file_query_info (item->file, query, flags, cancellable, error);
+  g_free (query);
+
+  if (info)
+    {
+      slot = trash_item_info_slot (flags);
+
+      g_mutex_lock (&item->root->info_lock);
+      if (item->info_generation == generation)
+        {
+          if (item->info[slot])
+            g_object_unref (item->info[slot]);
+          g_free (item->info_attributes[slot]);
+          item->info[slot] = g_object_ref (info);
+          item->info_attributes[slot] = g_strdup (attributes);
+        }
+      g_mutex_unlock (&item->root->info_lock);
+    }
+
+  return info;
+}
+
+GFileInfo *
+trash_item_get_info (TrashItem            *item,
+                     const char           *attributes,
+                     GFileQueryInfoFlags   flags,
+                     GCancellable         *cancellable,
+                     GError              **error)
+{
+  GFileInfo *info;
+
+  if ((info = trash_item_lookup_info (item, attributes, flags)))
+    return info;
+
+  info = trash_item_query_info (item, attributes, flags, cancellable, error);
+
+  if (info)
+    {
+      GFileInfo *copy;
+
+      /* the cached one must not be modified by the caller */
+      copy = g_file_info_dup (info);
+      g_object_unref (info);
+      info = copy;
+    }
+
+  return info;
+}
+
+static void
+trash_item_info_thread (gpointer data,
+                        gpointer user_data)
+{
+  InfoTask *task = data;
+  InfoBatch *batch = task->batch;
+
+  if (!g_cancellable_is_cancelled (batch->cancellable))
+    task->info = trash_item_get_info (task->item, batch->attributes,
+                                      batch->flags, batch->cancellable,
+                                      NULL);
+
+  g_mutex_lock (&batch->lock);
+  g_queue_push_tail (&batch->done, task);
+  batch->pending--;
+  g_cond_signal (&batch->cond);
+  g_mutex_unlock (&batch->lock);
+}
+
+static void
+trash_item_info_task_finish (InfoTask             *task,
+                             trash_item_info_func  func,
+                             gpointer              user_data)
+{
+  if (task->info)
+    {
+      func (task->item, task->info, user_data);
+      g_object_unref (task->info);
+    }
+
+  trash_item_unref (task->item);
+  g_slice_free (InfoTask, task);
+}
+
+void
+trash_root_query_infos (TrashRoot            *root,
+                        GList                *items,
+                        const char           *attributes,
+                        GFileQueryInfoFlags   flags,
+                        GCancellable         *cancellable,
+                        trash_item_info_func  func,
+                        gpointer              user_data)
+{
+  InfoBatch batch;
+  InfoTask *task;
+  GList *node;
+
+  g_mutex_init (&batch.lock);
+  g_cond_init (&batch.cond);
+  batch.pending = 0;
+  g_queue_init (&batch.done);
+  batch.attributes = attributes;
+  batch.flags = flags;
+  batch.cancellable = cancellable;
+
+  for (node = items; node; node = node->next)
+    {
+      TrashItem *item = node->data;
+      GFileInfo *info;
+
+      if ((info = trash_item_lookup_info (item, attributes, flags)))
+        {
+          func (item, info, user_data);
+          g_object_unref (info);
+          continue;
+        }
+
+      task = g_slice_new (InfoTask);
+      task->item = trash_item_ref (item);
+      task->info = NULL;
+      task->batch = &batch;
+
+      g_mutex_lock (&batch.lock);
+      batch.pending++;
+      g_mutex_unlock (&batch.lock);
+
+      g_thread_pool_push (root->info_pool, task, NULL);
+    }
+
+  /* pass on the queried infos as they come in */
+  g_mutex_lock (&batch.lock);
+  while (batch.pending > 0 || !g_queue_is_empty (&batch.done))
+    {
+      task = g_queue_pop_head (&batch.done);
+
+      if (task == NULL)
+        {
+          g_cond_wait (&batch.cond, &batch.lock);
+          continue;
+        }
+
+      g_mutex_unlock (&batch.lock);
+      trash_item_info_task_finish (task, func, user_data);
+      g_mutex_lock (&batch.lock);
+    }
+  g_mutex_unlock (&batch.lock);
+
+  g_mutex_clear (&batch.lock);
+  g_cond_clear (&batch.cond);
+}
+
+/* a file with several hard links, counted once */
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+} FileId;
+
+static guint
+file_id_hash (gconstpointer key)
+{
+  const FileId *id = key;
+
+  return (guint) id->ino ^ (guint) id->dev;
+}
+
+static gboolean
+file_id_equal (gconstpointer a,
+               gconstpointer b)
+{
+  const FileId *id_a = a, *id_b = b;
+
+  return id_a->ino == id_b->ino && id_a->dev == id_b->dev;
+}
+
+static void
+file_id_free (gpointer data)
+{
+  g_slice_free (FileId, data);
+}
+
+/* disk usage of the tree at name in the directory fd.  seen holds the
+ * hard linked files that were already counted */
+static goffset
+trash_item_measure (int         fd,
+                    const char *name,
+                    GHashTable *seen)
+{
+  struct dirent *entry;
+  struct stat buf;
+  goffset size;
+  DIR *dir;
+  int subfd;
+
+  if (fstatat (fd, name, &buf, AT_SYMLINK_NOFOLLOW) != 0)
+    return 0;
+
+  if (!S_ISDIR (buf.st_mode) && buf.st_nlink > 1)
+    {
+      FileId *id;
+
+      id = g_slice_new (FileId);
+      id->dev = buf.st_dev;
+      id->ino = buf.st_ino;
+
+      if (g_hash_table_lookup (seen, id))
+        {
+          file_id_free (id);
+          return 0;
+        }
+
+      g_hash_table_insert (seen, id, id);
+    }
+
+  size = (goffset) buf.st_blocks * 512;
+
+  if (!S_ISDIR (buf.st_mode))
+    return size;
+
+  subfd = openat (fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  if (subfd == -1)
+    return size;
+
+  dir = fdopendir (subfd);
+  if (dir == NULL)
+    {
+      close (subfd);
+      return size;
+    }
+
+  while ((entry = readdir (dir)))
+    if (strcmp (entry->d_name, ".") != 0 &&
+        strcmp (entry->d_name, "..") != 0)
+      size += trash_item_measure (subfd, entry->d_name, seen);
+
+  closedir (dir);
+
+  return size;
+}
+
+/* must hold info_lock */
+static void
+trash_root_account (TrashRoot  *root,
+                    const char *trash_dir,
+                    goffset     delta)
+{
+  goffset *dir_size;
+
+  root->total_size += delta;
+
+  dir_size = g_hash_table_lookup (root->dir_sizes, trash_dir);
+  if (dir_size == NULL)
+    {
+      dir_size = g_new0 (goffset, 1);
+      g_hash_table_insert (root->dir_sizes, (gpointer) trash_dir, dir_size);
+    }
+  *dir_size += delta;
+}
+
+static void
+trash_item_size_thread (gpointer data,
+                        gpointer user_data)
+{
+  TrashItem *item = data;
+  TrashRoot *root = item->root;
+  GHashTable *seen;
+  goffset size;
+  char *path;
+
+  if (g_atomic_int_get (&root->freeing))
+    {
+      trash_item_unref (item);
+      return;
+    }
+
+  seen = g_hash_table_new_full (file_id_hash, file_id_equal,
+                                file_id_free, NULL);
+
+  path = g_file_get_path (item->file);
+  size = path ? trash_item_measure (AT_FDCWD, path, seen) : 0;
+  g_free (path);
+
+  g_hash_table_destroy (seen);
+
+  g_mutex_lock (&root->info_lock);
+
+  if (!item->removed)
+    {
+      if (item->size_known)
+        trash_root_account (root, item->trash_dir, size - item->size);
+      else
+        {
+          trash_root_account (root, item->trash_dir, size);
+          root->n_unsized--;
+        }
+
+      item->size = size;
+      item->size_known = TRUE;
+    }
+
+  g_mutex_unlock (&root->info_lock);
+
+  trash_item_unref (item);
+}
+
+gboolean
+trash_item_get_size (TrashItem *item,
+                     goffset   *size)
+{
+  gboolean known;
+
+  g_mutex_lock (&item->root->info_lock);
+  known = item->size_known;
+  *size = item->size;
+  g_mutex_unlock (&item->root->info_lock);
+
+  return known;
+}
+
+goffset
+trash_root_get_size (TrashRoot *root,
+                     int       *n_pending)
+{
+  goffset size;
+
+  g_mutex_lock (&root->info_lock);
+  size = root->total_size;
+  if (n_pending)
+    *n_pending = root->n_unsized;
+  g_mutex_unlock (&root->info_lock);
+
+  return size;
+}
+
+char **
+trash_root_get_dir_sizes (TrashRoot *root)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  char **result;
+  int i;
+
+  g_mutex_lock (&root->info_lock);
+
+  result = g_new (char *, g_hash_table_size (root->dir_sizes) + 1);
+  i = 0;
+
+  g_hash_table_iter_init (&iter, root->dir_sizes);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    result[i++] = g_strdup_printf ("%s=%" G_GUINT64_FORMAT,
+                                   (const char *) key,
+                                   (guint64) *(goffset *) value);
+  result[i] = NULL;
+
+  g_mutex_unlock (&root->info_lock);
+
+  return result;
+}
+
+void
+trash_root_item_changed (TrashRoot *root,
+                         GFile     *file,
+                         gboolean   in_homedir)
+{
+  TrashItem *item;
+  char *escaped;
+
+  escaped = trash_item_escape_name (file, in_homedir);
+  item = trash_root_lookup_item (root, escaped);
+  g_free (escaped);
+
+  if (item == NULL)
+    return;
+
+  g_mutex_lock (&root->info_lock);
+  trash_item_drop_infos (item);
+  g_mutex_unlock (&root->info_lock);
+
+  /* measure it again */
+  g_thread_pool_push (root->size_pool, item, NULL);
+}
+
 GFile *
 trash_item_get_file (TrashItem *item)
 {
@@ -322,6 +901,15 @@ static void
 trash_item_removed (gpointer data)
 {
   TrashItem *item = data;
+  TrashRoot *root = item->root;
+
+  g_mutex_lock (&root->info_lock);
+  item->removed = TRUE;
+  if (item->size_known)
+    trash_root_account (root, item->trash_dir, -item->size);
+  else
+    root->n_unsized--;
+  g_mutex_unlock (&root->info_lock);
 
   trash_item_queue_notify (item, item->root->delete_notify);
   trash_item_unref (item);
@@ -345,6 +933,16 @@ trash_root_new (trash_item_notify create,
   root->item_table = g_hash_table_new_full (g_str_hash, g_str_equal,
                                             NULL, trash_item_removed);
   root->old_size = 0;
+  g_mutex_init (&root->info_lock);
+  root->info_pool = g_thread_pool_new (trash_item_info_thread, NULL,
+                                       INFO_THREADS, FALSE, NULL);
+  root->size_pool = g_thread_pool_new (trash_item_size_thread, NULL,
+                                       1, FALSE, NULL);
+  g_atomic_int_set (&root->freeing, FALSE);
+  root->total_size = 0;
+  root->n_unsized = 0;
+  root->dir_sizes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           NULL, g_free);
 
   return root;
 }
@@ -352,6 +950,11 @@ trash_root_new (trash_item_notify create,
 void
 trash_root_free (TrashRoot *root)
 {
+  /* let the pending size jobs finish quickly */
+  g_atomic_int_set (&root->freeing, TRUE);
+  g_thread_pool_free (root->size_pool, FALSE, TRUE);
+  g_thread_pool_free (root->info_pool, FALSE, TRUE);
+
   g_hash_table_destroy (root->item_table);
 
   while (!g_queue_is_empty (root->notifications))
@@ -364,6 +967,9 @@ trash_root_free (TrashRoot *root)
     }
   g_queue_free (root->notifications);
 
+  g_hash_table_destroy (root->dir_sizes);
+  g_mutex_clear (&root->info_lock);
+
   g_slice_free (TrashRoot, root);
 }
 
@@ -390,7 +996,13 @@ trash_root_add_item (TrashRoot *list,
   g_hash_table_insert (list->item_table, item->escaped_name, item);
   trash_item_queue_notify (item, item->root->create_notify);
 
+  g_mutex_lock (&list->info_lock);
+  list->n_unsized++;
+  g_mutex_unlock (&list->info_lock);
+
   g_rw_lock_writer_unlock (&list->lock);
+
+  g_thread_pool_push (list->size_pool, trash_item_ref (item), NULL);
 }
 
 void
@@ -17,6 +17,9 @@ typedef struct  OPAQUE_TYPE__TrashItem        TrashItem;
 typedef void  (*trash_item_notify)           (TrashItem          *item,
                                               gpointer            user_data);
 typedef void  (*trash_size_change)           (gpointer            user_data);
+typedef void  (*trash_item_info_func)        (TrashItem          *item,
+                                              GFileInfo          *info,
+                                              gpointer            user_data);
 
 /* trash root -- the set of all toplevel trash items */
 TrashRoot      *trash_root_new               (trash_item_notify   create,
@@ -32,6 +35,9 @@ void            trash_root_add_item          (TrashRoot          *root,
 void            trash_root_remove_item       (TrashRoot          *root,
                                               GFile              *file,
                                               gboolean            in_homedir);
+void            trash_root_item_changed      (TrashRoot          *root,
+                                              GFile              *file,
+                                              gboolean            in_homedir);
 void            trash_root_thaw              (TrashRoot          *root);
 
 /* query trash items, holding references (safe from any thread) */
@@ -40,14 +46,39 @@ GList          *trash_root_get_items         (TrashRoot          *root);
 TrashItem      *trash_root_lookup_item       (TrashRoot          *root,
                                               const char         *escaped);
 
+/* total size of the items, measured in the background (safe from any
+ * thread).  n_pending is set to the number of items not measured yet.
+ * the per trash directory sizes are "path=bytes" strings */
+goffset         trash_root_get_size          (TrashRoot          *root,
+                                              int                *n_pending);
+char          **trash_root_get_dir_sizes     (TrashRoot          *root);
+
 void            trash_item_list_free         (GList              *list);
 void            trash_item_unref             (TrashItem          *item);
 
+/* query the file infos of trash items, in parallel for those that are not
+ * cached yet. func is called in the calling thread for each item as soon
+ * as its info is known (safe from any thread) */
+void            trash_root_query_infos       (TrashRoot          *root,
+                                              GList              *items,
+                                              const char         *attributes,
+                                              GFileQueryInfoFlags flags,
+                                              GCancellable       *cancellable,
+                                              trash_item_info_func func,
+                                              gpointer            user_data);
+
 /* query a trash item (safe while holding a reference to it) */
 const char     *trash_item_get_escaped_name  (TrashItem          *item);
 const char     *trash_item_get_delete_date   (TrashItem          *item);
 GFile          *trash_item_get_original      (TrashItem          *item);
 GFile          *trash_item_get_file          (TrashItem          *item);
+gboolean        trash_item_get_size          (TrashItem          *item,
+                                              goffset            *size);
+GFileInfo      *trash_item_get_info          (TrashItem          *item,
+                                              const char         *attributes,
+                                              GFileQueryInfoFlags flags,
+                                              GCancellable       *cancellable,
+                                              GError            **error);
 
 /* delete a trash item (safe while holding a reference to it) */
 gboolean        trash_item_delete            (TrashItem          *item,
@@ -33,6 +33,8 @@
 #include "gvfsdaemonprotocol.h"
 #include "metadata-dbus.h"
 
+/* How long after a write the tree may be rewritten, meta_tree_flush()
+   does nothing while the journal still has enough room */
 #define WRITEOUT_TIMEOUT_SECS 60
 
 typedef struct {
@@ -110,80 +112,105 @@ tree_info_lookup (const char *filename)
   return info;
 }
 
-static gboolean
-handle_set (GVfsMetadata *object,
-            GDBusMethodInvocation *invocation,
-            const gchar *arg_treefile,
-            const gchar *arg_path,
-            GVariant *arg_data,
-            GVfsMetadata *daemon)
+static void
+batch_add_data (MetaTreeBatch *batch,
+		const char *path,
+		GVariant *data)
 {
-  TreeInfo *info;
   const gchar *str;
   const gchar **strv;
   const gchar *key;
-  GError *error;
   GVariantIter iter;
   GVariant *value;
 
-  info = tree_info_lookup (arg_treefile);
-  if (info == NULL)
-    {
-      g_dbus_method_invocation_return_error (invocation,
-                                             G_IO_ERROR,
-                                             G_IO_ERROR_NOT_FOUND,
-                                             _("Can't find metadata file %s"),
-                                             arg_treefile);
-      return TRUE;
-    }
-
-  error = NULL;
-
-  g_variant_iter_init (&iter, arg_data);
+  g_variant_iter_init (&iter, data);
   while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
     {
       if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
 	{
 	  /* stringv */
           strv = g_variant_get_strv (value, NULL);
-	  if (!meta_tree_set_stringv (info->tree, arg_path, key, (gchar **) strv))
-	    {
-	      g_set_error_literal (&error, G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                  _("Unable to set metadata key"));
-	    }
+	  meta_tree_batch_set_stringv (batch, path, key, (gchar **) strv);
 	  g_free (strv);
 	}
       else if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
 	{
 	  /* string */
           str = g_variant_get_string (value, NULL);
-	  if (!meta_tree_set_string (info->tree, arg_path, key, str))
-	    {
-              g_set_error_literal (&error, G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                   _("Unable to set metadata key"));
-	    }
+	  meta_tree_batch_set_string (batch, path, key, str);
 	}
       else if (g_variant_is_of_type (value, G_VARIANT_TYPE_BYTE))
 	{
 	  /* Unset */
-	  if (!meta_tree_unset (info->tree, arg_path, key))
-	    {
-              g_set_error_literal (&error, G_IO_ERROR,
-                                   G_IO_ERROR_FAILED,
-                                   _("Unable to unset metadata key"));
-	    }
+	  meta_tree_batch_unset (batch, path, key);
 	}
       g_variant_unref (value);
     }
+}
+
+/* Rejects calls that would make a single journal append grow
+   without bounds, returns FALSE if an error was returned */
+static gboolean
+check_batch_limits (GDBusMethodInvocation *invocation,
+                    gsize n_paths,
+                    MetaTreeBatch *batch)
+{
+  if (n_paths > META_TREE_BATCH_MAX_PATHS ||
+      (batch != NULL &&
+       meta_tree_batch_get_length (batch) > META_TREE_BATCH_MAX_LENGTH))
+    {
+      g_dbus_method_invocation_return_error_literal (invocation,
+                                                     G_IO_ERROR,
+                                                     G_IO_ERROR_INVALID_ARGUMENT,
+                                                     _("Too much metadata in a single request"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+handle_set (GVfsMetadata *object,
+            GDBusMethodInvocation *invocation,
+            const gchar *arg_treefile,
+            const gchar *arg_path,
+            GVariant *arg_data,
+            GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  MetaTreeBatch *batch;
+  gboolean res;
+
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
+    }
+
+  /* All keys go to the journal in a single append */
+  batch = meta_tree_batch_new ();
+  batch_add_data (batch, arg_path, arg_data);
+  if (!check_batch_limits (invocation, 1, batch))
+    {
+      meta_tree_batch_free (batch);
+      return TRUE;
+    }
+  res = meta_tree_apply_batch (info->tree, batch);
+  meta_tree_batch_free (batch);
 
   tree_info_schedule_writeout (info);
 
-  if (error)
+  if (!res)
     {
-      g_dbus_method_invocation_return_gerror (invocation, error);
-      g_error_free (error);
+      g_dbus_method_invocation_return_error_literal (invocation,
+                                                     G_IO_ERROR,
+                                                     G_IO_ERROR_FAILED,
+                                                     _("Unable to set metadata key"));
     }
   else
     {
@@ -193,6 +220,66 @@ handle_set (GVfsMetadata *object,
   return TRUE;
 }
 
+static gboolean
+handle_set_multi (GVfsMetadata *object,
+                  GDBusMethodInvocation *invocation,
+                  const gchar *arg_treefile,
+                  GVariant *arg_data,
+                  GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  MetaTreeBatch *batch;
+  GVariantIter iter;
+  const gchar *path;
+  GVariant *data;
+  gboolean res;
+
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
+    }
+
+  if (!check_batch_limits (invocation, g_variant_n_children (arg_data), NULL))
+    return TRUE;
+
+  batch = meta_tree_batch_new ();
+  g_variant_iter_init (&iter, arg_data);
+  while (g_variant_iter_next (&iter, "(^&ay@a{sv})", &path, &data))
+    {
+      batch_add_data (batch, path, data);
+      g_variant_unref (data);
+    }
+  if (!check_batch_limits (invocation, 0, batch))
+    {
+      meta_tree_batch_free (batch);
+      return TRUE;
+    }
+  res = meta_tree_apply_batch (info->tree, batch);
+  meta_tree_batch_free (batch);
+
+  tree_info_schedule_writeout (info);
+
+  if (!res)
+    {
+      g_dbus_method_invocation_return_error_literal (invocation,
+                                                     G_IO_ERROR,
+                                                     G_IO_ERROR_FAILED,
+                                                     _("Unable to set metadata key"));
+    }
+  else
+    {
+      gvfs_metadata_complete_set_multi (object, invocation);
+    }
+
+  return TRUE;
+}
+
 static void
 append_key (GVariantBuilder *builder,
 	    MetaTree *tree,
@@ -231,6 +318,42 @@ enum_keys (const char *key,
   return TRUE;
 }
 
+static GVariant *
+get_keys (MetaTree *tree,
+	  const char *path,
+	  const gchar *const *keys)
+{
+  GPtrArray *meta_keys;
+  gboolean free_keys;
+  gchar **iter_keys;
+  gchar **i;
+  GVariantBuilder builder;
+
+  if (keys == NULL)
+    {
+      /* Get all keys */
+      free_keys = TRUE;
+      meta_keys = g_ptr_array_new ();
+      meta_tree_enumerate_keys (tree, path, enum_keys, meta_keys);
+      g_ptr_array_add (meta_keys, NULL);
+      iter_keys = (gchar **) g_ptr_array_free (meta_keys, FALSE);
+    }
+  else
+    {
+      free_keys = FALSE;
+      iter_keys = (gchar **) keys;
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  for (i = iter_keys; *i; i++)
+    append_key (&builder, tree, path, *i);
+  if (free_keys)
+    g_strfreev (iter_keys);
+
+  return g_variant_builder_end (&builder);
+}
+
 static gboolean
 handle_get (GVfsMetadata *object,
             GDBusMethodInvocation *invocation,
@@ -240,11 +363,6 @@ handle_get (GVfsMetadata *object,
             GVfsMetadata *daemon)
 {
   TreeInfo *info;
-  GPtrArray *meta_keys;
-  gboolean free_keys;
-  gchar **iter_keys;
-  gchar **i;
-  GVariantBuilder *builder;
 
   info = tree_info_lookup (arg_treefile);
   if (info == NULL)
@@ -257,30 +375,46 @@ handle_get (GVfsMetadata *object,
       return TRUE;
     }
 
-  if (arg_keys == NULL)
-    {
-      /* Get all keys */
-      free_keys = TRUE;
-      meta_keys = g_ptr_array_new ();
-      meta_tree_enumerate_keys (info->tree, arg_path, enum_keys, meta_keys);
-      iter_keys = (gchar **) g_ptr_array_free (meta_keys, FALSE);
-    }
-  else
+  gvfs_metadata_complete_get (object, invocation,
+                              get_keys (info->tree, arg_path, arg_keys));
+
+  return TRUE;
+}
+
+static gboolean
+handle_get_multi (GVfsMetadata *object,
+                  GDBusMethodInvocation *invocation,
+                  const gchar *arg_treefile,
+                  const gchar *const *arg_paths,
+                  const gchar *const *arg_keys,
+                  GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  GVariantBuilder builder;
+  int i;
+
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
     {
-      free_keys = FALSE;
-      iter_keys = (gchar **) arg_keys;
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
     }
 
-  builder = g_variant_builder_new (G_VARIANT_TYPE_VARDICT);
+  if (!check_batch_limits (invocation, g_strv_length ((gchar **) arg_paths), NULL))
+    return TRUE;
 
-  for (i = iter_keys; *i; i++)
-    append_key (builder, info->tree, arg_path, *i);
-  if (free_keys)
-    g_strfreev (iter_keys);
-  
-  gvfs_metadata_complete_get (object, invocation,
-                              g_variant_builder_end (builder));
-  g_variant_builder_unref (builder);
+  /* One dict per path, in the order of the paths */
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+  for (i = 0; arg_paths[i] != NULL; i++)
+    g_variant_builder_add_value (&builder,
+                                 get_keys (info->tree, arg_paths[i], arg_keys));
+
+  gvfs_metadata_complete_get_multi (object, invocation,
+                                    g_variant_builder_end (&builder));
 
   return TRUE;
 }
@@ -356,6 +490,53 @@ handle_remove (GVfsMetadata *object,
   return TRUE;
 }
 
+static gboolean
+handle_remove_multi (GVfsMetadata *object,
+                     GDBusMethodInvocation *invocation,
+                     const gchar *arg_treefile,
+                     const gchar *const *arg_paths,
+                     GVfsMetadata *daemon)
+{
+  TreeInfo *info;
+  MetaTreeBatch *batch;
+  gboolean res;
+  int i;
+
+  info = tree_info_lookup (arg_treefile);
+  if (info == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             _("Can't find metadata file %s"),
+                                             arg_treefile);
+      return TRUE;
+    }
+
+  if (!check_batch_limits (invocation, g_strv_length ((gchar **) arg_paths), NULL))
+    return TRUE;
+
+  batch = meta_tree_batch_new ();
+  for (i = 0; arg_paths[i] != NULL; i++)
+    meta_tree_batch_remove (batch, arg_paths[i]);
+  res = meta_tree_apply_batch (info->tree, batch);
+  meta_tree_batch_free (batch);
+
+  if (!res)
+    {
+      g_dbus_method_invocation_return_error_literal (invocation,
+                                                     G_IO_ERROR,
+                                                     G_IO_ERROR_FAILED,
+                                                     _("Unable to remove metadata keys"));
+      return TRUE;
+    }
+
+  tree_info_schedule_writeout (info);
+  gvfs_metadata_complete_remove_multi (object, invocation);
+
+  return TRUE;
+}
+
 static gboolean
 handle_move (GVfsMetadata *object,
              GDBusMethodInvocation *invocation,
@@ -410,6 +591,9 @@ on_name_acquired (GDBusConnection *connection,
   g_signal_connect (skeleton, "handle-get", G_CALLBACK (handle_get), skeleton);
   g_signal_connect (skeleton, "handle-remove", G_CALLBACK (handle_remove), skeleton);
   g_signal_connect (skeleton, "handle-move", G_CALLBACK (handle_move), skeleton);
+  g_signal_connect (skeleton, "handle-set-multi", G_CALLBACK (handle_set_multi), skeleton);
+  g_signal_connect (skeleton, "handle-get-multi", G_CALLBACK (handle_get_multi), skeleton);
+  g_signal_connect (skeleton, "handle-remove-multi", G_CALLBACK (handle_remove_multi), skeleton);
 
   error = NULL;
   if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (skeleton), connection,
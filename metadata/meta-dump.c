@@ -0,0 +1,179 @@
+#include "config.h"
+#include "metatree.h"
+#include "metabuilder.h"
+#include <string.h>
+
+#define N_LATENCY_BUCKETS 24
+
+static gboolean stats = FALSE;
+static GOptionEntry entries[] =
+{
+  { "stats", 's', 0, G_OPTION_ARG_NONE, &stats, "Print statistics instead of the contents", NULL },
+  { NULL }
+};
+
+typedef struct {
+  MetaTree *tree;
+  guint num_files;
+  guint num_files_with_data;
+  guint num_values;
+  guint num_list_values;
+  gsize name_bytes;
+  gsize value_bytes;
+  guint latency[N_LATENCY_BUCKETS]; /* log2 of usecs */
+} Stats;
+
+static gboolean
+count_key (const char *key,
+	   MetaKeyType type,
+	   gpointer value,
+	   gpointer user_data)
+{
+  return TRUE;
+}
+
+static void
+time_lookup (Stats *s,
+	     const char *path)
+{
+  gint64 start, usecs;
+  int bucket;
+
+  start = g_get_monotonic_time ();
+  meta_tree_enumerate_keys (s->tree, path, count_key, NULL);
+  usecs = g_get_monotonic_time () - start;
+
+  bucket = 0;
+  while (usecs > 1 && bucket < N_LATENCY_BUCKETS - 1)
+    {
+      usecs >>= 1;
+      bucket++;
+    }
+  s->latency[bucket]++;
+}
+
+static void
+collect_stats (Stats *s,
+	       MetaFile *file,
+	       const char *path)
+{
+  GList *l, *v, *children;
+  MetaData *data;
+  MetaFile *child;
+  char *child_path;
+
+  s->num_files++;
+  s->name_bytes += strlen (file->name) + 1;
+
+  if (file->data != NULL)
+    {
+      s->num_files_with_data++;
+      time_lookup (s, path);
+    }
+
+  for (l = file->data; l != NULL; l = l->next)
+    {
+      data = l->data;
+      s->num_values++;
+      if (data->is_list)
+	{
+	  for (v = data->values; v != NULL; v = v->next)
+	    {
+	      s->num_list_values++;
+	      s->value_bytes += strlen (v->data) + 1;
+	    }
+	}
+      else
+	s->value_bytes += strlen (data->value) + 1;
+    }
+
+  children = metafile_get_sorted_children (file);
+  for (l = children; l != NULL; l = l->next)
+    {
+      child = l->data;
+      child_path = g_build_filename (path, child->name, NULL);
+      collect_stats (s, child, child_path);
+      g_free (child_path);
+    }
+  g_list_free (children);
+}
+
+static void
+print_stats (MetaTree *tree,
+	     MetaBuilder *builder)
+{
+  MetaTreeStats tree_stats;
+  Stats s = { 0 };
+  int i;
+
+  meta_tree_get_stats (tree, &tree_stats);
+
+  s.tree = tree;
+  collect_stats (&s, builder->root, "/");
+
+  g_print ("tree file:        %s\n", meta_tree_get_filename (tree));
+  g_print ("tree size:        %" G_GSIZE_FORMAT " bytes\n", tree_stats.tree_size);
+  g_print ("keys:             %u\n", tree_stats.num_keys);
+  g_print ("journal:          %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes used (%d%%), %u entries\n",
+	   tree_stats.journal_used, tree_stats.journal_size,
+	   tree_stats.journal_size ?
+	   (int)(tree_stats.journal_used * 100 / tree_stats.journal_size) : 0,
+	   tree_stats.journal_entries);
+  g_print ("files:            %u (%u with data)\n",
+	   s.num_files, s.num_files_with_data);
+  g_print ("values:           %u (%u list items)\n",
+	   s.num_values, s.num_list_values);
+  g_print ("name strings:     %" G_GSIZE_FORMAT " bytes\n", s.name_bytes);
+  g_print ("value strings:    %" G_GSIZE_FORMAT " bytes\n", s.value_bytes);
+
+  g_print ("lookup latency:\n");
+  for (i = 0; i < N_LATENCY_BUCKETS; i++)
+    {
+      if (s.latency[i] == 0)
+	continue;
+      g_print ("  < %8lu us: %u\n", 1UL << (i + 1), s.latency[i]);
+    }
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  MetaTree *tree;
+  MetaBuilder *builder;
+  GError *error = NULL;
+  GOptionContext *context;
+
+  context = g_option_context_new ("<tree file> - dump all metadata in a tree");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  if (argc < 2)
+    {
+      g_printerr ("No metadata tree specified\n");
+      return 1;
+    }
+
+  tree = meta_tree_open (argv[1], FALSE);
+  if (tree == NULL || !meta_tree_exists (tree))
+    {
+      g_printerr ("can't open metadata tree %s\n", argv[1]);
+      return 1;
+    }
+
+  builder = meta_tree_get_builder (tree);
+
+  if (stats)
+    print_stats (tree, builder);
+  else
+    meta_builder_dump (builder, stdout);
+
+  meta_builder_free (builder);
+  meta_tree_unref (tree);
+
+  return 0;
+}
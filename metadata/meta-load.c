@@ -0,0 +1,63 @@
+#include "config.h"
+#include "metabuilder.h"
+#include <glib/gstdio.h>
+#include <string.h>
+#include <errno.h>
+
+int
+main (int argc,
+      char *argv[])
+{
+  MetaBuilder *builder;
+  GError *error = NULL;
+  GOptionContext *context;
+  FILE *in;
+
+  context = g_option_context_new ("<dump file> <tree file> - create a tree from a dump");
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  if (argc < 3)
+    {
+      if (argc < 2)
+	g_printerr ("No dump file specified\n");
+      else
+	g_printerr ("No metadata tree specified\n");
+      return 1;
+    }
+
+  if (strcmp (argv[1], "-") == 0)
+    in = stdin;
+  else
+    in = g_fopen (argv[1], "r");
+
+  if (in == NULL)
+    {
+      g_printerr ("can't open %s: %s\n", argv[1], g_strerror (errno));
+      return 1;
+    }
+
+  builder = meta_builder_load (in);
+  if (in != stdin)
+    fclose (in);
+
+  if (builder == NULL)
+    {
+      g_printerr ("%s is not a valid metadata dump\n", argv[1]);
+      return 1;
+    }
+
+  if (!meta_builder_write (builder, argv[2]))
+    {
+      g_printerr ("can't write metadata tree %s\n", argv[2]);
+      meta_builder_free (builder);
+      return 1;
+    }
+
+  meta_builder_free (builder);
+
+  return 0;
+}
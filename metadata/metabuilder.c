@@ -19,13 +19,19 @@
 
 #define KEY_IS_LIST_MASK (1<<31)
 
+#define DUMP_HEADER "#gvfs-metadata-dump 1"
+
 MetaBuilder *
 meta_builder_new (void)
 {
   MetaBuilder *builder;
 
   builder = g_new0 (MetaBuilder, 1);
+  builder->keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 g_free, NULL);
   builder->root = metafile_new ("/", NULL);
+  builder->root->keys = builder->keys;
+  builder->journal_size = NEW_JOURNAL_SIZE;
 
   return builder;
 }
@@ -35,6 +41,7 @@ meta_builder_free (MetaBuilder *builder)
 {
   if (builder->root)
     metafile_free (builder->root);
+  g_hash_table_destroy (builder->keys);
   g_free (builder);
 }
 
@@ -69,12 +76,56 @@ metafile_new (const char *name,
   f = g_new0 (MetaFile, 1);
   f->name = g_strdup (name);
   if (parent)
-    parent->children = g_list_insert_sorted (parent->children, f,
-					     compare_metafile);
+    {
+      f->keys = parent->keys;
+      if (parent->children == NULL)
+	parent->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  NULL,
+						  (GDestroyNotify)metafile_free);
+      g_hash_table_replace (parent->children, f->name, f);
+    }
 
   return f;
 }
 
+gboolean
+metafile_has_children (MetaFile *file)
+{
+  return file->children != NULL &&
+    g_hash_table_size (file->children) > 0;
+}
+
+/* Returns a newly allocated list, free with g_list_free() */
+GList *
+metafile_get_sorted_children (MetaFile *file)
+{
+  GList *children;
+
+  if (file->children == NULL)
+    return NULL;
+
+  children = g_hash_table_get_values (file->children);
+  return g_list_sort (children, compare_metafile);
+}
+
+/* There are few distinct keys, but they are used by lots of files,
+   so they are shared. The strings are freed with the builder. */
+static char *
+metafile_get_shared_key (MetaFile *file,
+			 const char *key)
+{
+  char *shared;
+
+  shared = g_hash_table_lookup (file->keys, key);
+  if (shared == NULL)
+    {
+      shared = g_strdup (key);
+      g_hash_table_insert (file->keys, shared, shared);
+    }
+
+  return shared;
+}
+
 static MetaData *
 metadata_new (const char *key,
 	      MetaFile *file)
@@ -82,7 +133,7 @@ metadata_new (const char *key,
   MetaData *data;
 
   data = g_new0 (MetaData, 1);
-  data->key = g_strdup (key);
+  data->key = metafile_get_shared_key (file, key);
 
   if (file)
     file->data = g_list_insert_sorted (file->data, data, compare_metadata);
@@ -116,7 +167,6 @@ metadata_dup (MetaFile *file,
 static void
 metadata_free (MetaData *data)
 {
-  g_free (data->key);
   if (data->is_list)
     {
       g_list_foreach (data->values, (GFunc)g_free, NULL);
@@ -131,9 +181,9 @@ metadata_free (MetaData *data)
 void
 metafile_free (MetaFile *file)
 {
+  if (file->children)
+    g_hash_table_destroy (file->children);
   g_free (file->name);
-  g_list_foreach (file->children, (GFunc)metafile_free, NULL);
-  g_list_free (file->children);
   g_list_foreach (file->data, (GFunc)metadata_free, NULL);
   g_list_free (file->data);
   g_free (file);
@@ -144,17 +194,13 @@ metafile_lookup_child (MetaFile *metafile,
 		       const char *name,
 		       gboolean create)
 {
-  GList *l;
   MetaFile *child;
 
-  for (l = metafile->children; l != NULL; l = l->next)
-    {
-      child = l->data;
-      if (strcmp (child->name, name) == 0)
-	return child;
-    }
   child = NULL;
-  if (create)
+  if (metafile->children)
+    child = g_hash_table_lookup (metafile->children, name);
+
+  if (child == NULL && create)
     child = metafile_new (name, metafile);
   return child;
 }
@@ -166,29 +212,34 @@ meta_builder_lookup_with_parent (MetaBuilder *builder,
 				 MetaFile **parent)
 {
   MetaFile *f, *last;
-  const char *element_start;
-  char *element;
+  char *path_copy, *element, *p;
+
+  /* Split the path in place in a single copy, instead
+     of allocating each element */
+  path_copy = p = g_strdup (path);
 
   last = NULL;
   f = builder->root;
   while (f)
     {
-      while (*path == '/')
-	path++;
+      while (*p == '/')
+	p++;
 
-      if (*path == 0)
+      if (*p == 0)
 	break; /* Found it! */
 
-      element_start = path;
-      while (*path != 0 && *path != '/')
-	path++;
-      element = g_strndup (element_start, path - element_start);
+      element = p;
+      while (*p != 0 && *p != '/')
+	p++;
+      if (*p != 0)
+	*p++ = 0;
 
       last = f;
       f = metafile_lookup_child (f, element, create);
-      g_free (element);
     }
 
+  g_free (path_copy);
+
   if (parent)
     *parent = last;
 
@@ -218,17 +269,16 @@ meta_builder_remove (MetaBuilder *builder,
 
   if (parent != NULL)
     {
-      parent->children = g_list_remove (parent->children, f);
-      metafile_free (f);
+      /* Frees f */
+      g_hash_table_remove (parent->children, f->name);
       if (mtime)
 	parent->last_changed = mtime;
     }
   else
     {
       /* Removing root not allowed, just remove children */
-      g_list_foreach (f->children, (GFunc)metafile_free, NULL);
-      g_list_free (f->children);
-      f->children = NULL;
+      if (f->children)
+	g_hash_table_remove_all (f->children);
       if (mtime)
 	f->last_changed = mtime;
     }
@@ -241,6 +291,7 @@ meta_file_copy_into (MetaFile *src,
 		     guint64 mtime)
 {
   MetaFile *src_child, *dest_child;
+  GHashTableIter iter;
   GList *l;
 
   if (mtime)
@@ -251,9 +302,12 @@ meta_file_copy_into (MetaFile *src,
   for (l = src->data; l != NULL; l = l->next)
     metadata_dup (dest, l->data);
 
-  for (l = src->children; l != NULL; l = l->next)
+  if (src->children == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, src->children);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&src_child))
     {
-      src_child = l->data;
       dest_child = metafile_new (src_child->name, dest);
       meta_file_copy_into (src_child, dest_child, mtime);
     }
@@ -386,7 +440,7 @@ metafile_key_list_add (MetaFile *metafile,
 static void
 metafile_print (MetaFile *file, int indent, char *parent)
 {
-  GList *l, *v;
+  GList *l, *v, *children;
   MetaData *data;
   char *dir;
 
@@ -418,10 +472,12 @@ metafile_print (MetaFile *file, int indent, char *parent)
 	g_print ("%s", data->value);
       g_print ("\n");
     }
-  for (l = file->children; l != NULL; l = l->next)
+  children = metafile_get_sorted_children (file);
+  for (l = children; l != NULL; l = l->next)
     {
       metafile_print (l->data, indent, dir);
     }
+  g_list_free (children);
 
   g_free (dir);
 }
@@ -432,6 +488,214 @@ meta_builder_print (MetaBuilder *builder)
   metafile_print (builder->root, 0, NULL);
 }
 
+/* Dump format:
+ *
+ * A header line, then one line per file with data or a change time,
+ * in sorted depth first order, followed by its keys:
+ *
+ * <path> TAB <last_changed>
+ * TAB s TAB <key> TAB <value>
+ * TAB v TAB <key> [TAB <value>]...
+ *
+ * Paths, keys and values are escaped with g_strescape(), so they never
+ * contain tabs or newlines.
+ */
+
+static char *
+dump_escape (const char *str)
+{
+  static char exceptions[129];
+  int i;
+
+  /* Keep UTF-8 readable, only escape control chars */
+  if (exceptions[0] == 0)
+    for (i = 0; i < 128; i++)
+      exceptions[i] = 0x80 + i;
+
+  return g_strescape (str, exceptions);
+}
+
+static void
+dump_string (FILE *out,
+	     const char *str)
+{
+  char *escaped;
+
+  escaped = dump_escape (str);
+  fputs (escaped, out);
+  g_free (escaped);
+}
+
+static void
+metafile_dump (MetaFile *file,
+	       const char *path,
+	       FILE *out)
+{
+  GList *l, *v, *children;
+  MetaData *data;
+  MetaFile *child;
+  char *child_path;
+
+  if (file->data != NULL || file->last_changed != 0)
+    {
+      dump_string (out, path);
+      fprintf (out, "\t%" G_GINT64_FORMAT "\n", file->last_changed);
+
+      for (l = file->data; l != NULL; l = l->next)
+	{
+	  data = l->data;
+	  fputs (data->is_list ? "\tv\t" : "\ts\t", out);
+	  dump_string (out, data->key);
+	  if (data->is_list)
+	    {
+	      for (v = data->values; v != NULL; v = v->next)
+		{
+		  fputc ('\t', out);
+		  dump_string (out, v->data);
+		}
+	    }
+	  else
+	    {
+	      fputc ('\t', out);
+	      dump_string (out, data->value);
+	    }
+	  fputc ('\n', out);
+	}
+    }
+
+  children = metafile_get_sorted_children (file);
+  for (l = children; l != NULL; l = l->next)
+    {
+      child = l->data;
+      child_path = g_build_filename (path, child->name, NULL);
+      metafile_dump (child, child_path, out);
+      g_free (child_path);
+    }
+  g_list_free (children);
+}
+
+void
+meta_builder_dump (MetaBuilder *builder,
+		   FILE *out)
+{
+  fputs (DUMP_HEADER "\n", out);
+  metafile_dump (builder->root, "/", out);
+}
+
+static gboolean
+read_line (FILE *in,
+	   GString *line)
+{
+  char buf[4096];
+
+  g_string_truncate (line, 0);
+  while (fgets (buf, sizeof (buf), in) != NULL)
+    {
+      g_string_append (line, buf);
+      if (line->str[line->len - 1] == '\n')
+	{
+	  g_string_truncate (line, line->len - 1);
+	  return TRUE;
+	}
+    }
+
+  return line->len > 0;
+}
+
+static gboolean
+load_key (MetaFile *file,
+	  char **fields)
+{
+  char *key, *value;
+  int i;
+
+  /* fields[0] is the empty string before the leading tab */
+  if (file == NULL ||
+      fields[1] == NULL || fields[2] == NULL)
+    return FALSE;
+
+  key = g_strcompress (fields[2]);
+  if (strcmp (fields[1], "s") == 0 &&
+      fields[3] != NULL)
+    {
+      value = g_strcompress (fields[3]);
+      metafile_key_set_value (file, key, value);
+      g_free (value);
+    }
+  else if (strcmp (fields[1], "v") == 0)
+    {
+      metafile_key_list_set (file, key);
+      for (i = 3; fields[i] != NULL; i++)
+	{
+	  value = g_strcompress (fields[i]);
+	  metafile_key_list_add (file, key, value);
+	  g_free (value);
+	}
+    }
+  else
+    {
+      g_free (key);
+      return FALSE;
+    }
+
+  g_free (key);
+  return TRUE;
+}
+
+/* Builds a tree from a stream written by meta_builder_dump() in
+   a single pass, returns NULL if the stream is not valid */
+MetaBuilder *
+meta_builder_load (FILE *in)
+{
+  MetaBuilder *builder;
+  MetaFile *file;
+  GString *line;
+  char **fields;
+  char *path;
+  gboolean ok;
+
+  line = g_string_new (NULL);
+  if (!read_line (in, line) ||
+      strcmp (line->str, DUMP_HEADER) != 0)
+    {
+      g_string_free (line, TRUE);
+      return NULL;
+    }
+
+  builder = meta_builder_new ();
+  file = NULL;
+  ok = TRUE;
+  while (ok && read_line (in, line))
+    {
+      if (line->len == 0)
+	continue;
+
+      fields = g_strsplit (line->str, "\t", -1);
+      if (line->str[0] == '\t')
+	ok = load_key (file, fields);
+      else if (fields[1] != NULL)
+	{
+	  path = g_strcompress (fields[0]);
+	  file = meta_builder_lookup (builder, path, TRUE);
+	  metafile_set_mtime (file, g_ascii_strtoll (fields[1], NULL, 10));
+	  g_free (path);
+	}
+      else
+	ok = FALSE;
+      g_strfreev (fields);
+    }
+
+  g_string_free (line, TRUE);
+
+  if (!ok || ferror (in))
+    {
+      meta_builder_free (builder);
+      return NULL;
+    }
+
+  return builder;
+}
+
 static void
 set_uint32 (GString *s, guint32 offset, guint32 val)
 {
@@ -497,7 +761,7 @@ metafile_collect_times (MetaFile *file,
 			gint64 *time_t_min,
 			gint64 *time_t_max)
 {
-  GList *l;
+  GHashTableIter iter;
   MetaFile *child;
 
   if (*time_t_min == 0)
@@ -508,17 +772,19 @@ metafile_collect_times (MetaFile *file,
   if (file->last_changed > *time_t_max)
     *time_t_max = file->last_changed;
 
-  for (l = file->children; l != NULL; l = l->next)
-    {
-      child = l->data;
-      metafile_collect_times (child, time_t_min, time_t_max);
-    }
+  if (file->children == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, file->children);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&child))
+    metafile_collect_times (child, time_t_min, time_t_max);
 }
 
 static void
 metafile_collect_keywords (MetaFile *file,
 			   GHashTable *hash)
 {
+  GHashTableIter iter;
   GList *l;
   MetaData *data;
   MetaFile *child;
@@ -532,11 +798,12 @@ metafile_collect_keywords (MetaFile *file,
       g_hash_table_insert (hash, data->key, GINT_TO_POINTER (1));
     }
 
-  for (l = file->children; l != NULL; l = l->next)
-    {
-      child = l->data;
-      metafile_collect_keywords (child, hash);
-    }
+  if (file->children == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, file->children);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&child))
+    metafile_collect_keywords (child, hash);
 }
 
 static GHashTable *
@@ -668,17 +935,16 @@ write_children (GString *out,
 {
   GHashTable *strings;
   MetaFile *child, *file;
-  GList *l;
-  GList *files;
+  GList *l, *children;
+  GQueue files = G_QUEUE_INIT;
 
-  files = g_list_prepend (NULL, builder->root);
+  g_queue_push_tail (&files, builder->root);
 
-  while (files != NULL)
+  while (!g_queue_is_empty (&files))
     {
-      file = files->data;
-      files = g_list_delete_link (files, files);
+      file = g_queue_pop_head (&files);
 
-      if (file->children == NULL)
+      if (!metafile_has_children (file))
 	continue; /* No children, skip file */
 
       strings = string_block_begin ();
@@ -686,16 +952,17 @@ write_children (GString *out,
       if (file->children_pointer != 0)
 	set_uint32 (out, file->children_pointer, out->len);
 
-      append_uint32 (out, g_list_length (file->children), NULL);
+      append_uint32 (out, g_hash_table_size (file->children), NULL);
 
-      for (l = file->children; l != NULL; l = l->next)
+      children = metafile_get_sorted_children (file);
+      for (l = children; l != NULL; l = l->next)
 	{
 	  child = l->data;
 
 	  /* No mtime, children or metadata, no need for this
 	     to be in the file */
 	  if (child->last_changed == 0 &&
-	      child->children == NULL &&
+	      !metafile_has_children (child) &&
 	      child->data == NULL)
 	    continue;
 
@@ -704,9 +971,9 @@ write_children (GString *out,
 	  append_uint32 (out, 0, &child->metadata_pointer);
 	  append_time_t (out, child->last_changed, builder);
 
-	  if (file->children)
-	    files = g_list_append (files, child);
+	  g_queue_push_tail (&files, child);
 	}
+      g_list_free (children);
 
       string_block_end (out, strings);
     }
@@ -751,8 +1018,8 @@ write_metadata (GString *out,
   GHashTable *strings;
   GList *stringvs;
   MetaFile *child, *file;
-  GList *l;
-  GList *files;
+  GList *l, *children;
+  GQueue files = G_QUEUE_INIT;
 
   /* Root metadata */
   if (builder->root->data != NULL)
@@ -767,19 +1034,19 @@ write_metadata (GString *out,
 
   /* the rest, breadth first with all files in one
      dir sharing string block */
-  files = g_list_prepend (NULL, builder->root);
-  while (files != NULL)
+  g_queue_push_tail (&files, builder->root);
+  while (!g_queue_is_empty (&files))
     {
-      file = files->data;
-      files = g_list_delete_link (files, files);
+      file = g_queue_pop_head (&files);
 
-      if (file->children == NULL)
+      if (!metafile_has_children (file))
 	continue; /* No children, skip file */
 
       strings = string_block_begin ();
       stringvs = stringv_block_begin ();
 
-      for (l = file->children; l != NULL; l = l->next)
+      children = metafile_get_sorted_children (file);
+      for (l = children; l != NULL; l = l->next)
 	{
 	  child = l->data;
 
@@ -787,9 +1054,10 @@ write_metadata (GString *out,
 	    write_metadata_for_file (out, child,
 				     &stringvs, strings, key_hash);
 
-	  if (child->children != NULL)
-	    files = g_list_append (files, child);
+	  if (metafile_has_children (child))
+	    g_queue_push_tail (&files, child);
 	}
+      g_list_free (children);
 
       stringv_block_end (out, strings, stringvs);
       string_block_end (out, strings);
@@ -852,7 +1120,9 @@ get_journal_filename (const char *filename, guint32 random_tag)
 }
 
 static gboolean
-create_new_journal (const char *filename, guint32 random_tag)
+create_new_journal (const char *filename,
+		    guint32 random_tag,
+		    gsize journal_size)
 {
   char *journal_name;
   guint32 size_offset;
@@ -882,7 +1152,7 @@ create_new_journal (const char *filename, guint32 random_tag)
 
   pos = out->len;
 
-  g_string_set_size (out, NEW_JOURNAL_SIZE);
+  g_string_set_size (out, MAX (journal_size, pos));
   memset (out->str + pos, 0, out->len - pos);
 
   set_uint32 (out, size_offset, out->len);
@@ -1024,7 +1294,7 @@ meta_builder_write (MetaBuilder *builder,
   if (!write_all_data_and_close (fd, out->str, out->len))
     goto out;
 
-  if (!create_new_journal (filename, random_tag))
+  if (!create_new_journal (filename, random_tag, builder->journal_size))
     goto out;
 
   /* Open old file so we can set it rotated */
@@ -24,6 +24,7 @@
 #define __META_BUILDER_H__
 
 #include <glib.h>
+#include <stdio.h>
 
 typedef struct _MetaBuilder MetaBuilder;
 typedef struct _MetaFile MetaFile;
@@ -34,13 +35,17 @@ struct _MetaBuilder {
 
   guint32 root_pointer;
   gint64 time_t_base;
+
+  gsize journal_size;
+  GHashTable *keys; /* Shared key strings of all MetaData */
 };
 
 struct _MetaFile {
   char *name;
-  GList *children;
+  GHashTable *children; /* name -> MetaFile, NULL until first child */
   gint64 last_changed;
-  GList *data;
+  GList *data; /* Sorted by key */
+  GHashTable *keys; /* The builder's shared keys */
 
   guint32 metadata_pointer;
   guint32 children_pointer;
@@ -68,11 +73,16 @@ void         meta_builder_copy      (MetaBuilder *builder,
 				     guint64      mtime);
 gboolean     meta_builder_write     (MetaBuilder *builder,
 				     const char  *filename);
+void         meta_builder_dump      (MetaBuilder *builder,
+				     FILE        *out);
+MetaBuilder *meta_builder_load      (FILE        *in);
 MetaFile *   metafile_new           (const char  *name,
 				     MetaFile    *parent);
 void         metafile_free          (MetaFile    *file);
 void         metafile_set_mtime     (MetaFile    *file,
 				     guint64      mtime);
+gboolean     metafile_has_children  (MetaFile    *file);
+GList *      metafile_get_sorted_children (MetaFile *file);
 MetaFile *   metafile_lookup_child  (MetaFile    *metafile,
 				     const char  *name,
 				     gboolean     create);
@@ -68,6 +68,18 @@
 
 #define KEY_IS_LIST_MASK (1<<31)
 
+/* The journal size adapts to the write rate, so that busy trees
+   are not rewritten over and over while idle ones stay small */
+#define JOURNAL_MIN_SIZE (32*1024)
+#define JOURNAL_FAST_FILL_SECS (10*60)
+#define JOURNAL_SLOW_FILL_SECS (24*60*60)
+/* Lookups scan the journal linearly, so it must stay small */
+#define JOURNAL_MAX_SIZE (512*1024)
+/* The periodic writeout only rewrites the tree when the journal is
+   at least this full, or when it is older than JOURNAL_SLOW_FILL_SECS
+   so that an oversized journal gets shrunk */
+#define JOURNAL_WRITEOUT_FILL_PERCENT 50
+
 static GRWLock metatree_lock;
 
 typedef enum {
@@ -145,6 +157,7 @@ typedef struct {
   MetaJournalEntry *last_entry;
 
   gboolean journal_valid; /* True if all entries validated on open */
+  gint64 creation_time; /* The journal is written along with the tree */
 } MetaJournal;
 
 struct _MetaTree {
@@ -157,6 +170,7 @@ struct _MetaTree {
   char *data;
   gsize len;
   ino_t inode;
+  time_t mtime;
 
   guint32 tag;
   gint64 time_t_base;
@@ -469,6 +483,7 @@ meta_tree_init (MetaTree *tree)
   tree->fd = fd;
   tree->len = statbuf.st_size;
   tree->inode = statbuf.st_ino;
+  tree->mtime = statbuf.st_mtime;
   tree->data = data;
   tree->header = (MetaFileHeader *)data;
 
@@ -1108,8 +1123,10 @@ meta_journal_entry_new_unset (guint64 mtime,
 
 /* Call with writer lock held */
 static gboolean
-meta_journal_add_entry (MetaJournal *journal,
-			GString *entry)
+meta_journal_add_entries (MetaJournal *journal,
+			  const char *entries,
+			  gsize len,
+			  guint32 num_entries)
 {
   char *ptr;
   guint32 offset;
@@ -1119,19 +1136,41 @@ meta_journal_add_entry (MetaJournal *journal,
   ptr = (char *)journal->last_entry;
   offset =  ptr - journal->data;
 
-  /* Does the entry fit? */
-  if (entry->len > journal->len - offset)
+  /* Do the entries fit? */
+  if (len > journal->len - offset)
     return FALSE;
 
-  memcpy (ptr, entry->str, entry->len);
+  memcpy (ptr, entries, len);
 
-  journal->header->num_entries = GUINT_TO_BE (journal->last_entry_num + 1);
+  journal->header->num_entries = GUINT_TO_BE (journal->last_entry_num + num_entries);
   meta_journal_validate_more (journal);
   g_assert (journal->journal_valid);
 
   return TRUE;
 }
 
+/* Call with writer lock held */
+static gboolean
+meta_journal_add_entry (MetaJournal *journal,
+			GString *entry)
+{
+  return meta_journal_add_entries (journal, entry->str, entry->len, 1);
+}
+
+/* Call with lock held */
+static guint
+meta_journal_get_fill_percent (MetaJournal *journal)
+{
+  gsize used, size;
+
+  used = (char *)journal->last_entry - (char *)journal->first_entry;
+  size = journal->len - ((char *)journal->first_entry - journal->data);
+  if (size == 0)
+    return 100;
+
+  return used * 100 / size;
+}
+
 static MetaJournal *
 meta_journal_open (MetaTree *tree, const char *filename, gboolean for_write, guint32 tag)
 {
@@ -1179,9 +1218,10 @@ meta_journal_open (MetaTree *tree, const char *filename, gboolean for_write, gui
   journal->len = statbuf.st_size;
   journal->data = data;
   journal->header = (MetaJournalHeader *)data;
+
   journal->first_entry = (MetaJournalEntry *)(data + sizeof (MetaJournalHeader));
-  journal->last_entry = journal->first_entry;
-  journal->last_entry_num = 0;
+  /* The tree file is never modified once written */
+  journal->creation_time = tree->mtime;
 
   if (memcmp (journal->header->magic, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0)
     goto err;
@@ -1189,6 +1229,9 @@ meta_journal_open (MetaTree *tree, const char *filename, gboolean for_write, gui
   if (journal->header->major != JOURNAL_MAJOR_VERSION)
     goto err;
 
+  journal->last_entry = journal->first_entry;
+  journal->last_entry_num = 0;
+
   if (journal->len != GUINT32_FROM_BE (journal->header->file_size))
     goto err;
 
@@ -2342,14 +2385,54 @@ apply_journal_to_builder (MetaTree *tree,
 }
 
 
+/* Picks the size of the journal that is created when the tree is
+   rewritten. If the current journal filled up quickly we grow it, if
+   it has been mostly unused for a long time we shrink it. */
+static gsize
+meta_tree_get_new_journal_size (MetaTree *tree,
+				gsize needed)
+{
+  MetaJournal *journal;
+  gsize size, used;
+  gint64 age;
+
+  journal = tree->journal;
+  if (journal == NULL)
+    size = JOURNAL_MIN_SIZE;
+  else
+    {
+      size = journal->len;
+      used = (char *)journal->last_entry - journal->data;
+      age = time (NULL) - journal->creation_time;
+
+      if (used >= size / 4 * 3 &&
+	  age < JOURNAL_FAST_FILL_SECS)
+	size *= 2;
+      else if (used < size / 4 &&
+	       age > JOURNAL_SLOW_FILL_SECS)
+	size /= 2;
+    }
+
+  size = CLAMP (size, JOURNAL_MIN_SIZE, JOURNAL_MAX_SIZE);
+
+  /* Always make room for the entry that caused the rotation */
+  needed += sizeof (MetaJournalHeader);
+  if (size < needed)
+    size = needed;
+
+  return size;
+}
+
 /* Needs write lock */
 static gboolean
-meta_tree_flush_locked (MetaTree *tree)
+meta_tree_flush_locked (MetaTree *tree,
+			gsize needed)
 {
   MetaBuilder *builder;
   gboolean res;
 
   builder = meta_builder_new ();
+  builder->journal_size = meta_tree_get_new_journal_size (tree, needed);
 
   copy_tree_to_builder (tree, tree->root, builder->root);
 
@@ -2372,11 +2455,69 @@ meta_tree_flush (MetaTree *tree)
   gboolean res;
 
   g_rw_lock_writer_lock (&metatree_lock);
-  res = meta_tree_flush_locked (tree);
+  /* Nothing to do if the journal was already rotated since the
+     flush was scheduled, or if it still has plenty of room. It is
+     rotated when it fills up anyway, and rewriting the whole tree
+     every time would make the adaptive journal size pointless.
+     A journal that has been around for long is rewritten though,
+     which lets meta_tree_get_new_journal_size() shrink it. */
+  if (tree->journal != NULL &&
+      tree->journal->journal_valid &&
+      meta_journal_get_fill_percent (tree->journal) < JOURNAL_WRITEOUT_FILL_PERCENT &&
+      time (NULL) - tree->journal->creation_time <= JOURNAL_SLOW_FILL_SECS)
+    res = TRUE;
+  else
+    res = meta_tree_flush_locked (tree, 0);
   g_rw_lock_writer_unlock (&metatree_lock);
   return res;
 }
 
+/* Returns the current contents of the tree, including
+   the journal, free with meta_builder_free() */
+MetaBuilder *
+meta_tree_get_builder (MetaTree *tree)
+{
+  MetaBuilder *builder;
+
+  builder = meta_builder_new ();
+
+  g_rw_lock_reader_lock (&metatree_lock);
+
+  if (tree->root)
+    copy_tree_to_builder (tree, tree->root, builder->root);
+
+  if (tree->journal)
+    apply_journal_to_builder (tree, builder);
+
+  g_rw_lock_reader_unlock (&metatree_lock);
+
+  return builder;
+}
+
+void
+meta_tree_get_stats (MetaTree *tree,
+		     MetaTreeStats *stats)
+{
+  MetaJournal *journal;
+
+  memset (stats, 0, sizeof (MetaTreeStats));
+
+  g_rw_lock_reader_lock (&metatree_lock);
+
+  stats->tree_size = tree->len;
+  stats->num_keys = tree->num_attributes;
+
+  journal = tree->journal;
+  if (journal)
+    {
+      stats->journal_size = journal->len;
+      stats->journal_used = (char *)journal->last_entry - journal->data;
+      stats->journal_entries = journal->last_entry_num;
+    }
+
+  g_rw_lock_reader_unlock (&metatree_lock);
+}
+
 gboolean
 meta_tree_unset (MetaTree                         *tree,
 		 const char                       *path,
@@ -2403,7 +2544,7 @@ meta_tree_unset (MetaTree                         *tree,
  retry:
   if (!meta_journal_add_entry (tree->journal, entry))
     {
-      if (meta_tree_flush_locked (tree))
+      if (meta_tree_flush_locked (tree, entry->len))
 	goto retry;
 
       res = FALSE;
@@ -2443,7 +2584,7 @@ meta_tree_set_string (MetaTree                         *tree,
  retry:
   if (!meta_journal_add_entry (tree->journal, entry))
     {
-      if (meta_tree_flush_locked (tree))
+      if (meta_tree_flush_locked (tree, entry->len))
 	goto retry;
 
       res = FALSE;
@@ -2483,7 +2624,7 @@ meta_tree_set_stringv (MetaTree                         *tree,
  retry:
   if (!meta_journal_add_entry (tree->journal, entry))
     {
-      if (meta_tree_flush_locked (tree))
+      if (meta_tree_flush_locked (tree, entry->len))
 	goto retry;
 
       res = FALSE;
@@ -2521,7 +2662,7 @@ meta_tree_remove (MetaTree *tree,
  retry:
   if (!meta_journal_add_entry (tree->journal, entry))
     {
-      if (meta_tree_flush_locked (tree))
+      if (meta_tree_flush_locked (tree, entry->len))
 	goto retry;
 
       res = FALSE;
@@ -2560,7 +2701,7 @@ meta_tree_copy (MetaTree                         *tree,
  retry:
   if (!meta_journal_add_entry (tree->journal, entry))
     {
-      if (meta_tree_flush_locked (tree))
+      if (meta_tree_flush_locked (tree, entry->len))
 	goto retry;
 
       res = FALSE;
@@ -2573,6 +2714,137 @@ meta_tree_copy (MetaTree                         *tree,
   return res;
 }
 
+struct _MetaTreeBatch {
+  GString *entries;
+  guint32 num_entries;
+};
+
+MetaTreeBatch *
+meta_tree_batch_new (void)
+{
+  MetaTreeBatch *batch;
+
+  batch = g_new0 (MetaTreeBatch, 1);
+  batch->entries = g_string_new (NULL);
+
+  return batch;
+}
+
+void
+meta_tree_batch_free (MetaTreeBatch *batch)
+{
+  g_string_free (batch->entries, TRUE);
+  g_free (batch);
+}
+
+guint
+meta_tree_batch_get_size (MetaTreeBatch *batch)
+{
+  return batch->num_entries;
+}
+
+/* Size of the journal entries, in bytes */
+gsize
+meta_tree_batch_get_length (MetaTreeBatch *batch)
+{
+  return batch->entries->len;
+}
+
+static void
+meta_tree_batch_add (MetaTreeBatch *batch,
+		     GString *entry)
+{
+  g_string_append_len (batch->entries, entry->str, entry->len);
+  batch->num_entries++;
+  g_string_free (entry, TRUE);
+}
+
+void
+meta_tree_batch_unset (MetaTreeBatch *batch,
+		       const char *path,
+		       const char *key)
+{
+  meta_tree_batch_add (batch,
+		       meta_journal_entry_new_unset (time (NULL), path, key));
+}
+
+void
+meta_tree_batch_set_string (MetaTreeBatch *batch,
+			    const char *path,
+			    const char *key,
+			    const char *value)
+{
+  meta_tree_batch_add (batch,
+		       meta_journal_entry_new_set (time (NULL), path, key, value));
+}
+
+void
+meta_tree_batch_set_stringv (MetaTreeBatch *batch,
+			     const char *path,
+			     const char *key,
+			     char **value)
+{
+  meta_tree_batch_add (batch,
+		       meta_journal_entry_new_setv (time (NULL), path, key, value));
+}
+
+void
+meta_tree_batch_remove (MetaTreeBatch *batch,
+			const char *path)
+{
+  meta_tree_batch_add (batch,
+		       meta_journal_entry_new_remove (time (NULL), path));
+}
+
+void
+meta_tree_batch_copy (MetaTreeBatch *batch,
+		      const char *src,
+		      const char *dest)
+{
+  meta_tree_batch_add (batch,
+		       meta_journal_entry_new_copy (time (NULL), src, dest));
+}
+
+gboolean
+meta_tree_apply_batch (MetaTree *tree,
+		       MetaTreeBatch *batch)
+{
+  gboolean res;
+
+  if (batch->num_entries == 0)
+    return TRUE;
+
+  /* Don't let a single batch grow the journal without bounds */
+  if (batch->entries->len > META_TREE_BATCH_MAX_LENGTH)
+    return FALSE;
+
+  g_rw_lock_writer_lock (&metatree_lock);
+
+  if (tree->journal == NULL ||
+      !tree->journal->journal_valid)
+    {
+      res = FALSE;
+      goto out;
+    }
+
+  res = TRUE;
+ retry:
+  if (!meta_journal_add_entries (tree->journal,
+				 batch->entries->str,
+				 batch->entries->len,
+				 batch->num_entries))
+    {
+      if (meta_tree_flush_locked (tree, batch->entries->len))
+	goto retry;
+
+      res = FALSE;
+    }
+
+ out:
+  g_rw_lock_writer_unlock (&metatree_lock);
+  return res;
+}
+
 static char *
 canonicalize_filename (const char *filename)
 {
@@ -2746,17 +3018,34 @@ follow_symlink_recursively (char **path,
   *path_dev = path_stat.st_dev;
 }
 
+/* Symlinks may change without notice, so don't trust the expanded
+   parent for longer than this (in usecs) */
+#define LAST_PARENT_TIMEOUT (2 * G_USEC_PER_SEC)
+
+typedef struct {
+  dev_t dev;
+  char *mountpoint;
+  char *extra_prefix;
+} MountpointInfo;
+
 struct _MetaLookupCache {
+  GMutex lock;
+
   char *last_parent;
   char *last_parent_expanded;
   dev_t last_parent_dev;
   char *last_parent_mountpoint;
   char *last_parent_mountpoint_extra_prefix;
+  gint64 last_parent_time;
 
-  dev_t last_device;
-  char *last_device_tree;
+  /* These are only valid for one mountinfo_generation */
+  guint mount_generation;
+  GList *mountpoints; /* MountpointInfo */
+  GHashTable *device_trees; /* dev_t -> tree name, or NULL if none */
 };
 
+static guint mountinfo_generation = 0;
+
 #ifdef HAVE_LIBUDEV
 
 static struct udev *udev;
@@ -2797,6 +3086,16 @@ get_tree_from_udev (MetaLookupCache *cache,
 
   return res;
 }
+
+static gint64 *
+device_key_new (dev_t device)
+{
+  gint64 *key;
+
+  key = g_new (gint64, 1);
+  *key = device;
+  return key;
+}
 #endif
 
 static const char *
@@ -2804,14 +3103,19 @@ get_tree_for_device (MetaLookupCache *cache,
 		     dev_t device)
 {
 #ifdef HAVE_LIBUDEV
-  if (device != cache->last_device)
+  gint64 key;
+  char *tree;
+
+  key = device;
+  if (!g_hash_table_lookup_extended (cache->device_trees, &key,
+				     NULL, (gpointer *)&tree))
     {
-      cache->last_device = device;
-      g_free (cache->last_device_tree);
-      cache->last_device_tree = get_tree_from_udev (cache, device);
+      tree = get_tree_from_udev (cache, device);
+      g_hash_table_insert (cache->device_trees,
+			   device_key_new (device), tree);
     }
 
-  return cache->last_device_tree;
+  return tree;
 #endif
   return NULL;
 }
@@ -2826,7 +3130,7 @@ typedef struct {
 
 static gboolean mountinfo_initialized = FALSE;
 static int mountinfo_fd = -1;
-static MountinfoEntry *mountinfo_roots = NULL;
+static MountinfoEntry *mountinfo_entries = NULL;
 G_LOCK_DEFINE_STATIC (mountinfo);
 
 /* We want to avoid mmap and stat as these are not ideal
@@ -2944,7 +3248,7 @@ parse_mountinfo (const char *contents)
 	    }
 	}
 
-      if (line_mountpoint && !(line_root[0] == '/' && line_root[1] == ' '))
+      if (line_mountpoint)
 	{
 	  MountinfoEntry new_entry;
 
@@ -2968,15 +3272,15 @@ free_mountinfo (void)
 {
   int i;
 
-  if (mountinfo_roots)
+  if (mountinfo_entries)
     {
-      for (i = 0; mountinfo_roots[i].mountpoint != NULL; i++)
+      for (i = 0; mountinfo_entries[i].mountpoint != NULL; i++)
 	{
-	  g_free (mountinfo_roots[i].mountpoint);
-	  g_free (mountinfo_roots[i].root);
+	  g_free (mountinfo_entries[i].mountpoint);
+	  g_free (mountinfo_entries[i].root);
 	}
-      g_free (mountinfo_roots);
-      mountinfo_roots = NULL;
+      g_free (mountinfo_entries);
+      mountinfo_entries = NULL;
     }
 }
 
@@ -3001,20 +3305,24 @@ update_mountinfo (void)
 
   if (!first)
     {
+      /* The proc file is always readable, a change of the mount
+	 table is signalled with POLLPRI/POLLERR */
       pfd.fd = mountinfo_fd;
-      pfd.events = G_IO_IN | G_IO_OUT | G_IO_PRI;
+      pfd.events = G_IO_PRI;
       pfd.revents = 0;
       res = g_poll (&pfd, 1, 0);
-      if (res == 0)
+      if (res <= 0 ||
+	  (pfd.revents & (G_IO_ERR | G_IO_PRI)) == 0)
 	return;
     }
 
   free_mountinfo ();
+  mountinfo_generation++;
   contents = read_contents (mountinfo_fd);
   lseek (mountinfo_fd, SEEK_SET, 0);
   if (contents)
     {
-      mountinfo_roots = parse_mountinfo (contents);
+      mountinfo_entries = parse_mountinfo (contents);
       g_free (contents);
     }
 }
@@ -3031,13 +3339,15 @@ find_mountinfo_root_for_mountpoint (const char *mountpoint)
 
   update_mountinfo ();
 
-  if (mountinfo_roots)
+  if (mountinfo_entries)
     {
-      for (i = 0; mountinfo_roots[i].mountpoint != NULL; i++)
+      for (i = 0; mountinfo_entries[i].mountpoint != NULL; i++)
 	{
-	  if (strcmp (mountinfo_roots[i].mountpoint, mountpoint) == 0)
+	  /* Only bind mounts of subdirectories have an extra prefix */
+	  if (strcmp (mountinfo_entries[i].root, "/") != 0 &&
+	      strcmp (mountinfo_entries[i].mountpoint, mountpoint) == 0)
 	    {
-	      res = g_strdup (mountinfo_roots[i].root);
+	      res = g_strdup (mountinfo_entries[i].root);
 	      break;
 	    }
 	}
@@ -3050,6 +3360,25 @@ find_mountinfo_root_for_mountpoint (const char *mountpoint)
 
 #endif
 
+/* Changes whenever the mount table changes. This only polls the
+   mountinfo fd, the table itself is reread lazily on change. */
+static guint
+get_mount_generation (void)
+{
+  guint generation;
+
+  generation = 0;
+
+#ifdef __linux__
+  G_LOCK (mountinfo);
+  update_mountinfo ();
+  generation = mountinfo_generation;
+  G_UNLOCK (mountinfo);
+#endif
+
+  return generation;
+}
+
 
 static char *
 get_extra_prefix_for_mount (const char *mountpoint)
@@ -3071,6 +3400,116 @@ get_devnum (const char *path)
   return path_stat.st_dev;
 }
 
+static gboolean
+path_has_prefix (const char *path,
+		 const char *prefix)
+{
+  int prefix_len;
+
+  if (prefix == NULL)
+    return TRUE;
+
+  prefix_len = strlen (prefix);
+
+  if (strncmp (path, prefix, prefix_len) == 0 &&
+      (prefix_len == 0 || /* empty prefix always matches */
+       prefix[prefix_len - 1] == '/' || /* last char in prefix was a /, so it must be in path too */
+       path[prefix_len] == 0 ||
+       path[prefix_len] == '/'))
+    return TRUE;
+
+  return FALSE;
+}
+
+#ifdef __linux__
+/* Whether the mount table has a mount strictly below dir that
+   contains file, i.e. file may not be on the mount at dir */
+static gboolean
+mountinfo_has_mount_between (const char *dir,
+			     const char *file)
+{
+  gboolean res;
+  int i;
+
+  res = FALSE;
+
+  G_LOCK (mountinfo);
+
+  if (mountinfo_entries)
+    {
+      for (i = 0; mountinfo_entries[i].mountpoint != NULL; i++)
+	{
+	  const char *mountpoint = mountinfo_entries[i].mountpoint;
+
+	  if (strcmp (mountpoint, dir) != 0 &&
+	      path_has_prefix (mountpoint, dir) &&
+	      path_has_prefix (file, mountpoint))
+	    {
+	      res = TRUE;
+	      break;
+	    }
+	}
+    }
+
+  G_UNLOCK (mountinfo);
+
+  return res;
+}
+
+/* Other directories on a device are likely below a mountpoint seen
+   before. Use the longest one that contains file, as long as the
+   mount table doesn't show a mount inbetween. */
+static MountpointInfo *
+find_cached_mountpoint (MetaLookupCache *cache,
+			const char *file,
+			dev_t dev)
+{
+  MountpointInfo *info, *best;
+  GList *l;
+
+  best = NULL;
+  for (l = cache->mountpoints; l != NULL; l = l->next)
+    {
+      info = l->data;
+
+      if (info->dev == dev &&
+	  path_has_prefix (file, info->mountpoint) &&
+	  (best == NULL || strlen (info->mountpoint) > strlen (best->mountpoint)))
+	best = info;
+    }
+
+  if (best != NULL &&
+      mountinfo_has_mount_between (best->mountpoint, file))
+    return NULL;
+
+  return best;
+}
+
+static void
+add_cached_mountpoint (MetaLookupCache *cache,
+		       dev_t dev,
+		       const char *mountpoint,
+		       const char *extra_prefix)
+{
+  MountpointInfo *info;
+  GList *l;
+
+  for (l = cache->mountpoints; l != NULL; l = l->next)
+    {
+      info = l->data;
+      if (info->dev == dev &&
+	  strcmp (info->mountpoint, mountpoint) == 0)
+	return;
+    }
+
+  info = g_new (MountpointInfo, 1);
+  info->dev = dev;
+  info->mountpoint = g_strdup (mountpoint);
+  info->extra_prefix = g_strdup (extra_prefix);
+  cache->mountpoints = g_list_prepend (cache->mountpoints, info);
+}
+#endif
+
 /* Expands symlinks for parents and look for a mountpoint
  * file is symlink expanded and canonical
  */
@@ -3082,6 +3521,9 @@ find_mountpoint_for (MetaLookupCache *cache,
 {
   char *first_dir, *dir, *last;
   const char *prefix;
+#ifdef __linux__
+  MountpointInfo *info;
+#endif
   dev_t dir_dev = 0;
 
   first_dir = get_dirname (file);
@@ -3097,6 +3539,18 @@ find_mountpoint_for (MetaLookupCache *cache,
   if (cache->last_parent_mountpoint != NULL)
     goto out; /* Cache hit! */
 
+  /* The mountpoints are only cached where the mount table tells
+     us about changes and nested mounts, elsewhere always walk */
+#ifdef __linux__
+  info = find_cached_mountpoint (cache, file, dev);
+  if (info != NULL)
+    {
+      cache->last_parent_mountpoint = g_strdup (info->mountpoint);
+      cache->last_parent_mountpoint_extra_prefix = g_strdup (info->extra_prefix);
+      goto out;
+    }
+#endif
+
   dir = g_strdup (first_dir);
   last = g_strdup (file);
   while (1)
@@ -3108,6 +3562,11 @@ find_mountpoint_for (MetaLookupCache *cache,
 	  g_free (dir);
 	  cache->last_parent_mountpoint = last;
 	  cache->last_parent_mountpoint_extra_prefix = get_extra_prefix_for_mount (last);
+#ifdef __linux__
+	  add_cached_mountpoint (cache, dev,
+				 cache->last_parent_mountpoint,
+				 cache->last_parent_mountpoint_extra_prefix);
+#endif
 	  break;
 	}
 
@@ -3165,12 +3624,25 @@ expand_all_symlinks (const char *path,
   return res;
 }
 
+static void
+mountpoint_info_free (MountpointInfo *info)
+{
+  g_free (info->mountpoint);
+  g_free (info->extra_prefix);
+  g_free (info);
+}
+
 MetaLookupCache *
 meta_lookup_cache_new (void)
 {
   MetaLookupCache *cache;
 
   cache = g_new0 (MetaLookupCache, 1);
+  g_mutex_init (&cache->lock);
+  cache->device_trees =
+    g_hash_table_new_full (g_int64_hash, g_int64_equal,
+			   g_free, g_free);
+  cache->mount_generation = get_mount_generation ();
 
   return cache;
 }
@@ -3182,31 +3654,37 @@ meta_lookup_cache_free (MetaLookupCache *cache)
   g_free (cache->last_parent_expanded);
   g_free (cache->last_parent_mountpoint);
   g_free (cache->last_parent_mountpoint_extra_prefix);
-  g_free (cache->last_device_tree);
+  g_list_free_full (cache->mountpoints, (GDestroyNotify)mountpoint_info_free);
+  g_hash_table_destroy (cache->device_trees);
+  g_mutex_clear (&cache->lock);
   g_free (cache);
 }
 
-static gboolean
-path_has_prefix (const char *path,
-		 const char *prefix)
+/* Drop everything that depends on the mount table, if it changed */
+static void
+meta_lookup_cache_check_mounts (MetaLookupCache *cache)
 {
-  int prefix_len;
-
-  if (prefix == NULL)
-    return TRUE;
-
-  prefix_len = strlen (prefix);
+  guint generation;
 
-  if (strncmp (path, prefix, prefix_len) == 0 &&
-      (prefix_len == 0 || /* empty prefix always matches */
-       prefix[prefix_len - 1] == '/' || /* last char in prefix was a /, so it must be in path too */
-       path[prefix_len] == 0 ||
-       path[prefix_len] == '/'))
-    return TRUE;
+  generation = get_mount_generation ();
+  if (generation == cache->mount_generation)
+    return;
 
-  return FALSE;
+  cache->mount_generation = generation;
+  g_free (cache->last_parent);
+  cache->last_parent = NULL;
+  g_free (cache->last_parent_expanded);
+  cache->last_parent_expanded = NULL;
+  g_free (cache->last_parent_mountpoint);
+  cache->last_parent_mountpoint = NULL;
+  g_free (cache->last_parent_mountpoint_extra_prefix);
+  cache->last_parent_mountpoint_extra_prefix = NULL;
+  g_list_free_full (cache->mountpoints, (GDestroyNotify)mountpoint_info_free);
+  cache->mountpoints = NULL;
+  g_hash_table_remove_all (cache->device_trees);
 }
 
+
 struct HomedirData {
   dev_t device;
   char *expanded_path;
@@ -3221,6 +3699,7 @@ expand_parents (MetaLookupCache *cache,
   char *basename, *res;
   char *path_copy;
   dev_t parent_dev;
+  gint64 now;
 
   path_copy = canonicalize_filename (path);
   parent = get_dirname (path_copy);
@@ -3230,14 +3709,17 @@ expand_parents (MetaLookupCache *cache,
       return path_copy;
     }
 
+  now = g_get_monotonic_time ();
   if (cache->last_parent == NULL ||
-      strcmp (cache->last_parent, parent) != 0)
+      strcmp (cache->last_parent, parent) != 0 ||
+      now - cache->last_parent_time > LAST_PARENT_TIMEOUT)
     {
       g_free (cache->last_parent);
       g_free (cache->last_parent_expanded);
       cache->last_parent = parent;
       cache->last_parent_expanded = expand_all_symlinks (parent, &parent_dev);
       cache->last_parent_dev = parent_dev;
+      cache->last_parent_time = now;
       g_free (cache->last_parent_mountpoint);
       cache->last_parent_mountpoint = NULL;
       g_free (cache->last_parent_mountpoint_extra_prefix);
@@ -3264,6 +3746,7 @@ meta_lookup_cache_lookup_path (MetaLookupCache *cache,
 {
   const char *mountpoint;
   const char *treename;
+  char *treename_copy;
   char *prefix;
   char *expanded;
   static struct HomedirData homedir_data_storage;
@@ -3286,6 +3769,10 @@ meta_lookup_cache_lookup_path (MetaLookupCache *cache,
     }
   homedir_data = (struct HomedirData *)homedir_datap;
 
+  g_mutex_lock (&cache->lock);
+
+  meta_lookup_cache_check_mounts (cache);
+
   /* Canonicalized form with all symlinks expanded in parents */
   expanded = expand_parents (cache, filename, &parent_dev);
 
@@ -3330,7 +3817,15 @@ meta_lookup_cache_lookup_path (MetaLookupCache *cache,
 
  found:
   g_free (expanded);
-  tree = meta_tree_lookup_by_name (treename, for_write);
+  /* treename may point into the cache, copy it before unlocking so
+     opening the tree doesn't block other lookups */
+  treename_copy = g_strdup (treename);
+
+  g_mutex_unlock (&cache->lock);
+
+  tree = meta_tree_lookup_by_name (treename_copy, for_write);
+  g_free (treename_copy);
+
   if (tree)
     {
       *tree_path = prefix;
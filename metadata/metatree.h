@@ -27,6 +27,15 @@
 
 typedef struct _MetaTree MetaTree;
 typedef struct _MetaLookupCache MetaLookupCache;
+typedef struct _MetaTreeBatch MetaTreeBatch;
+
+typedef struct {
+  gsize tree_size;
+  guint num_keys;        /* distinct key names in the tree file */
+  gsize journal_size;
+  gsize journal_used;
+  guint journal_entries;
+} MetaTreeStats;
 
 typedef enum {
   META_KEY_TYPE_NONE,
@@ -47,7 +56,8 @@ typedef gboolean (*meta_tree_keys_enumerate_callback) (const char *key,
 						       gpointer value,
 						       gpointer user_data);
 
-/* MetaLookupCache is not threadsafe */
+/* MetaLookupCache is threadsafe and meant to be long-lived, it drops
+   its cached mountpoints when the mount table changes */
 MetaLookupCache *meta_lookup_cache_new         (void);
 void             meta_lookup_cache_free        (MetaLookupCache *cache);
 MetaTree        *meta_lookup_cache_lookup_path (MetaLookupCache *cache,
@@ -87,6 +97,10 @@ void        meta_tree_enumerate_keys   (MetaTree                         *tree,
 					meta_tree_keys_enumerate_callback callback,
 					gpointer                          user_data);
 gboolean    meta_tree_flush            (MetaTree                         *tree);
+/* Returns a MetaBuilder, see metabuilder.h */
+struct _MetaBuilder *meta_tree_get_builder (MetaTree                     *tree);
+void        meta_tree_get_stats        (MetaTree                         *tree,
+					MetaTreeStats                    *stats);
 gboolean    meta_tree_unset            (MetaTree                         *tree,
 					const char                       *path,
 					const char                       *key);
@@ -103,4 +117,32 @@ gboolean    meta_tree_remove           (MetaTree                         *tree,
 gboolean    meta_tree_copy             (MetaTree                         *tree,
 					const char                       *src,
 					const char                       *dest);
+
+/* A batch collects several changes that are then added to the
+   journal of a tree at once, with a single lock and append */
+#define META_TREE_BATCH_MAX_PATHS 1000
+#define META_TREE_BATCH_MAX_LENGTH (1024*1024)
+
+MetaTreeBatch *meta_tree_batch_new          (void);
+void           meta_tree_batch_free         (MetaTreeBatch  *batch);
+guint          meta_tree_batch_get_size     (MetaTreeBatch  *batch);
+gsize          meta_tree_batch_get_length   (MetaTreeBatch  *batch);
+void           meta_tree_batch_unset        (MetaTreeBatch  *batch,
+					     const char     *path,
+					     const char     *key);
+void           meta_tree_batch_set_string   (MetaTreeBatch  *batch,
+					     const char     *path,
+					     const char     *key,
+					     const char     *value);
+void           meta_tree_batch_set_stringv  (MetaTreeBatch  *batch,
+					     const char     *path,
+					     const char     *key,
+					     char          **value);
+void           meta_tree_batch_remove       (MetaTreeBatch  *batch,
+					     const char     *path);
+void           meta_tree_batch_copy         (MetaTreeBatch  *batch,
+					     const char     *src,
+					     const char     *dest);
+gboolean       meta_tree_apply_batch        (MetaTree       *tree,
+					     MetaTreeBatch  *batch);
 #endif /* __META_TREE_H__ */
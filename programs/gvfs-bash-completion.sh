@@ -58,5 +58,6 @@ complete -o nospace -F __gvfs_multiple_uris gvfs-move
 complete -o nospace -F __gvfs_multiple_uris gvfs-open
 complete -o nospace -F __gvfs_multiple_uris gvfs-rm
 complete -o nospace -F __gvfs_multiple_uris gvfs-save
+complete -o nospace -F __gvfs_multiple_uris gvfs-stats
 complete -o nospace -F __gvfs_multiple_uris gvfs-trash
 complete -o nospace -F __gvfs_multiple_uris gvfs-tree
@@ -0,0 +1,482 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <locale.h>
+#include <gio/gio.h>
+
+/* From common/gvfsdaemonprotocol.h, which needs libdbus */
+#define G_VFS_DBUS_DAEMON_NAME "org.gtk.vfs.Daemon"
+#define G_VFS_DBUS_MOUNTTRACKER_INTERFACE "org.gtk.vfs.MountTracker"
+#define G_VFS_DBUS_MOUNTTRACKER_PATH "/org/gtk/vfs/mounttracker"
+#define G_VFS_DBUS_MOUNTTRACKER_OP_LIST_MOUNTS "listMounts"
+#define G_VFS_DBUS_DAEMON_INTERFACE "org.gtk.vfs.Daemon"
+#define G_VFS_DBUS_DAEMON_PATH "/org/gtk/vfs/Daemon"
+#define G_VFS_DBUS_OP_GET_STATS "GetStats"
+
+#define STATS_TYPE "(a{st}ata(sttttatat)a(ust)a(stt))"
+
+static gboolean show_histograms = FALSE;
+
+static GOptionEntry entries[] =
+{
+  { "histograms", 'H', 0, G_OPTION_ARG_NONE, &show_histograms, N_("Show latency histograms"), NULL },
+  { NULL }
+};
+
+static char *
+format_usecs (guint64 usecs)
+{
+  if (usecs < 1000)
+    return g_strdup_printf ("%" G_GUINT64_FORMAT " us", usecs);
+  else if (usecs < G_USEC_PER_SEC)
+    return g_strdup_printf ("%.1f ms", usecs / 1000.0);
+  else
+    return g_strdup_printf ("%.2f s", usecs / (double)G_USEC_PER_SEC);
+}
+
+static void
+print_histogram (const char *label,
+		 GVariant   *limits,
+		 GVariant   *hist)
+{
+  gsize n_limits, n_buckets, i;
+  const guint64 *limit_values;
+  const guint64 *bucket_values;
+  GString *line;
+
+  limit_values = g_variant_get_fixed_array (limits, &n_limits, sizeof (guint64));
+  bucket_values = g_variant_get_fixed_array (hist, &n_buckets, sizeof (guint64));
+
+  line = g_string_new (NULL);
+  g_string_append_printf (line, "      %-6s", label);
+
+  for (i = 0; i < n_buckets; i++)
+    {
+      char *limit;
+
+      if (bucket_values[i] == 0)
+	continue;
+
+      if (i < n_limits)
+	{
+	  limit = format_usecs (limit_values[i]);
+	  g_string_append_printf (line, "  <%s: %" G_GUINT64_FORMAT,
+				  limit, bucket_values[i]);
+	}
+      else
+	{
+	  limit = format_usecs (n_limits > 0 ? limit_values[n_limits - 1] : 0);
+	  g_string_append_printf (line, "  >=%s: %" G_GUINT64_FORMAT,
+				  limit, bucket_values[i]);
+	}
+      g_free (limit);
+    }
+
+  g_print ("%s\n", line->str);
+  g_string_free (line, TRUE);
+}
+
+static void
+print_stats (GVariant *stats)
+{
+  GVariant *counters, *limits, *ops, *channels, *caches;
+  GVariantIter iter;
+  const char *name, *kind;
+  guint64 value, count, failed, queue_usecs, run_usecs, hits, misses;
+  GVariant *queue_hist, *run_hist;
+  guint32 id;
+
+  g_variant_get (stats, "(@a{st}@at@a(sttttatat)@a(ust)@a(stt))",
+		 &counters, &limits, &ops, &channels, &caches);
+
+  g_variant_iter_init (&iter, counters);
+  while (g_variant_iter_next (&iter, "{&st}", &name, &value))
+    {
+      if (strcmp (name, "uptime-usecs") == 0)
+	{
+	  char *str = format_usecs (value);
+	  g_print ("  %s: %s\n", "uptime", str);
+	  g_free (str);
+	}
+      else if (g_str_has_prefix (name, "bytes-"))
+	{
+	  char *str = g_format_size (value);
+	  g_print ("  %s: %s\n", name, str);
+	  g_free (str);
+	}
+      else
+	g_print ("  %s: %" G_GUINT64_FORMAT "\n", name, value);
+    }
+
+  if (g_variant_n_children (ops) > 0)
+    {
+      g_print ("  %s\n", _("Operations:"));
+      g_print ("    %-24s %8s %8s %12s %12s\n",
+	       _("name"), _("count"), _("failed"), _("avg queued"), _("avg run"));
+
+      g_variant_iter_init (&iter, ops);
+      while (g_variant_iter_next (&iter, "(&stttt@at@at)",
+				  &name, &count, &failed,
+				  &queue_usecs, &run_usecs,
+				  &queue_hist, &run_hist))
+	{
+	  char *avg_queue, *avg_run;
+
+	  avg_queue = format_usecs (count ? queue_usecs / count : 0);
+	  avg_run = format_usecs (count ? run_usecs / count : 0);
+	  g_print ("    %-24s %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %12s %12s\n",
+		   name, count, failed, avg_queue, avg_run);
+	  g_free (avg_queue);
+	  g_free (avg_run);
+
+	  if (show_histograms)
+	    {
+	      print_histogram (_("queued"), limits, queue_hist);
+	      print_histogram (_("run"), limits, run_hist);
+	    }
+
+	  g_variant_unref (queue_hist);
+	  g_variant_unref (run_hist);
+	}
+    }
+
+  if (g_variant_n_children (channels) > 0)
+    {
+      g_print ("  %s\n", _("Channels:"));
+
+      g_variant_iter_init (&iter, channels);
+      while (g_variant_iter_next (&iter, "(u&st)", &id, &kind, &value))
+	{
+	  char *size = g_format_size (value);
+	  g_print ("    #%u %s: %s\n", id, kind, size);
+	  g_free (size);
+	}
+    }
+
+  if (g_variant_n_children (caches) > 0)
+    {
+      g_print ("  %s\n", _("Caches:"));
+
+      g_variant_iter_init (&iter, caches);
+      while (g_variant_iter_next (&iter, "(&stt)", &name, &hits, &misses))
+	g_print ("    %-24s %8" G_GUINT64_FORMAT " hits %8" G_GUINT64_FORMAT " misses (%.1f%%)\n",
+		 name, hits, misses,
+		 hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    }
+
+  g_variant_unref (counters);
+  g_variant_unref (limits);
+  g_variant_unref (ops);
+  g_variant_unref (channels);
+  g_variant_unref (caches);
+}
+
+/* A mount asked for on the commandline */
+typedef struct {
+  const char *location;
+  char *id;		/* its object path or mount spec string */
+  gboolean found;
+} WantedMount;
+
+static char *
+bytestring_dup (GVariant *value)
+{
+  gconstpointer data;
+  gsize len;
+
+  data = g_variant_get_fixed_array (value, &len, sizeof (guchar));
+  return g_strndup (data, len);
+}
+
+/* Same format as g_mount_spec_to_string (), which the daemons use for
+ * the id::filesystem attribute */
+static char *
+mount_spec_to_string (GVariant *spec)
+{
+  GVariant *prefix_value, *items, *value;
+  GVariantIter iter;
+  const char *key;
+  char *type, *prefix, *str_value;
+  GString *str;
+
+  g_variant_get (spec, "(@ay@a(say))", &prefix_value, &items);
+
+  str = g_string_new (NULL);
+  type = NULL;
+
+  g_variant_iter_init (&iter, items);
+  while (g_variant_iter_next (&iter, "(&s@ay)", &key, &value))
+    {
+      str_value = bytestring_dup (value);
+      g_variant_unref (value);
+
+      if (strcmp (key, "type") == 0)
+	{
+	  g_free (type);
+	  type = str_value;
+	  continue;
+	}
+
+      if (str->len > 0)
+	g_string_append_c (str, ',');
+      g_string_append_printf (str, "%s=", key);
+      g_string_append_uri_escaped (str, str_value, "$&'()*+", TRUE);
+      g_free (str_value);
+    }
+
+  prefix = bytestring_dup (prefix_value);
+  if (strcmp (prefix, "/") != 0)
+    {
+      g_string_append (str, ",prefix=");
+      g_string_append_uri_escaped (str, prefix, "$&'()*+", TRUE);
+    }
+  g_free (prefix);
+
+  g_string_prepend_c (str, ':');
+  g_string_prepend (str, type ? type : "");
+  g_free (type);
+
+  g_variant_unref (prefix_value);
+  g_variant_unref (items);
+
+  return g_string_free (str, FALSE);
+}
+
+static gboolean
+mount_is_wanted (const char  *object_path,
+		 const char  *spec,
+		 WantedMount *wanted,
+		 int          n_wanted)
+{
+  gboolean res;
+  int i;
+
+  if (n_wanted == 0)
+    return TRUE;
+
+  res = FALSE;
+  for (i = 0; i < n_wanted; i++)
+    {
+      if (strcmp (wanted[i].id, object_path) == 0 ||
+	  strcmp (wanted[i].id, spec) == 0)
+	{
+	  wanted[i].found = TRUE;
+	  res = TRUE;
+	}
+    }
+
+  return res;
+}
+
+/* The locations are given as object paths of mounts, or as files whose
+ * mount spec their daemon tells in id::filesystem */
+static WantedMount *
+wanted_mounts_for_locations (int argc, char *argv[])
+{
+  WantedMount *wanted;
+  gboolean failed;
+  int i;
+
+  wanted = g_new0 (WantedMount, argc - 1);
+  failed = FALSE;
+
+  for (i = 1; i < argc; i++)
+    {
+      GFile *file;
+      GFileInfo *info;
+      GError *error;
+      const char *id;
+
+      wanted[i - 1].location = argv[i];
+
+      if (g_variant_is_object_path (argv[i]))
+	{
+	  wanted[i - 1].id = g_strdup (argv[i]);
+	  continue;
+	}
+
+      file = g_file_new_for_commandline_arg (argv[i]);
+      error = NULL;
+      info = g_file_query_info (file, G_FILE_ATTRIBUTE_ID_FILESYSTEM,
+				G_FILE_QUERY_INFO_NONE, NULL, &error);
+      g_object_unref (file);
+
+      if (info == NULL)
+	{
+	  g_printerr (_("Error finding mount of %s: %s\n"), argv[i], error->message);
+	  g_error_free (error);
+	  failed = TRUE;
+	  continue;
+	}
+
+      id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILESYSTEM);
+      if (id == NULL)
+	{
+	  g_printerr (_("Error finding mount of %s: %s\n"), argv[i],
+		      _("No filesystem id"));
+	  failed = TRUE;
+	}
+      else
+	wanted[i - 1].id = g_strdup (id);
+
+      g_object_unref (info);
+    }
+
+  if (failed)
+    {
+      for (i = 0; i < argc - 1; i++)
+	g_free (wanted[i].id);
+      g_free (wanted);
+      return NULL;
+    }
+
+  return wanted;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError *error;
+  GOptionContext *context;
+  GDBusConnection *connection;
+  GVariant *reply, *mounts, *mount;
+  GVariantIter iter;
+  WantedMount *wanted;
+  int n_wanted, i;
+  int retval = 0;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  error = NULL;
+  context = g_option_context_new (_("[LOCATION...] - show statistics of mounts"));
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  g_option_context_parse (context, &argc, &argv, &error);
+  g_option_context_free (context);
+
+  if (error != NULL)
+    {
+      g_printerr (_("Error parsing commandline options: %s\n"), error->message);
+      g_printerr ("\n");
+      g_printerr (_("Try \"%s --help\" for more information."),
+		  g_get_prgname ());
+      g_printerr ("\n");
+      g_error_free (error);
+      return 1;
+    }
+
+  n_wanted = argc - 1;
+  wanted = NULL;
+  if (n_wanted > 0)
+    {
+      wanted = wanted_mounts_for_locations (argc, argv);
+      if (wanted == NULL)
+	return 1;
+    }
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (connection == NULL)
+    {
+      g_printerr (_("Error connecting to the session bus: %s\n"), error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  reply = g_dbus_connection_call_sync (connection,
+				       G_VFS_DBUS_DAEMON_NAME,
+				       G_VFS_DBUS_MOUNTTRACKER_PATH,
+				       G_VFS_DBUS_MOUNTTRACKER_INTERFACE,
+				       G_VFS_DBUS_MOUNTTRACKER_OP_LIST_MOUNTS,
+				       NULL, NULL,
+				       G_DBUS_CALL_FLAGS_NONE, -1,
+				       NULL, &error);
+  if (reply == NULL)
+    {
+      g_printerr (_("Error listing mounts: %s\n"), error->message);
+      g_error_free (error);
+      g_object_unref (connection);
+      return 1;
+    }
+
+  mounts = g_variant_get_child_value (reply, 0);
+  g_variant_iter_init (&iter, mounts);
+  while ((mount = g_variant_iter_next_value (&iter)))
+    {
+      const char *dbus_id, *object_path, *display_name;
+      GVariant *spec_value, *stats;
+      char *spec;
+
+      g_variant_get_child (mount, 0, "&s", &dbus_id);
+      g_variant_get_child (mount, 1, "&o", &object_path);
+      g_variant_get_child (mount, 2, "&s", &display_name);
+      spec_value = g_variant_get_child_value (mount, 9);
+      spec = mount_spec_to_string (spec_value);
+      g_variant_unref (spec_value);
+
+      if (mount_is_wanted (object_path, spec, wanted, n_wanted))
+	{
+	  g_print ("%s (%s)\n", display_name, dbus_id);
+
+	  stats = g_dbus_connection_call_sync (connection,
+					       dbus_id,
+					       G_VFS_DBUS_DAEMON_PATH,
+					       G_VFS_DBUS_DAEMON_INTERFACE,
+					       G_VFS_DBUS_OP_GET_STATS,
+					       NULL, G_VARIANT_TYPE (STATS_TYPE),
+					       G_DBUS_CALL_FLAGS_NONE, -1,
+					       NULL, &error);
+	  if (stats == NULL)
+	    {
+	      g_printerr (_("Error getting statistics: %s\n"), error->message);
+	      g_clear_error (&error);
+	      retval = 1;
+	    }
+	  else
+	    {
+	      print_stats (stats);
+	      g_variant_unref (stats);
+	    }
+	}
+
+      g_free (spec);
+      g_variant_unref (mount);
+    }
+
+  for (i = 0; i < n_wanted; i++)
+    {
+      if (!wanted[i].found)
+	{
+	  g_printerr (_("No mount found for %s\n"), wanted[i].location);
+	  retval = 1;
+	}
+      g_free (wanted[i].id);
+    }
+  g_free (wanted);
+
+  g_variant_unref (mounts);
+  g_variant_unref (reply);
+  g_object_unref (connection);
+
+  return retval;
+}
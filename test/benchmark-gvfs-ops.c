@@ -0,0 +1,558 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Runs a set of common operations against a scratch directory and
+ * prints one line of tab separated numbers per test, eg. to compare
+ * runs against gvfsd-localtest with GVFS_LOCALTEST_LATENCY and friends
+ * set, before and after a change.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <locale.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#define METADATA_KEY "metadata::gvfs-benchmark"
+
+static int n_files = 1000;
+static int n_ops = 5000;
+static int n_enumerations = 20;
+static int n_copies = 8;
+static int n_threads = 4;
+static int block_size = 4096;
+static int small_file_size = 4096;
+static int big_file_size = 16 * 1024 * 1024;
+static char *tests = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "tests", 't', 0, G_OPTION_ARG_STRING, &tests, "Comma separated tests to run (create, enumerate, stat, random-read, copy, metadata-set, metadata-get)", "TESTS" },
+  { "files", 'n', 0, G_OPTION_ARG_INT, &n_files, "Number of files in the scratch directory", "N" },
+  { "ops", 'o', 0, G_OPTION_ARG_INT, &n_ops, "Number of operations for stat, random-read and metadata-get", "N" },
+  { "enumerations", 'e', 0, G_OPTION_ARG_INT, &n_enumerations, "Number of directory enumerations", "N" },
+  { "copies", 'c', 0, G_OPTION_ARG_INT, &n_copies, "Number of copies of the big file", "N" },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &n_threads, "Number of operations running in parallel", "N" },
+  { "block-size", 'b', 0, G_OPTION_ARG_INT, &block_size, "Size of the random reads", "BYTES" },
+  { "big-file-size", 's', 0, G_OPTION_ARG_INT, &big_file_size, "Size of the file that is read and copied", "BYTES" },
+  { NULL }
+};
+
+typedef gboolean (*BenchmarkOpFunc) (guint    index,
+				     gsize   *bytes,
+				     GError **error);
+
+typedef struct
+{
+  BenchmarkOpFunc func;
+
+  GMutex lock;
+  guint64 failed;
+  guint64 bytes;
+  GArray *latencies;
+  GError *first_error;
+} BenchmarkRun;
+
+static GFile *work_dir;
+static GFile **small_files;
+static GFile *big_file;
+/* open streams on big_file, one per thread */
+static GAsyncQueue *big_file_streams;
+
+static GFile *
+small_file (guint index)
+{
+  return small_files[index % n_files];
+}
+
+static void
+run_op (gpointer data,
+	gpointer user_data)
+{
+  BenchmarkRun *run = user_data;
+  guint index = GPOINTER_TO_UINT (data) - 1;
+  GError *error;
+  gsize bytes;
+  gint64 start, usecs;
+  gboolean res;
+
+  error = NULL;
+  bytes = 0;
+  start = g_get_monotonic_time ();
+  res = run->func (index, &bytes, &error);
+  usecs = g_get_monotonic_time () - start;
+
+  g_mutex_lock (&run->lock);
+  if (res)
+    {
+      run->bytes += bytes;
+      g_array_append_val (run->latencies, usecs);
+    }
+  else
+    {
+      run->failed++;
+      if (run->first_error == NULL)
+	run->first_error = error;
+      else
+	g_clear_error (&error);
+    }
+  g_mutex_unlock (&run->lock);
+}
+
+static int
+compare_latencies (gconstpointer a,
+		   gconstpointer b)
+{
+  gint64 la = *(const gint64 *)a;
+  gint64 lb = *(const gint64 *)b;
+
+  return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static double
+percentile_msecs (GArray *latencies,
+		  int     percent)
+{
+  guint i;
+
+  if (latencies->len == 0)
+    return 0;
+
+  i = (latencies->len - 1) * percent / 100;
+  return g_array_index (latencies, gint64, i) / 1000.0;
+}
+
+static gboolean
+test_wanted (const char *name)
+{
+  char **names;
+  gboolean res;
+  int i;
+
+  if (tests == NULL)
+    return TRUE;
+
+  names = g_strsplit (tests, ",", -1);
+  res = FALSE;
+  for (i = 0; names[i] != NULL; i++)
+    {
+      if (strcmp (g_strstrip (names[i]), name) == 0)
+	res = TRUE;
+    }
+  g_strfreev (names);
+
+  return res;
+}
+
+/* Runs func count times on n_threads threads and prints the results */
+static gboolean
+run_test (const char      *name,
+	  BenchmarkOpFunc  func,
+	  guint            count)
+{
+  BenchmarkRun run;
+  GThreadPool *pool;
+  gint64 start, elapsed;
+  double seconds, total_msecs;
+  guint i;
+  gboolean res;
+
+  memset (&run, 0, sizeof (run));
+  run.func = func;
+  g_mutex_init (&run.lock);
+  run.latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), count);
+
+  start = g_get_monotonic_time ();
+
+  pool = g_thread_pool_new (run_op, &run, MAX (n_threads, 1), TRUE, NULL);
+  for (i = 0; i < count; i++)
+    g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  elapsed = g_get_monotonic_time () - start;
+  seconds = elapsed / (double) G_USEC_PER_SEC;
+
+  g_array_sort (run.latencies, compare_latencies);
+  total_msecs = 0;
+  for (i = 0; i < run.latencies->len; i++)
+    total_msecs += g_array_index (run.latencies, gint64, i) / 1000.0;
+
+  g_print ("%s\t%u\t%" G_GUINT64_FORMAT "\t%.3f\t%.1f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n",
+	   name,
+	   run.latencies->len,
+	   run.failed,
+	   seconds,
+	   seconds > 0 ? run.latencies->len / seconds : 0,
+	   seconds > 0 ? run.bytes / seconds / (1024 * 1024) : 0,
+	   run.latencies->len ? total_msecs / run.latencies->len : 0,
+	   percentile_msecs (run.latencies, 50),
+	   percentile_msecs (run.latencies, 90),
+	   percentile_msecs (run.latencies, 99),
+	   percentile_msecs (run.latencies, 100));
+
+  res = run.first_error == NULL;
+  if (run.first_error)
+    {
+      g_printerr ("%s: %s\n", name, run.first_error->message);
+      g_error_free (run.first_error);
+    }
+
+  g_array_free (run.latencies, TRUE);
+  g_mutex_clear (&run.lock);
+
+  return res;
+}
+
+static gboolean
+write_file (GFile   *file,
+	    gsize    size,
+	    GError **error)
+{
+  GFileOutputStream *stream;
+  char buffer[4096];
+  gsize written, bytes_written;
+  gboolean res;
+
+  stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+  if (stream == NULL)
+    return FALSE;
+
+  memset (buffer, 0xaa, sizeof (buffer));
+  res = TRUE;
+
+  for (written = 0; res && written < size; written += bytes_written)
+    res = g_output_stream_write_all (G_OUTPUT_STREAM (stream), buffer,
+				     MIN (sizeof (buffer), size - written),
+				     &bytes_written, NULL, error);
+
+  if (res)
+    res = g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error);
+
+  g_object_unref (stream);
+
+  return res;
+}
+
+static gboolean
+op_create (guint    index,
+	   gsize   *bytes,
+	   GError **error)
+{
+  *bytes = small_file_size;
+  return write_file (small_file (index), small_file_size, error);
+}
+
+static gboolean
+op_enumerate (guint    index,
+	      gsize   *bytes,
+	      GError **error)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+  GError *my_error;
+
+  enumerator = g_file_enumerate_children (work_dir, "standard::*", 0, NULL, error);
+  if (enumerator == NULL)
+    return FALSE;
+
+  my_error = NULL;
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &my_error)) != NULL)
+    g_object_unref (info);
+
+  g_file_enumerator_close (enumerator, NULL, NULL);
+  g_object_unref (enumerator);
+
+  if (my_error)
+    {
+      g_propagate_error (error, my_error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+op_stat (guint    index,
+	 gsize   *bytes,
+	 GError **error)
+{
+  GFileInfo *info;
+
+  info = g_file_query_info (small_file (g_random_int_range (0, n_files)),
+			    "standard::*", 0, NULL, error);
+  if (info == NULL)
+    return FALSE;
+
+  g_object_unref (info);
+  return TRUE;
+}
+
+static gboolean
+op_random_read (guint    index,
+		gsize   *bytes,
+		GError **error)
+{
+  GFileInputStream *stream;
+  char *buffer;
+  goffset offset;
+  gboolean res;
+
+  stream = g_async_queue_pop (big_file_streams);
+
+  offset = (goffset) g_random_int_range (0, MAX (big_file_size / block_size, 1)) * block_size;
+  buffer = g_malloc (block_size);
+
+  res = g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, NULL, error) &&
+    g_input_stream_read_all (G_INPUT_STREAM (stream), buffer, block_size,
+			     bytes, NULL, error);
+
+  g_free (buffer);
+  g_async_queue_push (big_file_streams, stream);
+
+  return res;
+}
+
+static gboolean
+op_copy (guint    index,
+	 gsize   *bytes,
+	 GError **error)
+{
+  GFile *dest;
+  char *name;
+  gboolean res;
+
+  name = g_strdup_printf ("copy-%u", index);
+  dest = g_file_get_child (work_dir, name);
+  g_free (name);
+
+  res = g_file_copy (big_file, dest, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, error);
+  if (res)
+    *bytes = big_file_size;
+
+  g_object_unref (dest);
+
+  return res;
+}
+
+static gboolean
+op_metadata_set (guint    index,
+		 gsize   *bytes,
+		 GError **error)
+{
+  char *value;
+  gboolean res;
+
+  value = g_strdup_printf ("%u", index);
+  res = g_file_set_attribute_string (small_file (index), METADATA_KEY, value,
+				     0, NULL, error);
+  g_free (value);
+
+  return res;
+}
+
+static gboolean
+op_metadata_get (guint    index,
+		 gsize   *bytes,
+		 GError **error)
+{
+  GFileInfo *info;
+
+  info = g_file_query_info (small_file (g_random_int_range (0, n_files)),
+			    "metadata::*", 0, NULL, error);
+  if (info == NULL)
+    return FALSE;
+
+  g_object_unref (info);
+  return TRUE;
+}
+
+static gboolean
+setup_big_file (void)
+{
+  GError *error;
+  int i;
+
+  error = NULL;
+  big_file = g_file_get_child (work_dir, "big");
+  if (!write_file (big_file, big_file_size, &error))
+    {
+      g_printerr ("Failed to create the big file: %s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  big_file_streams = g_async_queue_new ();
+  for (i = 0; i < MAX (n_threads, 1); i++)
+    {
+      GFileInputStream *stream;
+
+      stream = g_file_read (big_file, NULL, &error);
+      if (stream == NULL)
+	{
+	  g_printerr ("Failed to open the big file: %s\n", error->message);
+	  g_error_free (error);
+	  return FALSE;
+	}
+      g_async_queue_push (big_file_streams, stream);
+    }
+
+  return TRUE;
+}
+
+static void
+cleanup (void)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+
+  if (big_file_streams)
+    {
+      GFileInputStream *stream;
+
+      while ((stream = g_async_queue_try_pop (big_file_streams)) != NULL)
+	{
+	  g_input_stream_close (G_INPUT_STREAM (stream), NULL, NULL);
+	  g_object_unref (stream);
+	}
+      g_async_queue_unref (big_file_streams);
+    }
+
+  enumerator = g_file_enumerate_children (work_dir, G_FILE_ATTRIBUTE_STANDARD_NAME,
+					  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+					  NULL, NULL);
+  if (enumerator)
+    {
+      while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
+	{
+	  GFile *child;
+
+	  child = g_file_get_child (work_dir, g_file_info_get_name (info));
+	  g_file_delete (child, NULL, NULL);
+	  g_object_unref (child);
+	  g_object_unref (info);
+	}
+      g_file_enumerator_close (enumerator, NULL, NULL);
+      g_object_unref (enumerator);
+    }
+
+  g_file_delete (work_dir, NULL, NULL);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error;
+  GFile *base_dir;
+  char *name;
+  gboolean files_created;
+  int i, retval;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  error = NULL;
+  context = g_option_context_new ("<scratch URI> - benchmark common operations");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_parse (context, &argc, &argv, &error);
+  g_option_context_free (context);
+
+  if (error != NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  if (argc < 2 || n_files < 1 || block_size < 1 || big_file_size < block_size)
+    {
+      g_printerr ("Usage: %s [OPTION...] <scratch URI>\n", argv[0]);
+      return 1;
+    }
+
+  base_dir = g_file_new_for_commandline_arg (argv[1]);
+  name = g_strdup_printf ("gvfs-benchmark-%d", getpid ());
+  work_dir = g_file_get_child (base_dir, name);
+  g_free (name);
+  g_object_unref (base_dir);
+
+  if (!g_file_make_directory (work_dir, NULL, &error))
+    {
+      g_printerr ("Failed to create the scratch directory: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  small_files = g_new0 (GFile *, n_files);
+  for (i = 0; i < n_files; i++)
+    {
+      name = g_strdup_printf ("file-%d", i);
+      small_files[i] = g_file_get_child (work_dir, name);
+      g_free (name);
+    }
+
+  retval = 0;
+
+  g_print ("# test\tops\tfailed\tseconds\tops/s\tMiB/s\tmean ms\tp50 ms\tp90 ms\tp99 ms\tmax ms\n");
+
+  /* The other tests need the files, so they are always created */
+  files_created = run_test ("create", op_create, n_files);
+  if (!files_created)
+    retval = 1;
+
+  if (files_created && test_wanted ("enumerate"))
+    retval |= !run_test ("enumerate", op_enumerate, n_enumerations);
+
+  if (files_created && test_wanted ("stat"))
+    retval |= !run_test ("stat", op_stat, n_ops);
+
+  if ((test_wanted ("random-read") || test_wanted ("copy")) && !setup_big_file ())
+    retval = 1;
+  else
+    {
+      if (test_wanted ("random-read"))
+	retval |= !run_test ("random-read", op_random_read, n_ops);
+
+      if (test_wanted ("copy"))
+	retval |= !run_test ("copy", op_copy, n_copies);
+    }
+
+  /* Not all backends support metadata, that is not an error */
+  if (files_created &&
+      (test_wanted ("metadata-set") || test_wanted ("metadata-get")) &&
+      run_test ("metadata-set", op_metadata_set, n_files) &&
+      test_wanted ("metadata-get"))
+    retval |= !run_test ("metadata-get", op_metadata_get, n_ops);
+
+  cleanup ();
+
+  for (i = 0; i < n_files; i++)
+    g_object_unref (small_files[i]);
+  g_free (small_files);
+  if (big_file)
+    g_object_unref (big_file);
+  g_object_unref (work_dir);
+
+  return retval;
+}
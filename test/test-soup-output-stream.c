@@ -0,0 +1,331 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Uploads through a SoupOutputStream to a local server that refuses
+ * chunked requests with 411 Length Required, the way some WebDAV
+ * servers do, and checks that the upload is sent again with a
+ * Content-Length.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#include "soup-output-stream.h"
+
+/* Fill test data with 0..200, repeadedly.
+ * This is not a power of two to avoid possible
+ * effects with base-2 i/o buffer sizes that could
+ * hide bugs */
+#define DATA_MODULO 200
+
+/* More than the stream keeps pending, so that writes have to wait */
+#define DATA_SIZE (1000*1000)
+#define BLOCK_SIZE (64*1024)
+
+static GMainLoop *main_loop;
+static volatile gint n_refused;
+static volatile gint n_received;
+
+static gboolean
+verify_block (const guchar *data, gsize size)
+{
+  guchar d;
+  gsize i;
+
+  d = 0;
+  for (i = 0; i < size; i++)
+    {
+      if (data[i] != d)
+	return FALSE;
+
+      d++;
+      if (d >= DATA_MODULO)
+	d = 0;
+    }
+
+  return TRUE;
+}
+
+static guchar *
+allocate_block (gsize size)
+{
+  guchar *data;
+  gsize i;
+  guchar d;
+
+  data = g_malloc (size);
+  d = 0;
+  for (i = 0; i < size; i++)
+    {
+      data[i] = d;
+      d++;
+      if (d >= DATA_MODULO)
+	d = 0;
+    }
+  return data;
+}
+
+/* Server side, runs in its own thread */
+
+static void
+server_got_headers (SoupMessage *msg, gpointer user_data)
+{
+  if (soup_message_headers_get_encoding (msg->request_headers) == SOUP_ENCODING_CHUNKED)
+    {
+      g_atomic_int_inc (&n_refused);
+      soup_message_set_status (msg, SOUP_STATUS_LENGTH_REQUIRED);
+    }
+}
+
+static void
+server_request_started (SoupServer        *server,
+			SoupMessage       *msg,
+			SoupClientContext *client,
+			gpointer           user_data)
+{
+  g_signal_connect (msg, "got-headers",
+		    G_CALLBACK (server_got_headers), NULL);
+}
+
+static void
+server_callback (SoupServer        *server,
+		 SoupMessage       *msg,
+		 const char        *path,
+		 GHashTable        *query,
+		 SoupClientContext *client,
+		 gpointer           user_data)
+{
+  SoupBuffer *body;
+
+  if (msg->method != SOUP_METHOD_PUT)
+    {
+      soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
+      return;
+    }
+
+  body = soup_message_body_flatten (msg->request_body);
+  if (body->length == DATA_SIZE &&
+      verify_block ((const guchar *) body->data, body->length))
+    {
+      g_atomic_int_inc (&n_received);
+      soup_message_set_status (msg, SOUP_STATUS_CREATED);
+    }
+  else
+    soup_message_set_status (msg, SOUP_STATUS_BAD_REQUEST);
+  soup_buffer_free (body);
+}
+
+static gpointer
+server_thread (gpointer data)
+{
+  soup_server_run (SOUP_SERVER (data));
+  return NULL;
+}
+
+static void
+check_upload (const char *mode)
+{
+  if (g_atomic_int_get (&n_refused) != 1)
+    {
+      g_print ("%s: chunked request refused %d times, expected once\n",
+	       mode, g_atomic_int_get (&n_refused));
+      exit (1);
+    }
+
+  if (g_atomic_int_get (&n_received) != 1)
+    {
+      g_print ("%s: upload not received\n", mode);
+      exit (1);
+    }
+
+  g_atomic_int_set (&n_refused, 0);
+  g_atomic_int_set (&n_received, 0);
+}
+
+/* Synchronous API, with the session in its own context */
+
+static void
+test_sync (const char *uri, guchar *data)
+{
+  GMainContext *context;
+  SoupSession *session;
+  SoupMessage *msg;
+  GOutputStream *out;
+  GError *error;
+  gsize offset, written;
+
+  context = g_main_context_new ();
+  session = soup_session_async_new_with_options (SOUP_SESSION_ASYNC_CONTEXT, context,
+						 NULL);
+
+  msg = soup_message_new (SOUP_METHOD_PUT, uri);
+  out = soup_output_stream_new (session, msg, -1);
+  g_object_unref (msg);
+
+  error = NULL;
+  for (offset = 0; offset < DATA_SIZE; offset += written)
+    {
+      if (!g_output_stream_write_all (out, data + offset,
+				      MIN (BLOCK_SIZE, DATA_SIZE - offset),
+				      &written, NULL, &error))
+	{
+	  g_print ("sync: error writing: %s\n", error->message);
+	  exit (1);
+	}
+    }
+
+  if (!g_output_stream_close (out, NULL, &error))
+    {
+      g_print ("sync: error closing: %s\n", error->message);
+      exit (1);
+    }
+
+  g_object_unref (out);
+  soup_session_abort (session);
+  g_object_unref (session);
+  g_main_context_unref (context);
+
+  check_upload ("sync");
+}
+
+/* Asynchronous API, in the default context */
+
+static guchar *async_data;
+static gsize async_offset;
+
+static void
+close_cb (GObject      *source_object,
+	  GAsyncResult *res,
+	  gpointer      user_data)
+{
+  GError *error;
+
+  error = NULL;
+  if (!g_output_stream_close_finish (G_OUTPUT_STREAM (source_object), res, &error))
+    {
+      g_print ("async: error closing: %s\n", error->message);
+      exit (1);
+    }
+
+  g_main_loop_quit (main_loop);
+}
+
+static void
+write_cb (GObject      *source_object,
+	  GAsyncResult *res,
+	  gpointer      user_data)
+{
+  GOutputStream *out = G_OUTPUT_STREAM (source_object);
+  GError *error;
+  gssize written;
+
+  error = NULL;
+  written = g_output_stream_write_finish (out, res, &error);
+  if (written < 0)
+    {
+      g_print ("async: error writing: %s\n", error->message);
+      exit (1);
+    }
+
+  async_offset += written;
+  if (async_offset < DATA_SIZE)
+    g_output_stream_write_async (out, async_data + async_offset,
+				 MIN (BLOCK_SIZE, DATA_SIZE - async_offset),
+				 0, NULL, write_cb, NULL);
+  else
+    g_output_stream_close_async (out, 0, NULL, close_cb, NULL);
+}
+
+static void
+test_async (const char *uri, guchar *data)
+{
+  SoupSession *session;
+  SoupMessage *msg;
+  GOutputStream *out;
+
+  session = soup_session_async_new ();
+
+  msg = soup_message_new (SOUP_METHOD_PUT, uri);
+  out = soup_output_stream_new (session, msg, -1);
+  g_object_unref (msg);
+
+  async_data = data;
+  async_offset = 0;
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_output_stream_write_async (out, data, BLOCK_SIZE, 0, NULL, write_cb, NULL);
+  g_main_loop_run (main_loop);
+  g_main_loop_unref (main_loop);
+
+  g_object_unref (out);
+  soup_session_abort (session);
+  g_object_unref (session);
+
+  check_upload ("async");
+}
+
+int
+main (int argc, char *argv[])
+{
+  GMainContext *server_context;
+  SoupServer *server;
+  GThread *thread;
+  guchar *data;
+  char *uri;
+
+  g_type_init ();
+
+  server_context = g_main_context_new ();
+  server = soup_server_new (SOUP_SERVER_PORT, 0,
+			    SOUP_SERVER_ASYNC_CONTEXT, server_context,
+			    NULL);
+  if (server == NULL)
+    {
+      g_print ("error creating server\n");
+      exit (1);
+    }
+
+  g_signal_connect (server, "request-started",
+		    G_CALLBACK (server_request_started), NULL);
+  soup_server_add_handler (server, NULL, server_callback, NULL, NULL);
+
+  thread = g_thread_new ("server", server_thread, server);
+
+  uri = g_strdup_printf ("http://127.0.0.1:%u/upload", soup_server_get_port (server));
+  data = allocate_block (DATA_SIZE);
+
+  test_sync (uri, data);
+  test_async (uri, data);
+
+  soup_server_quit (server);
+  g_thread_join (thread);
+  g_object_unref (server);
+  g_main_context_unref (server_context);
+  g_free (data);
+  g_free (uri);
+
+  g_print ("ALL OK\n");
+  return 0;
+}